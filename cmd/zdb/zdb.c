@@ -133,6 +133,7 @@ static int flagbits[256];
 
 
 static uint64_t max_inflight_bytes = 256 * 1024 * 1024; /* 256MB */
+static uint_t traverse_jobs = 1;
 static int leaked_objects = 0;
 static zfs_range_tree_t *mos_refd_objs;
 static spa_t *spa;
@@ -729,7 +730,7 @@ usage(void)
 	    "Usage:\t%s [-AbcdDFGhikLMPsvXy] [-e [-V] [-p <path> ...]] "
 	    "[-I <inflight I/Os>]\n"
 	    "\t\t[-o <var>=<value>]... [-t <txg>] [-U <cache>] [-x <dumpdir>]\n"
-	    "\t\t[-K <key>]\n"
+	    "\t\t[-K <key>] [-j <jobs>]\n"
 	    "\t\t[<poolname>[/<dataset | objset id>] [<object | range> ...]]\n"
 	    "\t%s [-AdiPv] [-e [-V] [-p <path> ...]] [-U <cache>] [-K <key>]\n"
 	    "\t\t[<poolname>[/<dataset | objset id>] [<object | range> ...]\n"
@@ -843,6 +844,9 @@ usage(void)
 	(void) fprintf(stderr, "        -I --inflight=INTEGER        "
 	    "specify the maximum number of checksumming I/Os "
 	    "[default is 200]\n");
+	(void) fprintf(stderr, "        -j --jobs=INTEGER            "
+	    "traverse datasets with this many threads for block "
+	    "statistics\n");
 	(void) fprintf(stderr, "        -K --key=KEY                 "
 	    "decryption key for encrypted dataset\n");
 	(void) fprintf(stderr, "        -o --option=\"NAME=VALUE\" "
@@ -6160,6 +6164,19 @@ typedef struct zdb_cb {
 	uint32_t	**zcb_vd_obsolete_counts;
 	avl_tree_t	zcb_brt;
 	boolean_t	zcb_brt_is_active;
+
+	/*
+	 * Parallel traversal (-j).  Each worker counts blocks into its own
+	 * zdb_cb_t, pointing to the main one through zcb_parent, which
+	 * holds the BRT shared by all and the time of the last progress
+	 * report, protected by zcb_lock.  The workers are merged back into
+	 * the main zdb_cb_t once all I/O is done.
+	 */
+	struct zdb_cb	*zcb_parent;
+	kmutex_t	zcb_lock;
+	uint64_t	zcb_progress;	/* asize reported for progress */
+	struct zdb_cb	**zcb_workers;
+	uint_t		zcb_nworkers;
 } zdb_cb_t;
 
 /* test if two DVA offsets from same vdev are within the same metaslab */
@@ -6509,11 +6526,15 @@ ddt_done:
 		 * we haven't seen before, we look it up in the real BRT. If
 		 * we see the block again, we count it as a clone.
 		 */
+		zdb_cb_t *pzcb = zcb->zcb_parent;
+		avl_tree_t *brt = pzcb != NULL ? &pzcb->zcb_brt : &zcb->zcb_brt;
 		zdb_brt_entry_t zbre_search, *zbre;
 		avl_index_t where;
 
+		if (pzcb != NULL)
+			mutex_enter(&pzcb->zcb_lock);
 		zbre_search.zbre_dva = bp->blk_dva[0];
-		zbre = avl_find(&zcb->zcb_brt, &zbre_search, &where);
+		zbre = avl_find(brt, &zbre_search, &where);
 		if (zbre == NULL) {
 			uint64_t refcnt =
 			    brt_entry_get_refcount(zcb->zcb_spa, bp);
@@ -6523,7 +6544,7 @@ ddt_done:
 				    UMEM_NOFAIL);
 				zbre->zbre_dva = bp->blk_dva[0];
 				zbre->zbre_refcount = refcnt;
-				avl_insert(&zcb->zcb_brt, zbre, where);
+				avl_insert(brt, zbre, where);
 			}
 		} else {
 			brt_block = B_TRUE;
@@ -6534,6 +6555,8 @@ ddt_done:
 				claimed = B_TRUE;
 			}
 		}
+		if (pzcb != NULL)
+			mutex_exit(&pzcb->zcb_lock);
 	}
 
 	for (i = 0; i < 4; i++) {
@@ -6806,16 +6829,28 @@ zdb_blkptr_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 	zcb->zcb_readfails = 0;
 
 	/* only call gethrtime() every 100 blocks */
-	static int iters;
-	if (++iters > 100)
-		iters = 0;
-	else
+	static uint_t iters;
+	if (atomic_inc_uint_nv(&iters) % 100 != 0)
 		return (0);
 
+	uint64_t bytes = zcb->zcb_type[ZB_TOTAL][ZDB_OT_TOTAL].zb_asize;
+	kmutex_t *lock = NULL;
+	if (zcb->zcb_parent != NULL) {
+		zdb_cb_t *pzcb = zcb->zcb_parent;
+
+		/* Report the progress of all workers from the main zdb_cb_t */
+		bytes = atomic_add_64_nv(&pzcb->zcb_progress,
+		    bytes - zcb->zcb_progress);
+		zcb->zcb_progress =
+		    zcb->zcb_type[ZB_TOTAL][ZDB_OT_TOTAL].zb_asize;
+		zcb = pzcb;
+		lock = &zcb->zcb_lock;
+		mutex_enter(lock);
+	}
+
 	if (dump_opt['b'] < 5 && gethrtime() > zcb->zcb_lastprint + NANOSEC) {
 		uint64_t now = gethrtime();
 		char buf[10];
-		uint64_t bytes = zcb->zcb_type[ZB_TOTAL][ZDB_OT_TOTAL].zb_asize;
 		uint64_t kb_per_sec =
 		    1 + bytes / (1 + ((now - zcb->zcb_start) / 1000 / 1000));
 		uint64_t sec_remaining =
@@ -6836,6 +6871,8 @@ zdb_blkptr_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 
 		zcb->zcb_lastprint = now;
 	}
+	if (lock != NULL)
+		mutex_exit(lock);
 
 	return (0);
 }
@@ -7718,6 +7755,229 @@ zdb_brt_entry_compare(const void *zcn1, const void *zcn2)
 	return (cmp);
 }
 
+/*
+ * Parallel block traversal.  The MOS and each dataset are separate work
+ * items, taken in order by traverse_jobs worker threads, each counting
+ * into its own zdb_cb_t.  Only the order in which blocks are visited
+ * differs from traverse_pool(), the counts once merged are the same.
+ */
+typedef struct zdb_traverse {
+	spa_t		*zt_spa;
+	zdb_cb_t	*zt_zcb;
+	int		zt_flags;
+	uint64_t	*zt_objs;	/* 0 for the MOS, or dataset objects */
+	uint64_t	zt_nobjs;
+	uint64_t	zt_next;	/* next work item */
+	int		zt_err;
+} zdb_traverse_t;
+
+typedef struct zdb_traverse_worker {
+	zdb_traverse_t	*ztw_zt;
+	zdb_cb_t	*ztw_zcb;
+} zdb_traverse_worker_t;
+
+static int
+zdb_traverse_one(zdb_traverse_t *zt, zdb_cb_t *zcb, uint64_t obj)
+{
+	dsl_pool_t *dp = spa_get_dsl(zt->zt_spa);
+	dsl_dataset_t *ds;
+	uint64_t txg = 0;
+	int err;
+
+	if (obj == 0)
+		return (traverse_mos(zt->zt_spa, 0, zt->zt_flags,
+		    zdb_blkptr_cb, zcb));
+
+	dsl_pool_config_enter(dp, FTAG);
+	err = dsl_dataset_hold_obj(dp, obj, FTAG, &ds);
+	dsl_pool_config_exit(dp, FTAG);
+	if (err != 0)
+		return ((zt->zt_flags & TRAVERSE_HARD) ? 0 : err);
+
+	if (dsl_dataset_phys(ds)->ds_prev_snap_txg > txg)
+		txg = dsl_dataset_phys(ds)->ds_prev_snap_txg;
+	err = traverse_dataset(ds, txg, zt->zt_flags, zdb_blkptr_cb, zcb);
+	dsl_dataset_rele(ds, FTAG);
+
+	return (err);
+}
+
+static __attribute__((noreturn)) void
+zdb_traverse_thread(void *arg)
+{
+	zdb_traverse_worker_t *ztw = arg;
+	zdb_traverse_t *zt = ztw->ztw_zt;
+
+	for (;;) {
+		uint64_t i = atomic_inc_64_nv(&zt->zt_next) - 1;
+		int err;
+
+		if (i >= zt->zt_nobjs || atomic_load_32(
+		    (uint32_t *)&zt->zt_err) != 0)
+			break;
+
+		err = zdb_traverse_one(zt, ztw->ztw_zcb, zt->zt_objs[i]);
+		if (err != 0)
+			(void) atomic_cas_32((uint32_t *)&zt->zt_err, 0, err);
+	}
+
+	thread_exit();
+}
+
+/*
+ * Same as traverse_pool(spa, 0, flags, zdb_blkptr_cb, zcb), with the
+ * blocks counted into per-worker zdb_cb_ts left in zcb->zcb_workers, to be
+ * merged by zdb_merge_workers().
+ */
+static int
+zdb_traverse_pool_parallel(spa_t *spa, int flags, zdb_cb_t *zcb)
+{
+	objset_t *mos = spa->spa_meta_objset;
+	zdb_traverse_t zt = { 0 };
+	zdb_traverse_worker_t *ztw;
+	kthread_t **threads;
+	uint64_t maxobjs = 64;
+	uint_t nworkers;
+	int err = 0;
+
+	zt.zt_spa = spa;
+	zt.zt_zcb = zcb;
+	zt.zt_flags = flags;
+	zt.zt_objs = umem_alloc(maxobjs * sizeof (uint64_t), UMEM_NOFAIL);
+	zt.zt_objs[zt.zt_nobjs++] = 0;
+
+	/* Same dataset selection as traverse_pool() */
+	for (uint64_t obj = 1; err == 0;
+	    err = dmu_object_next(mos, &obj, B_FALSE, 0)) {
+		dmu_object_info_t doi;
+
+		err = dmu_object_info(mos, obj, &doi);
+		if (err != 0) {
+			if (flags & TRAVERSE_HARD)
+				continue;
+			break;
+		}
+		if (doi.doi_bonus_type != DMU_OT_DSL_DATASET)
+			continue;
+
+		if (zt.zt_nobjs == maxobjs) {
+			uint64_t *objs = umem_alloc(2 * maxobjs *
+			    sizeof (uint64_t), UMEM_NOFAIL);
+			memcpy(objs, zt.zt_objs, maxobjs * sizeof (uint64_t));
+			umem_free(zt.zt_objs, maxobjs * sizeof (uint64_t));
+			zt.zt_objs = objs;
+			maxobjs *= 2;
+		}
+		zt.zt_objs[zt.zt_nobjs++] = obj;
+	}
+	if (err == ESRCH)
+		err = 0;
+
+	nworkers = MIN(traverse_jobs, zt.zt_nobjs);
+	ztw = umem_zalloc(nworkers * sizeof (*ztw), UMEM_NOFAIL);
+	threads = umem_zalloc(nworkers * sizeof (kthread_t *), UMEM_NOFAIL);
+	zcb->zcb_workers = umem_zalloc(nworkers * sizeof (zdb_cb_t *),
+	    UMEM_NOFAIL);
+	zcb->zcb_nworkers = nworkers;
+	zcb->zcb_progress = zcb->zcb_type[ZB_TOTAL][ZDB_OT_TOTAL].zb_asize;
+	mutex_init(&zcb->zcb_lock, NULL, MUTEX_DEFAULT, NULL);
+
+	for (uint_t w = 0; w < nworkers; w++) {
+		zdb_cb_t *wzcb = umem_zalloc(sizeof (zdb_cb_t), UMEM_NOFAIL);
+
+		wzcb->zcb_spa = zcb->zcb_spa;
+		wzcb->zcb_brt_is_active = zcb->zcb_brt_is_active;
+		wzcb->zcb_vd_obsolete_counts = zcb->zcb_vd_obsolete_counts;
+		wzcb->zcb_parent = zcb;
+		zcb->zcb_workers[w] = wzcb;
+
+		ztw[w].ztw_zt = &zt;
+		ztw[w].ztw_zcb = wzcb;
+		threads[w] = thread_create(NULL, 0, zdb_traverse_thread,
+		    &ztw[w], 0, NULL, TS_RUN | TS_JOINABLE, defclsyspri);
+	}
+	for (uint_t w = 0; w < nworkers; w++)
+		VERIFY0(thread_join(threads[w]));
+
+	mutex_destroy(&zcb->zcb_lock);
+	umem_free(threads, nworkers * sizeof (kthread_t *));
+	umem_free(ztw, nworkers * sizeof (*ztw));
+	umem_free(zt.zt_objs, maxobjs * sizeof (uint64_t));
+
+	return (zt.zt_err != 0 ? zt.zt_err : err);
+}
+
+/*
+ * Fold the counts of the parallel traversal workers into the main
+ * zdb_cb_t.  Must be called once all the reads they issued are done.
+ */
+static void
+zdb_merge_workers(zdb_cb_t *zcb)
+{
+	for (uint_t w = 0; w < zcb->zcb_nworkers; w++) {
+		zdb_cb_t *wzcb = zcb->zcb_workers[w];
+
+		for (int l = 0; l <= ZB_TOTAL; l++) {
+			for (int t = 0; t <= ZDB_OT_TOTAL; t++) {
+				zdb_blkstats_t *zb = &zcb->zcb_type[l][t];
+				zdb_blkstats_t *wzb = &wzcb->zcb_type[l][t];
+
+				zb->zb_asize += wzb->zb_asize;
+				zb->zb_lsize += wzb->zb_lsize;
+				zb->zb_psize += wzb->zb_psize;
+				zb->zb_count += wzb->zb_count;
+				zb->zb_gangs += wzb->zb_gangs;
+				zb->zb_ditto_samevdev +=
+				    wzb->zb_ditto_samevdev;
+				zb->zb_ditto_same_ms += wzb->zb_ditto_same_ms;
+				for (int i = 0; i < PSIZE_HISTO_SIZE; i++) {
+					zb->zb_psize_histogram[i] +=
+					    wzb->zb_psize_histogram[i];
+				}
+			}
+		}
+
+		zcb->zcb_dedup_asize += wzcb->zcb_dedup_asize;
+		zcb->zcb_dedup_blocks += wzcb->zcb_dedup_blocks;
+		zcb->zcb_clone_asize += wzcb->zcb_clone_asize;
+		zcb->zcb_clone_blocks += wzcb->zcb_clone_blocks;
+
+		for (int i = 0; i < SPA_MAX_FOR_16M; i++) {
+			zcb->zcb_psize_count[i] += wzcb->zcb_psize_count[i];
+			zcb->zcb_lsize_count[i] += wzcb->zcb_lsize_count[i];
+			zcb->zcb_asize_count[i] += wzcb->zcb_asize_count[i];
+			zcb->zcb_psize_len[i] += wzcb->zcb_psize_len[i];
+			zcb->zcb_lsize_len[i] += wzcb->zcb_lsize_len[i];
+			zcb->zcb_asize_len[i] += wzcb->zcb_asize_len[i];
+		}
+		zcb->zcb_psize_total += wzcb->zcb_psize_total;
+		zcb->zcb_lsize_total += wzcb->zcb_lsize_total;
+		zcb->zcb_asize_total += wzcb->zcb_asize_total;
+
+		for (int i = 0; i < NUM_BP_EMBEDDED_TYPES; i++) {
+			zcb->zcb_embedded_blocks[i] +=
+			    wzcb->zcb_embedded_blocks[i];
+			for (int j = 0; j <= BPE_PAYLOAD_SIZE; j++) {
+				zcb->zcb_embedded_histogram[i][j] +=
+				    wzcb->zcb_embedded_histogram[i][j];
+			}
+		}
+
+		for (int e = 0; e < 256; e++)
+			zcb->zcb_errors[e] += wzcb->zcb_errors[e];
+		zcb->zcb_haderrors |= wzcb->zcb_haderrors;
+
+		umem_free(wzcb, sizeof (zdb_cb_t));
+	}
+
+	if (zcb->zcb_nworkers != 0) {
+		umem_free(zcb->zcb_workers,
+		    zcb->zcb_nworkers * sizeof (zdb_cb_t *));
+		zcb->zcb_workers = NULL;
+		zcb->zcb_nworkers = 0;
+	}
+}
+
 static int
 dump_block_stats(spa_t *spa)
 {
@@ -7794,7 +8054,15 @@ dump_block_stats(spa_t *spa)
 	zcb->zcb_totalasize +=
 	    metaslab_class_get_alloc(spa_special_embedded_log_class(spa));
 	zcb->zcb_start = zcb->zcb_lastprint = gethrtime();
-	err = traverse_pool(spa, 0, flags, zdb_blkptr_cb, zcb);
+
+	/*
+	 * Blocks are only listed in traversal order (-bbbbb) when traversing
+	 * them serially.
+	 */
+	if (traverse_jobs > 1 && dump_opt['b'] < 5)
+		err = zdb_traverse_pool_parallel(spa, flags, zcb);
+	else
+		err = traverse_pool(spa, 0, flags, zdb_blkptr_cb, zcb);
 
 	/*
 	 * If we've traversed the data blocks then we need to wait for those
@@ -7815,6 +8083,7 @@ dump_block_stats(spa_t *spa)
 	 * Done after zio_wait() since zcb_haderrors is modified in
 	 * zdb_blkptr_done()
 	 */
+	zdb_merge_workers(zcb);
 	zcb->zcb_haderrors |= err;
 
 	if (zcb->zcb_haderrors) {
@@ -9974,6 +10243,7 @@ main(int argc, char **argv)
 		{"scripting-mode",	no_argument,		NULL, 'H'},
 		{"intent-logs",		no_argument,		NULL, 'i'},
 		{"inflight",		required_argument,	NULL, 'I'},
+		{"jobs",		required_argument,	NULL, 'j'},
 		{"checkpointed-state",	no_argument,		NULL, 'k'},
 		{"key",			required_argument,	NULL, 'K'},
 		{"label",		no_argument,		NULL, 'l'},
@@ -10011,7 +10281,7 @@ main(int argc, char **argv)
 	};
 
 	while ((c = getopt_long(argc, argv,
-	    "AbBcCdDeEfFGhHiI:kK:lLmMNo:Op:PqrRsSt:TuU:vVx:XYyZ",
+	    "AbBcCdDeEfFGhHiI:j:kK:lLmMNo:Op:PqrRsSt:TuU:vVx:XYyZ",
 	    long_options, NULL)) != -1) {
 		switch (c) {
 		case 'b':
@@ -10067,6 +10337,14 @@ main(int argc, char **argv)
 				usage();
 			}
 			break;
+		case 'j':
+			traverse_jobs = strtoul(optarg, NULL, 0);
+			if (traverse_jobs == 0) {
+				(void) fprintf(stderr, "number of block "
+				    "traversal jobs must be greater than 0\n");
+				usage();
+			}
+			break;
 		case 'K':
 			dump_opt[c]++;
 			key_material = strdup(optarg);
@@ -4872,10 +4872,7 @@ zfs_do_send(int argc, char **argv)
 			flags.progress = B_TRUE;
 			break;
 		case 'D':
-			(void) fprintf(stderr,
-			    gettext("WARNING: deduplicated send is no "
-			    "longer supported.  A regular,\n"
-			    "non-deduplicated stream will be generated.\n\n"));
+			flags.dedup = B_TRUE;
 			break;
 		case 'n':
 			flags.dryrun = B_TRUE;
@@ -43,10 +43,17 @@ zstream_usage(void)
 	    "\t... | zstream raw [-v] [-b blocks] [-g guid] IMAGE|DEVICE\n"
 	    "\n"
 	    "\tzstream recompress [-t num_threads] [-l level] TYPE\n"
+	    "\tzstream recompress [-t num_threads] [-l level] "
+	    "[-c TYPE[,TYPE]...] [-g percent] auto\n"
+	    "\n"
+	    "\tzstream stats [-t num_threads] [-c TYPE [-l level]] "
+	    "[-n objects] FILE\n"
+	    "\t... | zstream stats [-t num_threads] [-c TYPE [-l level]] "
+	    "[-n objects]\n"
 	    "\n"
 	    "\tzstream token resume_token\n"
 	    "\n"
-	    "\tzstream redup [-v] FILE | ...\n");
+	    "\tzstream redup [-v] [-m memory] [-d directory] FILE | ...\n");
 	exit(1);
 }
 
@@ -73,6 +80,8 @@ main(int argc, char *argv[])
 		return (zstream_do_raw(argc - 1, argv + 1));
 	} else if (strcmp(subcommand, "recompress") == 0) {
 		return (zstream_do_recompress(argc - 1, argv + 1));
+	} else if (strcmp(subcommand, "stats") == 0) {
+		return (zstream_do_stats(argc - 1, argv + 1));
 	} else if (strcmp(subcommand, "token") == 0) {
 		return (zstream_do_token(argc - 1, argv + 1));
 	} else if (strcmp(subcommand, "redup") == 0) {
@@ -49,10 +49,24 @@
 #include "zstream_recompress.h"
 
 #define	MAX_COMPRESSION_STEPS 4
+#define	MAX_AUTO_CANDIDATES 16
 
 static compression_spec_t	specs[MAX_COMPRESSION_STEPS];
 static int			next_spec = 0;
 
+/*
+ * For "zstream recompress auto": the algorithms to try on each block,
+ * ordered from fastest to slowest to decompress, and the minimum saving, as
+ * a percentage, that justifies choosing a slower one.
+ */
+typedef struct {
+	compression_spec_t	ac_candidates[MAX_AUTO_CANDIDATES];
+	int			ac_ncandidates;
+	uint_t			ac_min_gain;
+} auto_spec_t;
+
+static auto_spec_t		auto_spec;
+
 /*
  * Item is known to be a DRR_WRITE packet. Determine whether current
  * compression is compatible with desired compression and whether the
@@ -292,6 +306,106 @@ parallel_compress_writes(compression_spec_t *target)
 	return (step);
 }
 
+/*
+ * Rough relative cost of decompressing a block of each type. Only the order
+ * matters: it determines which candidate wins when sizes are close.
+ */
+static int
+decompress_cost(enum zio_compress ct)
+{
+	if (ct == ZIO_COMPRESS_ZSTD)
+		return (2);
+	if (ct >= ZIO_COMPRESS_GZIP_1 && ct <= ZIO_COMPRESS_GZIP_9)
+		return (3);
+	return (1);
+}
+
+/*
+ * Compress the block with every candidate and keep the smallest result.
+ * Candidates are sorted by decompression cost, so a later candidate that
+ * is slower to read back must beat the current choice by ac_min_gain
+ * percent to replace it.
+ */
+static void
+chain_auto_compress_writes(queue_item_t *item_in, void *context_in)
+{
+	drr_packet_t *item = (drr_packet_t *)item_in;
+	auto_spec_t *context = (auto_spec_t *)context_in;
+	struct drr_write *drrw = &item->dp_drr.drr_u.drr_write;
+	compression_spec_t *best = NULL;
+	uint8_t *bbuff = NULL;
+	size_t bsize = item->dp_payload_size;
+
+	VERIFY3U(item->dp_drr.drr_type, ==, DRR_WRITE);
+	VERIFY3B(ctype_is_uncompressed(drrw->drr_compressiontype), ==, B_TRUE);
+
+	for (int i = 0; i < context->ac_ncandidates; i++) {
+		compression_spec_t *spec = &context->ac_candidates[i];
+		uint8_t *cbuff;
+		size_t csize;
+
+		cbuff = compress_buffer(item->dp_payload,
+		    item->dp_payload_size, *spec, &csize);
+		if (cbuff == NULL)
+			continue;
+		if (best != NULL && (csize >= bsize ||
+		    (decompress_cost(spec->cs_type) >
+		    decompress_cost(best->cs_type) && csize * 100 >
+		    bsize * (100 - context->ac_min_gain)))) {
+			free(cbuff);
+			continue;
+		}
+		free(bbuff);
+		bbuff = cbuff;
+		bsize = csize;
+		best = spec;
+	}
+
+	if (best == NULL) {
+		drrw->drr_compressiontype = 0;
+		drrw->drr_compressed_size = 0;
+	} else {
+		free(item->dp_payload);
+		item->dp_payload = bbuff;
+		item->dp_payload_size = bsize;
+		drrw->drr_compressed_size = bsize;
+		drrw->drr_compressiontype = best->cs_type;
+	}
+}
+
+static size_t
+chain_auto_compress_cost(queue_item_t *item_in, void *context_in)
+{
+	auto_spec_t *context = (auto_spec_t *)context_in;
+	drr_packet_t *item = (drr_packet_t *)item_in;
+	dmu_replay_record_t *drr = &item->dp_drr;
+	struct drr_write *drrw = &drr->drr_u.drr_write;
+
+	if (drr->drr_type != DRR_WRITE ||
+	    !ctype_is_uncompressed(drrw->drr_compressiontype) ||
+	    DMU_OT_IS_METADATA(drrw->drr_type) || write_is_encrypted(drrw))
+		return (0);
+	return (drrw->drr_logical_size * context->ac_ncandidates);
+}
+
+static chain_step_t
+parallel_auto_compress_writes(auto_spec_t *context)
+{
+	chain_step_t step = {
+	    .cs_type = CS_PARALLEL,
+	    .cs_in_size = sizeof (drr_packet_t),
+	    .cs_out_size = sizeof (drr_packet_t),
+	    .cs_context = context,
+	    .cs_parallel = {
+		.queue_length = 1024,
+		.batch_budget = 128 * 1024,
+		.process = chain_auto_compress_writes,
+		.cost = chain_auto_compress_cost
+	    }
+	};
+	return (step);
+}
+
 /*
  * Keep DRR_BEGIN feature flags consistent with the WRITE payloads we emit.
  * Compressed WRITEs require DMU_BACKUP_FEATURE_COMPRESSED (and LZ4/ZSTD as
@@ -300,23 +414,9 @@ parallel_compress_writes(compression_spec_t *target)
  * LZ4/ZSTD are cleared only when neither EMBED_DATA nor RAW remains, since
  * recompress does not rewrite those record types.
  */
-static disposition_t
-chain_update_compress_features(void *item_in, void *context_in)
+static uint64_t
+update_compress_features(uint64_t flags, compression_spec_t *spec)
 {
-	drr_packet_t *item = (drr_packet_t *)item_in;
-	compression_spec_t *spec = (compression_spec_t *)context_in;
-	struct drr_begin *drrb;
-	uint64_t flags;
-
-	if (item == NULL)
-		return (D_OK);
-
-	if (item->dp_drr.drr_type != DRR_BEGIN)
-		return (D_OK);
-
-	drrb = &item->dp_drr.drr_u.drr_begin;
-	flags = DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo);
-
 	if (ctype_is_uncompressed(spec->cs_type)) {
 		if (!(flags & DMU_BACKUP_FEATURE_RAW))
 			flags &= ~DMU_BACKUP_FEATURE_COMPRESSED;
@@ -333,11 +433,73 @@ chain_update_compress_features(void *item_in, void *context_in)
 			flags |= DMU_BACKUP_FEATURE_LZ4;
 		}
 	}
+	return (flags);
+}
+
+static disposition_t
+chain_update_compress_features(void *item_in, void *context_in)
+{
+	drr_packet_t *item = (drr_packet_t *)item_in;
+	compression_spec_t *spec = (compression_spec_t *)context_in;
+	struct drr_begin *drrb;
+	uint64_t flags;
+
+	if (item == NULL)
+		return (D_OK);
 
+	if (item->dp_drr.drr_type != DRR_BEGIN)
+		return (D_OK);
+
+	drrb = &item->dp_drr.drr_u.drr_begin;
+	flags = DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo);
+	flags = update_compress_features(flags, spec);
 	DMU_SET_FEATUREFLAGS(drrb->drr_versioninfo, flags);
 	return (D_OK);
 }
 
+/*
+ * In auto mode, any candidate may end up in the stream, so the stream
+ * needs the features of all of them. Blocks that were compressed on input
+ * are all decompressed first, so nothing else remains.
+ */
+static disposition_t
+chain_update_auto_features(void *item_in, void *context_in)
+{
+	drr_packet_t *item = (drr_packet_t *)item_in;
+	auto_spec_t *context = (auto_spec_t *)context_in;
+	compression_spec_t off = { .cs_type = ZIO_COMPRESS_OFF };
+	struct drr_begin *drrb;
+	uint64_t flags;
+
+	if (item == NULL || item->dp_drr.drr_type != DRR_BEGIN)
+		return (D_OK);
+
+	drrb = &item->dp_drr.drr_u.drr_begin;
+	flags = DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo);
+	flags = update_compress_features(flags, &off);
+	for (int i = 0; i < context->ac_ncandidates; i++) {
+		flags = update_compress_features(flags,
+		    &context->ac_candidates[i]);
+	}
+	DMU_SET_FEATUREFLAGS(drrb->drr_versioninfo, flags);
+	return (D_OK);
+}
+
+static chain_step_t
+serial_update_auto_features(auto_spec_t *context)
+{
+	chain_step_t step = {
+	    .cs_type = CS_SERIAL,
+	    .cs_in_size = sizeof (drr_packet_t),
+	    .cs_out_size = sizeof (drr_packet_t),
+	    .cs_context = context,
+	    .cs_serial = {
+		.process = chain_update_auto_features,
+	    }
+	};
+	return (step);
+}
+
 static chain_step_t
 serial_update_compress_features(compression_spec_t *target)
 {
@@ -359,17 +521,105 @@ serial_update_compress_features(compression_spec_t *target)
 	return (step);
 }
 
+/*
+ * Parse a compression property value such as "lz4", "gzip-9", or
+ * "zstd-19". Returns B_FALSE if it isn't one that recompress can produce.
+ */
+static boolean_t
+parse_compression(const char *name, int level, compression_spec_t *spec)
+{
+	enum zio_compress ct;
+	char *end;
+
+	spec->cs_level = level;
+	if (strcmp(name, "gzip") == 0) {
+		spec->cs_type = ZIO_COMPRESS_GZIP_6;
+		return (B_TRUE);
+	}
+	if (strncmp(name, "zstd-", 5) == 0) {
+		long zlevel = strtol(name + 5, &end, 10);
+		if (*end != '\0' || end == name + 5 ||
+		    zlevel < ZIO_ZSTD_LEVEL_MIN || zlevel > ZIO_ZSTD_LEVEL_MAX)
+			return (B_FALSE);
+		spec->cs_type = ZIO_COMPRESS_ZSTD;
+		spec->cs_level = zlevel;
+		return (B_TRUE);
+	}
+	for (ct = 0; ct < ZIO_COMPRESS_FUNCTIONS; ct++) {
+		if (strcmp(name, zio_compress_table[ct].ci_name) == 0)
+			break;
+	}
+	if (ct == ZIO_COMPRESS_FUNCTIONS || ctype_is_uncompressed(ct))
+		return (B_FALSE);
+	spec->cs_type = ct;
+	return (B_TRUE);
+}
+
+static int
+auto_candidate_compare(const void *x1, const void *x2)
+{
+	const compression_spec_t *s1 = x1;
+	const compression_spec_t *s2 = x2;
+
+	return (TREE_CMP(decompress_cost(s1->cs_type),
+	    decompress_cost(s2->cs_type)));
+}
+
+static void
+parse_auto_candidates(char *list, int level, auto_spec_t *context)
+{
+	char *name, *last = NULL;
+
+	context->ac_ncandidates = 0;
+	for (name = strtok_r(list, ",", &last); name != NULL;
+	    name = strtok_r(NULL, ",", &last)) {
+		if (context->ac_ncandidates == MAX_AUTO_CANDIDATES)
+			errx(2, "at most %d candidate algorithms are allowed",
+			    MAX_AUTO_CANDIDATES);
+		if (!parse_compression(name, level,
+		    &context->ac_candidates[context->ac_ncandidates++]))
+			errx(2, "invalid compression type %s", name);
+	}
+	if (context->ac_ncandidates == 0)
+		errx(2, "no candidate algorithms given");
+
+	/* Stable, so ties keep the order given on the command line */
+	for (int i = 1; i < context->ac_ncandidates; i++) {
+		compression_spec_t spec = context->ac_candidates[i];
+		int j = i;
+		while (j > 0 && auto_candidate_compare(
+		    &context->ac_candidates[j - 1], &spec) > 0) {
+			context->ac_candidates[j] =
+			    context->ac_candidates[j - 1];
+			j--;
+		}
+		context->ac_candidates[j] = spec;
+	}
+}
+
 int
 zstream_do_recompress(int argc, char *argv[])
 {
 	int c;
 	int level = ZIO_COMPLEVEL_DEFAULT;
 	uint_t num_threads = 0;
+	char *candidates = NULL;
 
 	chain_attrs_t attrs = { .ca_command_opts = CA_FORBID_DEDUP };
 
-	while ((c = getopt(argc, argv, "t:l:")) != -1) {
+	auto_spec.ac_min_gain = 5;
+	while ((c = getopt(argc, argv, "t:l:c:g:")) != -1) {
 		switch (c) {
+		case 'c':
+			candidates = optarg;
+			break;
+		case 'g':
+			if (sscanf(optarg, "%u", &auto_spec.ac_min_gain) != 1 ||
+			    auto_spec.ac_min_gain > 100) {
+				warnx("failed to parse gain '%s'", optarg);
+				zstream_usage();
+			}
+			break;
 		case 'l':
 			if (sscanf(optarg, "%d", &level) != 1) {
 				warnx("failed to parse level '%s'", optarg);
@@ -396,20 +646,31 @@ zstream_do_recompress(int argc, char *argv[])
 	if (argc != 1)
 		zstream_usage();
 
+	if (strcmp(argv[0], "auto") == 0) {
+		char default_candidates[] = "lz4,zstd";
+
+		parse_auto_candidates(candidates != NULL ? candidates :
+		    default_candidates, level, &auto_spec);
+
+		zstream_chain_t auto_chain = {
+			STANDARD_INPUT_STACK(NULL),
+			parallel_decompress_writes(NULL),
+			parallel_auto_compress_writes(&auto_spec),
+			serial_update_auto_features(&auto_spec),
+			STANDARD_OUTPUT_STACK(NULL)
+		};
+
+		zstream_chain_exec(auto_chain, &attrs);
+		return (0);
+	}
+	if (candidates != NULL)
+		errx(2, "-c requires the auto compression type");
+
 	compression_spec_t spec = { .cs_level = level };
 	if (strcmp(argv[0], "off") == 0) {
 		spec.cs_type = ZIO_COMPRESS_OFF;
-	} else {
-		enum zio_compress ct;
-		for (ct = 0; ct < ZIO_COMPRESS_FUNCTIONS; ct++) {
-			const char *ci_name = zio_compress_table[ct].ci_name;
-			if (strcmp(argv[0], ci_name) == 0)
-				break;
-		}
-		if (ct == ZIO_COMPRESS_FUNCTIONS || ctype_is_uncompressed(ct)) {
-			errx(2, "invalid compression type %s", argv[0]);
-		}
-		spec.cs_type = ct;
+	} else if (!parse_compression(argv[0], level, &spec)) {
+		errx(2, "invalid compression type %s", argv[0]);
 	}
 
 	zstream_chain_t recompress_chain = {
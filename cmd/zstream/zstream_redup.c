@@ -18,7 +18,6 @@
  * Copyright (c) 2020 by Delphix. All rights reserved.
  */
 
-#include <assert.h>
 #include <cityhash.h>
 #include <err.h>
 #include <errno.h>
@@ -27,12 +26,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <libzfs.h>
 #include <sys/bitops.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/stdtypes.h>
 #include <sys/sysmacros.h>
 #include <sys/zfs_ioctl.h>
-#include <umem.h>
 #include <unistd.h>
 
 #include "zstream.h"
@@ -41,9 +41,25 @@
 
 #define	MAX_RDT_PHYSMEM_PERCENT		20
 #define	SMALLEST_POSSIBLE_MAX_RDT_MB	128
+#define	INITIAL_RDT_HASHBITS		16
 
+/*
+ * The redup table maps each WRITE record's (guid, object, offset) to its
+ * offset in the input stream, so that later WRITE_BYREF records can be
+ * resolved by reading the original record back.  It's an open-addressed
+ * hash table with linear probing that doubles when it's half full.
+ *
+ * Tables up to rdt_mem_limit bytes live in anonymous memory.  Beyond that,
+ * the table is mapped from an unlinked file in rdt_spill_dir, so the
+ * kernel's page cache holds the part of it that fits in memory and writes
+ * the rest back to the file.  Either way it's accessed through the same
+ * mapping, so lookups cost about the same until the working set outgrows
+ * memory.
+ *
+ * No WRITE record can start at stream offset 0, where the first BEGIN
+ * record is, so a zero rde_stream_offset marks an empty slot.
+ */
 typedef struct redup_entry {
-	struct redup_entry	*rde_next;
 	uint64_t		rde_guid;
 	uint64_t		rde_object;
 	uint64_t		rde_offset;
@@ -51,10 +67,12 @@ typedef struct redup_entry {
 } redup_entry_t;
 
 typedef struct redup_table {
-	redup_entry_t	**redup_hash_array;
-	umem_cache_t	*ddecache;
-	uint64_t	ddt_count;
-	int		numhashbits;
+	redup_entry_t	*rdt_entries;
+	uint64_t	rdt_count;
+	int		rdt_hashbits;
+	int		rdt_fd;		/* -1 if in anonymous memory */
+	uint64_t	rdt_mem_limit;
+	const char	*rdt_spill_dir;
 } redup_table_t;
 
 typedef struct {
@@ -62,23 +80,142 @@ typedef struct {
 	FILE		*rc_fp;
 } redup_context_t;
 
+static size_t
+rdt_size(int hashbits)
+{
+	return (sizeof (redup_entry_t) << hashbits);
+}
+
+/*
+ * Map a zeroed table with 2^hashbits entries, from a spill file if it's
+ * too big to keep in memory.
+ */
+static redup_entry_t *
+rdt_map(redup_table_t *rdt, int hashbits, int *fdp)
+{
+	size_t size = rdt_size(hashbits);
+	void *entries;
+	int fd = -1;
+
+	if (size > rdt->rdt_mem_limit) {
+		char *path;
+
+		if (asprintf(&path, "%s/zstream-redup.XXXXXX",
+		    rdt->rdt_spill_dir) == -1)
+			err(1, "asprintf");
+		if ((fd = mkstemp(path)) == -1)
+			err(1, "unable to create redup table file %s", path);
+		(void) unlink(path);
+		free(path);
+		if (ftruncate(fd, size) != 0)
+			err(1, "unable to size redup table file");
+		entries = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, 0);
+	} else {
+		entries = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	if (entries == MAP_FAILED)
+		err(1, "unable to map %llu byte redup table",
+		    (u_longlong_t)size);
+
+	/* Probes land on random pages, so readahead would be wasted */
+	if (fd != -1)
+		(void) madvise(entries, size, MADV_RANDOM);
+
+	*fdp = fd;
+	return (entries);
+}
+
+static void
+rdt_unmap(redup_entry_t *entries, int hashbits, int fd)
+{
+	VERIFY0(munmap(entries, rdt_size(hashbits)));
+	if (fd != -1)
+		(void) close(fd);
+}
+
+/*
+ * Find the slot for a key: either the entry that holds it or the empty
+ * slot where it belongs.
+ */
+static redup_entry_t *
+rdt_probe(redup_entry_t *entries, int hashbits,
+    uint64_t guid, uint64_t object, uint64_t offset)
+{
+	uint64_t mask = (1ULL << hashbits) - 1;
+	uint64_t idx = cityhash3(guid, object, offset) & mask;
+
+	for (;;) {
+		redup_entry_t *rde = &entries[idx];
+		if (rde->rde_stream_offset == 0 ||
+		    (rde->rde_guid == guid &&
+		    rde->rde_object == object &&
+		    rde->rde_offset == offset))
+			return (rde);
+		idx = (idx + 1) & mask;
+	}
+}
+
+static void
+rdt_grow(redup_table_t *rdt)
+{
+	int hashbits = rdt->rdt_hashbits + 1;
+	int fd;
+	redup_entry_t *entries = rdt_map(rdt, hashbits, &fd);
+
+	for (uint64_t i = 0; i < (1ULL << rdt->rdt_hashbits); i++) {
+		redup_entry_t *rde = &rdt->rdt_entries[i];
+		if (rde->rde_stream_offset == 0)
+			continue;
+		*rdt_probe(entries, hashbits, rde->rde_guid,
+		    rde->rde_object, rde->rde_offset) = *rde;
+	}
+
+	rdt_unmap(rdt->rdt_entries, rdt->rdt_hashbits, rdt->rdt_fd);
+	rdt->rdt_entries = entries;
+	rdt->rdt_hashbits = hashbits;
+	rdt->rdt_fd = fd;
+}
+
+static void
+rdt_init(redup_table_t *rdt, uint64_t mem_limit, const char *spill_dir)
+{
+	rdt->rdt_mem_limit = mem_limit;
+	rdt->rdt_spill_dir = spill_dir;
+	rdt->rdt_hashbits = INITIAL_RDT_HASHBITS;
+	rdt->rdt_count = 0;
+	rdt->rdt_entries = rdt_map(rdt, rdt->rdt_hashbits, &rdt->rdt_fd);
+}
+
+static void
+rdt_fini(redup_table_t *rdt)
+{
+	rdt_unmap(rdt->rdt_entries, rdt->rdt_hashbits, rdt->rdt_fd);
+	rdt->rdt_entries = NULL;
+}
+
+/*
+ * If the same block appears twice, the later record wins, since a later
+ * WRITE_BYREF can only refer to the most recent one.
+ */
 static void
 rdt_insert(redup_table_t *rdt,
     uint64_t guid, uint64_t object, uint64_t offset, uint64_t stream_offset)
 {
-	uint64_t ch = cityhash3(guid, object, offset);
-	uint64_t hashcode = BF64_GET(ch, 0, rdt->numhashbits);
-	redup_entry_t **rdepp;
-
-	rdepp = &(rdt->redup_hash_array[hashcode]);
-	redup_entry_t *rde = umem_cache_alloc(rdt->ddecache, UMEM_NOFAIL);
-	rde->rde_next = *rdepp;
-	rde->rde_guid = guid;
-	rde->rde_object = object;
-	rde->rde_offset = offset;
+	VERIFY3U(stream_offset, !=, 0);
+	if ((rdt->rdt_count + 1) * 2 > (1ULL << rdt->rdt_hashbits))
+		rdt_grow(rdt);
+
+	redup_entry_t *rde = rdt_probe(rdt->rdt_entries, rdt->rdt_hashbits,
+	    guid, object, offset);
+	if (rde->rde_stream_offset == 0) {
+		rde->rde_guid = guid;
+		rde->rde_object = object;
+		rde->rde_offset = offset;
+		rdt->rdt_count++;
+	}
 	rde->rde_stream_offset = stream_offset;
-	*rdepp = rde;
-	rdt->ddt_count++;
 }
 
 static void
@@ -86,19 +223,14 @@ rdt_lookup(redup_table_t *rdt,
     uint64_t guid, uint64_t object, uint64_t offset,
     uint64_t *stream_offsetp)
 {
-	uint64_t ch = cityhash3(guid, object, offset);
-	uint64_t hashcode = BF64_GET(ch, 0, rdt->numhashbits);
-
-	for (redup_entry_t *rde = rdt->redup_hash_array[hashcode];
-	    rde != NULL; rde = rde->rde_next) {
-		if (rde->rde_guid == guid &&
-		    rde->rde_object == object &&
-		    rde->rde_offset == offset) {
-			*stream_offsetp = rde->rde_stream_offset;
-			return;
-		}
-	}
-	assert(!"could not find expected redup table entry");
+	redup_entry_t *rde = rdt_probe(rdt->rdt_entries, rdt->rdt_hashbits,
+	    guid, object, offset);
+
+	if (rde->rde_stream_offset == 0)
+		errx(1, "could not find expected redup table entry for "
+		    "object %llu offset %llu", (u_longlong_t)object,
+		    (u_longlong_t)offset);
+	*stream_offsetp = rde->rde_stream_offset;
 }
 
 static disposition_t
@@ -203,10 +335,22 @@ zstream_do_redup(int argc, char *argv[])
 	int c;
 	chain_attrs_t attrs = {0};
 	redup_context_t context = {0};
-	uint64_t numbuckets;
+	const char *spill_dir = getenv("TMPDIR");
+	uint64_t max_rdt_size = 0;
 
-	while ((c = getopt(argc, argv, "v")) != -1) {
+	while ((c = getopt(argc, argv, "d:m:v")) != -1) {
 		switch (c) {
+		case 'd':
+			spill_dir = optarg;
+			break;
+		case 'm':
+			if (zfs_nicestrtonum(NULL, optarg,
+			    &max_rdt_size) != 0) {
+				warnx("failed to parse memory limit '%s'",
+				    optarg);
+				zstream_usage();
+			}
+			break;
 		case 'v':
 			ENABLE_OPTION(&attrs, CA_VERBOSE);
 			break;
@@ -227,24 +371,20 @@ zstream_do_redup(int argc, char *argv[])
 		err(1, "unable to open %s", argv[0]);
 	}
 
+	if (max_rdt_size == 0) {
 #ifdef _ILP32
-	uint64_t max_rde_size = SMALLEST_POSSIBLE_MAX_RDT_MB << 20;
+		max_rdt_size = SMALLEST_POSSIBLE_MAX_RDT_MB << 20;
 #else
-	uint64_t physbytes = sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
-	uint64_t max_rde_size = MAX((physbytes * MAX_RDT_PHYSMEM_PERCENT) / 100,
-	    SMALLEST_POSSIBLE_MAX_RDT_MB << 20);
+		uint64_t physbytes =
+		    sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+		max_rdt_size = MAX((physbytes * MAX_RDT_PHYSMEM_PERCENT) / 100,
+		    SMALLEST_POSSIBLE_MAX_RDT_MB << 20);
 #endif
+	}
+	if (spill_dir == NULL || *spill_dir == '\0')
+		spill_dir = "/tmp";
 
-	numbuckets = max_rde_size / (sizeof (redup_entry_t));
-	if (!ISP2(numbuckets))
-		numbuckets = 1ULL << highbit64(numbuckets);
-
-	context.rc_rdt.redup_hash_array =
-	    safe_calloc(numbuckets * sizeof (redup_entry_t *));
-	context.rc_rdt.ddecache = umem_cache_create("rde",
-	    sizeof (redup_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
-	context.rc_rdt.numhashbits = highbit64(numbuckets) - 1;
-	context.rc_rdt.ddt_count = 0;
+	rdt_init(&context.rc_rdt, max_rdt_size, spill_dir);
 
 	zstream_chain_t redup_chain = {
 		STANDARD_INPUT_STACK(argv[0]),
@@ -256,17 +396,17 @@ zstream_do_redup(int argc, char *argv[])
 	if (attrs.ca_command_opts & CA_VERBOSE) {
 		char mem_str[16];
 		record_stats_t *acsi = attrs.ca_stats_in;
-		zfs_nicenum(context.rc_rdt.ddt_count * sizeof (redup_entry_t),
+		zfs_nicenum(rdt_size(context.rc_rdt.rdt_hashbits),
 		    mem_str, sizeof (mem_str));
 		fprintf(stderr, "Converted stream with %llu total records, "
-		    "including %llu dedup records, using %sB memory.\n",
+		    "including %llu dedup records, using a %sB table%s.\n",
 		    (u_longlong_t)attrs.ca_totals_in.rs_num_records,
 		    (u_longlong_t)acsi[DRR_WRITE_BYREF].rs_num_records,
-		    mem_str);
+		    mem_str, context.rc_rdt.rdt_fd == -1 ? "" :
+		    " spilled to disk");
 	}
 
 	fclose(context.rc_fp);
-	umem_cache_destroy(context.rc_rdt.ddecache);
-	free(context.rc_rdt.redup_hash_array);
+	rdt_fini(&context.rc_rdt);
 	return (0);
 }
@@ -0,0 +1,674 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the Common
+ * Development and Distribution License ("CDDL"), version 1.0. You may only use
+ * this file in accordance with the terms of version 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this source. A
+ * copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+
+#include <err.h>
+#include <libnvpair.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/avl.h>
+#include <sys/dmu.h>
+#include <sys/stdtypes.h>
+#include <sys/sysmacros.h>
+#include <sys/zfs_ioctl.h>
+#include <sys/zio_compress.h>
+
+#include "zstream.h"
+#include "zstream_modules.h"
+#include "zstream_queue.h"
+
+/*
+ * zstream stats: summarize a send stream as JSON without receiving it.
+ *
+ * The parallel step looks at the payload of each WRITE record: it checks
+ * whether the block is all zeroes and, with -c, how well it would compress.
+ * The serial step then adds each record into the counters for its stream and
+ * for its object.  Substreams of a replication stream are reported
+ * separately.
+ */
+
+typedef struct {
+	drr_packet_t	sp_base;
+	uint32_t	sp_est_size;	/* payload size if compressed per -c */
+	boolean_t	sp_zero;	/* payload is all zeroes */
+} stats_packet_t;
+
+typedef struct {
+	uint64_t	sr_count;
+	uint64_t	sr_bytes;	/* header plus payload */
+} stats_records_t;
+
+/* Counters kept for every stream, and for all streams together */
+typedef struct {
+	stats_records_t	sc_records[DRR_NUMTYPES];
+	uint64_t	sc_logical;	/* logical bytes of WRITE records */
+	uint64_t	sc_payload;	/* payload bytes of WRITE records */
+	uint64_t	sc_estimated;	/* payload bytes if compressed per -c */
+	uint64_t	sc_zero_blocks;
+	uint64_t	sc_zero_bytes;
+	uint64_t	sc_freed;	/* bytes in DRR_FREE ranges */
+	uint64_t	sc_blksz[SPA_MAXBLOCKSHIFT + 1];
+	stats_records_t	sc_compress[ZIO_COMPRESS_FUNCTIONS];
+	uint64_t	sc_compress_logical[ZIO_COMPRESS_FUNCTIONS];
+} stats_counts_t;
+
+/* Counters for one object of a stream; there may be millions of these */
+typedef struct {
+	avl_node_t	so_node;
+	uint64_t	so_object;
+	uint64_t	so_blksz;	/* from DRR_OBJECT, or 0 */
+	uint8_t		so_type;
+	stats_records_t	so_records[DRR_NUMTYPES];
+	uint64_t	so_logical;
+	uint64_t	so_freed;
+} stats_object_t;
+
+typedef struct {
+	compression_spec_t	sx_estimate;	/* -c, or ZIO_COMPRESS_OFF */
+	uint64_t		sx_max_objects;	/* -n; 0 for all */
+	nvlist_t		**sx_stream_list;
+	uint_t			sx_nstreams;
+	boolean_t		sx_in_stream;
+	nvlist_t		*sx_begin;	/* of the current stream */
+	stats_counts_t		sx_stream;
+	stats_counts_t		sx_total;
+	avl_tree_t		sx_objects;
+} stats_context_t;
+
+static stats_context_t stats_context;
+
+static const char *const stats_typenames[DRR_NUMTYPES] = {
+	[DRR_BEGIN] = "BEGIN",
+	[DRR_OBJECT] = "OBJECT",
+	[DRR_FREEOBJECTS] = "FREEOBJECTS",
+	[DRR_WRITE] = "WRITE",
+	[DRR_FREE] = "FREE",
+	[DRR_END] = "END",
+	[DRR_WRITE_BYREF] = "WRITE_BYREF",
+	[DRR_SPILL] = "SPILL",
+	[DRR_WRITE_EMBEDDED] = "WRITE_EMBEDDED",
+	[DRR_OBJECT_RANGE] = "OBJECT_RANGE",
+	[DRR_REDACT] = "REDACT",
+};
+
+static int
+stats_object_compare(const void *x1, const void *x2)
+{
+	const stats_object_t *so1 = x1;
+	const stats_object_t *so2 = x2;
+
+	return (TREE_CMP(so1->so_object, so2->so_object));
+}
+
+/*
+ * Only WRITE payloads that are neither compressed nor encrypted are worth
+ * looking at; the others cost nothing.
+ */
+static size_t
+chain_stats_cost(queue_item_t *item_in, void *context)
+{
+	(void) context;
+	drr_packet_t *item = (drr_packet_t *)item_in;
+	struct drr_write *drrw = &item->dp_drr.drr_u.drr_write;
+
+	if (item->dp_drr.drr_type != DRR_WRITE || item->dp_payload == NULL ||
+	    DRR_WRITE_COMPRESSED(drrw) || write_is_encrypted(drrw))
+		return (0);
+	return (item->dp_payload_size);
+}
+
+static void
+chain_stats_analyze(queue_item_t *item_in, void *context_in)
+{
+	stats_packet_t *item = (stats_packet_t *)item_in;
+	stats_context_t *context = context_in;
+	drr_packet_t *dp = &item->sp_base;
+	struct drr_write *drrw = &dp->dp_drr.drr_u.drr_write;
+	size_t csize;
+
+	item->sp_zero = B_TRUE;
+	for (uint32_t i = 0; i < dp->dp_payload_size; i += sizeof (uint64_t)) {
+		if (*(uint64_t *)(dp->dp_payload + i) != 0) {
+			item->sp_zero = B_FALSE;
+			break;
+		}
+	}
+
+	if (ctype_is_uncompressed(context->sx_estimate.cs_type) ||
+	    item->sp_zero || DMU_OT_IS_METADATA(drrw->drr_type))
+		return;
+
+	uint8_t *cbuf = compress_buffer(dp->dp_payload, dp->dp_payload_size,
+	    context->sx_estimate, &csize);
+	if (cbuf != NULL) {
+		item->sp_est_size = csize;
+		free(cbuf);
+	}
+}
+
+/*
+ * Items the parallel step waived still need their defaults, so they are
+ * set in a preceding serial step.
+ */
+static disposition_t
+chain_stats_prepare(void *item_in, void *context)
+{
+	(void) context;
+	stats_packet_t *item = (stats_packet_t *)item_in;
+
+	if (item == NULL)
+		return (D_OK);
+	item->sp_est_size = item->sp_base.dp_payload_size;
+	item->sp_zero = B_FALSE;
+	return (D_OK);
+}
+
+static stats_object_t *
+stats_object(stats_context_t *context, uint64_t object)
+{
+	stats_object_t search = { .so_object = object };
+	avl_index_t where;
+
+	stats_object_t *so = avl_find(&context->sx_objects, &search, &where);
+	if (so == NULL) {
+		so = safe_calloc(sizeof (*so));
+		so->so_object = object;
+		avl_insert(&context->sx_objects, so, where);
+	}
+	return (so);
+}
+
+static void
+stats_add_records(nvlist_t *nvl, const stats_records_t *records)
+{
+	nvlist_t *types = fnvlist_alloc();
+
+	for (int t = 0; t < DRR_NUMTYPES; t++) {
+		if (records[t].sr_count == 0)
+			continue;
+		nvlist_t *rec = fnvlist_alloc();
+		fnvlist_add_uint64(rec, "count", records[t].sr_count);
+		fnvlist_add_uint64(rec, "bytes", records[t].sr_bytes);
+		fnvlist_add_nvlist(types, stats_typenames[t], rec);
+		fnvlist_free(rec);
+	}
+	fnvlist_add_nvlist(nvl, "records", types);
+	fnvlist_free(types);
+}
+
+static void
+stats_add_ratio(nvlist_t *nvl, const char *name, uint64_t logical,
+    uint64_t physical)
+{
+	if (physical != 0)
+		VERIFY0(nvlist_add_double(nvl, name,
+		    (double)logical / physical));
+}
+
+static nvlist_t *
+stats_counts_nvl(const stats_context_t *context, const stats_counts_t *sc)
+{
+	nvlist_t *nvl = fnvlist_alloc();
+	uint64_t bytes = 0;
+
+	for (int t = 0; t < DRR_NUMTYPES; t++)
+		bytes += sc->sc_records[t].sr_bytes;
+	fnvlist_add_uint64(nvl, "bytes", bytes);
+	stats_add_records(nvl, sc->sc_records);
+
+	nvlist_t *writes = fnvlist_alloc();
+	fnvlist_add_uint64(writes, "logical_bytes", sc->sc_logical);
+	fnvlist_add_uint64(writes, "payload_bytes", sc->sc_payload);
+	stats_add_ratio(writes, "compression_ratio", sc->sc_logical,
+	    sc->sc_payload);
+	fnvlist_add_uint64(writes, "zero_blocks", sc->sc_zero_blocks);
+	fnvlist_add_uint64(writes, "zero_bytes", sc->sc_zero_bytes);
+	if (!ctype_is_uncompressed(context->sx_estimate.cs_type)) {
+		fnvlist_add_uint64(writes, "estimated_payload_bytes",
+		    sc->sc_estimated);
+		stats_add_ratio(writes, "estimated_compression_ratio",
+		    sc->sc_logical, sc->sc_estimated);
+	}
+
+	nvlist_t *blksz = fnvlist_alloc();
+	for (int b = 0; b <= SPA_MAXBLOCKSHIFT; b++) {
+		char key[32];
+
+		if (sc->sc_blksz[b] == 0)
+			continue;
+		(void) snprintf(key, sizeof (key), "%llu",
+		    (u_longlong_t)1 << b);
+		fnvlist_add_uint64(blksz, key, sc->sc_blksz[b]);
+	}
+	fnvlist_add_nvlist(writes, "block_sizes", blksz);
+	fnvlist_free(blksz);
+
+	nvlist_t *compress = fnvlist_alloc();
+	for (int c = 0; c < ZIO_COMPRESS_FUNCTIONS; c++) {
+		if (sc->sc_compress[c].sr_count == 0)
+			continue;
+		nvlist_t *cnvl = fnvlist_alloc();
+		fnvlist_add_uint64(cnvl, "count", sc->sc_compress[c].sr_count);
+		fnvlist_add_uint64(cnvl, "logical_bytes",
+		    sc->sc_compress_logical[c]);
+		fnvlist_add_uint64(cnvl, "payload_bytes",
+		    sc->sc_compress[c].sr_bytes);
+		fnvlist_add_nvlist(compress, ctype_is_uncompressed(c) ?
+		    "off" : zio_compress_table[c].ci_name, cnvl);
+		fnvlist_free(cnvl);
+	}
+	fnvlist_add_nvlist(writes, "compression", compress);
+	fnvlist_free(compress);
+
+	fnvlist_add_nvlist(nvl, "writes", writes);
+	fnvlist_free(writes);
+
+	fnvlist_add_uint64(nvl, "freed_bytes", sc->sc_freed);
+	return (nvl);
+}
+
+static uint64_t
+stats_object_bytes(const stats_object_t *so)
+{
+	uint64_t bytes = 0;
+
+	for (int t = 0; t < DRR_NUMTYPES; t++)
+		bytes += so->so_records[t].sr_bytes;
+	return (bytes);
+}
+
+static int
+stats_object_bytes_compare(const void *x1, const void *x2)
+{
+	const stats_object_t *so1 = *(stats_object_t *const *)x1;
+	const stats_object_t *so2 = *(stats_object_t *const *)x2;
+
+	int cmp = TREE_CMP(stats_object_bytes(so2), stats_object_bytes(so1));
+	if (cmp != 0)
+		return (cmp);
+	return (TREE_CMP(so1->so_object, so2->so_object));
+}
+
+/*
+ * Wrap up the current stream: its counters and its objects, in object order
+ * or, with -n, the largest ones by stream bytes.
+ */
+static void
+stats_end_stream(stats_context_t *context)
+{
+	nvlist_t *nvl = context->sx_begin;
+	nvlist_t *counts = stats_counts_nvl(context, &context->sx_stream);
+	uint64_t nobjects = avl_numnodes(&context->sx_objects);
+	uint64_t nlisted = nobjects;
+	stats_object_t **objects = safe_calloc(MAX(nobjects, 1) *
+	    sizeof (stats_object_t *));
+	stats_object_t *so;
+	void *cookie = NULL;
+	uint64_t i = 0;
+
+	fnvlist_merge(nvl, counts);
+	fnvlist_free(counts);
+	context->sx_begin = NULL;
+
+	while ((so = avl_destroy_nodes(&context->sx_objects, &cookie)) != NULL)
+		objects[i++] = so;
+	if (context->sx_max_objects != 0) {
+		qsort(objects, nobjects, sizeof (stats_object_t *),
+		    stats_object_bytes_compare);
+		nlisted = MIN(nobjects, context->sx_max_objects);
+	}
+
+	nvlist_t **list = safe_calloc(MAX(nlisted, 1) * sizeof (nvlist_t *));
+	for (i = 0; i < nlisted; i++) {
+		so = objects[i];
+		list[i] = fnvlist_alloc();
+		fnvlist_add_uint64(list[i], "object", so->so_object);
+		if (so->so_blksz != 0) {
+			fnvlist_add_uint64(list[i], "type", so->so_type);
+			fnvlist_add_uint64(list[i], "block_size",
+			    so->so_blksz);
+		}
+		fnvlist_add_uint64(list[i], "bytes", stats_object_bytes(so));
+		fnvlist_add_uint64(list[i], "logical_bytes", so->so_logical);
+		fnvlist_add_uint64(list[i], "freed_bytes", so->so_freed);
+		stats_add_records(list[i], so->so_records);
+	}
+	fnvlist_add_uint64(nvl, "num_objects", nobjects);
+	fnvlist_add_nvlist_array(nvl, "objects", (const nvlist_t **)list,
+	    nlisted);
+	for (i = 0; i < nlisted; i++)
+		fnvlist_free(list[i]);
+	free(list);
+	for (i = 0; i < nobjects; i++)
+		free(objects[i]);
+	free(objects);
+
+	context->sx_stream_list = realloc(context->sx_stream_list,
+	    (context->sx_nstreams + 1) * sizeof (nvlist_t *));
+	if (context->sx_stream_list == NULL)
+		err(1, "realloc");
+	context->sx_stream_list[context->sx_nstreams++] = nvl;
+	memset(&context->sx_stream, 0, sizeof (context->sx_stream));
+	context->sx_in_stream = B_FALSE;
+}
+
+static void
+stats_begin_stream(stats_context_t *context, struct drr_begin *drrb)
+{
+	uint64_t features = DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo);
+
+	if (context->sx_in_stream)
+		stats_end_stream(context);
+
+	/*
+	 * The header of a replication stream only describes the substreams
+	 * that follow, so it has no entry of its own.
+	 */
+	if (DMU_GET_STREAM_HDRTYPE(drrb->drr_versioninfo) ==
+	    DMU_COMPOUNDSTREAM)
+		return;
+
+	context->sx_begin = fnvlist_alloc();
+	fnvlist_add_string(context->sx_begin, "toname", drrb->drr_toname);
+	fnvlist_add_uint64(context->sx_begin, "toguid", drrb->drr_toguid);
+	fnvlist_add_uint64(context->sx_begin, "fromguid", drrb->drr_fromguid);
+	fnvlist_add_uint64(context->sx_begin, "feature_flags", features);
+	context->sx_in_stream = B_TRUE;
+}
+
+static void
+stats_count_write(stats_counts_t *sc, stats_packet_t *item)
+{
+	struct drr_write *drrw = &item->sp_base.dp_drr.drr_u.drr_write;
+	uint64_t lsize = drrw->drr_logical_size;
+	uint64_t psize = item->sp_base.dp_payload_size;
+	int ct = drrw->drr_compressiontype;
+	int bucket = MIN(highbit64(lsize), SPA_MAXBLOCKSHIFT + 1) - 1;
+
+	sc->sc_logical += lsize;
+	sc->sc_payload += psize;
+	sc->sc_estimated += item->sp_est_size;
+	if (item->sp_zero) {
+		sc->sc_zero_blocks++;
+		sc->sc_zero_bytes += lsize;
+	}
+	if (bucket >= 0)
+		sc->sc_blksz[bucket]++;
+	if (ct < ZIO_COMPRESS_FUNCTIONS) {
+		sc->sc_compress[ct].sr_count++;
+		sc->sc_compress[ct].sr_bytes += psize;
+		sc->sc_compress_logical[ct] += lsize;
+	}
+}
+
+static void
+stats_count(stats_counts_t *sc, stats_packet_t *item, uint64_t bytes,
+    uint64_t freed)
+{
+	int type = item->sp_base.dp_drr.drr_type;
+
+	sc->sc_records[type].sr_count++;
+	sc->sc_records[type].sr_bytes += bytes;
+	sc->sc_freed += freed;
+	if (type == DRR_WRITE)
+		stats_count_write(sc, item);
+}
+
+static disposition_t
+chain_stats_aggregate(void *item_in, void *context_in)
+{
+	stats_packet_t *item = (stats_packet_t *)item_in;
+	stats_context_t *context = context_in;
+	dmu_replay_record_t *drr;
+	stats_object_t *so = NULL;
+	uint64_t logical = 0;
+	uint64_t freed = 0;
+
+	if (item == NULL) {
+		if (context->sx_in_stream)
+			stats_end_stream(context);
+		return (D_OK);
+	}
+
+	drr = &item->sp_base.dp_drr;
+	uint64_t bytes = sizeof (dmu_replay_record_t) +
+	    item->sp_base.dp_payload_size;
+
+	switch (drr->drr_type) {
+	case DRR_BEGIN:
+		stats_begin_stream(context, &drr->drr_u.drr_begin);
+		break;
+	case DRR_OBJECT: {
+		struct drr_object *drro = &drr->drr_u.drr_object;
+		if (!context->sx_in_stream)
+			break;
+		so = stats_object(context, drro->drr_object);
+		so->so_type = drro->drr_type;
+		so->so_blksz = drro->drr_blksz;
+		break;
+	}
+	case DRR_WRITE: {
+		struct drr_write *drrw = &drr->drr_u.drr_write;
+		logical = drrw->drr_logical_size;
+		if (context->sx_in_stream)
+			so = stats_object(context, drrw->drr_object);
+		break;
+	}
+	case DRR_WRITE_BYREF: {
+		struct drr_write_byref *drrwb = &drr->drr_u.drr_write_byref;
+		logical = drrwb->drr_length;
+		if (context->sx_in_stream)
+			so = stats_object(context, drrwb->drr_object);
+		break;
+	}
+	case DRR_WRITE_EMBEDDED: {
+		struct drr_write_embedded *drrwe =
+		    &drr->drr_u.drr_write_embedded;
+		logical = drrwe->drr_length;
+		if (context->sx_in_stream)
+			so = stats_object(context, drrwe->drr_object);
+		break;
+	}
+	case DRR_SPILL: {
+		struct drr_spill *drrs = &drr->drr_u.drr_spill;
+		logical = drrs->drr_length;
+		if (context->sx_in_stream)
+			so = stats_object(context, drrs->drr_object);
+		break;
+	}
+	case DRR_FREE: {
+		struct drr_free *drrf = &drr->drr_u.drr_free;
+		/* A length of -1 frees to the end of the object */
+		if (drrf->drr_length != -1ULL)
+			freed = drrf->drr_length;
+		if (context->sx_in_stream)
+			so = stats_object(context, drrf->drr_object);
+		break;
+	}
+	case DRR_REDACT: {
+		struct drr_redact *drrr = &drr->drr_u.drr_redact;
+		if (context->sx_in_stream)
+			so = stats_object(context, drrr->drr_object);
+		break;
+	}
+	default:
+		break;
+	}
+
+	stats_count(&context->sx_total, item, bytes, freed);
+	if (context->sx_in_stream)
+		stats_count(&context->sx_stream, item, bytes, freed);
+	if (so != NULL) {
+		so->so_records[drr->drr_type].sr_count++;
+		so->so_records[drr->drr_type].sr_bytes += bytes;
+		so->so_logical += logical;
+		so->so_freed += freed;
+	}
+
+	if (drr->drr_type == DRR_END && context->sx_in_stream)
+		stats_end_stream(context);
+	return (D_OK);
+}
+
+static chain_step_t
+serial_stats_prepare(void)
+{
+	chain_step_t step = {
+		.cs_type = CS_SERIAL,
+		.cs_in_size = sizeof (drr_packet_t),
+		.cs_out_size = sizeof (stats_packet_t),
+		.cs_context = NULL,
+		.cs_serial = {
+			.process = chain_stats_prepare
+		}
+	};
+	return (step);
+}
+
+static chain_step_t
+parallel_stats_analyze(stats_context_t *context)
+{
+	chain_step_t step = {
+		.cs_type = CS_PARALLEL,
+		.cs_in_size = sizeof (stats_packet_t),
+		.cs_out_size = sizeof (stats_packet_t),
+		.cs_context = context,
+		.cs_parallel = {
+			.queue_length = 1024,
+			.batch_budget = 256 * 1024,
+			.process = chain_stats_analyze,
+			.cost = chain_stats_cost
+		}
+	};
+	return (step);
+}
+
+static chain_step_t
+serial_stats_aggregate(stats_context_t *context)
+{
+	chain_step_t step = {
+		.cs_type = CS_SERIAL,
+		.cs_in_size = sizeof (stats_packet_t),
+		.cs_out_size = sizeof (drr_packet_t),
+		.cs_context = context,
+		.cs_serial = {
+			.process = chain_stats_aggregate
+		}
+	};
+	return (step);
+}
+
+int
+zstream_do_stats(int argc, char *argv[])
+{
+	stats_context_t *context = &stats_context;
+	chain_attrs_t attrs = {0};
+	const char *input_file = NULL;
+	const char *estimate = NULL;
+	int level = ZIO_COMPLEVEL_DEFAULT;
+	uint_t num_threads = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, ":c:l:n:t:")) != -1) {
+		switch (c) {
+		case 'c':
+			estimate = optarg;
+			break;
+		case 'l':
+			if (sscanf(optarg, "%d", &level) != 1) {
+				warnx("failed to parse level '%s'", optarg);
+				zstream_usage();
+			}
+			break;
+		case 'n':
+			if (sscanf(optarg, "%llu",
+			    (u_longlong_t *)&context->sx_max_objects) != 1) {
+				warnx("failed to parse object count '%s'",
+				    optarg);
+				zstream_usage();
+			}
+			break;
+		case 't':
+			if (sscanf(optarg, "%u", &num_threads) != 1) {
+				warnx("failed to parse num_threads '%s'",
+				    optarg);
+				zstream_usage();
+			}
+			zstream_queue_set_num_threads(num_threads);
+			break;
+		case ':':
+			warnx("missing argument for '%c' option", optopt);
+			zstream_usage();
+			break;
+		case '?':
+			warnx("invalid option '%c'", optopt);
+			zstream_usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 1)
+		zstream_usage();
+	if (argc == 1)
+		input_file = argv[0];
+
+	context->sx_estimate.cs_type = ZIO_COMPRESS_OFF;
+	context->sx_estimate.cs_level = level;
+	if (estimate != NULL) {
+		enum zio_compress ct;
+		for (ct = 0; ct < ZIO_COMPRESS_FUNCTIONS; ct++) {
+			const char *ci_name = zio_compress_table[ct].ci_name;
+			if (strcmp(estimate, ci_name) == 0)
+				break;
+		}
+		if (ct == ZIO_COMPRESS_FUNCTIONS || ctype_is_uncompressed(ct))
+			errx(2, "invalid compression type %s", estimate);
+		context->sx_estimate.cs_type = ct;
+	}
+	avl_create(&context->sx_objects, stats_object_compare,
+	    sizeof (stats_object_t), offsetof(stats_object_t, so_node));
+
+	zstream_chain_t stats_chain = {
+		STANDARD_INPUT_STACK(input_file),
+		serial_stats_prepare(),
+		parallel_stats_analyze(context),
+		serial_stats_aggregate(context),
+		NULL_OUTPUT_STACK()
+	};
+
+	zstream_chain_exec(stats_chain, &attrs);
+
+	nvlist_t *nvl = fnvlist_alloc();
+	fnvlist_add_nvlist_array(nvl, "streams",
+	    (const nvlist_t **)context->sx_stream_list, context->sx_nstreams);
+	nvlist_t *total = stats_counts_nvl(context, &context->sx_total);
+	fnvlist_add_nvlist(nvl, "total", total);
+	fnvlist_free(total);
+
+	nvlist_print_json(stdout, nvl);
+	(void) printf("\n");
+
+	fnvlist_free(nvl);
+	for (uint_t i = 0; i < context->sx_nstreams; i++)
+		fnvlist_free(context->sx_stream_list[i]);
+	free(context->sx_stream_list);
+	avl_destroy(&context->sx_objects);
+	return (0);
+}
@@ -77,6 +77,7 @@ chain_validate_records(void *item_in, void *context_in)
 	struct drr_object *drro		= &drr->drr_u.drr_object;
 	struct drr_spill *drrs		= &drr->drr_u.drr_spill;
 	struct drr_write_embedded *drrwe = &drr->drr_u.drr_write_embedded;
+	struct drr_write_byref *drrwb	= &drr->drr_u.drr_write_byref;
 	struct drr_free *drrf		= &drr->drr_u.drr_free;
 	struct drr_freeobjects *drrfo	= &drr->drr_u.drr_freeobjects;
 	struct drr_object_range *drror	= &drr->drr_u.drr_object_range;
@@ -135,6 +136,20 @@ chain_validate_records(void *item_in, void *context_in)
 		validate_fail(err, errbuf);
 		break;
 
+	case DRR_WRITE_BYREF:
+		/*
+		 * Streams from the old "zfs send -D" refer to blocks in
+		 * earlier snapshots of the package; only "zstream redup"
+		 * makes sense of those.
+		 */
+		if (validate_stream_has_feature(context,
+		    DMU_BACKUP_FEATURE_DEDUPPROPS))
+			break;
+		err = recv_check_drr_write_byref(drrwb, NULL, is_raw,
+		    context->featureflags, errbuf, sizeof (errbuf));
+		validate_fail(err, errbuf);
+		break;
+
 	case DRR_SPILL:
 		err = recv_check_drr_spill(drrs, NULL, is_raw,
 		    context->featureflags, errbuf, sizeof (errbuf));
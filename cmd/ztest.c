@@ -139,6 +139,8 @@
 #include <libzutil.h>
 #include <sys/crypto/icp.h>
 #include <sys/zfs_impl.h>
+#include <sys/zfs_zero.h>
+#include <sys/zio_compress.h>
 #include <sys/backtrace.h>
 #include <libzpool.h>
 #include <libspl.h>
@@ -448,6 +450,7 @@ ztest_func_t ztest_trim;
 ztest_func_t ztest_blake3;
 ztest_func_t ztest_fletcher;
 ztest_func_t ztest_fletcher_incr;
+ztest_func_t ztest_zero;
 ztest_func_t ztest_verify_dnode_bt;
 ztest_func_t ztest_pool_prefetch_ddt;
 ztest_func_t ztest_ddt_prune;
@@ -507,6 +510,7 @@ static ztest_info_t ztest_info[] = {
 	ZTI_INIT(ztest_blake3, 1, &zopt_rarely),
 	ZTI_INIT(ztest_fletcher, 1, &zopt_rarely),
 	ZTI_INIT(ztest_fletcher_incr, 1, &zopt_rarely),
+	ZTI_INIT(ztest_zero, 1, &zopt_rarely),
 	ZTI_INIT(ztest_verify_dnode_bt, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_pool_prefetch_ddt, 1, &zopt_rarely),
 	ZTI_INIT(ztest_ddt_prune, 1, &zopt_rarely),
@@ -7076,6 +7080,80 @@ ztest_fletcher_incr(ztest_ds_t *zd, uint64_t id)
 	}
 }
 
+/*
+ * Verify that all zero detection and ZLE implementations give the same
+ * results as the scalar ones, on sparse data with runs of zeroes of random
+ * lengths and alignments.
+ */
+void
+ztest_zero(ztest_ds_t *zd, uint64_t id)
+{
+	(void) zd, (void) id;
+	hrtime_t end = gethrtime() + NANOSEC;
+
+	while (gethrtime() <= end) {
+		int run_count = 100;
+		size_t size = ztest_random_blocksize();
+		size_t d_len = size - size / 8;
+		uint8_t *buf = umem_alloc(size, UMEM_NOFAIL);
+		abd_t *abd = abd_alloc(size, B_FALSE);
+		abd_t *zabd = abd_alloc(size, B_FALSE);
+		abd_t *ref = abd_alloc_linear(size, B_FALSE);
+		abd_t *cmp = abd_alloc_linear(size, B_FALSE);
+		abd_t *out = abd_alloc(size, B_FALSE);
+		size_t ref_len, pos = 0;
+
+		while (pos < size) {
+			size_t run = ztest_random(300) + 1;
+			boolean_t zero = ztest_random(2);
+
+			run = MIN(run, size - pos);
+
+			for (size_t i = 0; i < run; i++, pos++) {
+				buf[pos] = (zero || ztest_random(16) == 0) ?
+				    0 : ztest_random(255) + 1;
+			}
+		}
+		abd_copy_from_buf(abd, buf, size);
+		abd_zero(zabd, size);
+
+		VERIFY0(zfs_zero_impl_set("scalar"));
+		ref_len = zfs_zle_compress(abd, ref, size, d_len, 64);
+		if (ref_len < d_len) {
+			VERIFY0(zfs_zle_decompress(ref, out, ref_len, size,
+			    64));
+			VERIFY0(abd_cmp(abd, out));
+		}
+
+		VERIFY0(zfs_zero_impl_set("cycle"));
+		while (run_count-- > 0) {
+			uint64_t off = ztest_random(size / sizeof (uint64_t)) *
+			    sizeof (uint64_t);
+			uint8_t one = 1;
+
+			VERIFY3U(zfs_zle_compress(abd, cmp, size, d_len, 64),
+			    ==, ref_len);
+			if (ref_len < d_len)
+				VERIFY0(memcmp(abd_to_buf(ref),
+				    abd_to_buf(cmp), ref_len));
+
+			VERIFY0(abd_cmp_zero(zabd, size));
+			abd_copy_from_buf_off(zabd, &one, off +
+			    ztest_random(sizeof (uint64_t)), 1);
+			VERIFY3S(abd_cmp_zero(zabd, size), !=, 0);
+			VERIFY0(abd_cmp_zero_off(zabd, 0, off));
+			abd_zero(zabd, size);
+		}
+
+		umem_free(buf, size);
+		abd_free(abd);
+		abd_free(zabd);
+		abd_free(ref);
+		abd_free(cmp);
+		abd_free(out);
+	}
+}
+
 void
 ztest_pool_prefetch_ddt(ztest_ds_t *zd, uint64_t id)
 {
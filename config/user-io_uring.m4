@@ -0,0 +1,26 @@
+dnl # SPDX-License-Identifier: CDDL-1.0
+dnl #
+dnl # Check for the io_uring kernel interface, used by libzpool for file
+dnl # vdev I/O.  Only the kernel header is needed, the system calls are
+dnl # made directly.
+dnl #
+AC_DEFUN([ZFS_AC_CONFIG_USER_IO_URING], [
+	AC_MSG_CHECKING([for io_uring])
+	AC_COMPILE_IFELSE([
+		AC_LANG_PROGRAM([[
+			#include <linux/io_uring.h>
+			#include <sys/syscall.h>
+		]], [[
+			struct io_uring_params p;
+			int op = IORING_OP_READ;
+			int feat = IORING_FEAT_RW_CUR_POS;
+			long nr = __NR_io_uring_setup;
+			(void) p; (void) op; (void) feat; (void) nr;
+		]])
+	], [
+		AC_MSG_RESULT([yes])
+		AC_DEFINE([HAVE_IO_URING], [1], [io_uring is available])
+	], [
+		AC_MSG_RESULT([no])
+	])
+])
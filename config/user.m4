@@ -20,6 +20,7 @@ AC_DEFUN([ZFS_AC_CONFIG_USER], [
 		ZFS_AC_CONFIG_USER_LIBUUID
 		ZFS_AC_CONFIG_USER_LIBBLKID
 		ZFS_AC_CONFIG_USER_STATX
+		ZFS_AC_CONFIG_USER_IO_URING
 		ZFS_AC_CONFIG_USER_MOUNT_SETATTR
 	])
 	ZFS_AC_CONFIG_USER_LIBTIRPC
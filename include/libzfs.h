@@ -815,8 +815,8 @@ typedef struct sendflags {
 	/* if dataset is a clone, do incremental from its origin */
 	boolean_t fromorigin;
 
-	/* field no longer used, maintained for backwards compatibility */
-	boolean_t pad;
+	/* send repeated blocks as references (ie, -D) */
+	boolean_t dedup;
 
 	/* send properties (ie, -p) */
 	boolean_t props;
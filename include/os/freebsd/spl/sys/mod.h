@@ -113,6 +113,9 @@
 #define	fletcher_4_param_set_args(var) \
     CTLTYPE_STRING, NULL, 0, fletcher_4_param, "A"
 
+#define	zfs_zero_param_set_args(var) \
+    CTLTYPE_STRING, NULL, 0, zfs_zero_param, "A"
+
 #define	blake3_param_set_args(var) \
     CTLTYPE_STRING, NULL, 0, blake3_param, "A"
 
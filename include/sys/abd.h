@@ -77,9 +77,17 @@ extern int zfs_abd_scatter_enabled;
  * Allocations and deallocations
  */
 
+/*
+ * NUMA node hint for abd_alloc_node(), meaning no preference.
+ */
+#define	ABD_NODE_ANY	(-1)
+
 __attribute__((malloc))
 abd_t *abd_alloc(size_t, boolean_t);
 __attribute__((malloc))
+abd_t *abd_alloc_node(size_t, boolean_t, int);
+int abd_buf_node(const void *);
+__attribute__((malloc))
 abd_t *abd_alloc_linear(size_t, boolean_t);
 abd_t *abd_alloc_linear_struct(abd_t *, size_t, boolean_t);
 __attribute__((malloc))
@@ -95,7 +95,7 @@ void abd_init_struct(abd_t *);
 abd_t *abd_alloc_struct_impl(size_t);
 abd_t *abd_get_offset_scatter(abd_t *, abd_t *, size_t, size_t);
 void abd_free_struct_impl(abd_t *);
-void abd_alloc_chunks(abd_t *, size_t);
+void abd_alloc_chunks(abd_t *, size_t, int);
 void abd_free_chunks(abd_t *);
 void abd_update_scatter_stats(abd_t *, abd_stats_op_t);
 void abd_update_linear_stats(abd_t *, abd_stats_op_t);
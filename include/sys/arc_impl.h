@@ -631,11 +631,24 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_evict_l2_eligible_mru;
 	kstat_named_t arcstat_evict_l2_ineligible;
 	kstat_named_t arcstat_evict_l2_skip;
+	/*
+	 * Number of times a thread had to block in arc_wait_for_eviction()
+	 * and the total time, in nanoseconds, spent blocked there.
+	 */
+	kstat_named_t arcstat_evict_wait_count;
+	kstat_named_t arcstat_evict_wait_time_ns;
 	kstat_named_t arcstat_hash_elements;
 	kstat_named_t arcstat_hash_elements_max;
 	kstat_named_t arcstat_hash_collisions;
 	kstat_named_t arcstat_hash_chains;
 	kstat_named_t arcstat_hash_chain_max;
+	/*
+	 * Number of hash table lookups which found no header without taking
+	 * the hash lock, and number of lockless lookups which raced with an
+	 * update of the hash chain and were redone with the hash lock held.
+	 */
+	kstat_named_t arcstat_hash_lockless_miss;
+	kstat_named_t arcstat_hash_lockless_retry;
 	kstat_named_t arcstat_meta;
 	kstat_named_t arcstat_pd;
 	kstat_named_t arcstat_pm;
@@ -999,9 +1012,13 @@ typedef struct arc_sums {
 	wmsum_t arcstat_evict_l2_eligible_mru;
 	wmsum_t arcstat_evict_l2_ineligible;
 	wmsum_t arcstat_evict_l2_skip;
+	wmsum_t arcstat_evict_wait_count;
+	wmsum_t arcstat_evict_wait_time_ns;
 	wmsum_t arcstat_hash_elements;
 	wmsum_t arcstat_hash_collisions;
 	wmsum_t arcstat_hash_chains;
+	wmsum_t arcstat_hash_lockless_miss;
+	wmsum_t arcstat_hash_lockless_retry;
 	aggsum_t arcstat_size;
 	wmsum_t arcstat_compressed_size;
 	wmsum_t arcstat_uncompressed_size;
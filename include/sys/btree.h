@@ -119,14 +119,21 @@ struct btree {
 	int32_t			bt_height;
 	uint64_t		bt_num_elems;
 	uint64_t		bt_num_nodes;
+	uint64_t		bt_num_leaves;
 	zfs_btree_hdr_t		*bt_root;
 	zfs_btree_leaf_t	*bt_bulk; // non-null if bulk loading
+	boolean_t		bt_dense; // bulk loading fills leaves
 };
 
 /*
  * Implementation of Shar's algorithm designed to accelerate binary search by
  * eliminating impossible to predict branches.
  *
+ * Without branches the CPU can no longer speculate ahead, so every step
+ * would wait for its load to complete.  Large trees are mostly out of cache,
+ * so each step prefetches both elements the next step may compare against,
+ * overlapping the cache misses of consecutive steps.
+ *
  * For optimality, this should be used to generate the search function in the
  * same file as the comparator  and the comparator should be marked
  * `__attribute__((always_inline) inline` so that the compiler will inline it.
@@ -154,6 +161,11 @@ NAME(zfs_btree_t *tree, uint8_t *buf, uint32_t nelems,			\
 	while (nelems > 1) {						\
 		uint32_t half = nelems / 2;				\
 		nelems -= half;						\
+		if (nelems > 1) {					\
+			/* Both elements the next step may compare */	\
+			__builtin_prefetch(&i[nelems / 2 - 1]);		\
+			__builtin_prefetch(&i[half + nelems / 2 - 1]);	\
+		}							\
 		i += (COMP(&i[half - 1], value) < 0) * half;		\
 	}								\
 									\
@@ -266,6 +278,20 @@ void zfs_btree_remove_idx(zfs_btree_t *, zfs_btree_index_t *);
  */
 ulong_t zfs_btree_numnodes(zfs_btree_t *);
 
+/*
+ * Return the number of bytes allocated for the nodes of the tree.
+ */
+size_t zfs_btree_memory(zfs_btree_t *);
+
+/*
+ * Rebuild the tree with its leaves packed full. Trees built by inserting in
+ * random order settle at around 70% full leaves, so compacting a large tree
+ * that is mostly searched and seldom modified saves close to a third of its
+ * memory. Later inserts split full leaves as usual. Any indices into the tree
+ * are invalidated.
+ */
+void zfs_btree_compact(zfs_btree_t *);
+
 /*
  * Used to destroy any remaining nodes in a tree. The cookie argument should
  * be initialized to NULL before the first call. Returns a node that has been
@@ -331,12 +331,15 @@ typedef struct dmu_buf_impl {
 
 #define	DBUF_HASH_MUTEX(h, idx) \
 	(&(h)->hash_mutexes[(idx) & ((h)->hash_mutex_mask)])
+#define	DBUF_HASH_SEQ(h, idx) \
+	(&(h)->hash_seqs[(idx) & ((h)->hash_mutex_mask)])
 
 typedef struct dbuf_hash_table {
 	uint64_t hash_table_mask;
 	uint64_t hash_mutex_mask;
 	dmu_buf_impl_t **hash_table;
 	kmutex_t *hash_mutexes;
+	uint32_t *hash_seqs;	/* odd while a chain is being updated */
 } dbuf_hash_table_t;
 
 typedef void (*dbuf_prefetch_fn)(void *, uint64_t, uint64_t, boolean_t);
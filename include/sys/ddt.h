@@ -278,6 +278,21 @@ typedef struct {
 	ddt_key_t	ddl_checkpoint;	/* last checkpoint */
 } ddt_log_t;
 
+/*
+ * An entry the next log flush is expected to write back: where it's stored
+ * now (ddfp_otype is DDT_TYPES if nowhere), and which class it will move to.
+ */
+typedef struct {
+	ddt_key_t	ddfp_key;
+	uint8_t		ddfp_otype;
+	uint8_t		ddfp_oclass;
+	uint8_t		ddfp_nclass;
+	boolean_t	ddfp_remove;	/* refcount is zero, no new entry */
+} ddt_flush_prefetch_t;
+
+/* Filter over the keys in the store objects, private to ddt_filter.c */
+typedef struct ddt_filter ddt_filter_t;
+
 /*
  * In-core DDT object. This covers all entries and stats for a the whole pool
  * for a given checksum type.
@@ -306,6 +321,15 @@ typedef struct {
 
 	uint64_t	ddt_flush_force_txg;	/* flush hard before this txg */
 
+	/* Next flush batch, handed to spa_ddt_flush_zthr to prefetch */
+	kmutex_t	ddt_flush_prefetch_lock;
+	ddt_flush_prefetch_t *ddt_flush_prefetch;
+	uint64_t	ddt_flush_prefetch_count;
+
+	/* Built and replaced by spa_ddt_filter_zthr, used by lookups */
+	krwlock_t	ddt_filter_lock;
+	ddt_filter_t	*ddt_filter;
+
 	kstat_t		*ddt_ksp;	/* kstats context */
 
 	/* wmsums for hot-path lookup counters */
@@ -321,6 +345,7 @@ typedef struct {
 	wmsum_t		ddt_kstat_dds_lookup_log_miss;
 	wmsum_t		ddt_kstat_dds_lookup_stored_hit;
 	wmsum_t		ddt_kstat_dds_lookup_stored_miss;
+	wmsum_t		ddt_kstat_dds_lookup_filter_miss;
 
 	enum zio_checksum ddt_checksum;	/* checksum algorithm in use */
 	spa_t		*ddt_spa;	/* pool this ddt is on */
@@ -430,6 +455,8 @@ extern void ddt_create(spa_t *spa);
 extern int ddt_load(spa_t *spa);
 extern void ddt_unload(spa_t *spa);
 extern void ddt_sync(spa_t *spa, uint64_t txg);
+extern void spa_start_ddt_flush_thread(spa_t *spa);
+extern void spa_start_ddt_filter_thread(spa_t *spa);
 
 extern void ddt_walk_init(spa_t *spa, uint64_t txg);
 extern boolean_t ddt_walk_ready(spa_t *spa);
@@ -172,8 +172,8 @@ typedef struct {
 	    const void *phys, size_t psize, dmu_tx_t *tx);
 	int (*ddt_op_remove)(dnode_t *dn, const ddt_key_t *ddk,
 	    dmu_tx_t *tx);
-	int (*ddt_op_walk)(dnode_t *dn, uint64_t *walk, ddt_key_t *ddk,
-	    void *phys, size_t psize);
+	int (*ddt_op_walk)(dnode_t *dn, uint64_t *walk, uint64_t start,
+	    uint64_t end, ddt_key_t *ddk, void *phys, size_t psize);
 	int (*ddt_op_count)(dnode_t *dn, uint64_t *count);
 } ddt_ops_t;
 
@@ -211,6 +211,12 @@ extern void ddt_log_free(ddt_t *ddt);
 extern void ddt_log_init(void);
 extern void ddt_log_fini(void);
 
+extern void ddt_filter_add(ddt_t *ddt, const ddt_key_t *ddk);
+extern boolean_t ddt_filter_contains(ddt_t *ddt, const ddt_key_t *ddk);
+extern void ddt_filter_wakeup(ddt_t *ddt);
+extern void ddt_filter_alloc(ddt_t *ddt);
+extern void ddt_filter_free(ddt_t *ddt);
+
 /*
  * These are only exposed so that zdb can access them. Try not to use them
  * outside of the DDT implementation proper, and if you do, consider moving
@@ -233,6 +239,17 @@ typedef struct ddt_age_histo {
 
 void ddt_prune_walk(spa_t *spa, uint64_t cutoff, ddt_age_histo_t *histogram);
 
+/*
+ * Parallel walk callback.  "shard" identifies the slice of the hash space
+ * being walked; each shard is only ever visited by one thread at a time.
+ */
+typedef int (ddt_walk_cb_t)(ddt_t *ddt, const ddt_lightweight_entry_t *ddlwe,
+    uint_t shard, void *arg);
+
+extern uint_t ddt_walk_parallel_shards(void);
+extern int ddt_walk_parallel(spa_t *spa, ddt_class_t clazz, uint64_t flags,
+    uint_t nshards, ddt_walk_cb_t *cb, void *arg);
+
 #if defined(_KERNEL) || !defined(ZFS_DEBUG)
 #define	ddt_dump_age_histogram(histo, cutoff)	((void)0)
 #else
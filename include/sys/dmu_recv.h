@@ -82,6 +82,15 @@ typedef struct dmu_recv_cookie {
 	zio_cksum_t drc_prev_cksum;
 	/* Sorted list of objects not to issue prefetches for. */
 	objlist_t *drc_ignore_objlist;
+	/*
+	 * The data block size of the last object looked up for prefetching
+	 * the blocks of partial writes, the last of its blocks prefetched,
+	 * and the prefetched bytes the writer thread has not reached yet.
+	 */
+	uint64_t drc_pf_object;
+	uint64_t drc_pf_blksz;
+	uint64_t drc_pf_blkid;
+	uint64_t drc_pf_bytes;
 } dmu_recv_cookie_t;
 
 int dmu_recv_begin(const char *, const char *, dmu_replay_record_t *,
@@ -117,5 +126,7 @@ int recv_check_drr_write(const struct drr_write *, spa_t *, boolean_t raw,
     uint64_t featureflags, char *errbuf, size_t errbuflen);
 int recv_check_drr_write_embedded(const struct drr_write_embedded *, spa_t *,
     boolean_t raw, uint64_t featureflags, char *errbuf, size_t errbuflen);
+int recv_check_drr_write_byref(const struct drr_write_byref *, spa_t *,
+    boolean_t raw, uint64_t featureflags, char *errbuf, size_t errbuflen);
 
 #endif /* _DMU_RECV_H */
@@ -51,7 +51,19 @@ typedef struct zsrange {
 	uint16_t	end;
 } zsrange_t;
 
-#define	ZFETCH_RANGES	9		/* Fits zstream_t into 128 bytes */
+#define	ZFETCH_RANGES	7		/* Fits zstream_t into 128 bytes */
+
+/*
+ * Forward streams track sequential accesses in block numbers.  Reverse and
+ * strided streams track accesses of zs_len blocks which start zs_stride
+ * blocks apart, the first one at zs_origin.  Their zs_blkid and prefetch
+ * positions are indexes into the concatenation of those accesses.
+ */
+typedef enum zstream_type {
+	ZSTREAM_FORWARD,
+	ZSTREAM_REVERSE,
+	ZSTREAM_STRIDED
+} zstream_type_t;
 
 typedef struct zstream {
 	list_node_t	zs_node;	/* link for zf_stream */
@@ -64,8 +76,17 @@ typedef struct zstream {
 	uint64_t	zs_pf_end;	/* data block to prefetch up to */
 	uint64_t	zs_ipf_start;	/* first data block to prefetch L1 */
 	uint64_t	zs_ipf_end;	/* data block to prefetch L1 up to */
-	boolean_t	zs_missed;	/* stream saw cache misses */
-	boolean_t	zs_more;	/* need more distant prefetch */
+	uint8_t		zs_missed;	/* stream saw cache misses */
+	uint8_t		zs_more;	/* need more distant prefetch */
+	uint8_t		zs_type;	/* zstream_type_t of the stream */
+	uint8_t		zs_len;		/* blocks per access */
+	int32_t		zs_stride;	/* blocks between access starts */
+	union {
+		/* first block of the last access, forward streams */
+		uint64_t	zs_last;
+		/* first block of the first access, other streams */
+		uint64_t	zs_origin;
+	};
 	zfs_refcount_t	zs_callers;	/* number of pending callers */
 	/*
 	 * Number of stream references: dnode, callers and pending blocks.
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_EBR_H
+#define	_SYS_EBR_H
+
+#include <sys/zfs_context.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Epoch based reclamation, see ebr.c.
+ */
+typedef struct ebr_slot {
+	uint64_t	es_readers[2];
+	kmutex_t	es_lock;
+	void		*es_retired[2];
+	uint64_t	es_nretired[2];
+} ____cacheline_aligned ebr_slot_t;
+
+typedef struct ebr {
+	ebr_slot_t	*ebr_slots;
+	uint_t		ebr_nslots;
+	size_t		ebr_link;
+	void		(*ebr_free)(void *);
+	kmutex_t	ebr_reclaim_lock;
+	uint64_t	ebr_epoch ____cacheline_aligned;
+} ebr_t;
+
+typedef struct ebr_read {
+	ebr_slot_t	*er_slot;
+	uint_t		er_epoch;
+} ebr_read_t;
+
+void ebr_init(ebr_t *, size_t, void (*)(void *));
+void ebr_fini(ebr_t *);
+void ebr_retire(ebr_t *, void *);
+void ebr_reclaim(ebr_t *);
+
+/*
+ * Start a read-side section.  Objects reachable from the protected structure
+ * will not be freed before the matching ebr_exit().
+ */
+static inline void
+ebr_enter(ebr_t *ebr, ebr_read_t *er)
+{
+	er->er_slot = &ebr->ebr_slots[CPU_SEQID_UNSTABLE % ebr->ebr_nslots];
+	for (;;) {
+		er->er_epoch = atomic_load_64(&ebr->ebr_epoch) & 1;
+		atomic_inc_64(&er->er_slot->es_readers[er->er_epoch]);
+		/* Order the reader count before any load of the structure. */
+		membar_sync();
+		/*
+		 * The epoch may have advanced before we were counted, and a
+		 * reclaim which no longer checks our parity could then free
+		 * what we are about to read.  Only once the epoch is seen
+		 * unchanged after the count is the count a valid one.
+		 */
+		if ((atomic_load_64(&ebr->ebr_epoch) & 1) == er->er_epoch)
+			break;
+		atomic_dec_64(&er->er_slot->es_readers[er->er_epoch]);
+	}
+}
+
+static inline void
+ebr_exit(ebr_read_t *er)
+{
+	membar_sync();
+	atomic_dec_64(&er->er_slot->es_readers[er->er_epoch]);
+}
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _SYS_EBR_H */
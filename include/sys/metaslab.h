@@ -70,6 +70,7 @@ uint64_t metaslab_allocated_space(metaslab_t *);
 void metaslab_sync(metaslab_t *, uint64_t);
 void metaslab_sync_done(metaslab_t *, uint64_t);
 void metaslab_sync_reassess(metaslab_group_t *);
+void metaslab_preload_vdev(vdev_t *);
 uint64_t metaslab_largest_allocatable(metaslab_t *);
 
 /*
@@ -87,6 +88,8 @@ int metaslab_alloc_range(spa_t *, metaslab_class_t *, uint64_t, uint64_t,
     int, const void *, uint64_t *);
 int metaslab_alloc_dva(spa_t *, metaslab_class_t *, uint64_t,
     dva_t *, int, const dva_t *, uint64_t, int, zio_alloc_list_t *, int);
+int metaslab_alloc_batch(spa_t *, metaslab_class_t *, blkptr_t **,
+    const void **, int, uint64_t, int, zio_alloc_list_t *, int);
 void metaslab_free(spa_t *, const blkptr_t *, uint64_t, boolean_t);
 void metaslab_free_concrete(vdev_t *, uint64_t, uint64_t, boolean_t);
 void metaslab_free_dva(spa_t *, const dva_t *, boolean_t);
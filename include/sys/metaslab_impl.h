@@ -487,6 +487,9 @@ struct metaslab {
 
 	uint64_t	ms_alloc_txg;	/* last successful alloc (debug only) */
 	uint64_t	ms_max_size;	/* maximum allocatable size	*/
+	uint64_t	ms_tree_mem;	/* in-core tree bytes, see kstats */
+	uint64_t	ms_compact_mem;	/* tree bytes and segments before */
+	uint64_t	ms_compact_elems; /* compaction, see kstats */
 
 	/*
 	 * -1 if it's not active in an allocator, otherwise set to the allocator
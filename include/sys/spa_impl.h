@@ -387,6 +387,8 @@ struct spa {
 
 	zthr_t		*spa_livelist_delete_zthr; /* deleting livelists */
 	zthr_t		*spa_livelist_condense_zthr; /* condensing livelists */
+	zthr_t		*spa_ddt_flush_zthr;	/* prefetch for DDT log flush */
+	zthr_t		*spa_ddt_filter_zthr;	/* builds DDT store filters */
 	uint64_t	spa_livelists_to_delete; /* set of livelists to free */
 	livelist_condense_entry_t	spa_to_condense; /* next to condense */
 
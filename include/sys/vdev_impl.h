@@ -136,6 +136,22 @@ typedef union vdev_queue_class {
 	avl_tree_t	vqc_tree;
 } vdev_queue_class_t;
 
+/*
+ * Per-class completion latency tracking for the latency-targeting mode of
+ * the I/O scheduler (see zfs_vdev_latency_target_us in vdev_queue.c).
+ */
+#define	VDQ_LAT_BUCKETS	40
+
+typedef struct vdev_queue_lat {
+	uint32_t	vql_hist[VDQ_LAT_BUCKETS]; /* current window */
+	uint32_t	vql_count;	/* samples in current window */
+	uint32_t	vql_limit;	/* adaptive max active I/Os */
+	boolean_t	vql_throttled;	/* hit vql_limit with I/O queued */
+	boolean_t	vql_probing;	/* vql_limit raised for a probe */
+	uint64_t	vql_p99;	/* p99 of last window, in us */
+	uint64_t	vql_probe_lat;	/* latency before the probe, in us */
+} vdev_queue_lat_t;
+
 struct vdev_queue {
 	vdev_t		*vq_vdev;
 	vdev_queue_class_t vq_class[ZIO_PRIORITY_NUM_QUEUEABLE];
@@ -153,6 +169,10 @@ struct vdev_queue {
 	hrtime_t	vq_io_delta_ts;
 	zio_t		vq_io_search; /* used as local for stack reduction */
 	kmutex_t	vq_lock;
+	vdev_queue_lat_t vq_lat[ZIO_PRIORITY_NUM_QUEUEABLE];
+	uint32_t	vq_lat_samples;	/* samples in current window */
+	uint64_t	vq_lat_windows;	/* completed evaluation windows */
+	kstat_t		*vq_ksp;	/* per-vdev scheduler kstat */
 };
 
 /*
@@ -339,6 +359,11 @@ struct vdev {
 	kcondvar_t	vdev_trim_io_cv;
 	uint64_t	vdev_trim_inflight[3];
 
+	/* ZIL cache flush grouping, see zil_lwb_flush_group() */
+	kmutex_t	vdev_zil_flush_lock;
+	boolean_t	vdev_zil_flush_active;	/* group flush in flight */
+	zio_t		*vdev_zil_flush_next;	/* group to issue next */
+
 	/*
 	 * Values stored in the config for an indirect or removing vdev.
 	 */
@@ -476,6 +476,14 @@ int zap_cursor_init_noprefetch(zap_cursor_t *zc, objset_t *os,
     uint64_t zapobj);
 int zap_cursor_init_noprefetch_by_dnode(zap_cursor_t *zc, dnode_t *dn);
 
+/*
+ * Initialize a cursor at the first attribute whose hash is greater than or
+ * equal to "hash", without prefetching the ZAP object.  Used to walk a
+ * slice of the hash space, e.g. to split a large ZAP among several workers.
+ */
+int zap_cursor_init_hash_by_dnode(zap_cursor_t *zc, dnode_t *dn,
+    uint64_t hash);
+
 /*
  * Initialize a zap cursor pointing to the position recorded by
  * zap_cursor_serialize (in the "serialized" argument).  You can also
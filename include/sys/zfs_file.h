@@ -73,4 +73,31 @@ zfs_file_t *zfs_file_get(int fd);
 void zfs_file_put(zfs_file_t *fp);
 void *zfs_file_private(zfs_file_t *fp);
 
+#ifndef _KERNEL
+/*
+ * Asynchronous file I/O through a shared submission ring (io_uring on
+ * Linux).  zfs_file_ring_create() returns NULL when the platform or the
+ * running kernel does not support it, and callers must then fall back to
+ * the synchronous interfaces above.  The done callback is dispatched to the
+ * taskq given to zfs_file_ring_create() with the same error and resid as the
+ * matching synchronous call would have returned.
+ */
+typedef struct zfs_file_ring zfs_file_ring_t;
+typedef void (zfs_file_ring_done_t)(void *arg, int error, ssize_t resid);
+
+zfs_file_ring_t *zfs_file_ring_create(uint_t entries, uint_t nbufs,
+    size_t bufsize, taskq_t *tq);
+void zfs_file_ring_destroy(zfs_file_ring_t *zr);
+void *zfs_file_ring_buf_alloc(zfs_file_ring_t *zr, size_t size, int *bufidx);
+void zfs_file_ring_buf_free(zfs_file_ring_t *zr, int bufidx);
+void zfs_file_ring_pread(zfs_file_ring_t *zr, zfs_file_t *fp, void *buf,
+    int bufidx, size_t len, loff_t off, zfs_file_ring_done_t *done,
+    void *arg);
+void zfs_file_ring_pwrite(zfs_file_ring_t *zr, zfs_file_t *fp,
+    const void *buf, int bufidx, size_t len, loff_t off, uint8_t ashift,
+    zfs_file_ring_done_t *done, void *arg);
+void zfs_file_ring_fsync(zfs_file_ring_t *zr, zfs_file_t *fp,
+    zfs_file_ring_done_t *done, void *arg);
+#endif
+
 #endif /* _SYS_ZFS_FILE_H */
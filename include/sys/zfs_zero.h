@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or https://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_ZFS_ZERO_H
+#define	_SYS_ZFS_ZERO_H
+
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Implementations of the two byte-scanning loops on the write path which
+ * look for zeroes: detection of all-zero blocks (abd_cmp_zero()) and
+ * zero-length encoding (zle.c).  Like fletcher 4 and the RAID-Z math, the
+ * implementation is picked at runtime from the ones the CPU supports.
+ */
+typedef enum zfs_zero_fn {
+	ZFS_ZERO_CHECK = 0,
+	ZFS_ZERO_ZLE,
+	ZFS_ZERO_FN_NUM
+} zfs_zero_fn_t;
+
+/* Returns B_TRUE if all size bytes (a multiple of 8) of buf are zero */
+typedef boolean_t (*zfs_zero_check_f)(const void *buf, size_t size);
+/* Zero-length encoding of s_start; see zle.c for the format */
+typedef size_t (*zfs_zero_zle_f)(const void *s_start, void *d_start,
+    size_t s_len, size_t d_len, int n);
+typedef boolean_t (*zfs_zero_will_work_f)(void);
+
+typedef struct zfs_zero_ops {
+	zfs_zero_check_f	check;
+	zfs_zero_zle_f		zle;
+	zfs_zero_will_work_f	is_supported;
+	boolean_t		uses_fpu;
+	const char		*name;
+} zfs_zero_ops_t;
+
+#if defined(__x86_64)
+extern const zfs_zero_ops_t zfs_zero_sse2_ops;
+extern const zfs_zero_ops_t zfs_zero_avx2_ops;
+extern const zfs_zero_ops_t zfs_zero_avx512bw_ops;
+#endif
+
+void zfs_zero_init(void);
+void zfs_zero_fini(void);
+int zfs_zero_impl_set(const char *);
+
+/*
+ * Returns the implementation of fn to use and, if it needs it, enables use
+ * of the FPU until zfs_zero_ops_end() is called.  Callers bracket a whole
+ * buffer (or ABD) rather than each chunk of it.
+ */
+const zfs_zero_ops_t *zfs_zero_ops_begin(zfs_zero_fn_t fn);
+void zfs_zero_ops_end(const zfs_zero_ops_t *ops);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_ZFS_ZERO_H */
@@ -544,6 +544,14 @@ typedef struct zil_stats {
 	kstat_named_t zil_itx_metaslab_slog_bytes;
 	kstat_named_t zil_itx_metaslab_slog_write;
 	kstat_named_t zil_itx_metaslab_slog_alloc;
+
+	/*
+	 * Number of vdev cache flushes needed by LWB writes, and how many
+	 * of those were satisfied by a flush shared with other LWBs, of
+	 * this or other datasets (see zil_lwb_flush_group()).
+	 */
+	kstat_named_t zil_lwb_flush_count;
+	kstat_named_t zil_lwb_flush_grouped_count;
 } zil_kstat_values_t;
 
 typedef struct zil_sums {
@@ -568,6 +576,8 @@ typedef struct zil_sums {
 	wmsum_t zil_itx_metaslab_slog_bytes;
 	wmsum_t zil_itx_metaslab_slog_write;
 	wmsum_t zil_itx_metaslab_slog_alloc;
+	wmsum_t zil_lwb_flush_count;
+	wmsum_t zil_lwb_flush_grouped_count;
 } zil_sums_t;
 
 #define	ZIL_STAT_INCR(zil, stat, val) \
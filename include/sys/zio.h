@@ -524,6 +524,7 @@ struct zio {
 	void		*io_vsd;
 	const zio_vsd_ops_t *io_vsd_ops;
 	metaslab_class_t *io_metaslab_class;	/* dva throttle class */
+	zio_t		*io_alloc_next;	/* allocation batch, see zio.c */
 
 	enum zio_qstate	io_queue_state;	/* vdev queue state */
 	union {
@@ -760,7 +760,7 @@ typedef struct send_dump_data {
 	uint64_t prevsnap_obj;
 	boolean_t seenfrom, seento, replicate, doall, fromorigin;
 	boolean_t dryrun, parsable, progress, embed_data, std_out;
-	boolean_t large_block, compress, raw, holds;
+	boolean_t large_block, compress, raw, holds, dedup;
 	boolean_t progressastitle;
 	int outfd;
 	boolean_t err;
@@ -1200,6 +1200,8 @@ dump_snapshot(zfs_handle_t *zhp, void *arg)
 		flags |= LZC_SEND_FLAG_COMPRESS;
 	if (sdd->raw)
 		flags |= LZC_SEND_FLAG_RAW;
+	if (sdd->dedup)
+		flags |= LZC_SEND_FLAG_DEDUP;
 
 	if (!sdd->doall && !isfromsnap && !istosnap) {
 		if (sdd->replicate) {
@@ -1620,6 +1622,8 @@ lzc_flags_from_sendflags(const sendflags_t *flags)
 		lzc_flags |= LZC_SEND_FLAG_RAW;
 	if (flags->saved)
 		lzc_flags |= LZC_SEND_FLAG_SAVED;
+	if (flags->dedup)
+		lzc_flags |= LZC_SEND_FLAG_DEDUP;
 
 	return (lzc_flags);
 }
@@ -2432,6 +2436,7 @@ zfs_send_cb_impl(zfs_handle_t *zhp, const char *fromsnap, const char *tosnap,
 	sdd.compress = flags->compress;
 	sdd.raw = flags->raw;
 	sdd.holds = flags->holds;
+	sdd.dedup = flags->dedup;
 	sdd.filter_cb = filter_func;
 	sdd.filter_cb_arg = cb_arg;
 	if (debugnvp)
@@ -4668,8 +4673,13 @@ zfs_receive_one(libzfs_handle_t *hdl, int infd, const char *tosnap,
 			(void) printf("found clone origin %s\n", origin);
 	}
 
+	/*
+	 * Streams from the old "zfs send -D" refer to blocks in other
+	 * snapshots of the package, which we don't support.  Current
+	 * deduplicated streams only refer to blocks in the same stream.
+	 */
 	if ((DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo) &
-	    DMU_BACKUP_FEATURE_DEDUP)) {
+	    DMU_BACKUP_FEATURE_DEDUPPROPS)) {
 		(void) fprintf(stderr,
 		    gettext("ERROR: \"zfs receive\" no longer supports "
 		    "deduplicated send streams.  Use\n"
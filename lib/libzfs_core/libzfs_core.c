@@ -824,6 +824,10 @@ lzc_send_wrapper(int (*func)(int, void *), int orig_fd, void *data)
  * If "flags" contains LZC_SEND_FLAG_RAW, the stream is generated, for encrypted
  * datasets, by sending data exactly as it exists on disk.  This allows backups
  * to be taken even if encryption keys are not currently loaded.
+ *
+ * If "flags" contains LZC_SEND_FLAG_DEDUP, blocks with the same contents as a
+ * block sent earlier in the stream are sent as DRR_WRITE_BYREF records
+ * referring to it.  This has no effect on raw streams.
  */
 int
 lzc_send(const char *snapname, const char *from, int fd,
@@ -885,6 +889,8 @@ lzc_send_resume_redacted_cb_impl(const char *snapname, const char *from, int fd,
 		fnvlist_add_boolean(args, "rawok");
 	if (flags & LZC_SEND_FLAG_SAVED)
 		fnvlist_add_boolean(args, "savedok");
+	if (flags & LZC_SEND_FLAG_DEDUP)
+		fnvlist_add_boolean(args, "dedupok");
 	if (resumeobj != 0 || resumeoff != 0) {
 		fnvlist_add_uint64(args, "resume_object", resumeobj);
 		fnvlist_add_uint64(args, "resume_offset", resumeoff);
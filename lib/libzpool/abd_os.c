@@ -98,8 +98,10 @@ abd_free_struct_impl(abd_t *abd)
 }
 
 void
-abd_alloc_chunks(abd_t *abd, size_t size)
+abd_alloc_chunks(abd_t *abd, size_t size, int node)
 {
+	(void) node;
+
 	/*
 	 * We've already allocated the iovec array; ensure that the wanted size
 	 * actually matches, otherwise the caller has made a mistake somewhere.
@@ -118,6 +120,13 @@ abd_alloc_chunks(abd_t *abd, size_t size)
 	}
 }
 
+int
+abd_buf_node(const void *buf)
+{
+	(void) buf;
+	return (ABD_NODE_ANY);
+}
+
 void
 abd_free_chunks(abd_t *abd)
 {
@@ -418,3 +418,572 @@ zfs_file_put(zfs_file_t *fp)
 	abort();
 	(void) fp;
 }
+
+/*
+ * Asynchronous file I/O ring
+ *
+ * On Linux the ring is a thin io_uring wrapper, talking to the kernel
+ * through the raw system calls so that no extra library is needed.  Any
+ * thread may queue requests.  Requests queued while another thread is in
+ * io_uring_enter() are left for that thread to submit along with its own,
+ * so concurrent submitters are batched into a single system call.  One
+ * completion thread reaps all the completions available each time it
+ * wakes up, without a system call per completion, and dispatches the done
+ * callbacks of the completed requests to the caller's taskq.
+ *
+ * A set of buffers is registered with the kernel up front.  Callers that
+ * would otherwise need a temporary buffer for the I/O, such as for a
+ * scatter ABD, can use one of those to avoid both the allocation and the
+ * per I/O page pinning.
+ *
+ * The number of SQEs in flight is limited to the size of the submission
+ * queue, which is half of the completion queue, so neither can overflow.
+ */
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+typedef struct zfs_file_ring_req {
+	zfs_file_t		*zrr_fp;
+	void			*zrr_buf;
+	size_t			zrr_len;
+	loff_t			zrr_off;
+	uint8_t			zrr_opcode;
+	uint_t			zrr_pending;	/* SQEs not completed yet */
+	size_t			zrr_done;	/* bytes transferred */
+	int			zrr_error;
+	zfs_file_ring_done_t	*zrr_func;
+	void			*zrr_arg;
+	taskq_ent_t		zrr_tqent;
+} zfs_file_ring_req_t;
+
+struct zfs_file_ring {
+	int			zr_fd;
+	kmutex_t		zr_lock;
+	kcondvar_t		zr_cv;
+	uint_t			zr_inflight;	/* SQEs queued, not reaped */
+	uint_t			zr_unsubmitted;	/* SQEs queued, not entered */
+	boolean_t		zr_submitting;
+	kthread_t		*zr_thread;
+	taskq_t			*zr_taskq;	/* runs the done callbacks */
+
+	/* Submission queue, protected by zr_lock */
+	void			*zr_sq_ring;
+	size_t			zr_sq_ring_sz;
+	uint32_t		*zr_sq_tail;
+	uint32_t		*zr_sq_array;
+	uint32_t		zr_sq_mask;
+	uint32_t		zr_sq_entries;
+	struct io_uring_sqe	*zr_sqes;
+	size_t			zr_sqes_sz;
+
+	/* Completion queue, only used by zr_thread */
+	void			*zr_cq_ring;
+	size_t			zr_cq_ring_sz;
+	uint32_t		*zr_cq_head;
+	uint32_t		*zr_cq_tail;
+	uint32_t		zr_cq_mask;
+	struct io_uring_cqe	*zr_cqes;
+
+	/* Registered buffers */
+	kmutex_t		zr_buf_lock;
+	char			*zr_bufs;
+	size_t			zr_bufsize;
+	uint_t			zr_nbufs;
+	int			*zr_buf_free;
+	uint_t			zr_buf_nfree;
+};
+
+static int
+zfs_file_ring_enter(zfs_file_ring_t *zr, uint_t to_submit,
+    uint_t min_complete, uint_t flags)
+{
+	return (syscall(__NR_io_uring_enter, zr->zr_fd, to_submit,
+	    min_complete, flags, NULL, 0));
+}
+
+static void
+zfs_file_ring_done(void *arg)
+{
+	zfs_file_ring_req_t *zrr = arg;
+	ssize_t resid;
+
+#ifdef __linux__
+	/*
+	 * Same as for the synchronous interfaces, this most likely means an
+	 * alignment issue due to O_DIRECT, so we abort() in order to catch
+	 * the offender.
+	 */
+	if (zrr->zrr_error == EINVAL && zrr->zrr_opcode != IORING_OP_FSYNC)
+		abort();
+#endif
+
+	if (zrr->zrr_opcode == IORING_OP_READ ||
+	    zrr->zrr_opcode == IORING_OP_READ_FIXED) {
+		zfs_file_t *fp = zrr->zrr_fp;
+
+		if (zrr->zrr_error == 0 && fp->f_dump_fd != -1) {
+			int status;
+
+			status = pwrite64(fp->f_dump_fd, zrr->zrr_buf,
+			    zrr->zrr_done, zrr->zrr_off);
+			ASSERT(status != -1);
+		}
+	}
+
+	resid = zrr->zrr_len - zrr->zrr_done;
+	zrr->zrr_func(zrr->zrr_arg, zrr->zrr_error, resid);
+	kmem_free(zrr, sizeof (*zrr));
+}
+
+/*
+ * Account for a CQE of the request, and once all of them are reaped hand
+ * the request over to the taskq.  Only called by the completion thread.
+ */
+static void
+zfs_file_ring_complete(zfs_file_ring_t *zr, zfs_file_ring_req_t *zrr,
+    int res)
+{
+	if (res >= 0) {
+		zrr->zrr_done += res;
+	} else if (res != -ECANCELED && zrr->zrr_error == 0) {
+		/*
+		 * -ECANCELED is what a linked SQE gets after a short or
+		 * failed transfer of the previous one, which is reported
+		 * as resid or as the previous SQE's error.
+		 */
+		zrr->zrr_error = -res;
+	}
+
+	if (--zrr->zrr_pending > 0)
+		return;
+
+	taskq_dispatch_ent(zr->zr_taskq, zfs_file_ring_done, zrr, 0,
+	    &zrr->zrr_tqent);
+}
+
+static __attribute__((noreturn)) void
+zfs_file_ring_reap(void *arg)
+{
+	zfs_file_ring_t *zr = arg;
+	boolean_t exiting = B_FALSE;
+
+	for (;;) {
+		uint32_t head = *zr->zr_cq_head;
+		uint32_t tail = atomic_load_32(zr->zr_cq_tail);
+		uint_t n = 0;
+
+		membar_consumer();
+		if (head == tail) {
+			(void) zfs_file_ring_enter(zr, 0, 1,
+			    IORING_ENTER_GETEVENTS);
+			continue;
+		}
+
+		for (; head != tail; head++, n++) {
+			struct io_uring_cqe *cqe =
+			    &zr->zr_cqes[head & zr->zr_cq_mask];
+			zfs_file_ring_req_t *zrr =
+			    (zfs_file_ring_req_t *)(uintptr_t)cqe->user_data;
+
+			/* NULL is the wakeup sent by zfs_file_ring_destroy() */
+			if (zrr != NULL)
+				zfs_file_ring_complete(zr, zrr, cqe->res);
+			else
+				exiting = B_TRUE;
+		}
+		membar_sync();
+		atomic_store_32(zr->zr_cq_head, head);
+
+		/*
+		 * Only exit once the wakeup itself has been reaped, so that
+		 * it is accounted for like any other SQE.
+		 */
+		mutex_enter(&zr->zr_lock);
+		ASSERT3U(zr->zr_inflight, >=, n);
+		zr->zr_inflight -= n;
+		cv_broadcast(&zr->zr_cv);
+		boolean_t done = exiting && zr->zr_inflight == 0;
+		mutex_exit(&zr->zr_lock);
+		if (done)
+			break;
+	}
+
+	thread_exit();
+}
+
+/*
+ * Queue the SQEs, and unless another thread is already submitting, submit
+ * them along with all those queued by other threads in the meantime.
+ */
+static void
+zfs_file_ring_submit(zfs_file_ring_t *zr, const struct io_uring_sqe *sqes,
+    uint_t nsqes)
+{
+	uint32_t tail;
+
+	mutex_enter(&zr->zr_lock);
+	while (zr->zr_inflight + nsqes > zr->zr_sq_entries)
+		cv_wait(&zr->zr_cv, &zr->zr_lock);
+	zr->zr_inflight += nsqes;
+
+	tail = *zr->zr_sq_tail;
+	for (uint_t i = 0; i < nsqes; i++, tail++) {
+		uint32_t idx = tail & zr->zr_sq_mask;
+
+		zr->zr_sqes[idx] = sqes[i];
+		zr->zr_sq_array[idx] = idx;
+	}
+	membar_producer();
+	atomic_store_32(zr->zr_sq_tail, tail);
+
+	zr->zr_unsubmitted += nsqes;
+	if (zr->zr_submitting) {
+		mutex_exit(&zr->zr_lock);
+		return;
+	}
+
+	zr->zr_submitting = B_TRUE;
+	while ((nsqes = zr->zr_unsubmitted) != 0) {
+		int rc;
+
+		mutex_exit(&zr->zr_lock);
+		rc = zfs_file_ring_enter(zr, nsqes, 0, 0);
+		VERIFY(rc >= 0 || errno == EINTR || errno == EAGAIN ||
+		    errno == EBUSY);
+		mutex_enter(&zr->zr_lock);
+		if (rc > 0)
+			zr->zr_unsubmitted -= MIN(rc, nsqes);
+	}
+	zr->zr_submitting = B_FALSE;
+	mutex_exit(&zr->zr_lock);
+}
+
+static zfs_file_ring_req_t *
+zfs_file_ring_req(zfs_file_t *fp, void *buf, size_t len, loff_t off,
+    uint8_t opcode, zfs_file_ring_done_t *done, void *arg)
+{
+	zfs_file_ring_req_t *zrr = kmem_zalloc(sizeof (*zrr), KM_SLEEP);
+
+	zrr->zrr_fp = fp;
+	zrr->zrr_buf = buf;
+	zrr->zrr_len = len;
+	zrr->zrr_off = off;
+	zrr->zrr_opcode = opcode;
+	zrr->zrr_func = done;
+	zrr->zrr_arg = arg;
+	taskq_init_ent(&zrr->zrr_tqent);
+
+	return (zrr);
+}
+
+static void
+zfs_file_ring_prep(struct io_uring_sqe *sqe, zfs_file_ring_req_t *zrr,
+    void *buf, int bufidx, size_t len, loff_t off)
+{
+	memset(sqe, 0, sizeof (*sqe));
+	sqe->opcode = zrr->zrr_opcode;
+	sqe->fd = zrr->zrr_fp->f_fd;
+	sqe->off = off;
+	sqe->addr = (uintptr_t)buf;
+	sqe->len = len;
+	if (bufidx >= 0)
+		sqe->buf_index = bufidx;
+	sqe->user_data = (uintptr_t)zrr;
+	zrr->zrr_pending++;
+}
+
+void
+zfs_file_ring_pread(zfs_file_ring_t *zr, zfs_file_t *fp, void *buf,
+    int bufidx, size_t len, loff_t off, zfs_file_ring_done_t *done,
+    void *arg)
+{
+	struct io_uring_sqe sqe;
+	zfs_file_ring_req_t *zrr = zfs_file_ring_req(fp, buf, len, off,
+	    bufidx >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ, done, arg);
+
+	zfs_file_ring_prep(&sqe, zrr, buf, bufidx, len, off);
+	zfs_file_ring_submit(zr, &sqe, 1);
+}
+
+void
+zfs_file_ring_pwrite(zfs_file_ring_t *zr, zfs_file_t *fp, const void *buf,
+    int bufidx, size_t len, loff_t off, uint8_t ashift,
+    zfs_file_ring_done_t *done, void *arg)
+{
+	struct io_uring_sqe sqes[2];
+	zfs_file_ring_req_t *zrr = zfs_file_ring_req(fp, (void *)buf, len, off,
+	    bufidx >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, done, arg);
+	int sectors = len >> ashift;
+	size_t split = (sectors > 0 ? rand() % sectors : 0) << ashift;
+
+	/*
+	 * Split the write in two like zfs_file_pwrite() does, so that ztest
+	 * still sees partial writes.  The second part is linked to the first
+	 * one, so it is only written once the first one completed.
+	 */
+	if (split == 0) {
+		zfs_file_ring_prep(&sqes[0], zrr, (void *)buf, bufidx, len,
+		    off);
+		zfs_file_ring_submit(zr, sqes, 1);
+		return;
+	}
+	zfs_file_ring_prep(&sqes[0], zrr, (void *)buf, bufidx, split, off);
+	sqes[0].flags |= IOSQE_IO_LINK;
+	zfs_file_ring_prep(&sqes[1], zrr, (char *)buf + split, bufidx,
+	    len - split, off + split);
+	zfs_file_ring_submit(zr, sqes, 2);
+}
+
+void
+zfs_file_ring_fsync(zfs_file_ring_t *zr, zfs_file_t *fp,
+    zfs_file_ring_done_t *done, void *arg)
+{
+	struct io_uring_sqe sqe;
+	zfs_file_ring_req_t *zrr = zfs_file_ring_req(fp, NULL, 0, 0,
+	    IORING_OP_FSYNC, done, arg);
+
+	zfs_file_ring_prep(&sqe, zrr, NULL, -1, 0, 0);
+	zfs_file_ring_submit(zr, &sqe, 1);
+}
+
+/*
+ * Get one of the registered buffers, if one at least size bytes large is
+ * available.  Never blocks.
+ */
+void *
+zfs_file_ring_buf_alloc(zfs_file_ring_t *zr, size_t size, int *bufidx)
+{
+	int idx;
+
+	if (size > zr->zr_bufsize)
+		return (NULL);
+
+	mutex_enter(&zr->zr_buf_lock);
+	if (zr->zr_buf_nfree == 0) {
+		mutex_exit(&zr->zr_buf_lock);
+		return (NULL);
+	}
+	idx = zr->zr_buf_free[--zr->zr_buf_nfree];
+	mutex_exit(&zr->zr_buf_lock);
+
+	*bufidx = idx;
+	return (zr->zr_bufs + idx * zr->zr_bufsize);
+}
+
+void
+zfs_file_ring_buf_free(zfs_file_ring_t *zr, int bufidx)
+{
+	ASSERT3S(bufidx, >=, 0);
+	ASSERT3S(bufidx, <, zr->zr_nbufs);
+
+	mutex_enter(&zr->zr_buf_lock);
+	ASSERT3U(zr->zr_buf_nfree, <, zr->zr_nbufs);
+	zr->zr_buf_free[zr->zr_buf_nfree++] = bufidx;
+	mutex_exit(&zr->zr_buf_lock);
+}
+
+static void
+zfs_file_ring_bufs_init(zfs_file_ring_t *zr, uint_t nbufs, size_t bufsize)
+{
+	struct iovec *iov;
+	char *bufs;
+
+	if (nbufs == 0 || bufsize == 0)
+		return;
+
+	bufs = mmap(NULL, nbufs * bufsize, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (bufs == MAP_FAILED)
+		return;
+
+	iov = kmem_alloc(nbufs * sizeof (struct iovec), KM_SLEEP);
+	for (uint_t i = 0; i < nbufs; i++) {
+		iov[i].iov_base = bufs + i * bufsize;
+		iov[i].iov_len = bufsize;
+	}
+
+	/*
+	 * This may fail on RLIMIT_MEMLOCK, in which case the ring is still
+	 * used, only without registered buffers.
+	 */
+	if (syscall(__NR_io_uring_register, zr->zr_fd,
+	    IORING_REGISTER_BUFFERS, iov, nbufs) != 0) {
+		kmem_free(iov, nbufs * sizeof (struct iovec));
+		(void) munmap(bufs, nbufs * bufsize);
+		return;
+	}
+	kmem_free(iov, nbufs * sizeof (struct iovec));
+
+	zr->zr_bufs = bufs;
+	zr->zr_bufsize = bufsize;
+	zr->zr_nbufs = nbufs;
+	zr->zr_buf_free = kmem_alloc(nbufs * sizeof (int), KM_SLEEP);
+	for (uint_t i = 0; i < nbufs; i++)
+		zr->zr_buf_free[i] = nbufs - 1 - i;
+	zr->zr_buf_nfree = nbufs;
+}
+
+zfs_file_ring_t *
+zfs_file_ring_create(uint_t entries, uint_t nbufs, size_t bufsize,
+    taskq_t *tq)
+{
+	struct io_uring_params p;
+	zfs_file_ring_t *zr;
+	char *sq, *cq;
+	int fd;
+
+	memset(&p, 0, sizeof (p));
+	fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (fd < 0)
+		return (NULL);
+
+	/*
+	 * IORING_OP_READ and IORING_OP_WRITE were added in the same release
+	 * as IORING_FEAT_RW_CUR_POS, so use it to detect them.
+	 */
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+	    !(p.features & IORING_FEAT_RW_CUR_POS)) {
+		(void) close(fd);
+		return (NULL);
+	}
+
+	zr = kmem_zalloc(sizeof (*zr), KM_SLEEP);
+	zr->zr_fd = fd;
+	zr->zr_taskq = tq;
+	zr->zr_sq_ring_sz = MAX(p.sq_off.array + p.sq_entries *
+	    sizeof (uint32_t), p.cq_off.cqes + p.cq_entries *
+	    sizeof (struct io_uring_cqe));
+	zr->zr_sqes_sz = p.sq_entries * sizeof (struct io_uring_sqe);
+
+	sq = mmap(NULL, zr->zr_sq_ring_sz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto fail;
+	zr->zr_sq_ring = zr->zr_cq_ring = cq = sq;
+
+	zr->zr_sqes = mmap(NULL, zr->zr_sqes_sz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (zr->zr_sqes == MAP_FAILED) {
+		(void) munmap(sq, zr->zr_sq_ring_sz);
+		goto fail;
+	}
+
+	zr->zr_sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+	zr->zr_sq_array = (uint32_t *)(sq + p.sq_off.array);
+	zr->zr_sq_mask = *(uint32_t *)(sq + p.sq_off.ring_mask);
+	zr->zr_sq_entries = p.sq_entries;
+	zr->zr_cq_head = (uint32_t *)(cq + p.cq_off.head);
+	zr->zr_cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+	zr->zr_cq_mask = *(uint32_t *)(cq + p.cq_off.ring_mask);
+	zr->zr_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	mutex_init(&zr->zr_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zr->zr_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&zr->zr_buf_lock, NULL, MUTEX_DEFAULT, NULL);
+	zfs_file_ring_bufs_init(zr, nbufs, bufsize);
+
+	zr->zr_thread = thread_create(NULL, 0, zfs_file_ring_reap, zr, 0,
+	    NULL, TS_RUN | TS_JOINABLE, maxclsyspri);
+
+	return (zr);
+
+fail:
+	(void) close(fd);
+	kmem_free(zr, sizeof (*zr));
+	return (NULL);
+}
+
+/*
+ * All requests must have completed.
+ */
+void
+zfs_file_ring_destroy(zfs_file_ring_t *zr)
+{
+	struct io_uring_sqe sqe;
+
+	/* Wake up the completion thread with a NOP to make it exit */
+	memset(&sqe, 0, sizeof (sqe));
+	sqe.opcode = IORING_OP_NOP;
+	zfs_file_ring_submit(zr, &sqe, 1);
+	thread_join(zr->zr_thread);
+
+	ASSERT0(zr->zr_inflight);
+	ASSERT3U(zr->zr_buf_nfree, ==, zr->zr_nbufs);
+	if (zr->zr_nbufs != 0) {
+		kmem_free(zr->zr_buf_free, zr->zr_nbufs * sizeof (int));
+		(void) munmap(zr->zr_bufs, zr->zr_nbufs * zr->zr_bufsize);
+	}
+	(void) munmap(zr->zr_sqes, zr->zr_sqes_sz);
+	(void) munmap(zr->zr_sq_ring, zr->zr_sq_ring_sz);
+	(void) close(zr->zr_fd);
+
+	mutex_destroy(&zr->zr_buf_lock);
+	cv_destroy(&zr->zr_cv);
+	mutex_destroy(&zr->zr_lock);
+	kmem_free(zr, sizeof (*zr));
+}
+
+#else	/* HAVE_IO_URING */
+
+zfs_file_ring_t *
+zfs_file_ring_create(uint_t entries, uint_t nbufs, size_t bufsize,
+    taskq_t *tq)
+{
+	(void) entries, (void) nbufs, (void) bufsize, (void) tq;
+	return (NULL);
+}
+
+void
+zfs_file_ring_destroy(zfs_file_ring_t *zr)
+{
+	(void) zr;
+	abort();
+}
+
+void *
+zfs_file_ring_buf_alloc(zfs_file_ring_t *zr, size_t size, int *bufidx)
+{
+	(void) zr, (void) size, (void) bufidx;
+	abort();
+	return (NULL);
+}
+
+void
+zfs_file_ring_buf_free(zfs_file_ring_t *zr, int bufidx)
+{
+	(void) zr, (void) bufidx;
+	abort();
+}
+
+void
+zfs_file_ring_pread(zfs_file_ring_t *zr, zfs_file_t *fp, void *buf,
+    int bufidx, size_t len, loff_t off, zfs_file_ring_done_t *done,
+    void *arg)
+{
+	(void) zr, (void) fp, (void) buf, (void) bufidx, (void) len;
+	(void) off, (void) done, (void) arg;
+	abort();
+}
+
+void
+zfs_file_ring_pwrite(zfs_file_ring_t *zr, zfs_file_t *fp, const void *buf,
+    int bufidx, size_t len, loff_t off, uint8_t ashift,
+    zfs_file_ring_done_t *done, void *arg)
+{
+	(void) zr, (void) fp, (void) buf, (void) bufidx, (void) len;
+	(void) off, (void) ashift, (void) done, (void) arg;
+	abort();
+}
+
+void
+zfs_file_ring_fsync(zfs_file_ring_t *zr, zfs_file_t *fp,
+    zfs_file_ring_done_t *done, void *arg)
+{
+	(void) zr, (void) fp, (void) done, (void) arg;
+	abort();
+}
+
+#endif	/* HAVE_IO_URING */
@@ -186,10 +186,12 @@ abd_verify_scatter(abd_t *abd)
 }
 
 void
-abd_alloc_chunks(abd_t *abd, size_t size)
+abd_alloc_chunks(abd_t *abd, size_t size, int node)
 {
 	uint_t i, n;
 
+	(void) node;
+
 	n = abd_chunkcnt_for_bytes(size);
 	for (i = 0; i < n; i++) {
 		ABD_SCATTER(abd).abd_chunks[i] =
@@ -197,6 +199,13 @@ abd_alloc_chunks(abd_t *abd, size_t size)
 	}
 }
 
+int
+abd_buf_node(const void *buf)
+{
+	(void) buf;
+	return (ABD_NODE_ANY);
+}
+
 void
 abd_free_chunks(abd_t *abd)
 {
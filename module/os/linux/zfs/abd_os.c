@@ -71,6 +71,12 @@
 #define	ABD_MAX_ORDER	(MAX_PAGE_ORDER)
 #endif
 
+/*
+ * Number of NUMA nodes with their own scatter_node_N_size kstat, pages on
+ * higher numbered nodes are accounted to the last one.
+ */
+#define	ABD_MAX_NODES	16
+
 typedef struct abd_stats {
 	kstat_named_t abdstat_struct_size;
 	kstat_named_t abdstat_linear_cnt;
@@ -83,6 +89,7 @@ typedef struct abd_stats {
 	kstat_named_t abdstat_scatter_page_multi_zone;
 	kstat_named_t abdstat_scatter_page_alloc_retry;
 	kstat_named_t abdstat_scatter_sg_table_retry;
+	kstat_named_t abdstat_scatter_node_size[ABD_MAX_NODES];
 } abd_stats_t;
 
 static abd_stats_t abd_stats = {
@@ -137,6 +144,11 @@ static abd_stats_t abd_stats = {
 	 *  allocate the sg table for an ABD.
 	 */
 	{ "scatter_sg_table_retry",		KSTAT_DATA_UINT64 },
+	/*
+	 * The amount of memory in scatter ABD pages on each NUMA node.  Only
+	 * nodes which exist on the system are reported.
+	 */
+	{ { "scatter_node_N_size",		KSTAT_DATA_UINT64 } },
 };
 
 static struct {
@@ -151,6 +163,7 @@ static struct {
 	wmsum_t abdstat_scatter_page_multi_zone;
 	wmsum_t abdstat_scatter_page_alloc_retry;
 	wmsum_t abdstat_scatter_sg_table_retry;
+	wmsum_t abdstat_scatter_node_size[ABD_MAX_NODES];
 } abd_sums;
 
 #define	abd_for_each_sg(abd, sg, n, i)	\
@@ -180,6 +193,23 @@ static struct {
  */
 static int zfs_abd_scatter_min_size = 512 * 3;
 
+/*
+ * NUMA placement of scatter ABD pages.
+ *
+ * By default pages come from the node of the allocating thread, which for
+ * ARC data filled in by the write pipeline is a zio taskq or txg sync thread
+ * rather than the application that produced the data.  When
+ * zfs_abd_numa_requester is set, callers which know where the data is
+ * consumed pass that node to abd_alloc_node() and the pages are preferably
+ * allocated there.
+ *
+ * When zfs_abd_numa_interleave_metadata is set, metadata ABDs are instead
+ * spread round-robin across all online nodes, since metadata is shared by
+ * all consumers regardless of where they run.
+ */
+static uint_t zfs_abd_numa_requester = 1;
+static uint_t zfs_abd_numa_interleave_metadata = 0;
+
 /*
  * We use a scattered SPA_MAXBLOCKSIZE sized ABD whose pages are
  * just a single zero'd page. This allows us to conserve memory by
@@ -255,8 +285,56 @@ abd_unmark_zfs_page(struct page *page)
 #define	abd_unmark_zfs_page(page)
 #endif /* _LP64 */
 
+static inline int
+abd_node_idx(int nid)
+{
+	return (MIN(nid, ABD_MAX_NODES - 1));
+}
+
+/*
+ * Return the NUMA node of the memory backing the given kernel address.
+ */
+int
+abd_buf_node(const void *buf)
+{
+	struct page *page;
+
+	if (is_vmalloc_addr(buf))
+		page = vmalloc_to_page(buf);
+	else
+		page = virt_to_page(buf);
+
+	return (page != NULL ? page_to_nid(page) : ABD_NODE_ANY);
+}
+
 #ifndef CONFIG_HIGHMEM
 
+/*
+ * Pick the node to allocate the pages of a scatter ABD from, see the
+ * comment above zfs_abd_numa_requester.
+ */
+static int
+abd_alloc_node_select(abd_t *abd, int node)
+{
+	static int abd_numa_rotor = 0;
+
+	if (zfs_abd_numa_interleave_metadata &&
+	    (abd->abd_flags & ABD_FLAG_META)) {
+		int nid = next_node_in(READ_ONCE(abd_numa_rotor),
+		    node_online_map);
+		if (nid >= MAX_NUMNODES)
+			return (NUMA_NO_NODE);
+		WRITE_ONCE(abd_numa_rotor, nid);
+		return (nid);
+	}
+
+	if (zfs_abd_numa_requester && node != ABD_NODE_ANY &&
+	    node < MAX_NUMNODES && node_online(node))
+		return (node);
+
+	return (NUMA_NO_NODE);
+}
+
 /*
  * The goal is to minimize fragmentation by preferentially populating ABDs
  * with higher order compound pages from a single zone.  Allocation size is
@@ -265,7 +343,7 @@ abd_unmark_zfs_page(struct page *page)
  * allocating individual pages and allowing reclaim to satisfy allocations.
  */
 void
-abd_alloc_chunks(abd_t *abd, size_t size)
+abd_alloc_chunks(abd_t *abd, size_t size, int node)
 {
 	struct list_head pages;
 	struct sg_table table;
@@ -278,7 +356,7 @@ abd_alloc_chunks(abd_t *abd, size_t size)
 	unsigned int nr_pages = abd_chunkcnt_for_bytes(size);
 	unsigned int chunks = 0, zones = 0;
 	size_t remaining_size;
-	int nid = NUMA_NO_NODE;
+	int nid = abd_alloc_node_select(abd, node);
 	unsigned int alloc_pages = 0;
 
 	INIT_LIST_HEAD(&pages);
@@ -310,6 +388,8 @@ abd_alloc_chunks(abd_t *abd, size_t size)
 
 		nid = page_to_nid(page);
 		ABDSTAT_BUMP(abdstat_scatter_orders[order]);
+		ABDSTAT_INCR(abdstat_scatter_node_size[abd_node_idx(nid)],
+		    PAGESIZE << order);
 		chunks++;
 		alloc_pages += chunk_pages;
 	}
@@ -388,7 +468,7 @@ abd_alloc_chunks(abd_t *abd, size_t size)
  * number of kernel interfaces.  It's designed for maximum compatibility.
  */
 void
-abd_alloc_chunks(abd_t *abd, size_t size)
+abd_alloc_chunks(abd_t *abd, size_t size, int node)
 {
 	struct scatterlist *sg = NULL;
 	struct sg_table table;
@@ -397,6 +477,8 @@ abd_alloc_chunks(abd_t *abd, size_t size)
 	int nr_pages = abd_chunkcnt_for_bytes(size);
 	int i = 0;
 
+	(void) node;
+
 	while (sg_alloc_table(&table, nr_pages, gfp)) {
 		ABDSTAT_BUMP(abdstat_scatter_sg_table_retry);
 		schedule_timeout_interruptible(1);
@@ -413,6 +495,8 @@ abd_alloc_chunks(abd_t *abd, size_t size)
 		}
 
 		ABDSTAT_BUMP(abdstat_scatter_orders[0]);
+		ABDSTAT_INCR(abdstat_scatter_node_size[
+		    abd_node_idx(page_to_nid(page))], PAGESIZE);
 		sg_set_page(sg, page, PAGESIZE, 0);
 		abd_mark_zfs_page(page);
 	}
@@ -461,6 +545,9 @@ abd_free_chunks(abd_t *abd)
 			page = sg_page(sg);
 			abd_unmark_zfs_page(page);
 			order = compound_order(page);
+			ABDSTAT_INCR(abdstat_scatter_node_size[
+			    abd_node_idx(page_to_nid(page))],
+			    -(int64_t)(PAGESIZE << order));
 			__free_pages(page, order);
 			ASSERT3U(sg->length, <=, PAGE_SIZE << order);
 			ABDSTAT_BUMPDOWN(abdstat_scatter_orders[order]);
@@ -620,6 +707,10 @@ abd_kstats_update(kstat_t *ksp, int rw)
 	    wmsum_value(&abd_sums.abdstat_scatter_page_alloc_retry);
 	as->abdstat_scatter_sg_table_retry.value.ui64 =
 	    wmsum_value(&abd_sums.abdstat_scatter_sg_table_retry);
+	for (int i = 0; i < ABD_MAX_NODES; i++) {
+		as->abdstat_scatter_node_size[i].value.ui64 =
+		    wmsum_value(&abd_sums.abdstat_scatter_node_size[i]);
+	}
 	return (0);
 }
 
@@ -643,9 +734,17 @@ abd_init(void)
 	wmsum_init(&abd_sums.abdstat_scatter_page_multi_zone, 0);
 	wmsum_init(&abd_sums.abdstat_scatter_page_alloc_retry, 0);
 	wmsum_init(&abd_sums.abdstat_scatter_sg_table_retry, 0);
+	for (i = 0; i < ABD_MAX_NODES; i++)
+		wmsum_init(&abd_sums.abdstat_scatter_node_size[i], 0);
 
+	/*
+	 * The per-node entries are last, so only export those for nodes
+	 * which may exist on this system.
+	 */
+	int nodes = MIN(nr_node_ids, ABD_MAX_NODES);
 	abd_ksp = kstat_create("zfs", 0, "abdstats", "misc", KSTAT_TYPE_NAMED,
-	    sizeof (abd_stats) / sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	    sizeof (abd_stats) / sizeof (kstat_named_t) -
+	    (ABD_MAX_NODES - nodes), KSTAT_FLAG_VIRTUAL);
 	if (abd_ksp != NULL) {
 		for (i = 0; i < ABD_MAX_ORDER; i++) {
 			snprintf(abd_stats.abdstat_scatter_orders[i].name,
@@ -653,6 +752,12 @@ abd_init(void)
 			abd_stats.abdstat_scatter_orders[i].data_type =
 			    KSTAT_DATA_UINT64;
 		}
+		for (i = 0; i < ABD_MAX_NODES; i++) {
+			snprintf(abd_stats.abdstat_scatter_node_size[i].name,
+			    KSTAT_STRLEN, "scatter_node_%d_size", i);
+			abd_stats.abdstat_scatter_node_size[i].data_type =
+			    KSTAT_DATA_UINT64;
+		}
 		abd_ksp->ks_data = &abd_stats;
 		abd_ksp->ks_update = abd_kstats_update;
 		kstat_install(abd_ksp);
@@ -683,6 +788,8 @@ abd_fini(void)
 	wmsum_fini(&abd_sums.abdstat_scatter_page_multi_zone);
 	wmsum_fini(&abd_sums.abdstat_scatter_page_alloc_retry);
 	wmsum_fini(&abd_sums.abdstat_scatter_sg_table_retry);
+	for (int i = 0; i < ABD_MAX_NODES; i++)
+		wmsum_fini(&abd_sums.abdstat_scatter_node_size[i]);
 
 	if (abd_cache) {
 		kmem_cache_destroy(abd_cache);
@@ -1222,3 +1329,9 @@ MODULE_PARM_DESC(zfs_abd_scatter_min_size,
 module_param(zfs_abd_scatter_max_order, uint, 0644);
 MODULE_PARM_DESC(zfs_abd_scatter_max_order,
 	"Maximum order allocation used for a scatter ABD.");
+module_param(zfs_abd_numa_requester, uint, 0644);
+MODULE_PARM_DESC(zfs_abd_numa_requester,
+	"Place scatter ABD pages on the NUMA node of the data's consumer.");
+module_param(zfs_abd_numa_interleave_metadata, uint, 0644);
+MODULE_PARM_DESC(zfs_abd_numa_interleave_metadata,
+	"Interleave metadata scatter ABD pages across NUMA nodes.");
@@ -102,6 +102,7 @@
 #include <sys/zio.h>
 #include <sys/zfs_context.h>
 #include <sys/zfs_znode.h>
+#include <sys/zfs_zero.h>
 
 /* see block comment above for description */
 int zfs_abd_scatter_enabled = B_TRUE;
@@ -186,6 +187,18 @@ abd_free_struct(abd_t *abd)
  */
 abd_t *
 abd_alloc(size_t size, boolean_t is_metadata)
+{
+	return (abd_alloc_node(size, is_metadata, ABD_NODE_ANY));
+}
+
+/*
+ * Allocate an ABD like abd_alloc(), preferring to place its scatter pages on
+ * the given NUMA node.  The node is only a hint: the platform may ignore it,
+ * e.g. because of its NUMA placement policy, or fall back to other nodes
+ * when the preferred one is short on memory.
+ */
+abd_t *
+abd_alloc_node(size_t size, boolean_t is_metadata, int node)
 {
 	if (abd_size_alloc_linear(size))
 		return (abd_alloc_linear(size, is_metadata));
@@ -195,11 +208,10 @@ abd_alloc(size_t size, boolean_t is_metadata)
 	abd_t *abd = abd_alloc_struct(size);
 	abd->abd_flags |= ABD_FLAG_OWNER;
 	abd->abd_u.abd_scatter.abd_offset = 0;
-	abd_alloc_chunks(abd, size);
-
 	if (is_metadata) {
 		abd->abd_flags |= ABD_FLAG_META;
 	}
+	abd_alloc_chunks(abd, size, node);
 	abd->abd_size = size;
 
 	abd_update_scatter_stats(abd, ABDSTAT_INCR);
@@ -1057,23 +1069,24 @@ abd_cmp(abd_t *dabd, abd_t *sabd)
 static int
 abd_cmp_zero_off_cb(void *data, size_t len, void *private)
 {
-	(void) private;
+	zfs_zero_check_f *check = private;
 
 	/* This function can only check whole uint64s. Enforce that. */
 	ASSERT0(P2PHASE(len, 8));
 
-	uint64_t *end = (uint64_t *)((char *)data + len);
-	for (uint64_t *word = (uint64_t *)data; word < end; word++)
-		if (*word != 0)
-			return (1);
-
-	return (0);
+	return ((*check)(data, len) ? 0 : 1);
 }
 
 int
 abd_cmp_zero_off(abd_t *abd, size_t off, size_t size)
 {
-	return (abd_iterate_func(abd, off, size, abd_cmp_zero_off_cb, NULL));
+	const zfs_zero_ops_t *ops = zfs_zero_ops_begin(ZFS_ZERO_CHECK);
+	zfs_zero_check_f check = ops->check;
+	int ret = abd_iterate_func(abd, off, size, abd_cmp_zero_off_cb,
+	    &check);
+	zfs_zero_ops_end(ops);
+
+	return (ret);
 }
 
 /*
@@ -103,6 +103,16 @@
  * buf_hash_remove() expects the appropriate hash mutex to be
  * already held before it is invoked.
  *
+ * The hash chains are walked by buf_hash_find() without holding the
+ * hash mutex, and the mutex is only acquired once a matching header
+ * was found.  Such lockless walks are validated against a sequence
+ * number which buf_hash_insert() and buf_hash_remove() bump, and are
+ * redone with the mutex held when they raced with an update.  Since a
+ * lockless walk may still reference a header after it was removed from
+ * the hash table, headers are not freed immediately when destroyed
+ * but retired with buf_hash_retire(), which frees them only once all
+ * lockless walks which may have observed them have finished.
+ *
  * Each ARC state also has a mutex which is used to protect the
  * buffer list associated with the state.  When attempting to
  * obtain a hash table lock while holding an ARC list lock you
@@ -307,6 +317,7 @@
 #include <sys/arc_impl.h>
 #include <sys/trace_zfs.h>
 #include <sys/aggsum.h>
+#include <sys/ebr.h>
 #include <sys/wmsum.h>
 #include <cityhash.h>
 #include <sys/vdev_trim.h>
@@ -340,6 +351,17 @@ static clock_t arc_last_uncached_flush;
 static taskq_t *arc_evict_taskq;
 static struct evict_arg *arc_evict_arg;
 
+/*
+ * Per-worker eviction statistics, exported in the arc_evict_workers kstat.
+ */
+typedef struct arc_evict_worker_stats {
+	uint64_t	evws_evicted;	/* bytes evicted by this worker */
+	uint64_t	evws_stolen;	/* sublists taken from other workers */
+} arc_evict_worker_stats_t;
+
+static arc_evict_worker_stats_t *arc_evict_worker_stats;
+static kstat_t *arc_evict_worker_ksp;
+
 /*
  * Count of bytes evicted since boot.
  */
@@ -377,6 +399,13 @@ static uint_t zfs_arc_evict_batch_limit = 10;
  */
 static uint_t zfs_arc_evict_batches_limit = 5;
 
+/*
+ * Look up headers in the hash table without taking the hash lock first, see
+ * buf_hash_find().  Only read at module load, headers are freed directly
+ * when it is not set.
+ */
+static int zfs_arc_lockless_lookup = 0;
+
 /* number of seconds before growing cache again */
 uint_t arc_grow_retry = 5;
 
@@ -532,11 +561,15 @@ arc_stats_t arc_stats = {
 	{ "evict_l2_eligible_mru",	KSTAT_DATA_UINT64 },
 	{ "evict_l2_ineligible",	KSTAT_DATA_UINT64 },
 	{ "evict_l2_skip",		KSTAT_DATA_UINT64 },
+	{ "evict_wait_count",		KSTAT_DATA_UINT64 },
+	{ "evict_wait_time_ns",		KSTAT_DATA_UINT64 },
 	{ "hash_elements",		KSTAT_DATA_UINT64 },
 	{ "hash_elements_max",		KSTAT_DATA_UINT64 },
 	{ "hash_collisions",		KSTAT_DATA_UINT64 },
 	{ "hash_chains",		KSTAT_DATA_UINT64 },
 	{ "hash_chain_max",		KSTAT_DATA_UINT64 },
+	{ "hash_lockless_miss",		KSTAT_DATA_UINT64 },
+	{ "hash_lockless_retry",	KSTAT_DATA_UINT64 },
 	{ "meta",			KSTAT_DATA_UINT64 },
 	{ "pd",				KSTAT_DATA_UINT64 },
 	{ "pm",				KSTAT_DATA_UINT64 },
@@ -788,6 +821,7 @@ typedef struct buf_hash_table {
 	uint64_t ht_mask;
 	arc_buf_hdr_t **ht_table;
 	kmutex_t ht_locks[BUF_LOCKS] ____cacheline_aligned;
+	uint32_t ht_seqs[BUF_LOCKS] ____cacheline_aligned;
 } buf_hash_table_t;
 
 static buf_hash_table_t buf_hash_table;
@@ -795,6 +829,7 @@ static buf_hash_table_t buf_hash_table;
 #define	BUF_HASH_INDEX(spa, dva, birth) \
 	(buf_hash(spa, dva, birth) & buf_hash_table.ht_mask)
 #define	BUF_HASH_LOCK(idx)	(&buf_hash_table.ht_locks[idx & (BUF_LOCKS-1)])
+#define	BUF_HASH_SEQ(idx)	(&buf_hash_table.ht_seqs[idx & (BUF_LOCKS-1)])
 #define	HDR_LOCK(hdr) \
 	(BUF_HASH_LOCK(BUF_HASH_INDEX(hdr->b_spa, &hdr->b_dva, hdr->b_birth)))
 
@@ -906,7 +941,8 @@ enum arc_hdr_alloc_flags {
 };
 
 
-static abd_t *arc_get_data_abd(arc_buf_hdr_t *, uint64_t, const void *, int);
+static abd_t *arc_get_data_abd(arc_buf_hdr_t *, uint64_t, const void *, int,
+    int);
 static void *arc_get_data_buf(arc_buf_hdr_t *, uint64_t, const void *);
 static void arc_get_data_impl(arc_buf_hdr_t *, uint64_t, const void *, int);
 static void arc_free_data_abd(arc_buf_hdr_t *, abd_t *, uint64_t, const void *);
@@ -915,6 +951,7 @@ static void arc_free_data_impl(arc_buf_hdr_t *hdr, uint64_t size,
     const void *tag);
 static void arc_hdr_free_abd(arc_buf_hdr_t *, boolean_t);
 static void arc_hdr_alloc_abd(arc_buf_hdr_t *, int);
+static void arc_hdr_alloc_abd_node(arc_buf_hdr_t *, int, int);
 static void arc_hdr_destroy(arc_buf_hdr_t *);
 static void arc_access(arc_buf_hdr_t *, arc_flags_t, boolean_t);
 static void arc_buf_watch(arc_buf_t *);
@@ -1060,9 +1097,9 @@ buf_hash(uint64_t spa, const dva_t *dva, uint64_t birth)
 	(HDR_EMPTY(hdr) || MUTEX_HELD(HDR_LOCK(hdr)))
 
 #define	HDR_EQUAL(spa, dva, birth, hdr)				\
-	((hdr)->b_dva.dva_word[0] == (dva)->dva_word[0]) &&	\
+	(((hdr)->b_dva.dva_word[0] == (dva)->dva_word[0]) &&	\
 	((hdr)->b_dva.dva_word[1] == (dva)->dva_word[1]) &&	\
-	((hdr)->b_birth == birth) && ((hdr)->b_spa == spa)
+	((hdr)->b_birth == birth) && ((hdr)->b_spa == spa))
 
 static void
 buf_discard_identity(arc_buf_hdr_t *hdr)
@@ -1073,6 +1110,82 @@ buf_discard_identity(arc_buf_hdr_t *hdr)
 	hdr->b_birth = 0;
 }
 
+/*
+ * Headers removed from the hash table are freed through buf_hash_ebr, so that
+ * lockless hash chain walks never dereference freed memory.
+ */
+static ebr_t buf_hash_ebr;
+
+/*
+ * Writers of the hash chains bracket their updates with these, leaving the
+ * sequence number odd while the update is in progress.  The hash lock must
+ * be held.
+ */
+static inline void
+buf_hash_write_begin(uint64_t idx)
+{
+	uint32_t *seqp = BUF_HASH_SEQ(idx);
+
+	atomic_store_32(seqp, atomic_load_32(seqp) + 1);
+	membar_producer();
+}
+
+static inline void
+buf_hash_write_end(uint64_t idx)
+{
+	uint32_t *seqp = BUF_HASH_SEQ(idx);
+
+	membar_producer();
+	atomic_store_32(seqp, atomic_load_32(seqp) + 1);
+}
+
+/*
+ * Walk the hash chain without holding the hash lock.  Returns B_TRUE when
+ * the walk did not race with an update of the chain, in which case *hdrp is
+ * the matching header, or NULL when there is none, and *seqp the sequence
+ * number for which that answer is valid.  Must be called within an
+ * ebr_enter() and ebr_exit() section of buf_hash_ebr.
+ */
+static boolean_t
+buf_hash_walk_lockless(uint64_t spa, const dva_t *dva, uint64_t birth,
+    uint64_t idx, arc_buf_hdr_t **hdrp, uint32_t *seqp)
+{
+	uint32_t *seqaddr = BUF_HASH_SEQ(idx);
+	uint32_t seq = atomic_load_32(seqaddr);
+	arc_buf_hdr_t *hdr;
+
+	if (seq & 1)
+		return (B_FALSE);
+	membar_consumer();
+
+	hdr = atomic_load_ptr(&buf_hash_table.ht_table[idx]);
+	while (hdr != NULL && !HDR_EQUAL(spa, dva, birth, hdr)) {
+		hdr = atomic_load_ptr(&hdr->b_hash_next);
+		/*
+		 * A header removed behind our back may have been reinserted
+		 * into another chain, bail out as soon as we notice.
+		 */
+		membar_consumer();
+		if (atomic_load_32(seqaddr) != seq)
+			return (B_FALSE);
+	}
+
+	membar_consumer();
+	if (atomic_load_32(seqaddr) != seq)
+		return (B_FALSE);
+
+	*hdrp = hdr;
+	*seqp = seq;
+	return (B_TRUE);
+}
+
+/*
+ * Look up the header for the given block.  The hash chain is first walked
+ * locklessly: if no header is found the lookup completes without ever
+ * taking the hash lock, otherwise the lock is taken and the header returned
+ * if the chain did not change since.  Any lookup which raced with an update
+ * of the chain is redone with the hash lock held.
+ */
 static arc_buf_hdr_t *
 buf_hash_find(uint64_t spa, const blkptr_t *bp, kmutex_t **lockp)
 {
@@ -1082,7 +1195,36 @@ buf_hash_find(uint64_t spa, const blkptr_t *bp, kmutex_t **lockp)
 	kmutex_t *hash_lock = BUF_HASH_LOCK(idx);
 	arc_buf_hdr_t *hdr;
 
-	mutex_enter(hash_lock);
+	if (zfs_arc_lockless_lookup) {
+		ebr_read_t er;
+		boolean_t valid;
+		uint32_t seq;
+
+		ebr_enter(&buf_hash_ebr, &er);
+		valid = buf_hash_walk_lockless(spa, dva, birth, idx, &hdr,
+		    &seq);
+		ebr_exit(&er);
+
+		if (valid && hdr == NULL) {
+			ARCSTAT_BUMP(arcstat_hash_lockless_miss);
+			*lockp = NULL;
+			return (NULL);
+		}
+
+		mutex_enter(hash_lock);
+		/*
+		 * The chain is unchanged, so the header is still in it and
+		 * may be safely dereferenced now that we hold the lock.
+		 */
+		if (valid && atomic_load_32(BUF_HASH_SEQ(idx)) == seq) {
+			*lockp = hash_lock;
+			return (hdr);
+		}
+		ARCSTAT_BUMP(arcstat_hash_lockless_retry);
+	} else {
+		mutex_enter(hash_lock);
+	}
+
 	for (hdr = buf_hash_table.ht_table[idx]; hdr != NULL;
 	    hdr = hdr->b_hash_next) {
 		if (HDR_EQUAL(spa, dva, birth, hdr)) {
@@ -1127,8 +1269,12 @@ buf_hash_insert(arc_buf_hdr_t *hdr, kmutex_t **lockp)
 			return (fhdr);
 	}
 
+	buf_hash_write_begin(idx);
 	hdr->b_hash_next = buf_hash_table.ht_table[idx];
-	buf_hash_table.ht_table[idx] = hdr;
+	/* Lockless walks must see b_hash_next before hdr itself. */
+	membar_producer();
+	atomic_store_ptr(&buf_hash_table.ht_table[idx], hdr);
+	buf_hash_write_end(idx);
 	arc_hdr_set_flags(hdr, ARC_FLAG_IN_HASH_TABLE);
 
 	/* collect some hash table performance data */
@@ -1157,8 +1303,10 @@ buf_hash_remove(arc_buf_hdr_t *hdr)
 		ASSERT3P(fhdr, !=, NULL);
 		hdrp = &fhdr->b_hash_next;
 	}
-	*hdrp = hdr->b_hash_next;
+	buf_hash_write_begin(idx);
+	atomic_store_ptr(hdrp, hdr->b_hash_next);
 	hdr->b_hash_next = NULL;
+	buf_hash_write_end(idx);
 	arc_hdr_clear_flags(hdr, ARC_FLAG_IN_HASH_TABLE);
 
 	/* collect some hash table performance data */
@@ -1176,9 +1324,41 @@ static kmem_cache_t *hdr_full_cache;
 static kmem_cache_t *hdr_l2only_cache;
 static kmem_cache_t *buf_cache;
 
+static void
+buf_hash_free_hdr(void *arg)
+{
+	arc_buf_hdr_t *hdr = arg;
+
+	if (HDR_HAS_L1HDR(hdr))
+		kmem_cache_free(hdr_full_cache, hdr);
+	else
+		kmem_cache_free(hdr_l2only_cache, hdr);
+}
+
+/*
+ * Free a destroyed header once no lockless hash walk can reference it
+ * anymore, or right away when lockless lookups are disabled.  The header
+ * must have been removed from the hash table, and is returned to the cache
+ * matching HDR_HAS_L1HDR().
+ */
+static void
+buf_hash_retire(arc_buf_hdr_t *hdr)
+{
+	ASSERT(!HDR_IN_HASH_TABLE(hdr));
+	ASSERT0P(hdr->b_hash_next);
+
+	if (zfs_arc_lockless_lookup)
+		ebr_retire(&buf_hash_ebr, hdr);
+	else
+		buf_hash_free_hdr(hdr);
+}
+
 static void
 buf_fini(void)
 {
+	/* No lockless walks remain, free all retired headers. */
+	ebr_fini(&buf_hash_ebr);
+
 #if defined(_KERNEL)
 	/*
 	 * Large allocations which do not require contiguous pages
@@ -1330,6 +1510,9 @@ retry:
 
 	for (i = 0; i < BUF_LOCKS; i++)
 		mutex_init(BUF_HASH_LOCK(i), NULL, MUTEX_DEFAULT, NULL);
+
+	ebr_init(&buf_hash_ebr, offsetof(arc_buf_hdr_t, b_hash_next),
+	    buf_hash_free_hdr);
 }
 
 #define	ARC_MINTIME	(hz>>4) /* 62 ms */
@@ -1929,7 +2112,8 @@ arc_hdr_decrypt(arc_buf_hdr_t *hdr, spa_t *spa, const zbookmark_phys_t *zb)
 		 * and then loan a buffer from it, rather than allocating a
 		 * linear buffer and wrapping it in an abd later.
 		 */
-		cabd = arc_get_data_abd(hdr, arc_hdr_size(hdr), hdr, 0);
+		cabd = arc_get_data_abd(hdr, arc_hdr_size(hdr), hdr, 0,
+		    ABD_NODE_ANY);
 
 		ret = zio_decompress_data(HDR_GET_COMPRESS(hdr),
 		    hdr->b_l1hdr.b_pabd, cabd, HDR_GET_PSIZE(hdr),
@@ -3221,8 +3405,12 @@ arc_buf_destroy_impl(arc_buf_t *buf)
 	kmem_cache_free(buf_cache, buf);
 }
 
+/*
+ * Allocate the data of the hdr, preferably on the given NUMA node, which
+ * should be the node where the data is consumed (see abd_alloc_node()).
+ */
 static void
-arc_hdr_alloc_abd(arc_buf_hdr_t *hdr, int alloc_flags)
+arc_hdr_alloc_abd_node(arc_buf_hdr_t *hdr, int alloc_flags, int node)
 {
 	uint64_t size;
 	boolean_t alloc_rdata = ((alloc_flags & ARC_HDR_ALLOC_RDATA) != 0);
@@ -3236,14 +3424,14 @@ arc_hdr_alloc_abd(arc_buf_hdr_t *hdr, int alloc_flags)
 		size = HDR_GET_PSIZE(hdr);
 		ASSERT0P(hdr->b_crypt_hdr.b_rabd);
 		hdr->b_crypt_hdr.b_rabd = arc_get_data_abd(hdr, size, hdr,
-		    alloc_flags);
+		    alloc_flags, node);
 		ASSERT3P(hdr->b_crypt_hdr.b_rabd, !=, NULL);
 		ARCSTAT_INCR(arcstat_raw_size, size);
 	} else {
 		size = arc_hdr_size(hdr);
 		ASSERT0P(hdr->b_l1hdr.b_pabd);
 		hdr->b_l1hdr.b_pabd = arc_get_data_abd(hdr, size, hdr,
-		    alloc_flags);
+		    alloc_flags, node);
 		ASSERT3P(hdr->b_l1hdr.b_pabd, !=, NULL);
 	}
 
@@ -3251,6 +3439,12 @@ arc_hdr_alloc_abd(arc_buf_hdr_t *hdr, int alloc_flags)
 	ARCSTAT_INCR(arcstat_uncompressed_size, HDR_GET_LSIZE(hdr));
 }
 
+static void
+arc_hdr_alloc_abd(arc_buf_hdr_t *hdr, int alloc_flags)
+{
+	arc_hdr_alloc_abd_node(hdr, alloc_flags, ABD_NODE_ANY);
+}
+
 static void
 arc_hdr_free_abd(arc_buf_hdr_t *hdr, boolean_t free_rdata)
 {
@@ -3448,7 +3642,9 @@ arc_hdr_realloc(arc_buf_hdr_t *hdr, kmem_cache_t *old, kmem_cache_t *new)
 	    arc_hdr_size(nhdr), nhdr);
 
 	buf_discard_identity(hdr);
-	kmem_cache_free(old, hdr);
+	ASSERT3P(old, ==, HDR_HAS_L1HDR(hdr) ? hdr_full_cache :
+	    hdr_l2only_cache);
+	buf_hash_retire(hdr);
 
 	return (nhdr);
 }
@@ -3757,10 +3953,8 @@ arc_hdr_destroy(arc_buf_hdr_t *hdr)
 #ifdef ZFS_DEBUG
 		ASSERT0P(hdr->b_l1hdr.b_freeze_cksum);
 #endif
-		kmem_cache_free(hdr_full_cache, hdr);
-	} else {
-		kmem_cache_free(hdr_l2only_cache, hdr);
 	}
+	buf_hash_retire(hdr);
 }
 
 void
@@ -4110,32 +4304,190 @@ arc_state_free_markers(arc_buf_hdr_t **markers, int count)
 	kmem_free(markers, sizeof (*markers) * count);
 }
 
+/*
+ * Parallel eviction splits the sublists of a multilist into one contiguous
+ * range per worker.  Each worker first evicts from the sublists of its own
+ * range, which keeps workers from contending on the same sublist locks, and
+ * then steals the sublists not yet claimed from the ranges of the other
+ * workers, so that a worker landing on densely populated sublists does not
+ * hold up the whole pass.
+ */
+typedef struct evict_pass {
+	multilist_t		*evp_ml;
+	arc_buf_hdr_t		**evp_markers;
+	struct evict_arg	*evp_args;
+	uint64_t		evp_spa;
+	uint64_t		evp_bytes;	/* target for the whole pass */
+	uint64_t		evp_quota;	/* target per sublist */
+	uint64_t		evp_evicted;	/* evicted so far (atomic) */
+	uint_t			evp_nworkers;
+	uint_t			evp_nsublists;
+	uint_t			evp_start;	/* first sublist of range 0 */
+} evict_pass_t;
+
 typedef struct evict_arg {
 	taskq_ent_t		eva_tqent;
-	multilist_t		*eva_ml;
-	arc_buf_hdr_t		*eva_marker;
-	int			eva_idx;
-	uint64_t		eva_spa;
-	uint64_t		eva_bytes;
+	evict_pass_t		*eva_pass;
+	uint_t			eva_worker;
+	uint32_t		eva_next;	/* next sublist to claim */
+	uint32_t		eva_end;	/* end of the worker's range */
 	uint64_t		eva_evicted;
 } evict_arg_t;
 
-static void
-arc_evict_task(void *arg)
+/*
+ * Evict up to the per-sublist quota from the given sublist, processing
+ * multiple batches to amortize taskq dispatch overhead.
+ */
+static uint64_t
+arc_evict_sublist(evict_pass_t *evp, int idx, uint64_t bytes)
 {
-	evict_arg_t *eva = arg;
 	uint64_t total_evicted = 0;
 	boolean_t more;
 	uint_t batches = zfs_arc_evict_batches_limit;
 
-	/* Process multiple batches to amortize taskq dispatch overhead. */
 	do {
-		total_evicted += arc_evict_state_impl(eva->eva_ml,
-		    eva->eva_idx, eva->eva_marker, eva->eva_spa,
-		    eva->eva_bytes - total_evicted, &more);
-	} while (total_evicted < eva->eva_bytes && --batches > 0 && more);
+		total_evicted += arc_evict_state_impl(evp->evp_ml, idx,
+		    evp->evp_markers[idx], evp->evp_spa,
+		    bytes - total_evicted, &more);
+	} while (total_evicted < bytes && --batches > 0 && more);
+
+	return (total_evicted);
+}
+
+static void
+arc_evict_task(void *arg)
+{
+	evict_arg_t *eva = arg;
+	evict_pass_t *evp = eva->eva_pass;
+	uint64_t total_evicted = 0, stolen = 0;
+
+	for (uint_t w = 0; w < evp->evp_nworkers; w++) {
+		evict_arg_t *owner =
+		    &evp->evp_args[(eva->eva_worker + w) % evp->evp_nworkers];
+		uint32_t idx;
+
+		while ((idx = atomic_inc_32_nv(&owner->eva_next) - 1) <
+		    owner->eva_end) {
+			uint64_t done = atomic_load_64(&evp->evp_evicted);
+			if (done >= evp->evp_bytes)
+				goto out;
 
+			uint64_t evicted = arc_evict_sublist(evp,
+			    (evp->evp_start + idx) % evp->evp_nsublists,
+			    MIN(evp->evp_quota, evp->evp_bytes - done));
+			atomic_add_64(&evp->evp_evicted, evicted);
+			total_evicted += evicted;
+			if (owner != eva)
+				stolen++;
+		}
+	}
+out:
 	eva->eva_evicted = total_evicted;
+
+	arc_evict_worker_stats_t *evws =
+	    &arc_evict_worker_stats[eva->eva_worker];
+	atomic_add_64(&evws->evws_evicted, total_evicted);
+	atomic_add_64(&evws->evws_stolen, stolen);
+}
+
+/*
+ * Run one parallel eviction pass over all sublists of the multilist using
+ * ntasks workers, returning the number of bytes evicted.
+ */
+static uint64_t
+arc_evict_state_parallel(evict_arg_t *eva, uint_t ntasks, multilist_t *ml,
+    arc_buf_hdr_t **markers, uint64_t spa, uint64_t bytes, uint64_t quota)
+{
+	evict_pass_t evp;
+	uint_t num_sublists = multilist_get_num_sublists(ml);
+
+	ASSERT3U(ntasks, >=, 2);
+	ASSERT3U(ntasks, <=, MIN(zfs_arc_evict_threads, num_sublists));
+
+	evp.evp_ml = ml;
+	evp.evp_markers = markers;
+	evp.evp_args = eva;
+	evp.evp_spa = spa;
+	evp.evp_bytes = bytes;
+	evp.evp_quota = quota;
+	evp.evp_evicted = 0;
+	evp.evp_nworkers = ntasks;
+	evp.evp_nsublists = num_sublists;
+
+	/*
+	 * Start using a randomly selected sublist, this is to try and evenly
+	 * balance eviction across all sublists.
+	 */
+	evp.evp_start = multilist_get_random_index(ml);
+
+	for (uint_t i = 0; i < ntasks; i++) {
+		eva[i].eva_pass = &evp;
+		eva[i].eva_worker = i;
+		eva[i].eva_next = i * num_sublists / ntasks;
+		eva[i].eva_end = (i + 1) * num_sublists / ntasks;
+		eva[i].eva_evicted = 0;
+	}
+
+	for (uint_t i = 0; i < ntasks; i++) {
+		taskq_dispatch_ent(arc_evict_taskq, arc_evict_task, &eva[i], 0,
+		    &eva[i].eva_tqent);
+	}
+	taskq_wait(arc_evict_taskq);
+
+	return (evp.evp_evicted);
+}
+
+static int
+arc_evict_worker_kstat_update(kstat_t *ksp, int rw)
+{
+	kstat_named_t *ks = ksp->ks_data;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	for (uint_t i = 0; i < zfs_arc_evict_threads; i++) {
+		(ks++)->value.ui64 =
+		    atomic_load_64(&arc_evict_worker_stats[i].evws_evicted);
+		(ks++)->value.ui64 =
+		    atomic_load_64(&arc_evict_worker_stats[i].evws_stolen);
+	}
+
+	return (0);
+}
+
+static void
+arc_evict_worker_kstat_init(void)
+{
+	uint_t ndata = 2 * zfs_arc_evict_threads;
+
+	arc_evict_worker_ksp = kstat_create("zfs", 0, "arc_evict_workers",
+	    "misc", KSTAT_TYPE_NAMED, ndata, KSTAT_FLAG_VIRTUAL);
+	if (arc_evict_worker_ksp != NULL) {
+		kstat_named_t *ks =
+		    kmem_zalloc(ndata * sizeof (kstat_named_t), KM_SLEEP);
+		for (uint_t i = 0; i < zfs_arc_evict_threads; i++) {
+			(void) snprintf(ks[2 * i].name, KSTAT_STRLEN,
+			    "worker_%u_evicted", i);
+			ks[2 * i].data_type = KSTAT_DATA_UINT64;
+			(void) snprintf(ks[2 * i + 1].name, KSTAT_STRLEN,
+			    "worker_%u_stolen", i);
+			ks[2 * i + 1].data_type = KSTAT_DATA_UINT64;
+		}
+		arc_evict_worker_ksp->ks_data = ks;
+		arc_evict_worker_ksp->ks_update = arc_evict_worker_kstat_update;
+		kstat_install(arc_evict_worker_ksp);
+	}
+}
+
+static void
+arc_evict_worker_kstat_fini(void)
+{
+	if (arc_evict_worker_ksp != NULL) {
+		kmem_free(arc_evict_worker_ksp->ks_data,
+		    2 * zfs_arc_evict_threads * sizeof (kstat_named_t));
+		kstat_delete(arc_evict_worker_ksp);
+		arc_evict_worker_ksp = NULL;
+	}
 }
 
 static void
@@ -4166,6 +4518,10 @@ arc_evict_thread_init(void)
 		    TASKQ_PREPOPULATE);
 		arc_evict_arg = kmem_zalloc(
 		    sizeof (evict_arg_t) * zfs_arc_evict_threads, KM_SLEEP);
+		arc_evict_worker_stats = kmem_zalloc(
+		    sizeof (arc_evict_worker_stats_t) * zfs_arc_evict_threads,
+		    KM_SLEEP);
+		arc_evict_worker_kstat_init();
 	}
 }
 
@@ -4231,11 +4587,8 @@ arc_evict_state(arc_state_t *state, arc_buf_contents_t type, uint64_t spa,
 			eva = kmem_alloc(sizeof (evict_arg_t) *
 			    zfs_arc_evict_threads, KM_NOSLEEP);
 		if (eva) {
-			for (int i = 0; i < zfs_arc_evict_threads; i++) {
+			for (int i = 0; i < zfs_arc_evict_threads; i++)
 				taskq_init_ent(&eva[i].eva_tqent);
-				eva[i].eva_ml = ml;
-				eva[i].eva_spa = spa;
-			}
 		} else {
 			/*
 			 * Fall back to the regular single evict if it is not
@@ -4260,56 +4613,54 @@ arc_evict_state(arc_state_t *state, arc_buf_contents_t type, uint64_t spa,
 	 * we're evicting all available buffers.
 	 */
 	while (total_evicted < bytes) {
-		uint64_t evict = MIN_EVICT_SIZE;
-		uint_t ntasks = zfs_arc_evict_threads;
-
 		if (use_evcttq) {
-			if (sublists_left < ntasks)
-				ntasks = sublists_left;
+			uint64_t left = bytes - total_evicted;
+			uint_t ntasks =
+			    MIN(zfs_arc_evict_threads, num_sublists);
+			uint64_t evict = bytes;
 
-			if (ntasks < 2)
-				use_evcttq = B_FALSE;
-		}
+			if (bytes != ARC_EVICT_ALL) {
+				if (left < ntasks * MIN_EVICT_SIZE)
+					ntasks = left / MIN_EVICT_SIZE;
+				evict = DIV_ROUND_UP(left, MAX(ntasks, 1));
+			}
 
-		if (use_evcttq) {
-			uint64_t left = bytes - total_evicted;
+			if (ntasks >= 2) {
+				scan_evicted = arc_evict_state_parallel(eva,
+				    ntasks, ml, markers, spa,
+				    bytes == ARC_EVICT_ALL ? bytes : left,
+				    evict);
+				total_evicted += scan_evicted;
 
-			if (bytes == ARC_EVICT_ALL) {
-				evict = bytes;
-			} else if (left >= ntasks * MIN_EVICT_SIZE) {
-				evict = DIV_ROUND_UP(left, ntasks);
-			} else {
-				ntasks = left / MIN_EVICT_SIZE;
-				if (ntasks < 2)
-					use_evcttq = B_FALSE;
-				else
-					evict = DIV_ROUND_UP(left, ntasks);
+				/*
+				 * Every pass visits all sublists, so if it
+				 * didn't evict anything another one won't
+				 * either.
+				 */
+				if (scan_evicted == 0) {
+					if (bytes != ARC_EVICT_ALL)
+						ARCSTAT_BUMP(
+						    arcstat_evict_not_enough);
+					break;
+				}
+				continue;
 			}
+
+			/*
+			 * Too little is left to be worth spreading across
+			 * the workers, finish the job in this thread.
+			 */
+			use_evcttq = B_FALSE;
+			scan_evicted = 0;
 		}
 
-		for (int i = 0; sublists_left > 0; i++, sublist_idx++,
-		    sublists_left--) {
+		for (; sublists_left > 0; sublist_idx++, sublists_left--) {
 			uint64_t bytes_evicted;
 
 			/* we've reached the end, wrap to the beginning */
 			if (sublist_idx >= num_sublists)
 				sublist_idx = 0;
 
-			if (use_evcttq) {
-				if (i == ntasks)
-					break;
-
-				eva[i].eva_marker = markers[sublist_idx];
-				eva[i].eva_idx = sublist_idx;
-				eva[i].eva_bytes = evict;
-
-				taskq_dispatch_ent(arc_evict_taskq,
-				    arc_evict_task, &eva[i], 0,
-				    &eva[i].eva_tqent);
-
-				continue;
-			}
-
 			bytes_evicted = arc_evict_state_impl(ml, sublist_idx,
 			    markers[sublist_idx], spa, bytes - total_evicted,
 			    NULL);
@@ -4323,15 +4674,6 @@ arc_evict_state(arc_state_t *state, arc_buf_contents_t type, uint64_t spa,
 				break;
 		}
 
-		if (use_evcttq) {
-			taskq_wait(arc_evict_taskq);
-
-			for (int i = 0; i < ntasks; i++) {
-				scan_evicted += eva[i].eva_evicted;
-				total_evicted += eva[i].eva_evicted;
-			}
-		}
-
 		/*
 		 * If we scanned all sublists and didn't evict anything, we
 		 * have no reason to believe we'll evict more during another
@@ -4844,6 +5186,11 @@ arc_kmem_reap_soon(void)
 		}
 	}
 	kmem_cache_reap_now(buf_cache);
+	/*
+	 * Give headers retired in the previous epoch back to their caches
+	 * before reaping those.
+	 */
+	ebr_reclaim(&buf_hash_ebr);
 	kmem_cache_reap_now(hdr_full_cache);
 	kmem_cache_reap_now(hdr_l2only_cache);
 	kmem_cache_reap_now(zfs_btree_leaf_cache);
@@ -5161,7 +5508,7 @@ arc_is_overflowing(boolean_t lax, boolean_t use_reserve)
 
 static abd_t *
 arc_get_data_abd(arc_buf_hdr_t *hdr, uint64_t size, const void *tag,
-    int alloc_flags)
+    int alloc_flags, int node)
 {
 	arc_buf_contents_t type = arc_buf_type(hdr);
 
@@ -5169,7 +5516,7 @@ arc_get_data_abd(arc_buf_hdr_t *hdr, uint64_t size, const void *tag,
 	if (alloc_flags & ARC_HDR_ALLOC_LINEAR)
 		return (abd_alloc_linear(size, type == ARC_BUFC_METADATA));
 	else
-		return (abd_alloc(size, type == ARC_BUFC_METADATA));
+		return (abd_alloc_node(size, type == ARC_BUFC_METADATA, node));
 }
 
 static void *
@@ -5256,11 +5603,15 @@ arc_wait_for_eviction(uint64_t amount, boolean_t lax, boolean_t use_reserve)
 		 * eviction completes.
 		 * In case of "false" wakeup, we will still be on the list.
 		 */
+		hrtime_t start = gethrtime();
 		do {
 			cv_wait(&aw.aew_cv, &arc_evict_lock);
 		} while (list_link_active(&aw.aew_node));
 		mutex_exit(&arc_evict_lock);
 
+		ARCSTAT_BUMP(arcstat_evict_wait_count);
+		ARCSTAT_INCR(arcstat_evict_wait_time_ns, gethrtime() - start);
+
 		cv_destroy(&aw.aew_cv);
 	}
 	}
@@ -6957,6 +7308,12 @@ arc_write_ready(zio_t *zio)
 	if (zio->io_error != 0 || psize == 0)
 		goto out;
 
+	/*
+	 * The hdr data is filled in from the zio or txg sync thread, place it
+	 * on the NUMA node of the buffer written by the consumer instead.
+	 */
+	int node = abd_buf_node(buf->b_data);
+
 	/*
 	 * Fill the hdr with data. If the buffer is encrypted we have no choice
 	 * but to copy the data into b_radb. If the hdr is compressed, the data
@@ -6974,8 +7331,8 @@ arc_write_ready(zio_t *zio)
 	if (ARC_BUF_ENCRYPTED(buf)) {
 		ASSERT3U(psize, >, 0);
 		ASSERT(ARC_BUF_COMPRESSED(buf));
-		arc_hdr_alloc_abd(hdr, ARC_HDR_ALLOC_RDATA |
-		    ARC_HDR_USE_RESERVE);
+		arc_hdr_alloc_abd_node(hdr, ARC_HDR_ALLOC_RDATA |
+		    ARC_HDR_USE_RESERVE, node);
 		abd_copy(hdr->b_crypt_hdr.b_rabd, zio->io_abd, psize);
 	} else if (!(HDR_UNCACHED(hdr) ||
 	    abd_size_alloc_linear(arc_buf_size(buf))) ||
@@ -6987,17 +7344,17 @@ arc_write_ready(zio_t *zio)
 		 */
 		if (BP_IS_ENCRYPTED(bp)) {
 			ASSERT3U(psize, >, 0);
-			arc_hdr_alloc_abd(hdr, ARC_HDR_ALLOC_RDATA |
-			    ARC_HDR_USE_RESERVE);
+			arc_hdr_alloc_abd_node(hdr, ARC_HDR_ALLOC_RDATA |
+			    ARC_HDR_USE_RESERVE, node);
 			abd_copy(hdr->b_crypt_hdr.b_rabd, zio->io_abd, psize);
 		} else if (arc_hdr_get_compress(hdr) != ZIO_COMPRESS_OFF &&
 		    !ARC_BUF_COMPRESSED(buf)) {
 			ASSERT3U(psize, >, 0);
-			arc_hdr_alloc_abd(hdr, ARC_HDR_USE_RESERVE);
+			arc_hdr_alloc_abd_node(hdr, ARC_HDR_USE_RESERVE, node);
 			abd_copy(hdr->b_l1hdr.b_pabd, zio->io_abd, psize);
 		} else {
 			ASSERT3U(zio->io_orig_size, ==, arc_hdr_size(hdr));
-			arc_hdr_alloc_abd(hdr, ARC_HDR_USE_RESERVE);
+			arc_hdr_alloc_abd_node(hdr, ARC_HDR_USE_RESERVE, node);
 			abd_copy_from_buf(hdr->b_l1hdr.b_pabd, buf->b_data,
 			    arc_buf_size(buf));
 		}
@@ -7385,6 +7742,10 @@ arc_kstat_update(kstat_t *ksp, int rw)
 	    wmsum_value(&arc_sums.arcstat_evict_l2_ineligible);
 	as->arcstat_evict_l2_skip.value.ui64 =
 	    wmsum_value(&arc_sums.arcstat_evict_l2_skip);
+	as->arcstat_evict_wait_count.value.ui64 =
+	    wmsum_value(&arc_sums.arcstat_evict_wait_count);
+	as->arcstat_evict_wait_time_ns.value.ui64 =
+	    wmsum_value(&arc_sums.arcstat_evict_wait_time_ns);
 	as->arcstat_hash_elements.value.ui64 =
 	    as->arcstat_hash_elements_max.value.ui64 =
 	    wmsum_value(&arc_sums.arcstat_hash_elements);
@@ -7392,6 +7753,10 @@ arc_kstat_update(kstat_t *ksp, int rw)
 	    wmsum_value(&arc_sums.arcstat_hash_collisions);
 	as->arcstat_hash_chains.value.ui64 =
 	    wmsum_value(&arc_sums.arcstat_hash_chains);
+	as->arcstat_hash_lockless_miss.value.ui64 =
+	    wmsum_value(&arc_sums.arcstat_hash_lockless_miss);
+	as->arcstat_hash_lockless_retry.value.ui64 =
+	    wmsum_value(&arc_sums.arcstat_hash_lockless_retry);
 	as->arcstat_size.value.ui64 =
 	    aggsum_value(&arc_sums.arcstat_size);
 	as->arcstat_compressed_size.value.ui64 =
@@ -7814,9 +8179,13 @@ arc_state_init(void)
 	wmsum_init(&arc_sums.arcstat_evict_l2_eligible_mru, 0);
 	wmsum_init(&arc_sums.arcstat_evict_l2_ineligible, 0);
 	wmsum_init(&arc_sums.arcstat_evict_l2_skip, 0);
+	wmsum_init(&arc_sums.arcstat_evict_wait_count, 0);
+	wmsum_init(&arc_sums.arcstat_evict_wait_time_ns, 0);
 	wmsum_init(&arc_sums.arcstat_hash_elements, 0);
 	wmsum_init(&arc_sums.arcstat_hash_collisions, 0);
 	wmsum_init(&arc_sums.arcstat_hash_chains, 0);
+	wmsum_init(&arc_sums.arcstat_hash_lockless_miss, 0);
+	wmsum_init(&arc_sums.arcstat_hash_lockless_retry, 0);
 	aggsum_init(&arc_sums.arcstat_size, 0);
 	wmsum_init(&arc_sums.arcstat_compressed_size, 0);
 	wmsum_init(&arc_sums.arcstat_uncompressed_size, 0);
@@ -7973,9 +8342,13 @@ arc_state_fini(void)
 	wmsum_fini(&arc_sums.arcstat_evict_l2_eligible_mru);
 	wmsum_fini(&arc_sums.arcstat_evict_l2_ineligible);
 	wmsum_fini(&arc_sums.arcstat_evict_l2_skip);
+	wmsum_fini(&arc_sums.arcstat_evict_wait_count);
+	wmsum_fini(&arc_sums.arcstat_evict_wait_time_ns);
 	wmsum_fini(&arc_sums.arcstat_hash_elements);
 	wmsum_fini(&arc_sums.arcstat_hash_collisions);
 	wmsum_fini(&arc_sums.arcstat_hash_chains);
+	wmsum_fini(&arc_sums.arcstat_hash_lockless_miss);
+	wmsum_fini(&arc_sums.arcstat_hash_lockless_retry);
 	aggsum_fini(&arc_sums.arcstat_size);
 	wmsum_fini(&arc_sums.arcstat_compressed_size);
 	wmsum_fini(&arc_sums.arcstat_uncompressed_size);
@@ -8262,6 +8635,9 @@ arc_fini(void)
 		taskq_destroy(arc_evict_taskq);
 		kmem_free(arc_evict_arg,
 		    sizeof (evict_arg_t) * zfs_arc_evict_threads);
+		arc_evict_worker_kstat_fini();
+		kmem_free(arc_evict_worker_stats,
+		    sizeof (arc_evict_worker_stats_t) * zfs_arc_evict_threads);
 	}
 
 	mutex_destroy(&arc_evict_lock);
@@ -8835,7 +9211,7 @@ l2arc_untransform(zio_t *zio, l2arc_read_callback_t *cb)
 	 */
 	if (BP_IS_ENCRYPTED(bp)) {
 		abd_t *eabd = arc_get_data_abd(hdr, arc_hdr_size(hdr), hdr,
-		    ARC_HDR_USE_RESERVE);
+		    ARC_HDR_USE_RESERVE, ABD_NODE_ANY);
 
 		zio_crypt_decode_params_bp(bp, salt, iv);
 		zio_crypt_decode_mac_bp(bp, mac);
@@ -8872,7 +9248,7 @@ l2arc_untransform(zio_t *zio, l2arc_read_callback_t *cb)
 	if (HDR_GET_COMPRESS(hdr) != ZIO_COMPRESS_OFF &&
 	    !HDR_COMPRESSION_ENABLED(hdr)) {
 		abd_t *cabd = arc_get_data_abd(hdr, arc_hdr_size(hdr), hdr,
-		    ARC_HDR_USE_RESERVE);
+		    ARC_HDR_USE_RESERVE, ABD_NODE_ANY);
 
 		ret = zio_decompress_data(HDR_GET_COMPRESS(hdr),
 		    hdr->b_l1hdr.b_pabd, cabd, HDR_GET_PSIZE(hdr),
@@ -11843,3 +12219,6 @@ ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, prune_task_threads, INT, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, evict_threads, UINT, ZMOD_RD,
 	"Number of threads to use for ARC eviction.");
+
+ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, lockless_lookup, INT, ZMOD_RD,
+	"Look up ARC headers without taking the hash lock first");
@@ -187,6 +187,7 @@ zfs_btree_fini(void)
 static void *
 zfs_btree_leaf_alloc(zfs_btree_t *tree)
 {
+	tree->bt_num_leaves++;
 	if (tree->bt_leaf_size == BTREE_LEAF_SIZE)
 		return (kmem_cache_alloc(zfs_btree_leaf_cache, KM_SLEEP));
 	else
@@ -196,6 +197,7 @@ zfs_btree_leaf_alloc(zfs_btree_t *tree)
 static void
 zfs_btree_leaf_free(zfs_btree_t *tree, void *ptr)
 {
+	tree->bt_num_leaves--;
 	if (tree->bt_leaf_size == BTREE_LEAF_SIZE)
 		return (kmem_cache_free(zfs_btree_leaf_cache, ptr));
 	else
@@ -851,8 +853,13 @@ zfs_btree_insert_into_leaf(zfs_btree_t *tree, zfs_btree_leaf_t *leaf,
 	 *
 	 * In either case, we're left with one extra element. The leftover
 	 * element will become the new dividing element between the two nodes.
+	 *
+	 * When compacting (bt_dense) we keep the old leaf full and start the
+	 * new leaf with only the value being appended.
 	 */
 	uint32_t move_count = MAX(capacity / (tree->bt_bulk ? 4 : 2), 1) - 1;
+	if (tree->bt_bulk != NULL && tree->bt_dense && idx == capacity)
+		move_count = 0;
 	uint32_t keep_count = capacity - move_count - 1;
 	ASSERT3U(keep_count, >=, 1);
 	/* If we insert on left. move one more to keep leaves balanced.  */
@@ -1952,10 +1959,58 @@ zfs_btree_clear(zfs_btree_t *tree)
 	tree->bt_num_elems = 0;
 	tree->bt_root = NULL;
 	tree->bt_num_nodes = 0;
+	tree->bt_num_leaves = 0;
 	tree->bt_height = -1;
 	tree->bt_bulk = NULL;
 }
 
+size_t
+zfs_btree_memory(zfs_btree_t *tree)
+{
+	uint64_t cores = tree->bt_num_nodes - tree->bt_num_leaves;
+
+	return (tree->bt_num_leaves * tree->bt_leaf_size +
+	    cores * (sizeof (zfs_btree_core_t) +
+	    BTREE_CORE_ELEMS * tree->bt_elem_size));
+}
+
+void
+zfs_btree_compact(zfs_btree_t *tree)
+{
+	/* A lone root leaf can't be packed any tighter. */
+	if (tree->bt_height < 1)
+		return;
+
+	zfs_btree_t new;
+	zfs_btree_create_custom(&new, tree->bt_compar, tree->bt_find_in_buf,
+	    tree->bt_elem_size, tree->bt_leaf_size);
+	new.bt_dense = B_TRUE;
+
+	/*
+	 * Move the elements over in order, so that every insert is an append
+	 * to the bulk leaf. Destroying the old tree as we go frees each of its
+	 * nodes once we're past it, which bounds the extra memory needed.
+	 */
+	zfs_btree_index_t *cookie = NULL;
+	zfs_btree_index_t where = {0};
+	void *value;
+	while ((value = zfs_btree_destroy_nodes(tree, &cookie)) != NULL) {
+		if (zfs_btree_last(&new, &where) != NULL) {
+			where.bti_offset++;
+			where.bti_before = B_TRUE;
+		}
+		zfs_btree_add_idx(&new, value, &where);
+	}
+	ASSERT0(tree->bt_num_nodes);
+	ASSERT0(tree->bt_num_leaves);
+
+	if (new.bt_bulk != NULL)
+		zfs_btree_bulk_finish(&new);
+	new.bt_dense = B_FALSE;
+
+	*tree = new;
+}
+
 void
 zfs_btree_destroy(zfs_btree_t *tree)
 {
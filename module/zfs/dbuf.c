@@ -51,6 +51,7 @@
 #include <sys/trace_zfs.h>
 #include <sys/callb.h>
 #include <sys/abd.h>
+#include <sys/ebr.h>
 #include <sys/brt.h>
 #include <sys/vdev.h>
 #include <cityhash.h>
@@ -88,6 +89,14 @@ typedef struct dbuf_stats {
 	 */
 	kstat_named_t hash_hits;
 	kstat_named_t hash_misses;
+	/*
+	 * Lookups which completed without taking the hash mutex, and
+	 * lookups which raced with a hash chain update and were redone
+	 * with the mutex held.
+	 */
+	kstat_named_t hash_lockless_hits;
+	kstat_named_t hash_lockless_misses;
+	kstat_named_t hash_lockless_retries;
 	kstat_named_t hash_collisions;
 	kstat_named_t hash_elements;
 	/*
@@ -132,6 +141,9 @@ dbuf_stats_t dbuf_stats = {
 	{ { "cache_levels_bytes_N",		KSTAT_DATA_UINT64 } },
 	{ "hash_hits",				KSTAT_DATA_UINT64 },
 	{ "hash_misses",			KSTAT_DATA_UINT64 },
+	{ "hash_lockless_hits",			KSTAT_DATA_UINT64 },
+	{ "hash_lockless_misses",		KSTAT_DATA_UINT64 },
+	{ "hash_lockless_retries",		KSTAT_DATA_UINT64 },
 	{ "hash_collisions",			KSTAT_DATA_UINT64 },
 	{ "hash_elements",			KSTAT_DATA_UINT64 },
 	{ "hash_chains",			KSTAT_DATA_UINT64 },
@@ -152,6 +164,9 @@ struct {
 	wmsum_t cache_levels_bytes[DN_MAX_LEVELS];
 	wmsum_t hash_hits;
 	wmsum_t hash_misses;
+	wmsum_t hash_lockless_hits;
+	wmsum_t hash_lockless_misses;
+	wmsum_t hash_lockless_retries;
 	wmsum_t hash_collisions;
 	wmsum_t hash_elements;
 	wmsum_t hash_chains;
@@ -238,6 +253,12 @@ static uint_t dbuf_metadata_cache_shift = 6;
 /* Set the dbuf hash mutex count as log2 shift (dynamic by default) */
 static uint_t dbuf_mutex_cache_shift = 0;
 
+/*
+ * Walk the dbuf hash chains without holding the hash mutex in dbuf_find().
+ * Only read at module load, dbufs are freed directly when it is not set.
+ */
+static int dbuf_lockless_lookup = 0;
+
 static unsigned long dbuf_cache_target_bytes(void);
 static unsigned long dbuf_metadata_cache_target_bytes(void);
 
@@ -314,11 +335,23 @@ dbuf_dest(void *vdb, void *unused)
 	zfs_refcount_destroy(&db->db_holds);
 }
 
+static void
+dbuf_hash_free(void *vdb)
+{
+	kmem_cache_free(dbuf_kmem_cache, vdb);
+}
+
 /*
  * dbuf hash table routines
  */
 static dbuf_hash_table_t dbuf_hash_table;
 
+/*
+ * Dbufs removed from the hash table are freed through dbuf_hash_ebr, so that
+ * lockless lookups never dereference freed memory.
+ */
+static ebr_t dbuf_hash_ebr;
+
 /*
  * We use Cityhash for this. It's fast, and has good hash properties without
  * requiring any large static buffers.
@@ -339,6 +372,69 @@ dbuf_hash(void *os, uint64_t obj, uint8_t lvl, uint64_t blkid)
 	(dbuf)->db_level == (level) &&			\
 	(dbuf)->db_blkid == (blkid))
 
+/*
+ * Look up a dbuf without holding the hash mutex.  Dbufs removed from the hash
+ * table are only freed once no such lookup can reference them anymore, so
+ * that any dbuf found can be safely locked.  Returns B_TRUE when the lookup
+ * completed, with *dbp set to the locked dbuf or NULL if there is none, and
+ * B_FALSE when it raced with the removal of a dbuf from the hash chain, or
+ * found a dbuf being evicted, and has to be redone with the mutex held.
+ */
+static boolean_t
+dbuf_find_lockless(dbuf_hash_table_t *h, uint64_t idx, objset_t *os,
+    uint64_t obj, uint8_t level, uint64_t blkid, dmu_buf_impl_t **dbp)
+{
+	uint32_t *seqp = DBUF_HASH_SEQ(h, idx);
+	dmu_buf_impl_t *db;
+	ebr_read_t er;
+	uint32_t seq;
+
+	ebr_enter(&dbuf_hash_ebr, &er);
+	seq = atomic_load_32(seqp);
+	if (seq & 1) {
+		ebr_exit(&er);
+		return (B_FALSE);
+	}
+	membar_consumer();
+
+	db = atomic_load_ptr(&h->hash_table[idx]);
+	while (db != NULL && !DBUF_EQUAL(db, os, obj, level, blkid)) {
+		db = atomic_load_ptr(&db->db_hash_next);
+		/*
+		 * A removed dbuf links to other retired dbufs, which may
+		 * have been retired before we entered and already be freed.
+		 * Only follow a link loaded while the chain was unchanged.
+		 */
+		membar_consumer();
+		if (atomic_load_32(seqp) != seq) {
+			ebr_exit(&er);
+			return (B_FALSE);
+		}
+	}
+
+	if (db != NULL) {
+		/*
+		 * The identity of a dbuf never changes until it is freed, and
+		 * a dbuf not being evicted is still in the hash table.
+		 */
+		mutex_enter(&db->db_mtx);
+		if (db->db_state == DB_EVICTING) {
+			mutex_exit(&db->db_mtx);
+			ebr_exit(&er);
+			return (B_FALSE);
+		}
+		ebr_exit(&er);
+		*dbp = db;
+		return (B_TRUE);
+	}
+
+	membar_consumer();
+	boolean_t valid = (atomic_load_32(seqp) == seq);
+	ebr_exit(&er);
+	*dbp = NULL;
+	return (valid);
+}
+
 dmu_buf_impl_t *
 dbuf_find(objset_t *os, uint64_t obj, uint8_t level, uint64_t blkid,
     uint64_t *hash_out)
@@ -351,6 +447,20 @@ dbuf_find(objset_t *os, uint64_t obj, uint8_t level, uint64_t blkid,
 	hv = dbuf_hash(os, obj, level, blkid);
 	idx = hv & h->hash_table_mask;
 
+	if (dbuf_lockless_lookup) {
+		if (dbuf_find_lockless(h, idx, os, obj, level, blkid, &db)) {
+			if (db != NULL) {
+				DBUF_STAT_BUMP(hash_lockless_hits);
+				return (db);
+			}
+			DBUF_STAT_BUMP(hash_lockless_misses);
+			if (hash_out != NULL)
+				*hash_out = hv;
+			return (NULL);
+		}
+		DBUF_STAT_BUMP(hash_lockless_retries);
+	}
+
 	mutex_enter(DBUF_HASH_MUTEX(h, idx));
 	for (db = h->hash_table[idx]; db != NULL; db = db->db_hash_next) {
 		if (DBUF_EQUAL(db, os, obj, level, blkid)) {
@@ -429,8 +539,13 @@ dbuf_hash_insert(dmu_buf_impl_t *db)
 	}
 
 	mutex_enter(&db->db_mtx);
+	/*
+	 * Lockless lookups may miss a dbuf being inserted, as they would
+	 * if they ran just before us, so only publish it once initialized.
+	 */
 	db->db_hash_next = h->hash_table[idx];
-	h->hash_table[idx] = db;
+	membar_producer();
+	atomic_store_ptr(&h->hash_table[idx], db);
 	mutex_exit(DBUF_HASH_MUTEX(h, idx));
 	DBUF_STAT_BUMP(hash_elements);
 
@@ -502,8 +617,17 @@ dbuf_hash_remove(dmu_buf_impl_t *db)
 		dbp = &dbf->db_hash_next;
 		ASSERT(dbf != NULL);
 	}
-	*dbp = db->db_hash_next;
-	db->db_hash_next = NULL;
+	/*
+	 * Leave the sequence number odd during the update, so that lockless
+	 * lookups which may have missed a dbuf because of it are redone.
+	 */
+	uint32_t *seqp = DBUF_HASH_SEQ(h, idx);
+	atomic_store_32(seqp, *seqp + 1);
+	membar_producer();
+	atomic_store_ptr(dbp, db->db_hash_next);
+	atomic_store_ptr(&db->db_hash_next, NULL);
+	membar_producer();
+	atomic_store_32(seqp, *seqp + 1);
 	if (h->hash_table[idx] &&
 	    h->hash_table[idx]->db_hash_next == NULL)
 		DBUF_STAT_BUMPDOWN(hash_chains);
@@ -836,6 +960,9 @@ dbuf_evict_thread(void *unused)
 		}
 		mutex_exit(&dbuf_evict_lock);
 
+		/* Free the dbufs retired since we last woke up. */
+		ebr_reclaim(&dbuf_hash_ebr);
+
 		/*
 		 * Keep evicting as long as we're above the low water mark
 		 * for the cache. We do this without holding the locks to
@@ -923,6 +1050,12 @@ dbuf_kstat_update(kstat_t *ksp, int rw)
 	    wmsum_value(&dbuf_sums.hash_hits);
 	ds->hash_misses.value.ui64 =
 	    wmsum_value(&dbuf_sums.hash_misses);
+	ds->hash_lockless_hits.value.ui64 =
+	    wmsum_value(&dbuf_sums.hash_lockless_hits);
+	ds->hash_lockless_misses.value.ui64 =
+	    wmsum_value(&dbuf_sums.hash_lockless_misses);
+	ds->hash_lockless_retries.value.ui64 =
+	    wmsum_value(&dbuf_sums.hash_lockless_retries);
 	ds->hash_collisions.value.ui64 =
 	    wmsum_value(&dbuf_sums.hash_collisions);
 	ds->hash_elements.value.ui64 =
@@ -987,6 +1120,7 @@ dbuf_init(void)
 		if (h->hash_mutexes == NULL)
 			hmsize >>= 1;
 	}
+	h->hash_seqs = vmem_zalloc(hmsize * sizeof (uint32_t), KM_SLEEP);
 
 	dbuf_kmem_cache = kmem_cache_create("dmu_buf_impl_t",
 	    sizeof (dmu_buf_impl_t),
@@ -996,6 +1130,8 @@ dbuf_init(void)
 
 	for (int i = 0; i < hmsize; i++)
 		mutex_init(&h->hash_mutexes[i], NULL, MUTEX_NOLOCKDEP, NULL);
+	ebr_init(&dbuf_hash_ebr, offsetof(dmu_buf_impl_t, db_hash_next),
+	    dbuf_hash_free);
 
 	dbuf_stats_init(h);
 
@@ -1027,6 +1163,9 @@ dbuf_init(void)
 	}
 	wmsum_init(&dbuf_sums.hash_hits, 0);
 	wmsum_init(&dbuf_sums.hash_misses, 0);
+	wmsum_init(&dbuf_sums.hash_lockless_hits, 0);
+	wmsum_init(&dbuf_sums.hash_lockless_misses, 0);
+	wmsum_init(&dbuf_sums.hash_lockless_retries, 0);
 	wmsum_init(&dbuf_sums.hash_collisions, 0);
 	wmsum_init(&dbuf_sums.hash_elements, 0);
 	wmsum_init(&dbuf_sums.hash_chains, 0);
@@ -1061,25 +1200,30 @@ dbuf_fini(void)
 
 	dbuf_stats_destroy();
 
+	/* The evict thread reclaims retired dbufs, stop it first. */
+	mutex_enter(&dbuf_evict_lock);
+	dbuf_evict_thread_exit = B_TRUE;
+	while (dbuf_evict_thread_exit) {
+		cv_signal(&dbuf_evict_cv);
+		cv_wait(&dbuf_evict_cv, &dbuf_evict_lock);
+	}
+	mutex_exit(&dbuf_evict_lock);
+
+	/* No lockless lookups remain, free all retired dbufs. */
+	ebr_fini(&dbuf_hash_ebr);
+
 	for (int i = 0; i < (h->hash_mutex_mask + 1); i++)
 		mutex_destroy(&h->hash_mutexes[i]);
 
 	vmem_free(h->hash_table, (h->hash_table_mask + 1) * sizeof (void *));
 	vmem_free(h->hash_mutexes, (h->hash_mutex_mask + 1) *
 	    sizeof (kmutex_t));
+	vmem_free(h->hash_seqs, (h->hash_mutex_mask + 1) * sizeof (uint32_t));
 
 	kmem_cache_destroy(dbuf_kmem_cache);
 	kmem_cache_destroy(dbuf_dirty_kmem_cache);
 	taskq_destroy(dbu_evict_taskq);
 
-	mutex_enter(&dbuf_evict_lock);
-	dbuf_evict_thread_exit = B_TRUE;
-	while (dbuf_evict_thread_exit) {
-		cv_signal(&dbuf_evict_cv);
-		cv_wait(&dbuf_evict_cv, &dbuf_evict_lock);
-	}
-	mutex_exit(&dbuf_evict_lock);
-
 	mutex_destroy(&dbuf_evict_lock);
 	cv_destroy(&dbuf_evict_cv);
 
@@ -1101,6 +1245,9 @@ dbuf_fini(void)
 	}
 	wmsum_fini(&dbuf_sums.hash_hits);
 	wmsum_fini(&dbuf_sums.hash_misses);
+	wmsum_fini(&dbuf_sums.hash_lockless_hits);
+	wmsum_fini(&dbuf_sums.hash_lockless_misses);
+	wmsum_fini(&dbuf_sums.hash_lockless_retries);
 	wmsum_fini(&dbuf_sums.hash_collisions);
 	wmsum_fini(&dbuf_sums.hash_elements);
 	wmsum_fini(&dbuf_sums.hash_chains);
@@ -3407,7 +3554,11 @@ dbuf_destroy(dmu_buf_impl_t *db)
 		dbuf_rele_and_unlock(parent, db, B_TRUE);
 	}
 
-	kmem_cache_free(dbuf_kmem_cache, db);
+	/* Lockless lookups may still reference a dbuf which was hashed. */
+	if (dbuf_lockless_lookup && db->db_blkid != DMU_BONUS_BLKID)
+		ebr_retire(&dbuf_hash_ebr, db);
+	else
+		kmem_cache_free(dbuf_kmem_cache, db);
 	arc_space_return(sizeof (dmu_buf_impl_t), ARC_SPACE_DBUF);
 }
 
@@ -5583,3 +5734,6 @@ ZFS_MODULE_PARAM(zfs_dbuf, dbuf_, metadata_cache_shift, UINT, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_dbuf, dbuf_, mutex_cache_shift, UINT, ZMOD_RD,
 	"Set size of dbuf cache mutex array as log2 shift.");
+
+ZFS_MODULE_PARAM(zfs_dbuf, dbuf_, lockless_lookup, INT, ZMOD_RD,
+	"Look up dbufs without holding the dbuf hash mutex");
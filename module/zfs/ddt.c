@@ -41,6 +41,7 @@
 #include <sys/dsl_scan.h>
 #include <sys/abd.h>
 #include <sys/zfeature.h>
+#include <sys/zthr.h>
 
 /*
  * # DDT: Deduplication tables
@@ -246,6 +247,12 @@ uint_t dedup_class_wait_txgs = 5;
  */
 static uint32_t zfs_ddt_prunes_per_txg = 50000;
 
+/*
+ * Maximum number of threads used to walk the DDT in parallel when pruning
+ * or building the age histogram.  Also capped at the number of CPUs.
+ */
+static uint_t zfs_dedup_walk_threads = 8;
+
 /*
  * For testing, synthesize aged DDT entries
  * (in global scope for ztest)
@@ -293,6 +300,12 @@ boolean_t zfs_dedup_log_hard_cap = B_FALSE;
  */
 uint_t zfs_dedup_log_flush_flow_rate_txgs = 10;
 
+/*
+ * Maximum entries of the next log flush to prefetch from the store objects
+ * ahead of time. Zero disables prefetching.
+ */
+uint_t zfs_dedup_log_flush_prefetch_max = 20000;
+
 static const ddt_ops_t *const ddt_ops[DDT_TYPES] = {
 	&ddt_zap_ops,
 };
@@ -334,6 +347,9 @@ typedef struct {
 	kstat_named_t dds_lookup_stored_hit;
 	kstat_named_t dds_lookup_stored_miss;
 
+	/* store searches skipped because the filter excluded the entry */
+	kstat_named_t dds_lookup_filter_miss;
+
 	/* number of entries on log trees */
 	kstat_named_t dds_log_active_entries;
 	kstat_named_t dds_log_flushing_entries;
@@ -357,6 +373,7 @@ static const ddt_kstats_t ddt_kstats_template = {
 	{ "lookup_log_miss",		KSTAT_DATA_UINT64 },
 	{ "lookup_stored_hit",		KSTAT_DATA_UINT64 },
 	{ "lookup_stored_miss",		KSTAT_DATA_UINT64 },
+	{ "lookup_filter_miss",		KSTAT_DATA_UINT64 },
 	{ "log_active_entries",		KSTAT_DATA_UINT64 },
 	{ "log_flushing_entries",	KSTAT_DATA_UINT64 },
 	{ "log_ingest_rate",		KSTAT_DATA_UINT32 },
@@ -624,6 +641,9 @@ ddt_object_update(ddt_t *ddt, ddt_type_t type, ddt_class_t class,
 	dnode_t *dn = ddt->ddt_object_dnode[type][class];
 	ASSERT(dn != NULL);
 
+	/* The filter must have the key before any lookup can find it */
+	ddt_filter_add(ddt, &ddlwe->ddlwe_key);
+
 	return (ddt_ops[type]->ddt_op_update(dn, &ddlwe->ddlwe_key,
 	    &ddlwe->ddlwe_phys, DDT_PHYS_SIZE(ddt), tx));
 }
@@ -638,9 +658,14 @@ ddt_object_remove(ddt_t *ddt, ddt_type_t type, ddt_class_t class,
 	return (ddt_ops[type]->ddt_op_remove(dn, ddk, tx));
 }
 
-int
-ddt_object_walk(ddt_t *ddt, ddt_type_t type, ddt_class_t class,
-    uint64_t *walk, ddt_lightweight_entry_t *ddlwe)
+/*
+ * Walk the entries of one DDT object whose key hash falls in [start, end).
+ * An end of 0 means the walk continues to the end of the hash space.
+ */
+static int
+ddt_object_walk_range(ddt_t *ddt, ddt_type_t type, ddt_class_t class,
+    uint64_t start, uint64_t end, uint64_t *walk,
+    ddt_lightweight_entry_t *ddlwe)
 {
 	/*
 	 * Can be called from open context, so protect against concurrent
@@ -654,8 +679,8 @@ ddt_object_walk(ddt_t *ddt, ddt_type_t type, ddt_class_t class,
 		return (SET_ERROR(ENOENT));
 	}
 
-	int error = ddt_ops[type]->ddt_op_walk(dn, walk, &ddlwe->ddlwe_key,
-	    &ddlwe->ddlwe_phys, DDT_PHYS_SIZE(ddt));
+	int error = ddt_ops[type]->ddt_op_walk(dn, walk, start, end,
+	    &ddlwe->ddlwe_key, &ddlwe->ddlwe_phys, DDT_PHYS_SIZE(ddt));
 	if (error == 0) {
 		ddlwe->ddlwe_type = type;
 		ddlwe->ddlwe_class = class;
@@ -665,6 +690,13 @@ ddt_object_walk(ddt_t *ddt, ddt_type_t type, ddt_class_t class,
 	return (error);
 }
 
+int
+ddt_object_walk(ddt_t *ddt, ddt_type_t type, ddt_class_t class,
+    uint64_t *walk, ddt_lightweight_entry_t *ddlwe)
+{
+	return (ddt_object_walk_range(ddt, type, class, 0, 0, walk, ddlwe));
+}
+
 int
 ddt_object_count(ddt_t *ddt, ddt_type_t type, ddt_class_t class,
     uint64_t *count)
@@ -1340,18 +1372,28 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t verify)
 		DDT_KSTAT_BUMP(ddt, dds_lookup_log_miss);
 	}
 
-	/* Search all store objects for the entry. */
+	/*
+	 * Search all store objects for the entry, unless the filter tells us
+	 * it's not in any of them.
+	 */
 	error = ENOENT;
-	for (type = 0; type < DDT_TYPES; type++) {
-		for (class = 0; class < DDT_CLASSES; class++) {
-			error = ddt_object_lookup(ddt, type, class, dde);
-			if (error != ENOENT) {
-				ASSERT0(error);
-				break;
+	if (ddt_filter_contains(ddt, &search)) {
+		for (type = 0; type < DDT_TYPES; type++) {
+			for (class = 0; class < DDT_CLASSES; class++) {
+				error = ddt_object_lookup(ddt, type, class,
+				    dde);
+				if (error != ENOENT) {
+					ASSERT0(error);
+					break;
+				}
 			}
+			if (error != ENOENT)
+				break;
 		}
-		if (error != ENOENT)
-			break;
+	} else {
+		DDT_KSTAT_BUMP(ddt, dds_lookup_filter_miss);
+		type = DDT_TYPES;
+		class = DDT_CLASSES;
 	}
 
 	ddt_enter(ddt);
@@ -1699,6 +1741,8 @@ ddt_kstat_update(kstat_t *ksp, int rw)
 	    wmsum_value(&ddt->ddt_kstat_dds_lookup_stored_hit);
 	dds->dds_lookup_stored_miss.value.ui64 =
 	    wmsum_value(&ddt->ddt_kstat_dds_lookup_stored_miss);
+	dds->dds_lookup_filter_miss.value.ui64 =
+	    wmsum_value(&ddt->ddt_kstat_dds_lookup_filter_miss);
 
 	/* Sync-only counters are already set directly in kstats */
 
@@ -1725,6 +1769,7 @@ ddt_table_alloc_kstats(ddt_t *ddt)
 	wmsum_init(&ddt->ddt_kstat_dds_lookup_log_miss, 0);
 	wmsum_init(&ddt->ddt_kstat_dds_lookup_stored_hit, 0);
 	wmsum_init(&ddt->ddt_kstat_dds_lookup_stored_miss, 0);
+	wmsum_init(&ddt->ddt_kstat_dds_lookup_filter_miss, 0);
 
 	ddt->ddt_ksp = kstat_create(mod, 0, name, "misc", KSTAT_TYPE_NAMED,
 	    sizeof (ddt_kstats_t) / sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
@@ -1754,6 +1799,7 @@ ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 	avl_create(&ddt->ddt_repair_tree, ddt_key_compare,
 	    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
 	rw_init(&ddt->ddt_objects_lock, NULL, RW_DEFAULT, NULL);
+	mutex_init(&ddt->ddt_flush_prefetch_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	ddt->ddt_checksum = c;
 	ddt->ddt_spa = spa;
@@ -1762,6 +1808,7 @@ ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 	ddt->ddt_log_flush_pressure = 10;
 
 	ddt_log_alloc(ddt);
+	ddt_filter_alloc(ddt);
 	ddt_table_alloc_kstats(ddt);
 
 	return (ddt);
@@ -1789,8 +1836,10 @@ ddt_table_free(ddt_t *ddt)
 	wmsum_fini(&ddt->ddt_kstat_dds_lookup_log_miss);
 	wmsum_fini(&ddt->ddt_kstat_dds_lookup_stored_hit);
 	wmsum_fini(&ddt->ddt_kstat_dds_lookup_stored_miss);
+	wmsum_fini(&ddt->ddt_kstat_dds_lookup_filter_miss);
 
 	ddt_log_free(ddt);
+	ddt_filter_free(ddt);
 	for (ddt_type_t type = 0; type < DDT_TYPES; type++) {
 		for (ddt_class_t class = 0; class < DDT_CLASSES; class++) {
 			if (ddt->ddt_object_dnode[type][class] != NULL) {
@@ -1801,6 +1850,12 @@ ddt_table_free(ddt_t *ddt)
 		}
 	}
 	rw_destroy(&ddt->ddt_objects_lock);
+	if (ddt->ddt_flush_prefetch != NULL) {
+		vmem_free(ddt->ddt_flush_prefetch,
+		    ddt->ddt_flush_prefetch_count *
+		    sizeof (ddt_flush_prefetch_t));
+	}
+	mutex_destroy(&ddt->ddt_flush_prefetch_lock);
 	ASSERT0(avl_numnodes(&ddt->ddt_tree));
 	ASSERT0(avl_numnodes(&ddt->ddt_repair_tree));
 	avl_destroy(&ddt->ddt_tree);
@@ -1904,6 +1959,9 @@ ddt_class_contains(spa_t *spa, ddt_class_t max_class, const blkptr_t *bp)
 
 	ddt_key_fill(&ddk, bp);
 
+	if (!ddt_filter_contains(ddt, &ddk))
+		return (B_FALSE);
+
 	for (ddt_type_t type = 0; type < DDT_TYPES; type++) {
 		for (ddt_class_t class = 0; class <= max_class; class++) {
 			if (ddt_object_contains(ddt, type, class, &ddk) == 0)
@@ -2233,6 +2291,140 @@ ddt_flush_force_update_txg(ddt_t *ddt, uint64_t txg)
 	ddt->ddt_flush_force_txg = 0;
 }
 
+/*
+ * Flushing a log entry means updating the store objects, which usually
+ * means reading a ZAP leaf. Done one entry at a time inside spa_sync, those
+ * reads dominate the flush. So at the end of each flush, we note the
+ * entries the next one will likely take, and spa_ddt_flush_zthr prefetches
+ * their leaves before the next txg syncs.
+ *
+ * The flushing tree is already sorted by key, which for the (pre-hashed)
+ * ZAP store objects is also leaf order, so the batch is taken from the
+ * front in order.
+ */
+static void
+ddt_flush_prefetch_prepare(ddt_t *ddt, uint64_t flushed)
+{
+	spa_t *spa = ddt->ddt_spa;
+	avl_tree_t *tree = &ddt->ddt_log_flushing->ddl_tree;
+	ddt_flush_prefetch_t *batch = NULL;
+	uint64_t count = 0;
+
+	/*
+	 * Estimate the next flush the same way ddt_sync_flush_log() sets its
+	 * minimum, allowing for it to run a little over as it usually does.
+	 */
+	if (spa->spa_ddt_flush_zthr != NULL && !avl_is_empty(tree)) {
+		uint64_t backlog = avl_numnodes(tree) +
+		    avl_numnodes(&ddt->ddt_log_active->ddl_tree);
+		count = MAX(backlog / MAX(1, zfs_dedup_log_flush_txgs),
+		    zfs_dedup_log_flush_entries_min);
+		count = MAX(count, flushed) * 5 / 4;
+		if (ddt->ddt_flush_force_txg > 0)
+			count = avl_numnodes(tree);
+		count = MIN(count, avl_numnodes(tree));
+		count = MIN(count, zfs_dedup_log_flush_entries_max);
+		count = MIN(count, zfs_dedup_log_flush_prefetch_max);
+	}
+
+	if (count > 0) {
+		batch = vmem_alloc(count * sizeof (ddt_flush_prefetch_t),
+		    KM_SLEEP);
+		ddt_log_entry_t *ddle = avl_first(tree);
+		for (uint64_t i = 0; i < count; i++) {
+			ddt_flush_prefetch_t *ddfp = &batch[i];
+			ddt_lightweight_entry_t ddlwe;
+
+			DDT_LOG_ENTRY_TO_LIGHTWEIGHT(ddt, ddle, &ddlwe);
+			uint64_t refcnt =
+			    ddt_phys_total_refcnt(ddt, &ddlwe.ddlwe_phys);
+
+			ddfp->ddfp_key = ddlwe.ddlwe_key;
+			ddfp->ddfp_otype = ddlwe.ddlwe_type;
+			ddfp->ddfp_oclass = ddlwe.ddlwe_class;
+			ddfp->ddfp_nclass = (refcnt > 1) ?
+			    DDT_CLASS_DUPLICATE : DDT_CLASS_UNIQUE;
+			ddfp->ddfp_remove = (refcnt == 0);
+			ddle = AVL_NEXT(tree, ddle);
+		}
+	}
+
+	/* Replace any batch the zthr hasn't got to; it's stale now */
+	mutex_enter(&ddt->ddt_flush_prefetch_lock);
+	ddt_flush_prefetch_t *old = ddt->ddt_flush_prefetch;
+	uint64_t old_count = ddt->ddt_flush_prefetch_count;
+	ddt->ddt_flush_prefetch = batch;
+	ddt->ddt_flush_prefetch_count = count;
+	mutex_exit(&ddt->ddt_flush_prefetch_lock);
+
+	if (old != NULL)
+		vmem_free(old, old_count * sizeof (ddt_flush_prefetch_t));
+	if (batch != NULL)
+		zthr_wakeup(spa->spa_ddt_flush_zthr);
+}
+
+static boolean_t
+ddt_flush_prefetch_check(void *arg, zthr_t *zthr)
+{
+	(void) zthr;
+	spa_t *spa = arg;
+
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		if (ddt != NULL && ddt->ddt_flush_prefetch != NULL)
+			return (B_TRUE);
+	}
+	return (B_FALSE);
+}
+
+static void
+ddt_flush_prefetch_thread(void *arg, zthr_t *zthr)
+{
+	spa_t *spa = arg;
+
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		if (ddt == NULL)
+			continue;
+
+		mutex_enter(&ddt->ddt_flush_prefetch_lock);
+		ddt_flush_prefetch_t *batch = ddt->ddt_flush_prefetch;
+		uint64_t count = ddt->ddt_flush_prefetch_count;
+		ddt->ddt_flush_prefetch = NULL;
+		ddt->ddt_flush_prefetch_count = 0;
+		mutex_exit(&ddt->ddt_flush_prefetch_lock);
+
+		if (batch == NULL)
+			continue;
+
+		for (uint64_t i = 0; i < count && !zthr_iscancelled(zthr);
+		    i++) {
+			ddt_flush_prefetch_t *ddfp = &batch[i];
+
+			if (ddfp->ddfp_otype != DDT_TYPES) {
+				ddt_object_prefetch(ddt, ddfp->ddfp_otype,
+				    ddfp->ddfp_oclass, &ddfp->ddfp_key);
+			}
+			if (!ddfp->ddfp_remove &&
+			    (ddfp->ddfp_otype != DDT_TYPE_DEFAULT ||
+			    ddfp->ddfp_oclass != ddfp->ddfp_nclass)) {
+				ddt_object_prefetch(ddt, DDT_TYPE_DEFAULT,
+				    ddfp->ddfp_nclass, &ddfp->ddfp_key);
+			}
+		}
+		vmem_free(batch, count * sizeof (ddt_flush_prefetch_t));
+	}
+}
+
+void
+spa_start_ddt_flush_thread(spa_t *spa)
+{
+	ASSERT0P(spa->spa_ddt_flush_zthr);
+	spa->spa_ddt_flush_zthr = zthr_create("z_ddt_flush",
+	    ddt_flush_prefetch_check, ddt_flush_prefetch_thread, spa,
+	    minclsyspri);
+}
+
 static void
 ddt_sync_flush_log(ddt_t *ddt, dmu_tx_t *tx)
 {
@@ -2400,6 +2592,8 @@ housekeeping:
 	    zfs_dedup_log_flush_flow_rate_txgs);
 	DDT_KSTAT_SET(ddt, dds_log_flush_time_rate,
 	    ddt->ddt_log_flush_time_rate);
+
+	ddt_flush_prefetch_prepare(ddt, count);
 	if (avl_numnodes(&ddt->ddt_log_flushing->ddl_tree) > 0 &&
 	    zfs_flags & ZFS_DEBUG_DDT) {
 		zfs_dbgmsg("%lu entries remain(%lu in active), flushed %u @ "
@@ -2580,6 +2774,7 @@ ddt_sync(spa_t *spa, uint64_t txg)
 		if (ddt->ddt_flags & DDT_FLAG_LOG)
 			ddt_sync_flush_log(ddt, tx);
 		ddt_repair_table(ddt, rio);
+		ddt_filter_wakeup(ddt);
 	}
 
 	(void) zio_wait(rio);
@@ -2665,6 +2860,169 @@ ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_lightweight_entry_t *ddlwe)
 	return (ddt_walk_impl(spa, ddb, ddlwe, 0, B_TRUE));
 }
 
+/*
+ * Parallel DDT walk.  The key hash space of every matching DDT object is
+ * split into a power-of-two number of equal slices ("shards"), and each shard
+ * is walked by a single taskq thread across all checksums and types of the
+ * requested class.  A shard is only ever visited by one thread, so callers
+ * can keep per-shard state without locking and merge it afterwards.
+ *
+ * Unlike ddt_walk(), there is no resumable bookmark; the walk runs to
+ * completion, until the callback returns an error, or until the caller is
+ * signalled or the pool starts shutting down.
+ */
+typedef struct ddt_walk_parallel {
+	spa_t		*dwp_spa;
+	ddt_class_t	dwp_class;
+	uint64_t	dwp_flags;
+	uint_t		dwp_nshards;
+	ddt_walk_cb_t	*dwp_cb;
+	void		*dwp_arg;
+	kmutex_t	dwp_lock;
+	kcondvar_t	dwp_cv;
+	uint_t		dwp_pending;
+	int		dwp_error;
+	volatile boolean_t dwp_abort;
+} ddt_walk_parallel_t;
+
+typedef struct ddt_walk_shard {
+	ddt_walk_parallel_t	*dws_dwp;
+	uint_t			dws_shard;
+} ddt_walk_shard_t;
+
+/*
+ * Number of shards to split a parallel walk into.  Using a few more shards
+ * than threads evens out the work when entries are not spread uniformly.
+ */
+uint_t
+ddt_walk_parallel_shards(void)
+{
+	uint_t nthreads = MIN(MAX(zfs_dedup_walk_threads, 1), 1024);
+	return (1U << highbit64(nthreads * 4 - 1));
+}
+
+static void
+ddt_walk_shard_task(void *arg)
+{
+	ddt_walk_shard_t *dws = arg;
+	ddt_walk_parallel_t *dwp = dws->dws_dwp;
+	spa_t *spa = dwp->dwp_spa;
+	uint_t shard = dws->dws_shard;
+	int bits = highbit64(dwp->dwp_nshards) - 1;
+	uint64_t start = 0, end = 0;
+	ddt_lightweight_entry_t ddlwe;
+	int error = 0;
+
+	if (bits > 0) {
+		start = (uint64_t)shard << (64 - bits);
+		if (shard + 1 < dwp->dwp_nshards)
+			end = (uint64_t)(shard + 1) << (64 - bits);
+	}
+
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		if (ddt == NULL || (ddt->ddt_flags & dwp->dwp_flags) !=
+		    dwp->dwp_flags)
+			continue;
+
+		for (ddt_type_t type = 0; type < DDT_TYPES; type++) {
+			uint64_t walk = 0;
+
+			while (!dwp->dwp_abort &&
+			    (error = ddt_object_walk_range(ddt, type,
+			    dwp->dwp_class, start, end, &walk, &ddlwe)) == 0) {
+				error = dwp->dwp_cb(ddt, &ddlwe, shard,
+				    dwp->dwp_arg);
+				if (error != 0)
+					break;
+			}
+			if (error == ENOENT)
+				error = 0;
+			if (error != 0 || dwp->dwp_abort)
+				goto out;
+		}
+	}
+
+out:
+	mutex_enter(&dwp->dwp_lock);
+	if (error != 0 && dwp->dwp_error == 0) {
+		dwp->dwp_error = error;
+		dwp->dwp_abort = B_TRUE;
+	}
+	dwp->dwp_pending--;
+	cv_broadcast(&dwp->dwp_cv);
+	mutex_exit(&dwp->dwp_lock);
+}
+
+/*
+ * Walk every entry of the given class in all DDTs that have all of "flags"
+ * set, calling "cb" for each one from one of up to zfs_dedup_walk_threads
+ * worker threads.  "nshards" must be a power of two, normally the value
+ * returned by ddt_walk_parallel_shards().
+ */
+int
+ddt_walk_parallel(spa_t *spa, ddt_class_t class, uint64_t flags,
+    uint_t nshards, ddt_walk_cb_t *cb, void *arg)
+{
+	ddt_walk_parallel_t dwp = {
+		.dwp_spa = spa,
+		.dwp_class = class,
+		.dwp_flags = flags,
+		.dwp_nshards = nshards,
+		.dwp_cb = cb,
+		.dwp_arg = arg,
+		.dwp_pending = nshards,
+		.dwp_error = 0,
+		.dwp_abort = B_FALSE,
+	};
+
+	ASSERT(ISP2(nshards));
+	ASSERT3U(nshards, <=, 1U << 16);
+
+	uint_t nthreads = MIN(MAX(zfs_dedup_walk_threads, 1), boot_ncpus);
+	nthreads = MIN(nthreads, nshards);
+
+	mutex_init(&dwp.dwp_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&dwp.dwp_cv, NULL, CV_DEFAULT, NULL);
+
+	ddt_walk_shard_t *dws = kmem_alloc(nshards * sizeof (ddt_walk_shard_t),
+	    KM_SLEEP);
+	taskq_t *tq = taskq_create("z_ddt_walk", nthreads, minclsyspri,
+	    nthreads, nshards, TASKQ_PREPOPULATE);
+
+	for (uint_t i = 0; i < nshards; i++) {
+		dws[i].dws_dwp = &dwp;
+		dws[i].dws_shard = i;
+		VERIFY3U(taskq_dispatch(tq, ddt_walk_shard_task, &dws[i],
+		    TQ_SLEEP), !=, TASKQID_INVALID);
+	}
+
+	/*
+	 * The workers can't see signals sent to this thread, so poll for
+	 * them here and tell the workers to stop if one arrives.
+	 */
+	mutex_enter(&dwp.dwp_lock);
+	while (dwp.dwp_pending > 0) {
+		(void) cv_timedwait(&dwp.dwp_cv, &dwp.dwp_lock,
+		    ddi_get_lbolt() + MSEC_TO_TICK(100));
+		if (!dwp.dwp_abort && (spa_shutting_down(spa) || issig())) {
+			dwp.dwp_abort = B_TRUE;
+			if (dwp.dwp_error == 0)
+				dwp.dwp_error = SET_ERROR(EINTR);
+		}
+	}
+	mutex_exit(&dwp.dwp_lock);
+
+	taskq_wait(tq);
+	taskq_destroy(tq);
+	kmem_free(dws, nshards * sizeof (ddt_walk_shard_t));
+
+	cv_destroy(&dwp.dwp_cv);
+	mutex_destroy(&dwp.dwp_lock);
+
+	return (dwp.dwp_error);
+}
+
 /*
  * This function is used by Block Cloning (brt.c) to increase reference
  * counter for the DDT entry if the block is already in DDT.
@@ -2810,6 +3168,63 @@ ddt_prune_entry(list_t *list, ddt_t *ddt, const ddt_key_t *ddk,
 	list_insert_head(list, dpe);
 }
 
+/*
+ * Per-shard prune walk state. Each shard batches its own candidates and
+ * histogram, which are merged once the walk completes.
+ */
+typedef struct ddt_prune_shard {
+	ddt_prune_info_t	dps_dpi;
+	ddt_age_histo_t		dps_histogram;
+	uint64_t		dps_candidates;
+	uint64_t		dps_valid;
+} ddt_prune_shard_t;
+
+typedef struct ddt_prune_walk_arg {
+	spa_t			*dpw_spa;
+	uint64_t		dpw_cutoff;
+	uint64_t		dpw_now;
+	uint64_t		dpw_batch;
+	boolean_t		dpw_histogram;
+	ddt_prune_shard_t	*dpw_shards;
+} ddt_prune_walk_arg_t;
+
+static int
+ddt_prune_walk_cb(ddt_t *ddt, const ddt_lightweight_entry_t *ddlwe,
+    uint_t shard, void *arg)
+{
+	ddt_prune_walk_arg_t *dpw = arg;
+	ddt_prune_shard_t *dps = &dpw->dpw_shards[shard];
+
+	ASSERT(ddt->ddt_flags & DDT_FLAG_FLAT);
+	ASSERT3U(ddlwe->ddlwe_phys.ddp_flat.ddp_refcnt, <=, 1);
+
+	uint64_t class_start = ddlwe->ddlwe_phys.ddp_flat.ddp_class_start;
+
+	/* prune older entries */
+	if (dpw->dpw_cutoff != 0 && class_start < dpw->dpw_cutoff) {
+		if (dps->dps_candidates++ >= dpw->dpw_batch) {
+			/* sync prune candidates in batches */
+			VERIFY0(dsl_sync_task(spa_name(dpw->dpw_spa),
+			    NULL, prune_candidates_sync,
+			    &dps->dps_dpi, 0, ZFS_SPACE_CHECK_NONE));
+			dps->dps_candidates = 1;
+		}
+		ddt_prune_entry(&dps->dps_dpi.dpi_candidates, ddt,
+		    &ddlwe->ddlwe_key, &ddlwe->ddlwe_phys);
+	}
+
+	/* build a histogram */
+	if (dpw->dpw_histogram) {
+		uint64_t age = (dpw->dpw_now - class_start) / 3600;
+		int bin = MIN(highbit64(age), HIST_BINS - 1);
+		dps->dps_histogram.dah_entries++;
+		dps->dps_histogram.dah_age_histo[bin]++;
+	}
+
+	dps->dps_valid++;
+	return (0);
+}
+
 /*
  * Interate over all the entries in the DDT unique class.
  * The walk will perform one of the following operations:
@@ -2817,73 +3232,75 @@ ddt_prune_entry(list_t *list, ddt_t *ddt, const ddt_key_t *ddk,
  *  (b) prune entries older than the cutoff
  *
  *  Also called by zdb(8) to dump the age histogram
+ *
+ * The walk is split across ddt_walk_parallel() shards.  Each shard submits
+ * its own candidate batches, sized so that all shards together still add
+ * about zfs_ddt_prunes_per_txg entries per txg.
  */
 void
 ddt_prune_walk(spa_t *spa, uint64_t cutoff, ddt_age_histo_t *histogram)
 {
-	ddt_bookmark_t ddb = {
-		.ddb_class = DDT_CLASS_UNIQUE,
-		.ddb_type = 0,
-		.ddb_checksum = 0,
-		.ddb_cursor = 0
+	uint_t nshards = ddt_walk_parallel_shards();
+	ddt_prune_walk_arg_t dpw = {
+		.dpw_spa = spa,
+		.dpw_cutoff = cutoff,
+		.dpw_now = gethrestime_sec(),
+		.dpw_batch = MAX(zfs_ddt_prunes_per_txg / nshards, 1),
+		.dpw_histogram = (histogram != NULL),
 	};
-	ddt_lightweight_entry_t ddlwe = {0};
-	int error;
-	uint64_t valid = 0;
-	uint64_t candidates = 0;
-	uint64_t now = gethrestime_sec();
 	ddt_prune_info_t dpi;
+	uint64_t valid = 0;
 	boolean_t pruning = (cutoff != 0);
 
+	dpw.dpw_shards = kmem_zalloc(nshards * sizeof (ddt_prune_shard_t),
+	    KM_SLEEP);
+
 	if (pruning) {
 		dpi.dpi_txg_syncs = 0;
 		dpi.dpi_pruned = 0;
 		dpi.dpi_spa = spa;
 		list_create(&dpi.dpi_candidates, sizeof (ddt_prune_entry_t),
 		    offsetof(ddt_prune_entry_t, dpe_node));
+		for (uint_t i = 0; i < nshards; i++) {
+			ddt_prune_info_t *sdpi = &dpw.dpw_shards[i].dps_dpi;
+			sdpi->dpi_spa = spa;
+			list_create(&sdpi->dpi_candidates,
+			    sizeof (ddt_prune_entry_t),
+			    offsetof(ddt_prune_entry_t, dpe_node));
+		}
 	}
 
 	if (histogram != NULL)
 		memset(histogram, 0, sizeof (ddt_age_histo_t));
 
-	while ((error =
-	    ddt_walk_impl(spa, &ddb, &ddlwe, DDT_FLAG_FLAT, B_FALSE)) == 0) {
-		ddt_t *ddt = spa->spa_ddt[ddb.ddb_checksum];
-		VERIFY(ddt);
-
-		if (spa_shutting_down(spa) || issig())
-			break;
+	(void) ddt_walk_parallel(spa, DDT_CLASS_UNIQUE, DDT_FLAG_FLAT,
+	    nshards, ddt_prune_walk_cb, &dpw);
 
-		ASSERT(ddt->ddt_flags & DDT_FLAG_FLAT);
-		ASSERT3U(ddlwe.ddlwe_phys.ddp_flat.ddp_refcnt, <=, 1);
+	for (uint_t i = 0; i < nshards; i++) {
+		ddt_prune_shard_t *dps = &dpw.dpw_shards[i];
 
-		uint64_t class_start =
-		    ddlwe.ddlwe_phys.ddp_flat.ddp_class_start;
-
-		/* prune older entries */
-		if (pruning && class_start < cutoff) {
-			if (candidates++ >= zfs_ddt_prunes_per_txg) {
-				/* sync prune candidates in batches */
-				VERIFY0(dsl_sync_task(spa_name(spa),
-				    NULL, prune_candidates_sync,
-				    &dpi, 0, ZFS_SPACE_CHECK_NONE));
-				candidates = 1;
-			}
-			ddt_prune_entry(&dpi.dpi_candidates, ddt,
-			    &ddlwe.ddlwe_key, &ddlwe.ddlwe_phys);
+		if (pruning) {
+			dpi.dpi_txg_syncs += dps->dps_dpi.dpi_txg_syncs;
+			dpi.dpi_pruned += dps->dps_dpi.dpi_pruned;
+			list_move_tail(&dpi.dpi_candidates,
+			    &dps->dps_dpi.dpi_candidates);
+			list_destroy(&dps->dps_dpi.dpi_candidates);
 		}
 
-		/* build a histogram */
 		if (histogram != NULL) {
-			uint64_t age = (now - class_start) / 3600;
-			int bin = MIN(highbit64(age), HIST_BINS - 1);
-			histogram->dah_entries++;
-			histogram->dah_age_histo[bin]++;
+			histogram->dah_entries +=
+			    dps->dps_histogram.dah_entries;
+			for (int b = 0; b < HIST_BINS; b++) {
+				histogram->dah_age_histo[b] +=
+				    dps->dps_histogram.dah_age_histo[b];
+			}
 		}
 
-		valid++;
+		valid += dps->dps_valid;
 	}
 
+	kmem_free(dpw.dpw_shards, nshards * sizeof (ddt_prune_shard_t));
+
 	if (pruning) {
 		if (!list_is_empty(&dpi.dpi_candidates)) {
 			/* sync out final batch of prune candidates */
@@ -2999,3 +3416,9 @@ ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, log_hard_cap, UINT, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, log_flush_flow_rate_txgs, UINT, ZMOD_RW,
 	"Number of txgs to average flow rates across");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, log_flush_prefetch_max, UINT, ZMOD_RW,
+	"Max number of log entries to prefetch ahead of each flush");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, walk_threads, UINT, ZMOD_RW,
+	"Max number of threads for parallel DDT prune walks");
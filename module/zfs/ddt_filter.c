@@ -0,0 +1,389 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or https://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/ddt.h>
+#include <sys/ddt_impl.h>
+#include <sys/zio_checksum.h>
+#include <sys/zthr.h>
+
+/*
+ * DDT store filter.
+ *
+ * On a pool where most written blocks are unique, nearly every ddt_lookup()
+ * misses the live tree and the log, and then has to search the store objects
+ * to find out that the entry doesn't exist. That's a random ZAP read for
+ * every new block written.
+ *
+ * To avoid it, each DDT keeps a blocked Bloom filter over the keys in its
+ * store objects. Each key sets DDT_FILTER_HASHES bits in one 512-bit block,
+ * so a test touches a single cache line. A clear bit means the key is not in
+ * any store object, and ddt_lookup() can treat it as new without going to
+ * disk. A filter never has false negatives, so keys are added before they are
+ * written to a store object, and are never removed; entries that are removed
+ * from the store just leave some stale bits behind.
+ *
+ * The filter only lives in memory. When a DDT is loaded, spa_ddt_filter_zthr
+ * builds it by walking the store objects, and replaces it with a larger one
+ * when the store outgrows it. Until a filter has been fully built, lookups
+ * ignore it. Keys written while a build is in progress are added directly,
+ * so none are missed whichever side of the walk cursor they land on. If the
+ * walk fails to read a store object, the filter could be missing its keys,
+ * so the build is abandoned and lookups keep ignoring the filter until the
+ * DDT is loaded again.
+ */
+
+#define	DDT_FILTER_BLOCK_SHIFT	9	/* 512 bits per block */
+#define	DDT_FILTER_BLOCK_WORDS	((1 << DDT_FILTER_BLOCK_SHIFT) / 64)
+#define	DDT_FILTER_BLOCK_BYTES	(DDT_FILTER_BLOCK_WORDS * sizeof (uint64_t))
+#define	DDT_FILTER_HASHES	7
+
+/* Smallest filter to build, so a new DDT doesn't regrow immediately */
+#define	DDT_FILTER_MIN_ENTRIES	(1ULL << 16)
+
+struct ddt_filter {
+	uint64_t	*ddf_bits;	/* ddf_nblocks blocks of bits */
+	uint64_t	ddf_nblocks;	/* always a power of 2 */
+	uint64_t	ddf_capacity;	/* entries the filter is sized for */
+	boolean_t	ddf_ready;	/* all store keys are in the filter */
+
+	/* build progress, so a cancelled build can pick up where it was */
+	ddt_type_t	ddf_walk_type;
+	ddt_class_t	ddf_walk_class;
+	uint64_t	ddf_walk_cursor;
+	int		ddf_walk_error;	/* walk failed, filter never ready */
+};
+
+/*
+ * Bits of filter to allocate per DDT entry. 0 disables the filter.
+ */
+static uint_t zfs_dedup_filter_bits_per_entry = 10;
+
+/*
+ * Max memory for each DDT's filter. If the store outgrows it, the filter
+ * still works, just with more false positives.
+ */
+static uint64_t zfs_dedup_filter_max_size = 32 * 1024 * 1024;
+
+/*
+ * Keys are cryptographic checksums, so their words are already uniformly
+ * distributed and can be used as hashes directly. The first word picks the
+ * block, and the second (mixed with the key's properties, which can differ
+ * for the same checksum) supplies the bits within it.
+ */
+static inline const uint64_t *
+ddt_filter_block(const ddt_filter_t *ddf, const ddt_key_t *ddk, uint64_t *hp)
+{
+	uint64_t block = ddk->ddk_cksum.zc_word[0] & (ddf->ddf_nblocks - 1);
+
+	*hp = ddk->ddk_cksum.zc_word[1] ^ ddk->ddk_prop;
+	return (&ddf->ddf_bits[block * DDT_FILTER_BLOCK_WORDS]);
+}
+
+static void
+ddt_filter_set(ddt_filter_t *ddf, const ddt_key_t *ddk)
+{
+	uint64_t h;
+	uint64_t *block = (uint64_t *)ddt_filter_block(ddf, ddk, &h);
+
+	for (int i = 0; i < DDT_FILTER_HASHES; i++) {
+		uint_t bit = h & ((1 << DDT_FILTER_BLOCK_SHIFT) - 1);
+		uint64_t mask = 1ULL << (bit & 63);
+
+		if (!(block[bit >> 6] & mask))
+			atomic_or_64(&block[bit >> 6], mask);
+		h >>= DDT_FILTER_BLOCK_SHIFT;
+	}
+}
+
+static boolean_t
+ddt_filter_test(const ddt_filter_t *ddf, const ddt_key_t *ddk)
+{
+	uint64_t h;
+	const uint64_t *block = ddt_filter_block(ddf, ddk, &h);
+
+	for (int i = 0; i < DDT_FILTER_HASHES; i++) {
+		uint_t bit = h & ((1 << DDT_FILTER_BLOCK_SHIFT) - 1);
+
+		if (!(block[bit >> 6] & (1ULL << (bit & 63))))
+			return (B_FALSE);
+		h >>= DDT_FILTER_BLOCK_SHIFT;
+	}
+	return (B_TRUE);
+}
+
+/*
+ * Number of entries in the store objects, as of the last sync.
+ */
+static uint64_t
+ddt_filter_store_entries(ddt_t *ddt)
+{
+	uint64_t count = 0;
+
+	for (ddt_type_t type = 0; type < DDT_TYPES; type++) {
+		for (ddt_class_t class = 0; class < DDT_CLASSES; class++)
+			count += ddt->ddt_object_stats[type][class].ddo_count;
+	}
+	return (count);
+}
+
+static ddt_filter_t *
+ddt_filter_create(uint64_t entries)
+{
+	ddt_filter_t *ddf = kmem_zalloc(sizeof (ddt_filter_t), KM_SLEEP);
+	uint64_t max_blocks = MAX(1,
+	    zfs_dedup_filter_max_size / DDT_FILTER_BLOCK_BYTES);
+	uint64_t nblocks;
+
+	/* Leave room to double before it has to be rebuilt */
+	ddf->ddf_capacity = MAX(entries * 2, DDT_FILTER_MIN_ENTRIES);
+	nblocks = ddf->ddf_capacity * zfs_dedup_filter_bits_per_entry >>
+	    DDT_FILTER_BLOCK_SHIFT;
+	nblocks = 1ULL << highbit64(MAX(nblocks, 1) - 1);
+	if (nblocks > max_blocks) {
+		/* As big as it gets; growing the store won't rebuild it */
+		nblocks = 1ULL << (highbit64(max_blocks) - 1);
+		ddf->ddf_capacity = UINT64_MAX;
+	}
+
+	ddf->ddf_nblocks = nblocks;
+	ddf->ddf_bits = vmem_zalloc(nblocks * DDT_FILTER_BLOCK_BYTES,
+	    KM_SLEEP);
+	return (ddf);
+}
+
+static void
+ddt_filter_destroy(ddt_filter_t *ddf)
+{
+	vmem_free(ddf->ddf_bits, ddf->ddf_nblocks * DDT_FILTER_BLOCK_BYTES);
+	kmem_free(ddf, sizeof (ddt_filter_t));
+}
+
+/*
+ * Publish a new filter in place of the current one, if any.
+ */
+static void
+ddt_filter_replace(ddt_t *ddt, ddt_filter_t *ddf)
+{
+	rw_enter(&ddt->ddt_filter_lock, RW_WRITER);
+	ddt_filter_t *old = ddt->ddt_filter;
+	ddt->ddt_filter = ddf;
+	rw_exit(&ddt->ddt_filter_lock);
+
+	if (old != NULL)
+		ddt_filter_destroy(old);
+}
+
+/*
+ * Does this DDT need work from the zthr: a filter built, rebuilt larger,
+ * or dropped because the filter has been disabled? Outside the zthr, the
+ * caller must hold ddt_filter_lock.
+ */
+static boolean_t
+ddt_filter_needs_build(ddt_t *ddt)
+{
+	ddt_filter_t *ddf = ddt->ddt_filter;
+
+	if (ddt->ddt_version == DDT_VERSION_UNCONFIGURED)
+		return (B_FALSE);
+	if (zfs_dedup_filter_bits_per_entry == 0)
+		return (ddf != NULL);
+	if (ddf == NULL)
+		return (B_TRUE);
+	if (ddf->ddf_walk_error != 0)
+		return (B_FALSE);
+	if (!ddf->ddf_ready)
+		return (B_TRUE);
+	return (ddt_filter_store_entries(ddt) > ddf->ddf_capacity);
+}
+
+static void
+ddt_filter_build(ddt_t *ddt, zthr_t *zthr)
+{
+	ddt_filter_t *ddf = ddt->ddt_filter;
+
+	if (zfs_dedup_filter_bits_per_entry == 0) {
+		ddt_filter_replace(ddt, NULL);
+		return;
+	}
+
+	/*
+	 * The filter is published before the walk starts, so that keys added
+	 * to the store from here on go into it as they are written.
+	 */
+	if (ddf == NULL || (ddf->ddf_ready &&
+	    ddt_filter_store_entries(ddt) > ddf->ddf_capacity)) {
+		ddf = ddt_filter_create(ddt_filter_store_entries(ddt) +
+		    avl_numnodes(&ddt->ddt_log_active->ddl_tree) +
+		    avl_numnodes(&ddt->ddt_log_flushing->ddl_tree));
+		ddt_filter_replace(ddt, ddf);
+	}
+
+	/*
+	 * Only this thread replaces the filter, so ddf stays valid without
+	 * holding ddt_filter_lock.
+	 */
+	while (ddf->ddf_walk_type < DDT_TYPES) {
+		ddt_lightweight_entry_t ddlwe;
+
+		if (zthr_iscancelled(zthr))
+			return;
+
+		int error = ddt_object_walk(ddt, ddf->ddf_walk_type,
+		    ddf->ddf_walk_class, &ddf->ddf_walk_cursor, &ddlwe);
+		if (error == 0) {
+			ddt_filter_set(ddf, &ddlwe.ddlwe_key);
+			continue;
+		}
+		if (error != ENOENT) {
+			zfs_dbgmsg("ddt_filter_build: spa=%s ddt=%s type=%u "
+			    "class=%u walk failed, error=%d",
+			    spa_name(ddt->ddt_spa),
+			    zio_checksum_table[ddt->ddt_checksum].ci_name,
+			    ddf->ddf_walk_type, ddf->ddf_walk_class, error);
+			ddf->ddf_walk_error = error;
+			return;
+		}
+
+		ddf->ddf_walk_cursor = 0;
+		if (++ddf->ddf_walk_class == DDT_CLASSES) {
+			ddf->ddf_walk_class = 0;
+			ddf->ddf_walk_type++;
+		}
+	}
+
+	/* All bits set by the walk must be visible before the filter is used */
+	membar_producer();
+	ddf->ddf_ready = B_TRUE;
+}
+
+static boolean_t
+ddt_filter_check(void *arg, zthr_t *zthr)
+{
+	(void) zthr;
+	spa_t *spa = arg;
+
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		if (ddt != NULL && ddt_filter_needs_build(ddt))
+			return (B_TRUE);
+	}
+	return (B_FALSE);
+}
+
+static void
+ddt_filter_thread(void *arg, zthr_t *zthr)
+{
+	spa_t *spa = arg;
+
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+
+		if (zthr_iscancelled(zthr))
+			return;
+		if (ddt != NULL && ddt_filter_needs_build(ddt))
+			ddt_filter_build(ddt, zthr);
+	}
+}
+
+void
+spa_start_ddt_filter_thread(spa_t *spa)
+{
+	ASSERT0P(spa->spa_ddt_filter_zthr);
+	spa->spa_ddt_filter_zthr = zthr_create("z_ddt_filter",
+	    ddt_filter_check, ddt_filter_thread, spa, minclsyspri);
+}
+
+/*
+ * Called before a key is written to a store object.
+ */
+void
+ddt_filter_add(ddt_t *ddt, const ddt_key_t *ddk)
+{
+	rw_enter(&ddt->ddt_filter_lock, RW_READER);
+	if (ddt->ddt_filter != NULL)
+		ddt_filter_set(ddt->ddt_filter, ddk);
+	rw_exit(&ddt->ddt_filter_lock);
+}
+
+/*
+ * Returns B_FALSE if the key is definitely not in any store object, and
+ * B_TRUE if it may be, or if there is no usable filter.
+ */
+boolean_t
+ddt_filter_contains(ddt_t *ddt, const ddt_key_t *ddk)
+{
+	boolean_t contains = B_TRUE;
+
+	rw_enter(&ddt->ddt_filter_lock, RW_READER);
+	ddt_filter_t *ddf = ddt->ddt_filter;
+	if (ddf != NULL && ddf->ddf_ready) {
+		membar_consumer();
+		contains = ddt_filter_test(ddf, ddk);
+	}
+	rw_exit(&ddt->ddt_filter_lock);
+
+	return (contains);
+}
+
+/*
+ * Called each txg, to have the zthr (re)build the filter once the DDT has
+ * been configured or the store has outgrown it.
+ */
+void
+ddt_filter_wakeup(ddt_t *ddt)
+{
+	zthr_t *zthr = ddt->ddt_spa->spa_ddt_filter_zthr;
+
+	if (zthr == NULL)
+		return;
+
+	rw_enter(&ddt->ddt_filter_lock, RW_READER);
+	boolean_t needed = ddt_filter_needs_build(ddt);
+	rw_exit(&ddt->ddt_filter_lock);
+
+	if (needed)
+		zthr_wakeup(zthr);
+}
+
+void
+ddt_filter_alloc(ddt_t *ddt)
+{
+	rw_init(&ddt->ddt_filter_lock, NULL, RW_DEFAULT, NULL);
+}
+
+void
+ddt_filter_free(ddt_t *ddt)
+{
+	if (ddt->ddt_filter != NULL)
+		ddt_filter_destroy(ddt->ddt_filter);
+	ddt->ddt_filter = NULL;
+	rw_destroy(&ddt->ddt_filter_lock);
+}
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, filter_bits_per_entry, UINT, ZMOD_RW,
+	"Bits of dedup table filter per entry, 0 to disable");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, filter_max_size, U64, ZMOD_RW,
+	"Max memory for each dedup table filter");
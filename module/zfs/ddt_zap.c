@@ -188,8 +188,8 @@ ddt_zap_remove(dnode_t *dn, const ddt_key_t *ddk, dmu_tx_t *tx)
 }
 
 static int
-ddt_zap_walk(dnode_t *dn, uint64_t *walk, ddt_key_t *ddk,
-    void *phys, size_t psize)
+ddt_zap_walk(dnode_t *dn, uint64_t *walk, uint64_t start, uint64_t end,
+    ddt_key_t *ddk, void *phys, size_t psize)
 {
 	zap_cursor_t zc;
 	zap_attribute_t *za;
@@ -204,11 +204,20 @@ ddt_zap_walk(dnode_t *dn, uint64_t *walk, ddt_key_t *ddk,
 		 * scrub I/Os for each ZAP block that we read in, so
 		 * reading the ZAP is unlikely to be the bottleneck.
 		 */
-		zap_cursor_init_noprefetch_by_dnode(&zc, dn);
+		zap_cursor_init_hash_by_dnode(&zc, dn, start);
 	} else {
 		zap_cursor_init_serialized_by_dnode(&zc, dn, *walk);
 	}
 	if ((error = zap_cursor_retrieve(&zc, za)) == 0) {
+		/*
+		 * Entries are returned in hash order, so the first one past
+		 * the end of the requested range finishes the walk.
+		 */
+		if (end != 0 && zc.zc_hash >= end) {
+			error = SET_ERROR(ENOENT);
+			goto out;
+		}
+
 		uint64_t csize = za->za_num_integers;
 
 		ASSERT3U(za->za_integer_length, ==, 1);
@@ -229,6 +238,7 @@ ddt_zap_walk(dnode_t *dn, uint64_t *walk, ddt_key_t *ddk,
 		zap_cursor_advance(&zc);
 		*walk = zap_cursor_serialize(&zc);
 	}
+out:
 	zap_cursor_fini(&zc);
 	zap_attribute_free(za);
 	return (error);
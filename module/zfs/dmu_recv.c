@@ -76,6 +76,8 @@ static uint_t zfs_recv_queue_length = SPA_MAXBLOCKSIZE;
 static uint_t zfs_recv_queue_ff = 20;
 static uint_t zfs_recv_write_batch_size = 1024 * 1024;
 static uint_t zfs_recv_defer_batch_size = 32 * 1024 * 1024;
+static uint_t zfs_recv_writer_threads = 4;
+static uint_t zfs_recv_prefetch_bytes = 16 * 1024 * 1024;
 static int zfs_recv_best_effort_corrective = 0;
 
 static const void *const dmu_recv_tag = "dmu_recv_tag";
@@ -100,6 +102,7 @@ struct receive_record_arg {
 	abd_t *abd;
 	int payload_size;
 	uint64_t bytes_read; /* bytes read from stream when record created */
+	uint64_t pf_bytes; /* data prefetched ahead of this record */
 	boolean_t eos_marker; /* Marks the end of the stream */
 	bqueue_node_t node;
 };
@@ -114,6 +117,23 @@ typedef struct receive_defer_range {
 	uint64_t rdr_last;	/* last slot in the range (inclusive) */
 } receive_defer_range_t;
 
+/*
+ * A batch of WRITE records for one object, applied by a writer worker.  See
+ * receive_write_batch_dispatch().
+ */
+typedef struct receive_write_batch {
+	list_node_t rwb_node;
+	struct receive_writer_arg *rwb_rwa;
+	list_t rwb_records;
+	/* Resume position to save for the batch, at or before its start */
+	uint64_t rwb_object;
+	uint64_t rwb_offset;
+	uint64_t rwb_bytes;
+	/* Set once the batch was applied, in rwb_txg */
+	boolean_t rwb_done;
+	uint64_t rwb_txg;
+} receive_write_batch_t;
+
 struct receive_writer_arg {
 	objset_t *os;
 	boolean_t byteswap;
@@ -139,6 +159,7 @@ struct receive_writer_arg {
 	uint64_t last_offset;
 	uint64_t max_object; /* highest object ID referenced in stream */
 	uint64_t bytes_read; /* bytes read when current record created */
+	uint64_t *pf_bytes; /* drc_pf_bytes of the reading thread */
 
 	list_t write_batch;
 
@@ -169,11 +190,25 @@ struct receive_writer_arg {
 	uint64_t defer_first_bytes_read;
 	uint64_t defer_max_free_txg;
 	boolean_t defer_replaying;
+
+	/*
+	 * Writer workers applying write batches, one taskq per worker so
+	 * that the batches of an object are applied in order, and the
+	 * batches dispatched to them which may not have synced out yet.
+	 * wb_lock protects wb_outstanding, wb_err and the resume state.
+	 */
+	taskq_t **wb_taskqs;
+	uint_t wb_ntaskqs;
+	kmutex_t wb_lock;
+	list_t wb_outstanding;
+	int wb_err;
 };
 
 static int receive_process_record(struct receive_writer_arg *rwa,
     struct receive_record_arg *rrd);
 static int flush_write_batch(struct receive_writer_arg *rwa);
+static int receive_write_batch_wait(struct receive_writer_arg *rwa,
+    uint64_t first, uint64_t count);
 
 typedef struct dmu_recv_begin_arg {
 	const char *drba_origin;
@@ -662,6 +697,14 @@ recv_begin_check_feature_flags_impl(uint64_t featureflags, spa_t *spa)
 	    !spa_feature_is_enabled(spa, SPA_FEATURE_LONGNAME))
 		return (SET_ERROR(ENOTSUP));
 
+	/*
+	 * Deduplicated streams are never raw: blocks of a deduplicated stream
+	 * are written through the dbuf layer, which can't take raw records.
+	 */
+	if ((featureflags & DMU_BACKUP_FEATURE_DEDUP) &&
+	    (featureflags & DMU_BACKUP_FEATURE_RAW))
+		return (SET_ERROR(EINVAL));
+
 	return (0);
 }
 
@@ -1703,12 +1746,93 @@ deduce_nblkptr(dmu_object_type_t bonus_type, uint64_t bonus_size,
 	}
 }
 
+/*
+ * Free the write batches at the head of wb_outstanding which have synced
+ * out, and return the first one which may not have.
+ */
+static receive_write_batch_t *
+receive_write_batch_prune(struct receive_writer_arg *rwa)
+{
+	uint64_t synced = spa_last_synced_txg(dmu_objset_spa(rwa->os));
+	receive_write_batch_t *rwb;
+
+	ASSERT(MUTEX_HELD(&rwa->wb_lock));
+	while ((rwb = list_head(&rwa->wb_outstanding)) != NULL &&
+	    rwb->rwb_done && rwb->rwb_txg <= synced) {
+		list_remove(&rwa->wb_outstanding, rwb);
+		list_destroy(&rwb->rwb_records);
+		kmem_free(rwb, sizeof (*rwb));
+	}
+	return (rwb);
+}
+
+/*
+ * Record the resume position in the dataset for the txg of tx.  Write
+ * batches applied by the workers complete out of stream order, and in any
+ * txg, so while any of them has not synced out the position is pinned at
+ * the start of the first one: everything before it is on disk once the txg
+ * of tx is.  Records at or after the pin may be received again, which is
+ * supported.  A pinned position, including the defer pin passed in by the
+ * caller, never moves the saved one backwards; what was saved before in
+ * this txg was safe when it was saved, and stays so.
+ */
+static void
+save_resume_position(struct receive_writer_arg *rwa, uint64_t object,
+    uint64_t offset, uint64_t bytes, boolean_t pinned, dmu_tx_t *tx)
+{
+	dsl_dataset_t *ds = rwa->os->os_dsl_dataset;
+	int txgoff = dmu_tx_get_txg(tx) & TXG_MASK;
+	receive_write_batch_t *rwb;
+
+	mutex_enter(&rwa->wb_lock);
+	rwb = receive_write_batch_prune(rwa);
+	if (rwb != NULL && (rwb->rwb_object < object ||
+	    (rwb->rwb_object == object && rwb->rwb_offset < offset))) {
+		object = rwb->rwb_object;
+		offset = rwb->rwb_offset;
+		bytes = rwb->rwb_bytes;
+		pinned = B_TRUE;
+	}
+	if (pinned && (object < ds->ds_resume_object[txgoff] ||
+	    (object == ds->ds_resume_object[txgoff] &&
+	    offset < ds->ds_resume_offset[txgoff]))) {
+		mutex_exit(&rwa->wb_lock);
+		return;
+	}
+
+	/*
+	 * We use ds_resume_bytes[] != 0 to indicate that we need to
+	 * update this on disk, so it must not be 0.
+	 */
+	ASSERT(bytes != 0);
+
+	/*
+	 * We only resume from write records, which have a valid
+	 * (non-meta-dnode) object number.
+	 */
+	ASSERT(object != 0);
+
+	/*
+	 * For resuming to work correctly, we must receive records in order,
+	 * sorted by object,offset.  This is checked by the callers, but
+	 * assert it here for good measure.
+	 */
+	ASSERT3U(object, >=, ds->ds_resume_object[txgoff]);
+	ASSERT(object != ds->ds_resume_object[txgoff] ||
+	    offset >= ds->ds_resume_offset[txgoff]);
+
+	ds->ds_resume_object[txgoff] = object;
+	ds->ds_resume_offset[txgoff] = offset;
+	ds->ds_resume_bytes[txgoff] = bytes;
+	mutex_exit(&rwa->wb_lock);
+}
+
 static void
 save_resume_state(struct receive_writer_arg *rwa,
     uint64_t object, uint64_t offset, dmu_tx_t *tx)
 {
-	int txgoff = dmu_tx_get_txg(tx) & TXG_MASK;
 	uint64_t bytes = rwa->bytes_read;
+	boolean_t pinned = B_FALSE;
 
 	if (!rwa->resumable)
 		return;
@@ -1728,40 +1852,13 @@ save_resume_state(struct receive_writer_arg *rwa,
 	 * past records this receive never parked.
 	 */
 	if (rwa->defer_replaying || !list_is_empty(&rwa->defer_records)) {
-		if (rwa->defer_first_object <
-		    rwa->os->os_dsl_dataset->ds_resume_object[txgoff])
-			return;
 		object = rwa->defer_first_object;
 		offset = 0;
 		bytes = rwa->defer_first_bytes_read;
+		pinned = B_TRUE;
 	}
 
-	/*
-	 * We use ds_resume_bytes[] != 0 to indicate that we need to
-	 * update this on disk, so it must not be 0.
-	 */
-	ASSERT(bytes != 0);
-
-	/*
-	 * We only resume from write records, which have a valid
-	 * (non-meta-dnode) object number.
-	 */
-	ASSERT(object != 0);
-
-	/*
-	 * For resuming to work correctly, we must receive records in order,
-	 * sorted by object,offset.  This is checked by the callers, but
-	 * assert it here for good measure.
-	 */
-	ASSERT3U(object, >=, rwa->os->os_dsl_dataset->ds_resume_object[txgoff]);
-	ASSERT(object != rwa->os->os_dsl_dataset->ds_resume_object[txgoff] ||
-	    offset >= rwa->os->os_dsl_dataset->ds_resume_offset[txgoff]);
-	ASSERT3U(rwa->bytes_read, >=,
-	    rwa->os->os_dsl_dataset->ds_resume_bytes[txgoff]);
-
-	rwa->os->os_dsl_dataset->ds_resume_object[txgoff] = object;
-	rwa->os->os_dsl_dataset->ds_resume_offset[txgoff] = offset;
-	rwa->os->os_dsl_dataset->ds_resume_bytes[txgoff] = bytes;
+	save_resume_position(rwa, object, offset, bytes, pinned, tx);
 }
 
 static int
@@ -2660,6 +2757,94 @@ recv_check_drr_write_embedded(const struct drr_write_embedded *drrwe,
 	return (0);
 }
 
+/*
+ * Validate a DRR_WRITE_BYREF record before copying the block it refers to.
+ * Only references to a block written earlier in the same stream, as
+ * generated by a deduplicated send, are supported.
+ */
+int
+recv_check_drr_write_byref(const struct drr_write_byref *drrwb, spa_t *spa,
+    boolean_t raw, uint64_t featureflags, char *errbuf, size_t errbuflen)
+{
+	recv_check_limits_t limits;
+
+	recv_check_resolve_limits(spa, &limits);
+
+	if (raw) {
+		return (recv_check_fail(EINVAL, errbuf, errbuflen,
+		    "DRR_WRITE_BYREF is invalid on raw streams"));
+	}
+
+	if (!(featureflags & DMU_BACKUP_FEATURE_DEDUP)) {
+		return (recv_check_fail(EINVAL, errbuf, errbuflen,
+		    "DRR_WRITE_BYREF requires DMU_BACKUP_FEATURE_DEDUP"));
+	}
+
+	/* the referenced block must be in this stream */
+	if (drrwb->drr_refguid != drrwb->drr_toguid) {
+		return (recv_check_fail(EINVAL, errbuf, errbuflen,
+		    "DRR_WRITE_BYREF refers to another stream (guid %llx)",
+		    (u_longlong_t)drrwb->drr_refguid));
+	}
+
+	/* object numbers must be valid */
+	int err = recv_check_drr_object_id(drrwb->drr_object, errbuf,
+	    errbuflen);
+	if (err != 0)
+		return (err);
+
+	err = recv_check_drr_object_id(drrwb->drr_refobject, errbuf,
+	    errbuflen);
+	if (err != 0)
+		return (err);
+
+	err = recv_check_drr_size_min(drrwb->drr_length, SPA_MINBLOCKSIZE,
+	    errbuf, errbuflen, "DRR_WRITE_BYREF length");
+	if (err != 0)
+		return (err);
+
+	err = recv_check_drr_size_max(drrwb->drr_length,
+	    limits.rcl_maxblocksize, errbuf, errbuflen,
+	    "DRR_WRITE_BYREF length");
+	if (err != 0)
+		return (err);
+
+	/* blocks larger than SPA_OLD_MAXBLOCKSIZE require LARGE_BLOCKS */
+	if (drrwb->drr_length > SPA_OLD_MAXBLOCKSIZE &&
+	    !(featureflags & DMU_BACKUP_FEATURE_LARGE_BLOCKS)) {
+		return (recv_check_fail(EINVAL, errbuf, errbuflen,
+		    "DRR_WRITE_BYREF length %llu requires "
+		    "DMU_BACKUP_FEATURE_LARGE_BLOCKS",
+		    (u_longlong_t)drrwb->drr_length));
+	}
+
+	/* offset + length must not overflow uint64_t */
+	if (recv_u64_add_overflow(drrwb->drr_offset, drrwb->drr_length) ||
+	    recv_u64_add_overflow(drrwb->drr_refoffset, drrwb->drr_length)) {
+		return (recv_check_fail(EINVAL, errbuf, errbuflen,
+		    "DRR_WRITE_BYREF offset + length %llu overflows",
+		    (u_longlong_t)drrwb->drr_length));
+	}
+
+	/*
+	 * Records are sent in increasing object, offset order, so the
+	 * referenced block must come before this one.
+	 */
+	if (drrwb->drr_refobject > drrwb->drr_object ||
+	    (drrwb->drr_refobject == drrwb->drr_object &&
+	    drrwb->drr_refoffset + drrwb->drr_length > drrwb->drr_offset)) {
+		return (recv_check_fail(EINVAL, errbuf, errbuflen,
+		    "DRR_WRITE_BYREF refers to object %llu offset %llu, "
+		    "which is not before object %llu offset %llu",
+		    (u_longlong_t)drrwb->drr_refobject,
+		    (u_longlong_t)drrwb->drr_refoffset,
+		    (u_longlong_t)drrwb->drr_object,
+		    (u_longlong_t)drrwb->drr_offset));
+	}
+
+	return (0);
+}
+
 static int
 receive_defer_range_compare(const void *a, const void *b)
 {
@@ -2865,6 +3050,8 @@ receive_defer_flush(struct receive_writer_arg *rwa)
 		return (0);
 
 	err = flush_write_batch(rwa);
+	if (err == 0)
+		err = receive_write_batch_wait(rwa, 0, UINT64_MAX);
 	if (err != 0)
 		return (err);
 
@@ -3005,6 +3192,20 @@ receive_defer_check(struct receive_writer_arg *rwa,
 	case DRR_WRITE_EMBEDDED:
 		first = last = rrd->header.drr_u.drr_write_embedded.drr_object;
 		break;
+	case DRR_WRITE_BYREF:
+	{
+		struct drr_write_byref *drrwb =
+		    &rrd->header.drr_u.drr_write_byref;
+
+		/* The copy must also wait for the block it reads */
+		if (receive_defer_overlaps(rwa, drrwb->drr_refobject,
+		    drrwb->drr_refobject)) {
+			receive_defer_park(rwa, rrd, drrwb->drr_object);
+			return (EAGAIN);
+		}
+		first = last = drrwb->drr_object;
+		break;
+	}
 	case DRR_FREE:
 		first = last = rrd->header.drr_u.drr_free.drr_object;
 		break;
@@ -3639,32 +3840,52 @@ receive_freeobjects(struct receive_writer_arg *rwa,
 }
 
 /*
+ * Apply a batch of WRITE records for one object, either rwa->write_batch
+ * from the writer thread or that of rwb from a writer worker.
+ *
  * Note: if this fails, the caller will clean up any records left on the
- * rwa->write_batch list.
+ * batch list.
  */
 static int
-flush_write_batch_impl(struct receive_writer_arg *rwa)
+flush_write_batch_impl(struct receive_writer_arg *rwa, list_t *batch,
+    receive_write_batch_t *rwb)
 {
 	dnode_t *dn;
 	int err;
 
-	if (dnode_hold(rwa->os, rwa->last_object, FTAG, &dn) != 0)
-		return (SET_ERROR(EINVAL));
-
-	struct receive_record_arg *last_rrd = list_tail(&rwa->write_batch);
+	struct receive_record_arg *last_rrd = list_tail(batch);
 	struct drr_write *last_drrw = &last_rrd->header.drr_u.drr_write;
 
-	struct receive_record_arg *first_rrd = list_head(&rwa->write_batch);
+	struct receive_record_arg *first_rrd = list_head(batch);
 	struct drr_write *first_drrw = &first_rrd->header.drr_u.drr_write;
+	uint64_t object = first_drrw->drr_object;
+
+	if (dnode_hold(rwa->os, object, FTAG, &dn) != 0)
+		return (SET_ERROR(EINVAL));
 
-	ASSERT3U(rwa->last_object, ==, last_drrw->drr_object);
-	ASSERT3U(rwa->last_offset, ==, last_drrw->drr_offset);
+	ASSERT(rwb != NULL || rwa->last_object == last_drrw->drr_object);
+	ASSERT(rwb != NULL || rwa->last_offset == last_drrw->drr_offset);
 
 	if (last_drrw->drr_offset < first_drrw->drr_offset) {
 		dnode_rele(dn, FTAG);
 		return (SET_ERROR(EINVAL));
 	}
 
+	/*
+	 * Raw records must be written as is, which takes a lightweight write
+	 * covering exactly one block.
+	 */
+	if (rwa->raw) {
+		for (struct receive_record_arg *rrd = first_rrd; rrd != NULL;
+		    rrd = list_next(batch, rrd)) {
+			if (rrd->header.drr_u.drr_write.drr_logical_size !=
+			    dn->dn_datablksz) {
+				dnode_rele(dn, FTAG);
+				return (SET_ERROR(EINVAL));
+			}
+		}
+	}
+
 	uint64_t hold_len = last_drrw->drr_offset - first_drrw->drr_offset;
 
 	/* hold length + last logical size must not overflow uint64_t */
@@ -3683,14 +3904,19 @@ flush_write_batch_impl(struct receive_writer_arg *rwa)
 		return (err);
 	}
 
+	if (rwb != NULL)
+		rwb->rwb_txg = dmu_tx_get_txg(tx);
+
 	struct receive_record_arg *rrd;
-	while ((rrd = list_head(&rwa->write_batch)) != NULL) {
+	while ((rrd = list_head(batch)) != NULL) {
 		struct drr_write *drrw = &rrd->header.drr_u.drr_write;
 		abd_t *abd = rrd->abd;
 
-		ASSERT3U(drrw->drr_object, ==, rwa->last_object);
+		ASSERT3U(drrw->drr_object, ==, object);
 
-		if (drrw->drr_logical_size != dn->dn_datablksz) {
+		if (drrw->drr_logical_size != dn->dn_datablksz ||
+		    (rwa->featureflags & DMU_BACKUP_FEATURE_DEDUP)) {
+			ASSERT(!rwa->raw);
 			/*
 			 * The WRITE record size does not match the
 			 * object's block size.  This happens when the
@@ -3706,7 +3932,16 @@ flush_write_batch_impl(struct receive_writer_arg *rwa)
 			 * write is not possible (those must cover exactly
 			 * one block), so we decompress the data (if
 			 * compressed) and do a normal dmu_write().
+			 *
+			 * Blocks of a deduplicated stream go this way too:
+			 * a later DRR_WRITE_BYREF may read them back before
+			 * the txg syncs, and only a dbuf can serve that read.
+			 * Keep them cached for it.
 			 */
+			dmu_flags_t flags = DMU_READ_NO_PREFETCH;
+			if (!(rwa->featureflags & DMU_BACKUP_FEATURE_DEDUP))
+				flags |= DMU_UNCACHEDIO;
+
 			if (DRR_WRITE_COMPRESSED(drrw)) {
 				abd_t *decomp_abd =
 				    abd_alloc_linear(drrw->drr_logical_size,
@@ -3722,18 +3957,21 @@ flush_write_batch_impl(struct receive_writer_arg *rwa)
 					dmu_write_by_dnode(dn,
 					    drrw->drr_offset,
 					    drrw->drr_logical_size,
-					    abd_to_buf(decomp_abd), tx,
-					    DMU_READ_NO_PREFETCH |
-					    DMU_UNCACHEDIO);
+					    abd_to_buf(decomp_abd), tx, flags);
 				}
 				abd_free(decomp_abd);
 			} else {
+				if (rwa->byteswap) {
+					dmu_object_byteswap_t byteswap =
+					    DMU_OT_BYTESWAP(drrw->drr_type);
+					dmu_ot_byteswap[byteswap].ob_func(
+					    abd_to_buf(abd),
+					    drrw->drr_logical_size);
+				}
 				dmu_write_by_dnode(dn,
 				    drrw->drr_offset,
 				    drrw->drr_logical_size,
-				    abd_to_buf(abd), tx,
-				    DMU_READ_NO_PREFETCH |
-				    DMU_UNCACHEDIO);
+				    abd_to_buf(abd), tx, flags);
 			}
 			if (err == 0)
 				abd_free(abd);
@@ -3810,9 +4048,15 @@ flush_write_batch_impl(struct receive_writer_arg *rwa)
 		 * received (as opposed to the next record), so that we can
 		 * verify that we are resuming from the correct location.
 		 */
-		save_resume_state(rwa, drrw->drr_object, drrw->drr_offset, tx);
+		if (rwb == NULL) {
+			save_resume_state(rwa, drrw->drr_object,
+			    drrw->drr_offset, tx);
+		} else if (rwa->resumable) {
+			save_resume_position(rwa, drrw->drr_object,
+			    drrw->drr_offset, rrd->bytes_read, B_FALSE, tx);
+		}
 
-		list_remove(&rwa->write_batch, rrd);
+		list_remove(batch, rrd);
 		kmem_free(rrd, sizeof (*rrd));
 	}
 
@@ -3821,21 +4065,165 @@ flush_write_batch_impl(struct receive_writer_arg *rwa)
 	return (err);
 }
 
+static void
+free_write_batch_records(list_t *batch)
+{
+	struct receive_record_arg *rrd;
+
+	while ((rrd = list_remove_head(batch)) != NULL) {
+		abd_free(rrd->abd);
+		kmem_free(rrd, sizeof (*rrd));
+	}
+}
+
+/*
+ * Writer worker: apply a batch of WRITE records.  A batch which failed is
+ * left in wb_outstanding, not done, so that the resume position never moves
+ * past it.
+ */
+static void
+receive_write_batch_func(void *arg)
+{
+	receive_write_batch_t *rwb = arg;
+	struct receive_writer_arg *rwa = rwb->rwb_rwa;
+	fstrans_cookie_t cookie = spl_fstrans_mark();
+
+	mutex_enter(&rwa->wb_lock);
+	int err = rwa->wb_err;
+	mutex_exit(&rwa->wb_lock);
+
+	if (err == 0)
+		err = flush_write_batch_impl(rwa, &rwb->rwb_records, rwb);
+	if (err != 0)
+		free_write_batch_records(&rwb->rwb_records);
+
+	mutex_enter(&rwa->wb_lock);
+	if (err != 0 && rwa->wb_err == 0)
+		rwa->wb_err = err;
+	rwb->rwb_done = (err == 0);
+	mutex_exit(&rwa->wb_lock);
+
+	spl_fstrans_unmark(cookie);
+}
+
+/*
+ * Hand rwa->write_batch to a writer worker.  Batches are dispatched in
+ * stream order, and all batches of an object go to the same worker, which
+ * applies them in order; records which must be ordered after the writes to
+ * an object wait for its worker, see receive_write_batch_barrier().  The
+ * txg each batch lands in is thus only ordered with respect to the records
+ * for the same object.
+ */
+static void
+receive_write_batch_dispatch(struct receive_writer_arg *rwa)
+{
+	struct receive_record_arg *first_rrd = list_head(&rwa->write_batch);
+	struct drr_write *drrw = &first_rrd->header.drr_u.drr_write;
+	receive_write_batch_t *rwb = kmem_zalloc(sizeof (*rwb), KM_SLEEP);
+
+	rwb->rwb_rwa = rwa;
+	list_create(&rwb->rwb_records, sizeof (struct receive_record_arg),
+	    offsetof(struct receive_record_arg, node.bqn_node));
+	list_move_tail(&rwb->rwb_records, &rwa->write_batch);
+
+	/* See save_resume_state() for the defer pin. */
+	if (rwa->defer_replaying || receive_defer_active(rwa)) {
+		rwb->rwb_object = rwa->defer_first_object;
+		rwb->rwb_offset = 0;
+		rwb->rwb_bytes = rwa->defer_first_bytes_read;
+	} else {
+		rwb->rwb_object = drrw->drr_object;
+		rwb->rwb_offset = drrw->drr_offset;
+		rwb->rwb_bytes = first_rrd->bytes_read;
+	}
+
+	mutex_enter(&rwa->wb_lock);
+	(void) receive_write_batch_prune(rwa);
+	list_insert_tail(&rwa->wb_outstanding, rwb);
+	mutex_exit(&rwa->wb_lock);
+
+	VERIFY3U(taskq_dispatch(
+	    rwa->wb_taskqs[drrw->drr_object % rwa->wb_ntaskqs],
+	    receive_write_batch_func, rwb, TQ_SLEEP), !=, TASKQID_INVALID);
+}
+
+/*
+ * Wait for the write batches of objects [first, first + count) to be
+ * applied, and return the error of any batch that failed.
+ */
+static int
+receive_write_batch_wait(struct receive_writer_arg *rwa, uint64_t first,
+    uint64_t count)
+{
+	if (rwa->wb_ntaskqs == 0)
+		return (0);
+
+	count = MIN(count, rwa->wb_ntaskqs);
+	for (uint64_t i = 0; i < count; i++)
+		taskq_wait(rwa->wb_taskqs[(first + i) % rwa->wb_ntaskqs]);
+
+	mutex_enter(&rwa->wb_lock);
+	int err = rwa->wb_err;
+	mutex_exit(&rwa->wb_lock);
+	return (err);
+}
+
+/*
+ * Wait for the write batches a record other than a WRITE must be applied
+ * after: those of the objects it applies to, or all of them for records
+ * covering a range of objects.
+ */
+static int
+receive_write_batch_barrier(struct receive_writer_arg *rwa,
+    const dmu_replay_record_t *drr)
+{
+	switch (drr->drr_type) {
+	case DRR_OBJECT:
+		/* A claim also frees the dnodes in the slots it covers */
+		return (receive_write_batch_wait(rwa,
+		    drr->drr_u.drr_object.drr_object,
+		    MAX(drr->drr_u.drr_object.drr_dn_slots, 1)));
+	case DRR_WRITE_EMBEDDED:
+		return (receive_write_batch_wait(rwa,
+		    drr->drr_u.drr_write_embedded.drr_object, 1));
+	case DRR_WRITE_BYREF:
+	{
+		/* Both the block copied from and the one written to */
+		int err = receive_write_batch_wait(rwa,
+		    drr->drr_u.drr_write_byref.drr_refobject, 1);
+		if (err != 0)
+			return (err);
+		return (receive_write_batch_wait(rwa,
+		    drr->drr_u.drr_write_byref.drr_object, 1));
+	}
+	case DRR_FREE:
+		return (receive_write_batch_wait(rwa,
+		    drr->drr_u.drr_free.drr_object, 1));
+	case DRR_SPILL:
+		return (receive_write_batch_wait(rwa,
+		    drr->drr_u.drr_spill.drr_object, 1));
+	case DRR_REDACT:
+		return (receive_write_batch_wait(rwa,
+		    drr->drr_u.drr_redact.drr_object, 1));
+	default:
+		return (receive_write_batch_wait(rwa, 0, UINT64_MAX));
+	}
+}
+
 noinline static int
 flush_write_batch(struct receive_writer_arg *rwa)
 {
 	if (list_is_empty(&rwa->write_batch))
 		return (0);
 	int err = rwa->err;
-	if (err == 0)
-		err = flush_write_batch_impl(rwa);
-	if (err != 0) {
-		struct receive_record_arg *rrd;
-		while ((rrd = list_remove_head(&rwa->write_batch)) != NULL) {
-			abd_free(rrd->abd);
-			kmem_free(rrd, sizeof (*rrd));
-		}
+	if (err == 0 && rwa->wb_ntaskqs != 0) {
+		receive_write_batch_dispatch(rwa);
+		return (0);
 	}
+	if (err == 0)
+		err = flush_write_batch_impl(rwa, &rwa->write_batch, NULL);
+	if (err != 0)
+		free_write_batch_records(&rwa->write_batch);
 	ASSERT(list_is_empty(&rwa->write_batch));
 	return (err);
 }
@@ -3975,6 +4363,67 @@ receive_write_embedded(struct receive_writer_arg *rwa,
 	return (0);
 }
 
+/*
+ * Write a block with the same contents as one written earlier in the stream,
+ * by copying that block.  Records are applied in stream order and WRITE
+ * records of deduplicated streams go through dbufs, so the copy sees the
+ * earlier block even if it has not synced yet.
+ */
+static int
+receive_write_byref(struct receive_writer_arg *rwa,
+    struct drr_write_byref *drrwb)
+{
+	dmu_tx_t *tx;
+
+	/* Re-validate; stream errors are reported only by the reader. */
+	int err = recv_check_drr_write_byref(drrwb, dmu_objset_spa(rwa->os),
+	    rwa->raw, rwa->featureflags, NULL, 0);
+	if (err != 0)
+		return (err);
+
+	if (dmu_object_info(rwa->os, drrwb->drr_object, NULL) != 0)
+		return (SET_ERROR(EINVAL));
+
+	/* As for WRITE records, resuming needs increasing (object, offset). */
+	if (drrwb->drr_object < rwa->last_object ||
+	    (drrwb->drr_object == rwa->last_object &&
+	    drrwb->drr_offset < rwa->last_offset)) {
+		return (SET_ERROR(EINVAL));
+	}
+	rwa->last_object = drrwb->drr_object;
+	rwa->last_offset = drrwb->drr_offset;
+
+	if (drrwb->drr_object > rwa->max_object)
+		rwa->max_object = drrwb->drr_object;
+
+	void *buf = vmem_alloc(drrwb->drr_length, KM_SLEEP);
+	err = dmu_read(rwa->os, drrwb->drr_refobject, drrwb->drr_refoffset,
+	    drrwb->drr_length, buf, DMU_READ_NO_PREFETCH);
+	if (err != 0) {
+		vmem_free(buf, drrwb->drr_length);
+		return (err == ENOENT ? SET_ERROR(EINVAL) : err);
+	}
+
+	tx = dmu_tx_create(rwa->os);
+	dmu_tx_hold_write(tx, drrwb->drr_object, drrwb->drr_offset,
+	    drrwb->drr_length);
+	err = dmu_tx_assign(tx, DMU_TX_WAIT);
+	if (err != 0) {
+		dmu_tx_abort(tx);
+		vmem_free(buf, drrwb->drr_length);
+		return (err);
+	}
+
+	dmu_write(rwa->os, drrwb->drr_object, drrwb->drr_offset,
+	    drrwb->drr_length, buf, tx, DMU_READ_NO_PREFETCH);
+	vmem_free(buf, drrwb->drr_length);
+
+	/* See comment in restore_write. */
+	save_resume_state(rwa, drrwb->drr_object, drrwb->drr_offset, tx);
+	dmu_tx_commit(tx);
+	return (0);
+}
+
 static int
 receive_spill(struct receive_writer_arg *rwa, struct drr_spill *drrs,
     abd_t *abd)
@@ -4306,6 +4755,60 @@ receive_read_prefetch(dmu_recv_cookie_t *drc, uint64_t object, uint64_t offset,
 	}
 }
 
+/*
+ * A write record smaller than the block it lands in makes the writer thread
+ * read the existing block before modifying it, and wait for that read (see
+ * the dmu_write_by_dnode() fallback in flush_write_batch_impl()).  The
+ * records queued for the writer thread are a window into the stream ahead of
+ * it, so start reading the data blocks those writes modify as we queue them,
+ * and they will be cached by the time the writer gets to them.
+ *
+ * Prefetched blocks count against zfs_recv_prefetch_bytes until the writer
+ * thread dequeues the record which issued them, which bounds how much of the
+ * ARC a receive may fill ahead of itself; past that we skip the prefetch.
+ */
+static void
+receive_read_prefetch_partial(dmu_recv_cookie_t *drc, struct drr_write *drrw)
+{
+	uint64_t object = drrw->drr_object;
+
+	/*
+	 * Unlike the indirect block prefetch, this ignores the object ignore
+	 * list: the block size changing is what makes a write partial, and
+	 * we look up the block size the object has in the dataset.
+	 */
+	if (drc->drc_heal || drc->drc_drrb->drr_fromguid == 0 ||
+	    zfs_recv_prefetch_bytes == 0)
+		return;
+
+	if (object != drc->drc_pf_object) {
+		dmu_object_info_t doi;
+
+		drc->drc_pf_object = object;
+		drc->drc_pf_blkid = UINT64_MAX;
+		drc->drc_pf_blksz = 0;
+		if (dmu_object_info(drc->drc_os, object, &doi) == 0)
+			drc->drc_pf_blksz = doi.doi_data_block_size;
+	}
+
+	uint64_t blksz = drc->drc_pf_blksz;
+	if (blksz == 0 || drrw->drr_logical_size >= blksz)
+		return;
+
+	/* The following writes to this block will find it cached too. */
+	uint64_t blkid = drrw->drr_offset / blksz;
+	if (blkid == drc->drc_pf_blkid ||
+	    atomic_load_64(&drc->drc_pf_bytes) + blksz >
+	    zfs_recv_prefetch_bytes)
+		return;
+
+	drc->drc_pf_blkid = blkid;
+	drc->drc_rrd->pf_bytes = blksz;
+	atomic_add_64(&drc->drc_pf_bytes, blksz);
+	dmu_prefetch(drc->drc_os, object, 0, blkid * blksz, blksz,
+	    ZIO_PRIORITY_ASYNC_READ);
+}
+
 /*
  * Read records off the stream, issuing any necessary prefetches.
  */
@@ -4399,6 +4902,7 @@ receive_read_record(dmu_recv_cookie_t *drc)
 		drc->drc_rrd->abd = abd;
 		receive_read_prefetch(drc, drrw->drr_object, drrw->drr_offset,
 		    drrw->drr_logical_size);
+		receive_read_prefetch_partial(drc, drrw);
 		return (err);
 	}
 	case DRR_WRITE_EMBEDDED:
@@ -4430,6 +4934,26 @@ receive_read_record(dmu_recv_cookie_t *drc)
 		    drrwe->drr_length);
 		return (err);
 	}
+	case DRR_WRITE_BYREF:
+	{
+		struct drr_write_byref *drrwb =
+		    &drc->drc_rrd->header.drr_u.drr_write_byref;
+
+		/* Reject malformed DRR_WRITE_BYREF before advancing stream. */
+		int err = recv_check_drr_write_byref(drrwb, drc->drc_os->os_spa,
+		    drc->drc_raw, drc->drc_featureflags, errbuf,
+		    sizeof (errbuf));
+
+		if (err != 0) {
+			recv_report_stream_error(drc->drc_errors, errbuf);
+			return (err);
+		}
+
+		err = receive_read_payload_and_next_header(drc, 0, NULL);
+		receive_read_prefetch(drc, drrwb->drr_object, drrwb->drr_offset,
+		    drrwb->drr_length);
+		return (err);
+	}
 	case DRR_FREE:
 	case DRR_REDACT:
 	{
@@ -4660,6 +5184,8 @@ receive_process_record(struct receive_writer_arg *rwa,
 
 	if (!rwa->heal && rrd->header.drr_type != DRR_WRITE) {
 		err = flush_write_batch(rwa);
+		if (err == 0)
+			err = receive_write_batch_barrier(rwa, &rrd->header);
 		if (err != 0) {
 			if (rrd->abd != NULL) {
 				abd_free(rrd->abd);
@@ -4731,6 +5257,13 @@ receive_process_record(struct receive_writer_arg *rwa,
 		rrd->payload = NULL;
 		break;
 	}
+	case DRR_WRITE_BYREF:
+	{
+		struct drr_write_byref *drrwb =
+		    &rrd->header.drr_u.drr_write_byref;
+		err = receive_write_byref(rwa, drrwb);
+		break;
+	}
 	case DRR_FREE:
 	{
 		struct drr_free *drrf = &rrd->header.drr_u.drr_free;
@@ -4770,6 +5303,29 @@ receive_process_record(struct receive_writer_arg *rwa,
 	return (err);
 }
 
+/*
+ * Tear down the writer workers, once the writer thread waited for them.
+ */
+static void
+receive_write_batch_fini(struct receive_writer_arg *rwa)
+{
+	receive_write_batch_t *rwb;
+
+	for (uint_t i = 0; i < rwa->wb_ntaskqs; i++)
+		taskq_destroy(rwa->wb_taskqs[i]);
+	if (rwa->wb_taskqs != NULL) {
+		kmem_free(rwa->wb_taskqs,
+		    rwa->wb_ntaskqs * sizeof (taskq_t *));
+	}
+	while ((rwb = list_remove_head(&rwa->wb_outstanding)) != NULL) {
+		ASSERT(list_is_empty(&rwb->rwb_records));
+		list_destroy(&rwb->rwb_records);
+		kmem_free(rwb, sizeof (*rwb));
+	}
+	list_destroy(&rwa->wb_outstanding);
+	mutex_destroy(&rwa->wb_lock);
+}
+
 /*
  * dmu_recv_stream's worker thread; pull records off the queue, and then call
  * receive_process_record  When we're done, signal the main thread and exit.
@@ -4789,6 +5345,13 @@ receive_writer_thread(void *arg)
 		 * can exit.
 		 */
 		int err = 0;
+		if (rrd->pf_bytes != 0)
+			atomic_sub_64(rwa->pf_bytes, rrd->pf_bytes);
+		if (rwa->err == 0 && rwa->wb_ntaskqs != 0) {
+			mutex_enter(&rwa->wb_lock);
+			rwa->err = rwa->wb_err;
+			mutex_exit(&rwa->wb_lock);
+		}
 		if (rwa->err == 0) {
 			err = receive_process_record(rwa, rrd);
 		} else if (rrd->abd != NULL) {
@@ -4826,6 +5389,9 @@ receive_writer_thread(void *arg)
 		err = flush_write_batch(rwa);
 		if (rwa->err == 0)
 			rwa->err = err;
+		err = receive_write_batch_wait(rwa, 0, UINT64_MAX);
+		if (rwa->err == 0)
+			rwa->err = err;
 	}
 	receive_defer_cleanup(rwa);
 	mutex_enter(&rwa->mutex);
@@ -4972,6 +5538,7 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, offset_t *voffp)
 	rwa->spill = drc->drc_spill;
 	rwa->featureflags = drc->drc_featureflags;
 	rwa->full = (drc->drc_drr_begin->drr_u.drr_begin.drr_fromguid == 0);
+	rwa->pf_bytes = &drc->drc_pf_bytes;
 	rwa->os->os_raw_receive = drc->drc_raw;
 	if (drc->drc_heal) {
 		rwa->heal_pio = zio_root(drc->drc_os->os_spa, NULL, NULL,
@@ -4984,6 +5551,18 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, offset_t *voffp)
 	avl_create(&rwa->defer_ranges, receive_defer_range_compare,
 	    sizeof (receive_defer_range_t),
 	    offsetof(receive_defer_range_t, rdr_node));
+	mutex_init(&rwa->wb_lock, NULL, MUTEX_DEFAULT, NULL);
+	list_create(&rwa->wb_outstanding, sizeof (receive_write_batch_t),
+	    offsetof(receive_write_batch_t, rwb_node));
+	if (!rwa->heal && zfs_recv_writer_threads > 0) {
+		rwa->wb_ntaskqs = zfs_recv_writer_threads;
+		rwa->wb_taskqs = kmem_alloc(rwa->wb_ntaskqs *
+		    sizeof (taskq_t *), KM_SLEEP);
+		for (uint_t i = 0; i < rwa->wb_ntaskqs; i++) {
+			rwa->wb_taskqs[i] = taskq_create("recv_writer", 1,
+			    minclsyspri, 1, INT_MAX, TASKQ_PREPOPULATE);
+		}
+	}
 
 	(void) thread_create(NULL, 0, receive_writer_thread, rwa, 0, curproc,
 	    TS_RUN, minclsyspri);
@@ -5070,6 +5649,7 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, offset_t *voffp)
 	cv_destroy(&rwa->cv);
 	mutex_destroy(&rwa->mutex);
 	bqueue_destroy(&rwa->q);
+	receive_write_batch_fini(rwa);
 	list_destroy(&rwa->write_batch);
 	list_destroy(&rwa->defer_records);
 	avl_destroy(&rwa->defer_ranges);
@@ -5441,5 +6021,11 @@ ZFS_MODULE_PARAM(zfs_recv, zfs_recv_, defer_batch_size, UINT, ZMOD_RW,
 	"Maximum bytes of records parked behind one txg sync while "
 	"receiving reallocated dnodes (0 to sync per object)");
 
+ZFS_MODULE_PARAM(zfs_recv, zfs_recv_, writer_threads, UINT, ZMOD_RW,
+	"Number of threads per receive applying writes to distinct objects");
+
+ZFS_MODULE_PARAM(zfs_recv, zfs_recv_, prefetch_bytes, UINT, ZMOD_RW,
+	"Maximum bytes of blocks prefetched ahead of partial block writes");
+
 ZFS_MODULE_PARAM(zfs_recv, zfs_recv_, best_effort_corrective, INT, ZMOD_RW,
 	"Ignore errors during corrective receive");
@@ -95,6 +95,22 @@ static uint_t zfs_send_no_prefetch_queue_length = 1024 * 1024;
 static uint_t zfs_send_queue_ff = 20;
 static uint_t zfs_send_no_prefetch_queue_ff = 20;
 
+/*
+ * Number of threads per send issuing the reads of the data to send.  Finding
+ * or reading a block in the ARC, decompressing it and setting up the zio for
+ * it otherwise all happen on the single send_reader_thread, which limits a
+ * send of many small blocks to what one CPU can do.  Setting this to 0 issues
+ * the reads from the send_reader_thread itself.
+ */
+static uint_t zfs_send_reader_threads = 4;
+
+/*
+ * Memory, in bytes, for the table of blocks already sent that a deduplicated
+ * send (zfs send -D) looks repeated blocks up in.  Once it is full, the
+ * oldest entries are replaced.
+ */
+static uint_t zfs_send_dedup_table_size = 32 * 1024 * 1024;
+
 /*
  * Use this to override the recordsize calculation for fast zfs send estimates.
  */
@@ -223,8 +239,32 @@ typedef struct dmu_send_cookie {
 	uint64_t dsc_resume_offset;
 	boolean_t dsc_sent_begin;
 	boolean_t dsc_sent_end;
+	struct send_dedup_table *dsc_dedup;
 } dmu_send_cookie_t;
 
+/*
+ * A block sent in a WRITE record of a deduplicated stream, which later
+ * blocks with the same contents are sent as references to.  The key is the
+ * block's checksum, when that is dedup-capable, or else the SHA-256 of the
+ * payload sent for it, together with the checksum type and the sizes and
+ * compression the checksum applies to.
+ */
+typedef struct send_dedup_entry {
+	avl_node_t	sde_avl;
+	list_node_t	sde_node;
+	ddt_key_t	sde_key;
+	uint8_t		sde_checksumtype;
+	uint64_t	sde_object;
+	uint64_t	sde_offset;
+} send_dedup_entry_t;
+
+typedef struct send_dedup_table {
+	avl_tree_t	sdt_tree;
+	list_t		sdt_list;	/* oldest first */
+	uint64_t	sdt_count;
+	uint64_t	sdt_max;
+} send_dedup_table_t;
+
 static int do_dump(dmu_send_cookie_t *dscp, struct send_range *range);
 
 static void
@@ -454,6 +494,127 @@ dump_redact(dmu_send_cookie_t *dscp, uint64_t object, uint64_t offset,
 	return (0);
 }
 
+static int
+send_dedup_compare(const void *x1, const void *x2)
+{
+	const send_dedup_entry_t *sde1 = x1;
+	const send_dedup_entry_t *sde2 = x2;
+
+	int cmp = TREE_CMP(sde1->sde_checksumtype, sde2->sde_checksumtype);
+	if (cmp != 0)
+		return (cmp);
+	return (ddt_key_compare(&sde1->sde_key, &sde2->sde_key));
+}
+
+static send_dedup_table_t *
+send_dedup_create(void)
+{
+	send_dedup_table_t *sdt = kmem_zalloc(sizeof (*sdt), KM_SLEEP);
+
+	avl_create(&sdt->sdt_tree, send_dedup_compare,
+	    sizeof (send_dedup_entry_t), offsetof(send_dedup_entry_t, sde_avl));
+	list_create(&sdt->sdt_list, sizeof (send_dedup_entry_t),
+	    offsetof(send_dedup_entry_t, sde_node));
+	sdt->sdt_max = MAX(zfs_send_dedup_table_size /
+	    sizeof (send_dedup_entry_t), 1);
+	return (sdt);
+}
+
+static void
+send_dedup_destroy(send_dedup_table_t *sdt)
+{
+	send_dedup_entry_t *sde;
+
+	while ((sde = list_remove_head(&sdt->sdt_list)) != NULL) {
+		avl_remove(&sdt->sdt_tree, sde);
+		kmem_free(sde, sizeof (*sde));
+	}
+	avl_destroy(&sdt->sdt_tree);
+	list_destroy(&sdt->sdt_list);
+	kmem_free(sdt, sizeof (*sdt));
+}
+
+/*
+ * Look up the block about to be sent in the WRITE record in dsc_drr, with
+ * the given payload.  Returns the entry of an earlier block with the same
+ * contents, or NULL after adding this block to the table.
+ */
+static const send_dedup_entry_t *
+send_dedup_lookup(dmu_send_cookie_t *dscp, const void *data,
+    uint64_t payload_size)
+{
+	send_dedup_table_t *sdt = dscp->dsc_dedup;
+	struct drr_write *drrw = &(dscp->dsc_drr->drr_u.drr_write);
+	send_dedup_entry_t search;
+	avl_index_t where;
+
+	if (drrw->drr_flags & DRR_CHECKSUM_DEDUP) {
+		search.sde_key = drrw->drr_key;
+		search.sde_checksumtype = drrw->drr_checksumtype;
+	} else {
+		abd_t *abd = abd_get_from_buf((void *)data, payload_size);
+		abd_checksum_sha256(abd, payload_size, NULL,
+		    &search.sde_key.ddk_cksum);
+		abd_free(abd);
+		search.sde_key.ddk_prop = 0;
+		DDK_SET_LSIZE(&search.sde_key, drrw->drr_logical_size);
+		DDK_SET_PSIZE(&search.sde_key, payload_size);
+		DDK_SET_COMPRESS(&search.sde_key, drrw->drr_compressiontype);
+		search.sde_checksumtype = ZIO_CHECKSUM_SHA256;
+	}
+
+	send_dedup_entry_t *sde = avl_find(&sdt->sdt_tree, &search, &where);
+	if (sde != NULL)
+		return (sde);
+
+	if (sdt->sdt_count == sdt->sdt_max) {
+		sde = list_remove_head(&sdt->sdt_list);
+		avl_remove(&sdt->sdt_tree, sde);
+		/* The removal may have moved where we insert */
+		VERIFY0P(avl_find(&sdt->sdt_tree, &search, &where));
+	} else {
+		sde = kmem_alloc(sizeof (*sde), KM_SLEEP);
+		sdt->sdt_count++;
+	}
+	sde->sde_key = search.sde_key;
+	sde->sde_checksumtype = search.sde_checksumtype;
+	sde->sde_object = drrw->drr_object;
+	sde->sde_offset = drrw->drr_offset;
+	avl_insert(&sdt->sdt_tree, sde, where);
+	list_insert_tail(&sdt->sdt_list, sde);
+	return (NULL);
+}
+
+/*
+ * Send a block with the same contents as one sent earlier in this stream as
+ * a reference to that block.  The receiver copies the data from where it
+ * wrote the earlier block.
+ */
+static int
+dump_write_byref(dmu_send_cookie_t *dscp, uint64_t object, uint64_t offset,
+    uint64_t length, const send_dedup_entry_t *sde)
+{
+	struct drr_write_byref *drrwbr =
+	    &(dscp->dsc_drr->drr_u.drr_write_byref);
+
+	memset(dscp->dsc_drr, 0, sizeof (dmu_replay_record_t));
+	dscp->dsc_drr->drr_type = DRR_WRITE_BYREF;
+	drrwbr->drr_object = object;
+	drrwbr->drr_offset = offset;
+	drrwbr->drr_length = length;
+	drrwbr->drr_toguid = dscp->dsc_toguid;
+	drrwbr->drr_refguid = dscp->dsc_toguid;
+	drrwbr->drr_refobject = sde->sde_object;
+	drrwbr->drr_refoffset = sde->sde_offset;
+	drrwbr->drr_checksumtype = sde->sde_checksumtype;
+	drrwbr->drr_flags = DRR_CHECKSUM_DEDUP;
+	drrwbr->drr_key = sde->sde_key;
+
+	if (dump_record(dscp, NULL, 0) != 0)
+		return (SET_ERROR(EINTR));
+	return (0);
+}
+
 static int
 dmu_dump_write(dmu_send_cookie_t *dscp, dmu_object_type_t type, uint64_t object,
     uint64_t offset, int lsize, int psize, const blkptr_t *bp,
@@ -556,6 +717,16 @@ dmu_dump_write(dmu_send_cookie_t *dscp, dmu_object_type_t type, uint64_t object,
 		drrw->drr_key.ddk_cksum = bp->blk_cksum;
 	}
 
+	/* data is NULL for dry runs, which don't need to find duplicates */
+	if (dscp->dsc_dedup != NULL && data != NULL &&
+	    !DMU_OT_IS_METADATA(type)) {
+		const send_dedup_entry_t *sde =
+		    send_dedup_lookup(dscp, data, payload_size);
+		if (sde != NULL)
+			return (dump_write_byref(dscp, object, offset, lsize,
+			    sde));
+	}
+
 	if (dump_record(dscp, data, payload_size) != 0)
 		return (SET_ERROR(EINTR));
 	return (0);
@@ -1558,6 +1729,13 @@ send_merge_thread(void *arg)
 	thread_exit();
 }
 
+/*
+ * Data ranges are handed to the reader workers in batches of consecutive
+ * ranges, which therefore cover disjoint ranges of objects.
+ */
+#define	SEND_READ_BATCH_RANGES	32
+#define	SEND_READ_BATCH_BYTES	(1024 * 1024)
+
 struct send_reader_thread_arg {
 	struct send_merge_thread_arg *smta;
 	bqueue_t q;
@@ -1565,6 +1743,17 @@ struct send_reader_thread_arg {
 	boolean_t issue_reads;
 	uint64_t featureflags;
 	int error;
+	taskq_t *taskq;
+	/* Batch of ranges not yet handed to the workers nor queued */
+	struct send_range *pending[SEND_READ_BATCH_RANGES];
+	uint_t npending;
+	uint64_t pending_bytes;
+};
+
+struct send_read_batch {
+	struct send_reader_thread_arg *srta;
+	uint_t count;
+	struct send_range *ranges[];
 };
 
 static void
@@ -1585,7 +1774,12 @@ dmu_send_read_done(zio_t *zio)
 	mutex_exit(&range->sru.data.lock);
 }
 
-static void
+/*
+ * Look up or start reading the data of a DATA range.  Returns B_TRUE if a
+ * zio was issued, which clears io_outstanding when it completes.  Use
+ * send_read_issue() rather than calling this directly.
+ */
+static boolean_t
 issue_data_read(struct send_reader_thread_arg *srta, struct send_range *range)
 {
 	struct srd *srdp = &range->sru.data;
@@ -1632,11 +1826,11 @@ issue_data_read(struct send_reader_thread_arg *srta, struct send_range *range)
 	    BP_GET_PSIZE(bp) : BP_GET_LSIZE(bp);
 
 	if (!srta->issue_reads)
-		return;
+		return (B_FALSE);
 	if (BP_IS_REDACTED(bp))
-		return;
+		return (B_FALSE);
 	if (send_do_embed(bp, srta->featureflags))
-		return;
+		return (B_FALSE);
 
 	zbookmark_phys_t zb = {
 	    .zb_objset = dmu_objset_id(os),
@@ -1658,11 +1852,105 @@ issue_data_read(struct send_reader_thread_arg *srta, struct send_range *range)
 	 */
 	if (arc_err != 0) {
 		srdp->abd = abd_alloc_linear(srdp->datasz, B_FALSE);
-		srdp->io_outstanding = B_TRUE;
 		zio_nowait(zio_read(NULL, os->os_spa, bp, srdp->abd,
 		    srdp->datasz, dmu_send_read_done, range,
 		    ZIO_PRIORITY_ASYNC_READ, zioflags, &zb));
+		return (B_TRUE);
+	}
+	return (B_FALSE);
+}
+
+/*
+ * Issue the read of a DATA range, which was set up with io_outstanding set
+ * before it could be seen by the main thread.  This clears io_outstanding
+ * unless a zio was issued, which will clear it instead.  Once it is cleared
+ * the range may be freed by the main thread, so it must not be referenced
+ * anymore.
+ */
+static void
+send_read_issue(struct send_reader_thread_arg *srta, struct send_range *range)
+{
+	ASSERT(range->sru.data.io_outstanding);
+	if (issue_data_read(srta, range))
+		return;
+
+	mutex_enter(&range->sru.data.lock);
+	range->sru.data.io_outstanding = B_FALSE;
+	cv_broadcast(&range->sru.data.cv);
+	mutex_exit(&range->sru.data.lock);
+}
+
+/*
+ * Reader worker: issue the reads of a batch of ranges.
+ */
+static void
+send_read_batch_func(void *arg)
+{
+	struct send_read_batch *srb = arg;
+	fstrans_cookie_t cookie = spl_fstrans_mark();
+
+	for (uint_t i = 0; i < srb->count; i++)
+		send_read_issue(srb->srta, srb->ranges[i]);
+
+	kmem_free(srb, offsetof(struct send_read_batch, ranges[srb->count]));
+	spl_fstrans_unmark(cookie);
+}
+
+/*
+ * Hand the pending batch of ranges to a reader worker and queue them for the
+ * main thread.  The batch is dispatched first, as the main thread may be
+ * waiting for the first of them while we block on a full queue.
+ */
+static void
+send_reader_flush(struct send_reader_thread_arg *srta, bqueue_t *q)
+{
+	uint_t count = srta->npending;
+
+	if (count == 0)
+		return;
+
+	struct send_read_batch *srb = kmem_alloc(
+	    offsetof(struct send_read_batch, ranges[count]), KM_SLEEP);
+	srb->srta = srta;
+	srb->count = count;
+	memcpy(srb->ranges, srta->pending, count * sizeof (srta->pending[0]));
+	VERIFY3U(taskq_dispatch(srta->taskq, send_read_batch_func, srb,
+	    TQ_SLEEP), !=, TASKQID_INVALID);
+
+	srta->npending = 0;
+	srta->pending_bytes = 0;
+	for (uint_t i = 0; i < count; i++) {
+		bqueue_enqueue(q, srta->pending[i],
+		    srta->pending[i]->sru.data.datablksz);
+	}
+}
+
+/*
+ * Queue a range for the main thread, issuing the read of its data first if
+ * it is a DATA range.  With reader workers, DATA ranges are batched up and
+ * their reads issued by the workers; the ranges are still queued in order,
+ * so the stream does not need to be reassembled.
+ */
+static void
+send_reader_enqueue(struct send_reader_thread_arg *srta, bqueue_t *q,
+    struct send_range *range, uint64_t size)
+{
+	if (range->type == DATA)
+		range->sru.data.io_outstanding = B_TRUE;
+
+	if (range->type == DATA && srta->taskq != NULL) {
+		srta->pending[srta->npending++] = range;
+		srta->pending_bytes += size;
+		if (srta->npending == SEND_READ_BATCH_RANGES ||
+		    srta->pending_bytes >= SEND_READ_BATCH_BYTES)
+			send_reader_flush(srta, q);
+		return;
 	}
+
+	send_reader_flush(srta, q);
+	if (range->type == DATA)
+		send_read_issue(srta, range);
+	bqueue_enqueue(q, range, size);
 }
 
 /*
@@ -1692,7 +1980,6 @@ enqueue_range(struct send_reader_thread_arg *srta, bqueue_t *q, dnode_t *dn,
 		range->sru.data.datablksz = datablksz;
 		range->sru.data.obj_type = dn->dn_type;
 		range->sru.data.bp = *bp;
-		issue_data_read(srta, range);
 		break;
 	case REDACT:
 		range->sru.redact.datablksz = datablksz;
@@ -1700,7 +1987,7 @@ enqueue_range(struct send_reader_thread_arg *srta, bqueue_t *q, dnode_t *dn,
 	default:
 		break;
 	}
-	bqueue_enqueue(q, range, datablksz);
+	send_reader_enqueue(srta, q, range, datablksz);
 }
 
 /*
@@ -1736,7 +2023,8 @@ piggyback_unmodified_spill(struct send_reader_thread_arg *srta,
 	spill_range->sru.data.obj_type = dnp->dn_type;
 	spill_range->sru.data.datablksz = BP_GET_LSIZE(bp);
 
-	issue_data_read(srta, spill_range);
+	spill_range->sru.data.io_outstanding = B_TRUE;
+	send_read_issue(srta, spill_range);
 	range->sru.object.spill_range = spill_range;
 
 	return (BP_GET_LSIZE(bp));
@@ -1776,8 +2064,8 @@ send_reader_thread(void *arg)
 		uint64_t spill = 0;
 		switch (range->type) {
 		case DATA:
-			issue_data_read(srta, range);
-			bqueue_enqueue(outq, range, range->sru.data.datablksz);
+			send_reader_enqueue(srta, outq, range,
+			    range->sru.data.datablksz);
 			range = get_next_range_nofree(inq, range);
 			break;
 		case OBJECT:
@@ -1786,7 +2074,8 @@ send_reader_thread(void *arg)
 		case HOLE:
 		case OBJECT_RANGE:
 		case REDACT: // Redacted blocks must exist
-			bqueue_enqueue(outq, range, sizeof (*range) + spill);
+			send_reader_enqueue(srta, outq, range,
+			    sizeof (*range) + spill);
 			range = get_next_range_nofree(inq, range);
 			break;
 		case PREVIOUSLY_REDACTED: {
@@ -1911,6 +2200,7 @@ send_reader_thread(void *arg)
 	while (!range->eos_marker)
 		range = get_next_range(inq, range);
 
+	send_reader_flush(srta, outq);
 	bqueue_enqueue_flush(outq, range, 1);
 	spl_fstrans_unmark(cookie);
 	thread_exit();
@@ -1937,6 +2227,7 @@ struct dmu_send_params {
 	boolean_t compressok;
 	boolean_t rawok;
 	boolean_t savedok;
+	boolean_t dedupok;
 	uint64_t resumeobj;
 	uint64_t resumeoff;
 	uint64_t saved_guid;
@@ -1985,6 +2276,10 @@ setup_featureflags(struct dmu_send_params *dspp, objset_t *os,
 	if (dspp->rawok && os->os_encrypted)
 		*featureflags |= DMU_BACKUP_FEATURE_RAW;
 
+	/* raw WRITE records carry per-block encryption parameters */
+	if (dspp->dedupok && !(*featureflags & DMU_BACKUP_FEATURE_RAW))
+		*featureflags |= DMU_BACKUP_FEATURE_DEDUP;
+
 	if ((*featureflags &
 	    (DMU_BACKUP_FEATURE_EMBED_DATA | DMU_BACKUP_FEATURE_COMPRESSED |
 	    DMU_BACKUP_FEATURE_RAW)) != 0 &&
@@ -2167,6 +2462,11 @@ setup_reader_thread(struct send_reader_thread_arg *srt_arg,
 	srt_arg->smta = smt_arg;
 	srt_arg->issue_reads = !dspp->dso->dso_dryrun;
 	srt_arg->featureflags = featureflags;
+	uint_t nthreads = zfs_send_reader_threads;
+	if (srt_arg->issue_reads && nthreads > 0) {
+		srt_arg->taskq = taskq_create("send_reader", nthreads,
+		    minclsyspri, nthreads, INT_MAX, TASKQ_PREPOPULATE);
+	}
 	(void) thread_create(NULL, 0, send_reader_thread, srt_arg, 0,
 	    curproc, TS_RUN, minclsyspri);
 }
@@ -2502,6 +2802,8 @@ dmu_send_impl(struct dmu_send_params *dspp)
 	dsc.dsc_featureflags = featureflags;
 	dsc.dsc_resume_object = dspp->resumeobj;
 	dsc.dsc_resume_offset = dspp->resumeoff;
+	if (featureflags & DMU_BACKUP_FEATURE_DEDUP)
+		dsc.dsc_dedup = send_dedup_create();
 
 	dsl_pool_rele(dp, tag);
 
@@ -2621,6 +2923,12 @@ dmu_send_impl(struct dmu_send_params *dspp)
 	}
 	range_free(range);
 
+	/*
+	 * All data ranges were freed, which waited for their reads, but the
+	 * workers may not have returned yet.
+	 */
+	if (srt_arg->taskq != NULL)
+		taskq_destroy(srt_arg->taskq);
 	bqueue_destroy(&srt_arg->q);
 	bqueue_destroy(&smt_arg->q);
 	if (dspp->redactbook != NULL)
@@ -2666,6 +2974,8 @@ out:
 	VERIFY(err != 0 || (dsc.dsc_sent_begin &&
 	    (dsc.dsc_sent_end || dspp->savedok)));
 
+	if (dsc.dsc_dedup != NULL)
+		send_dedup_destroy(dsc.dsc_dedup);
 	kmem_free(drr, sizeof (dmu_replay_record_t));
 	kmem_free(dssp, sizeof (dmu_sendstatus_t));
 	kmem_free(from_arg, sizeof (*from_arg));
@@ -2780,8 +3090,8 @@ dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
 int
 dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
     boolean_t large_block_ok, boolean_t compressok, boolean_t rawok,
-    boolean_t savedok, uint64_t resumeobj, uint64_t resumeoff,
-    const char *redactbook, int outfd, offset_t *off,
+    boolean_t savedok, boolean_t dedupok, uint64_t resumeobj,
+    uint64_t resumeoff, const char *redactbook, int outfd, offset_t *off,
     dmu_send_outparams_t *dsop)
 {
 	int err = 0;
@@ -2804,6 +3114,7 @@ dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
 	dspp.resumeoff = resumeoff;
 	dspp.rawok = rawok;
 	dspp.savedok = savedok;
+	dspp.dedupok = dedupok;
 
 	if (fromsnap != NULL && strpbrk(fromsnap, "@#") == NULL)
 		return (SET_ERROR(EINVAL));
@@ -3169,5 +3480,11 @@ ZFS_MODULE_PARAM(zfs_send, zfs_send_, queue_ff, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_send, zfs_send_, no_prefetch_queue_ff, UINT, ZMOD_RW,
 	"Send queue fill fraction for non-prefetch queues");
 
+ZFS_MODULE_PARAM(zfs_send, zfs_send_, reader_threads, UINT, ZMOD_RW,
+	"Number of threads per send issuing data reads");
+
+ZFS_MODULE_PARAM(zfs_send, zfs_send_, dedup_table_size, UINT, ZMOD_RW,
+	"Memory for the table of blocks sent by a deduplicated send");
+
 ZFS_MODULE_PARAM(zfs_send, zfs_, override_estimate_recordsize, UINT, ZMOD_RW,
 	"Override block size estimate with fixed size");
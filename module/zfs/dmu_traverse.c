@@ -758,6 +758,21 @@ traverse_dataset_destroyed(spa_t *spa, blkptr_t *blkptr,
 	    blkptr, txg_start, resume, flags, func, arg));
 }
 
+/*
+ * Visit the MOS only.  Together with traverse_dataset() on each dataset,
+ * this visits the same blocks as traverse_pool(), which lets callers
+ * traverse the datasets in parallel.
+ *
+ * NB: pool must not be changing on-disk (eg, from zdb or sync context).
+ */
+int
+traverse_mos(spa_t *spa, uint64_t txg_start, int flags,
+    blkptr_cb_t func, void *arg)
+{
+	return (traverse_impl(spa, NULL, 0, spa_get_rootblkptr(spa),
+	    txg_start, NULL, flags, func, arg));
+}
+
 /*
  * NB: pool must not be changing on-disk (eg, from zdb or sync context).
  */
@@ -771,8 +786,7 @@ traverse_pool(spa_t *spa, uint64_t txg_start, int flags,
 	boolean_t hard = (flags & TRAVERSE_HARD);
 
 	/* visit the MOS */
-	err = traverse_impl(spa, NULL, 0, spa_get_rootblkptr(spa),
-	    txg_start, NULL, flags, func, arg);
+	err = traverse_mos(spa, txg_start, flags, func, arg);
 	if (err != 0)
 		return (err);
 
@@ -815,6 +829,7 @@ traverse_pool(spa_t *spa, uint64_t txg_start, int flags,
 
 EXPORT_SYMBOL(traverse_dataset);
 EXPORT_SYMBOL(traverse_pool);
+EXPORT_SYMBOL(traverse_mos);
 
 ZFS_MODULE_PARAM(zfs, zfs_, pd_bytes_max, INT, ZMOD_RW,
 	"Max number of bytes to prefetch");
@@ -38,6 +38,10 @@
 #include <sys/kstat.h>
 #include <sys/wmsum.h>
 
+#if defined(_LP64) && !defined(ZFS_DEBUG)
+_Static_assert(sizeof (zstream_t) <= 128, "zstream_t exceeds 128 bytes");
+#endif
+
 /*
  * This tunable disables predictive prefetch.  Note that it leaves "prescient"
  * prefetch (e.g. prefetch for zfs send) intact.  Unlike predictive prefetch,
@@ -77,6 +81,10 @@ typedef struct zfetch_stats {
 	kstat_named_t zfetchstat_stride;
 	kstat_named_t zfetchstat_past;
 	kstat_named_t zfetchstat_misses;
+	kstat_named_t zfetchstat_reverse_hits;
+	kstat_named_t zfetchstat_reverse_misses;
+	kstat_named_t zfetchstat_strided_hits;
+	kstat_named_t zfetchstat_strided_misses;
 	kstat_named_t zfetchstat_max_streams;
 	kstat_named_t zfetchstat_io_issued;
 	kstat_named_t zfetchstat_io_active;
@@ -88,6 +96,10 @@ static zfetch_stats_t zfetch_stats = {
 	{ "stride",			KSTAT_DATA_UINT64 },
 	{ "past",			KSTAT_DATA_UINT64 },
 	{ "misses",			KSTAT_DATA_UINT64 },
+	{ "reverse_hits",		KSTAT_DATA_UINT64 },
+	{ "reverse_misses",		KSTAT_DATA_UINT64 },
+	{ "strided_hits",		KSTAT_DATA_UINT64 },
+	{ "strided_misses",		KSTAT_DATA_UINT64 },
 	{ "max_streams",		KSTAT_DATA_UINT64 },
 	{ "io_issued",			KSTAT_DATA_UINT64 },
 	{ "io_active",			KSTAT_DATA_UINT64 },
@@ -99,6 +111,10 @@ struct {
 	wmsum_t zfetchstat_stride;
 	wmsum_t zfetchstat_past;
 	wmsum_t zfetchstat_misses;
+	wmsum_t zfetchstat_reverse_hits;
+	wmsum_t zfetchstat_reverse_misses;
+	wmsum_t zfetchstat_strided_hits;
+	wmsum_t zfetchstat_strided_misses;
 	wmsum_t zfetchstat_max_streams;
 	wmsum_t zfetchstat_io_issued;
 	aggsum_t zfetchstat_io_active;
@@ -129,6 +145,14 @@ zfetch_kstats_update(kstat_t *ksp, int rw)
 	    wmsum_value(&zfetch_sums.zfetchstat_past);
 	zs->zfetchstat_misses.value.ui64 =
 	    wmsum_value(&zfetch_sums.zfetchstat_misses);
+	zs->zfetchstat_reverse_hits.value.ui64 =
+	    wmsum_value(&zfetch_sums.zfetchstat_reverse_hits);
+	zs->zfetchstat_reverse_misses.value.ui64 =
+	    wmsum_value(&zfetch_sums.zfetchstat_reverse_misses);
+	zs->zfetchstat_strided_hits.value.ui64 =
+	    wmsum_value(&zfetch_sums.zfetchstat_strided_hits);
+	zs->zfetchstat_strided_misses.value.ui64 =
+	    wmsum_value(&zfetch_sums.zfetchstat_strided_misses);
 	zs->zfetchstat_max_streams.value.ui64 =
 	    wmsum_value(&zfetch_sums.zfetchstat_max_streams);
 	zs->zfetchstat_io_issued.value.ui64 =
@@ -146,6 +170,10 @@ zfetch_init(void)
 	wmsum_init(&zfetch_sums.zfetchstat_stride, 0);
 	wmsum_init(&zfetch_sums.zfetchstat_past, 0);
 	wmsum_init(&zfetch_sums.zfetchstat_misses, 0);
+	wmsum_init(&zfetch_sums.zfetchstat_reverse_hits, 0);
+	wmsum_init(&zfetch_sums.zfetchstat_reverse_misses, 0);
+	wmsum_init(&zfetch_sums.zfetchstat_strided_hits, 0);
+	wmsum_init(&zfetch_sums.zfetchstat_strided_misses, 0);
 	wmsum_init(&zfetch_sums.zfetchstat_max_streams, 0);
 	wmsum_init(&zfetch_sums.zfetchstat_io_issued, 0);
 	aggsum_init(&zfetch_sums.zfetchstat_io_active, 0);
@@ -174,6 +202,10 @@ zfetch_fini(void)
 	wmsum_fini(&zfetch_sums.zfetchstat_stride);
 	wmsum_fini(&zfetch_sums.zfetchstat_past);
 	wmsum_fini(&zfetch_sums.zfetchstat_misses);
+	wmsum_fini(&zfetch_sums.zfetchstat_reverse_hits);
+	wmsum_fini(&zfetch_sums.zfetchstat_reverse_misses);
+	wmsum_fini(&zfetch_sums.zfetchstat_strided_hits);
+	wmsum_fini(&zfetch_sums.zfetchstat_strided_misses);
 	wmsum_fini(&zfetch_sums.zfetchstat_max_streams);
 	wmsum_fini(&zfetch_sums.zfetchstat_io_issued);
 	ASSERT0(aggsum_value(&zfetch_sums.zfetchstat_io_active));
@@ -326,14 +358,94 @@ reuse:
 	zs->zs_ipf_end = blkid;
 	zs->zs_missed = B_FALSE;
 	zs->zs_more = B_FALSE;
+	zs->zs_type = ZSTREAM_FORWARD;
+	zs->zs_len = 0;
+	zs->zs_stride = 0;
+	zs->zs_last = blkid;
 	return (zs);
 }
 
+/*
+ * A forward stream which never hit may still turn out to be the start of a
+ * reverse or strided stream.
+ */
+static inline boolean_t
+dmu_zfetch_fresh(zstream_t *zs)
+{
+	return (zs->zs_type == ZSTREAM_FORWARD && zs->zs_ipf_dist == 0 &&
+	    zs->zs_len != 0);
+}
+
+/*
+ * Record the access of a stream which never hit, and its distance from the
+ * previous one.  Patterns of larger accesses, or further apart than fits
+ * into the stream, are not tracked.
+ */
+static void
+dmu_zfetch_set_access(zstream_t *zs, uint64_t blkid, uint64_t nblks,
+    int64_t stride)
+{
+	if (nblks > UINT8_MAX || stride > INT32_MAX || stride < INT32_MIN) {
+		zs->zs_len = 0;
+		return;
+	}
+	zs->zs_stride = stride;
+	zs->zs_last = blkid;
+	zs->zs_len = nblks;
+}
+
+/*
+ * Remember an access associated with a stream which never hit, so that a
+ * reverse or strided pattern can be detected from the next one.
+ */
+static void
+dmu_zfetch_track(zstream_t *zs, uint64_t blkid, uint64_t nblks)
+{
+	if (!dmu_zfetch_fresh(zs))
+		return;
+	dmu_zfetch_set_access(zs, blkid, nblks, blkid - zs->zs_last);
+}
+
+/*
+ * Return the block at index idx of a reverse or strided stream, or
+ * UINT64_MAX if it would lie before the start of the file.
+ */
+static uint64_t
+dmu_zfetch_pattern_blkid(zstream_t *zs, uint64_t idx)
+{
+	int64_t blkid = zs->zs_origin + (int64_t)(idx / zs->zs_len) *
+	    zs->zs_stride + idx % zs->zs_len;
+
+	return (blkid < 0 ? UINT64_MAX : blkid);
+}
+
+/*
+ * Return the index of blkid in a reverse or strided stream, or UINT64_MAX
+ * if the block is not part of it.
+ */
+static uint64_t
+dmu_zfetch_pattern_idx(zstream_t *zs, uint64_t blkid)
+{
+	int64_t d = blkid - zs->zs_origin, s = zs->zs_stride, k;
+
+	/* Find the last access starting at or before blkid. */
+	if (s > 0)
+		k = (d >= 0) ? d / s : -((-d + s - 1) / s);
+	else
+		k = (d <= 0) ? (-d - s - 1) / -s : -(d / -s);
+	d -= k * s;
+	if (k < 0 || d >= zs->zs_len)
+		return (UINT64_MAX);
+	return (k * zs->zs_len + d);
+}
+
 static void
 dmu_zfetch_done(void *arg, uint64_t level, uint64_t blkid, boolean_t io_issued)
 {
 	zstream_t *zs = arg;
 
+	if (io_issued && level == 0 && zs->zs_type != ZSTREAM_FORWARD)
+		blkid = dmu_zfetch_pattern_idx(zs, blkid);
 	if (io_issued && level == 0 && blkid < zs->zs_blkid)
 		zs->zs_more = B_TRUE;
 	if (zfs_refcount_remove(&zs->zs_refs, NULL) == 0)
@@ -455,6 +567,28 @@ dmu_zfetch_future(zstream_t *zs, uint64_t blkid, uint64_t nblks)
 	return (0);
 }
 
+/*
+ * Calculate the data prefetch distance of a stream after a hit for nbytes,
+ * see dmu_zfetch_prepare().  Returns the distance in blocks.
+ */
+static unsigned int
+dmu_zfetch_pf_dist(zstream_t *zs, unsigned int nbytes, unsigned int dbs)
+{
+	if (unlikely(zs->zs_pf_dist < nbytes))
+		zs->zs_pf_dist = nbytes;
+	else if (zs->zs_pf_dist < zfetch_min_distance &&
+	    (zs->zs_pf_dist < (1 << dbs) ||
+	    aggsum_compare(&zfetch_sums.zfetchstat_io_active,
+	    arc_c_max >> (4 + dbs)) < 0))
+		zs->zs_pf_dist *= 2;
+	else if (zs->zs_more)
+		zs->zs_pf_dist += zs->zs_pf_dist / 8;
+	zs->zs_more = B_FALSE;
+	if (zs->zs_pf_dist > zfetch_max_distance)
+		zs->zs_pf_dist = zfetch_max_distance;
+	return (zs->zs_pf_dist >> dbs);
+}
+
 /*
  * Prime a zfetch stream at blkid, so that the first demand access triggered
  * enough prefetch without ramp-up to sequentially read up to end_blkid.
@@ -488,6 +622,8 @@ dmu_zfetch_prime(zfetch_t *zf, uint64_t blkid, uint64_t end_blkid)
 	uint_t max_near = zfetch_max_reorder >> dbs;
 	for (zs = list_head(&zf->zf_stream); zs != NULL;
 	    zs = list_next(&zf->zf_stream, zs)) {
+		if (zs->zs_type != ZSTREAM_FORWARD)
+			continue;
 		uint64_t diff = (blkid >= zs->zs_blkid) ?
 		    (blkid - zs->zs_blkid) : (zs->zs_blkid - blkid);
 		if (diff <= max_near) {
@@ -582,6 +718,8 @@ dmu_zfetch_prepare(zfetch_t *zf, uint64_t blkid, uint64_t nblks,
 	uint64_t end_blkid = blkid + nblks;
 	for (zs = list_head(&zf->zf_stream); zs != NULL;
 	    zs = list_next(&zf->zf_stream, zs)) {
+		if (zs->zs_type != ZSTREAM_FORWARD)
+			continue;
 		if (blkid == zs->zs_blkid) {
 			goto hit;
 		} else if (blkid + 1 == zs->zs_blkid) {
@@ -591,6 +729,48 @@ dmu_zfetch_prepare(zfetch_t *zf, uint64_t blkid, uint64_t nblks,
 		}
 	}
 
+	/*
+	 * Find reverse or strided stream expecting this access.  Otherwise
+	 * check whether this access continues a reverse or strided pattern
+	 * started by the accesses of a stream which never hit: reverse when
+	 * it ends where the last one started, strided when it is as far from
+	 * the last one as that one was from the previous.  Those are only
+	 * used for data prefetch, and require accesses of equal size.
+	 */
+	for (zs = list_head(&zf->zf_stream); fetch_data && zs != NULL;
+	    zs = list_next(&zf->zf_stream, zs)) {
+		if (zs->zs_type != ZSTREAM_FORWARD) {
+			if (nblks != zs->zs_len)
+				continue;
+			if (blkid == dmu_zfetch_pattern_blkid(zs, zs->zs_blkid))
+				goto pattern;
+			/* Unaligned accesses may read the same blocks again. */
+			if (blkid == dmu_zfetch_pattern_blkid(zs,
+			    zs->zs_blkid - zs->zs_len)) {
+				zs->zs_atime = gethrestime_sec();
+				goto out;
+			}
+			continue;
+		}
+		if (!dmu_zfetch_fresh(zs) || nblks != zs->zs_len)
+			continue;
+		if (end_blkid == zs->zs_last) {
+			zs->zs_type = ZSTREAM_REVERSE;
+			zs->zs_stride = -(int64_t)nblks;
+			/* zs_origin shares zs_last, the first access */
+			zs->zs_blkid = nblks;
+			goto pattern_new;
+		}
+		if (blkid == zs->zs_last + zs->zs_stride &&
+		    (zs->zs_stride > (int64_t)nblks ||
+		    zs->zs_stride < -(int64_t)nblks)) {
+			zs->zs_type = ZSTREAM_STRIDED;
+			zs->zs_origin = zs->zs_last - zs->zs_stride;
+			zs->zs_blkid = 2 * nblks;
+			goto pattern_new;
+		}
+	}
+
 	/*
 	 * Find close enough prefetch stream.  Access crossing stream position
 	 * is a hit in its new part.  Access ahead of stream position considered
@@ -602,6 +782,8 @@ dmu_zfetch_prepare(zfetch_t *zf, uint64_t blkid, uint64_t nblks,
 	uint_t t = gethrestime_sec() - zfetch_max_sec_reap;
 	for (zs = list_head(&zf->zf_stream); zs != NULL;
 	    zs = list_next(&zf->zf_stream, zs)) {
+		if (zs->zs_type != ZSTREAM_FORWARD)
+			continue;
 		if (blkid > zs->zs_blkid) {
 			if (end_blkid <= zs->zs_blkid + max_reorder) {
 				if (!fetch_data) {
@@ -610,6 +792,7 @@ dmu_zfetch_prepare(zfetch_t *zf, uint64_t blkid, uint64_t nblks,
 					ZFETCHSTAT_BUMP(zfetchstat_stride);
 					goto future;
 				}
+				dmu_zfetch_track(zs, blkid, nblks);
 				nblks = dmu_zfetch_future(zs, blkid, nblks);
 				if (nblks > 0)
 					ZFETCHSTAT_BUMP(zfetchstat_stride);
@@ -623,6 +806,7 @@ dmu_zfetch_prepare(zfetch_t *zf, uint64_t blkid, uint64_t nblks,
 			goto hit;
 		} else if (end_blkid + max_reorder > zs->zs_blkid &&
 		    (int)(zs->zs_atime - t) >= 0) {
+			dmu_zfetch_track(zs, blkid, nblks);
 			ZFETCHSTAT_BUMP(zfetchstat_past);
 			zs->zs_atime = gethrestime_sec();
 			goto out;
@@ -631,16 +815,62 @@ dmu_zfetch_prepare(zfetch_t *zf, uint64_t blkid, uint64_t nblks,
 
 	/*
 	 * This access is not part of any existing stream.  Create a new
-	 * stream for it unless we are at the end of file.
+	 * stream for it unless we are at the end of file.  Its distance from
+	 * the access which created the previous stream may be the stride of
+	 * a strided one, in which case it is created even at the end of file,
+	 * so the pattern can be detected there too.  Reverse streams started
+	 * at the end of file are picked up from their second access.
 	 */
 	ASSERT0P(zs);
-	if (end_blkid < maxblkid)
-		(void) dmu_zfetch_stream_create(zf, end_blkid);
+	zstream_t *prev = list_head(&zf->zf_stream);
+	int64_t stride = (prev != NULL && dmu_zfetch_fresh(prev)) ?
+	    blkid - prev->zs_last : 0;
+	if (end_blkid < maxblkid ||
+	    (fetch_data && blkid > 0 && stride > 0)) {
+		zstream_t *nzs = dmu_zfetch_stream_create(zf, end_blkid);
+		if (nzs != NULL)
+			dmu_zfetch_set_access(nzs, blkid, nblks, stride);
+	}
 	mutex_exit(&zf->zf_lock);
 	ZFETCHSTAT_BUMP(zfetchstat_misses);
 	ipf_start = 0;
 	goto prescient;
 
+pattern_new:
+	/* Reverse and strided streams only prefetch data blocks. */
+	memset(zs->zs_ranges, 0, sizeof (zs->zs_ranges));
+	zs->zs_pf_start = zs->zs_pf_end = zs->zs_blkid;
+	zs->zs_ipf_start = zs->zs_ipf_end = 0;
+
+pattern:
+	if (zs->zs_type == ZSTREAM_REVERSE)
+		ZFETCHSTAT_BUMP(zfetchstat_reverse_hits);
+	else
+		ZFETCHSTAT_BUMP(zfetchstat_strided_hits);
+	zs->zs_atime = gethrestime_sec();
+	zs->zs_blkid += zs->zs_len;
+
+	/* If the file is ending, remove the stream. */
+	if (dmu_zfetch_pattern_blkid(zs, zs->zs_blkid) > maxblkid) {
+		dmu_zfetch_stream_remove(zf, zs);
+		goto out;
+	}
+
+	/* Ramp up the distance as for forward streams, in stream blocks. */
+	uint64_t pf_end = zs->zs_blkid + dmu_zfetch_pf_dist(zs,
+	    nblks << zf->zf_dnode->dn_datablkshift,
+	    zf->zf_dnode->dn_datablkshift);
+	if (zs->zs_pf_start < zs->zs_blkid)
+		zs->zs_pf_start = zs->zs_blkid;
+	if (zs->zs_pf_end < pf_end)
+		zs->zs_pf_end = pf_end;
+
+	zfs_refcount_add(&zs->zs_refs, NULL);
+	zfs_refcount_add(&zs->zs_callers, NULL);
+	mutex_exit(&zf->zf_lock);
+	ipf_start = 0;
+	goto prescient;
+
 hit:
 	nblks = dmu_zfetch_hit(zs, nblks);
 	ZFETCHSTAT_BUMP(zfetchstat_hits);
@@ -677,23 +907,10 @@ out:
 	 */
 	unsigned int nbytes = nblks << dbs;
 	unsigned int pf_nblks;
-	if (fetch_data) {
-		if (unlikely(zs->zs_pf_dist < nbytes))
-			zs->zs_pf_dist = nbytes;
-		else if (zs->zs_pf_dist < zfetch_min_distance &&
-		    (zs->zs_pf_dist < (1 << dbs) ||
-		    aggsum_compare(&zfetch_sums.zfetchstat_io_active,
-		    arc_c_max >> (4 + dbs)) < 0))
-			zs->zs_pf_dist *= 2;
-		else if (zs->zs_more)
-			zs->zs_pf_dist += zs->zs_pf_dist / 8;
-		zs->zs_more = B_FALSE;
-		if (zs->zs_pf_dist > zfetch_max_distance)
-			zs->zs_pf_dist = zfetch_max_distance;
-		pf_nblks = zs->zs_pf_dist >> dbs;
-	} else {
+	if (fetch_data)
+		pf_nblks = dmu_zfetch_pf_dist(zs, nbytes, dbs);
+	else
 		pf_nblks = 0;
-	}
 	if (zs->zs_pf_start < end_blkid)
 		zs->zs_pf_start = end_blkid;
 	if (zs->zs_pf_end < end_blkid + pf_nblks)
@@ -756,8 +973,13 @@ dmu_zfetch_run(zfetch_t *zf, zstream_t *zs, boolean_t missed,
 	int64_t pf_start, pf_end, ipf_start, ipf_end;
 	int epbs, issued;
 
-	if (missed)
+	if (missed) {
 		zs->zs_missed = missed;
+		if (zs->zs_type == ZSTREAM_REVERSE)
+			ZFETCHSTAT_BUMP(zfetchstat_reverse_misses);
+		else if (zs->zs_type == ZSTREAM_STRIDED)
+			ZFETCHSTAT_BUMP(zfetchstat_strided_misses);
+	}
 
 	/*
 	 * Postpone the prefetch if there are more concurrent callers.
@@ -805,7 +1027,16 @@ dmu_zfetch_run(zfetch_t *zf, zstream_t *zs, boolean_t missed,
 
 	issued = 0;
 	for (int64_t blk = pf_start; blk < pf_end; blk++) {
-		issued += dbuf_prefetch_impl(zf->zf_dnode, 0, blk,
+		uint64_t pblk = blk;
+
+		if (zs->zs_type != ZSTREAM_FORWARD) {
+			pblk = dmu_zfetch_pattern_blkid(zs, blk);
+			if (pblk == UINT64_MAX) {
+				dmu_zfetch_done(zs, 0, pblk, B_FALSE);
+				continue;
+			}
+		}
+		issued += dbuf_prefetch_impl(zf->zf_dnode, 0, pblk,
 		    ZIO_PRIORITY_ASYNC_READ, uncached ?
 		    ARC_FLAG_UNCACHED : 0, dmu_zfetch_done, zs);
 	}
@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/ebr.h>
+
+/*
+ * Epoch based reclamation lets readers traverse a linked structure without
+ * taking the lock its writers use, by deferring the freeing of objects which
+ * were unlinked from it until no reader can still reference them.  It fills
+ * the role of RCU, which is not available to us on all platforms.
+ *
+ * Readers bracket their traversal with ebr_enter() and ebr_exit(), which
+ * count them in the slot of their CPU for the current epoch.  Writers hand
+ * the objects they unlinked to ebr_retire(), which queues them on the slot
+ * of their CPU, for the current epoch.  ebr_reclaim() advances the epoch
+ * from E to E + 1 once no reader counted in epoch E - 1 remains, and frees
+ * the objects retired in E - 1: any reader which could have seen them was
+ * counted in E - 1 or earlier, and all readers from before E - 1 were gone
+ * when the epoch advanced to E.  Since the epoch only ever advances by one,
+ * readers and retired objects need only be tracked by epoch parity.  This
+ * requires a reader to be counted in the epoch it reads in: ebr_enter()
+ * rereads the epoch once it is counted, and retries if the parity changed,
+ * as the epoch may have advanced in between.
+ *
+ * Retired objects are chained through a pointer at a fixed offset in the
+ * object, usually the link which chained it into the protected structure.
+ * A reader may still load that link after the object was retired, and it
+ * then points to objects retired earlier, which may already be freed.  The
+ * structure must detect this before the reader dereferences it, e.g. by
+ * checking a sequence count after each link it follows.
+ *
+ * Reclamation is opportunistic: it is attempted by ebr_retire() every
+ * EBR_RECLAIM_BATCH objects retired on a slot, and never waits, neither for
+ * readers nor for another thread already reclaiming.
+ */
+
+#define	EBR_RECLAIM_BATCH	256
+
+#define	EBR_LINK(ebr, obj)	((void **)((char *)(obj) + (ebr)->ebr_link))
+
+/*
+ * Set up reclamation for objects with a void * sized link at offset link,
+ * which are freed with free_func once no reader can reference them anymore.
+ */
+void
+ebr_init(ebr_t *ebr, size_t link, void (*free_func)(void *))
+{
+	ebr->ebr_nslots = MAX(boot_ncpus, 1);
+	ebr->ebr_slots = kmem_zalloc(ebr->ebr_nslots * sizeof (ebr_slot_t),
+	    KM_SLEEP);
+	for (uint_t i = 0; i < ebr->ebr_nslots; i++) {
+		mutex_init(&ebr->ebr_slots[i].es_lock, NULL, MUTEX_DEFAULT,
+		    NULL);
+	}
+	ebr->ebr_link = link;
+	ebr->ebr_free = free_func;
+	ebr->ebr_epoch = 0;
+	mutex_init(&ebr->ebr_reclaim_lock, NULL, MUTEX_DEFAULT, NULL);
+}
+
+static void
+ebr_free_list(ebr_t *ebr, void *obj)
+{
+	while (obj != NULL) {
+		void *next = *EBR_LINK(ebr, obj);
+
+		*EBR_LINK(ebr, obj) = NULL;
+		ebr->ebr_free(obj);
+		obj = next;
+	}
+}
+
+/*
+ * Free all retired objects.  No reader may remain.
+ */
+void
+ebr_fini(ebr_t *ebr)
+{
+	for (uint_t i = 0; i < ebr->ebr_nslots; i++) {
+		ebr_slot_t *es = &ebr->ebr_slots[i];
+
+		for (int e = 0; e < 2; e++) {
+			ASSERT0(es->es_readers[e]);
+			ebr_free_list(ebr, es->es_retired[e]);
+		}
+		mutex_destroy(&es->es_lock);
+	}
+	kmem_free(ebr->ebr_slots, ebr->ebr_nslots * sizeof (ebr_slot_t));
+	mutex_destroy(&ebr->ebr_reclaim_lock);
+}
+
+/*
+ * Free the objects retired in the previous epoch if no reader from that
+ * epoch is left, and advance the epoch.  Two successful calls free all
+ * objects retired before the first one.
+ */
+void
+ebr_reclaim(ebr_t *ebr)
+{
+	if (!mutex_tryenter(&ebr->ebr_reclaim_lock))
+		return;
+
+	uint64_t epoch = atomic_load_64(&ebr->ebr_epoch);
+	uint_t prev = (epoch - 1) & 1;
+
+	/* Order the retirements we are about to free before the counts. */
+	membar_sync();
+	for (uint_t i = 0; i < ebr->ebr_nslots; i++) {
+		if (atomic_load_64(&ebr->ebr_slots[i].es_readers[prev]) != 0) {
+			mutex_exit(&ebr->ebr_reclaim_lock);
+			return;
+		}
+	}
+	membar_sync();
+
+	for (uint_t i = 0; i < ebr->ebr_nslots; i++) {
+		ebr_slot_t *es = &ebr->ebr_slots[i];
+		void *obj;
+
+		mutex_enter(&es->es_lock);
+		obj = es->es_retired[prev];
+		es->es_retired[prev] = NULL;
+		es->es_nretired[prev] = 0;
+		mutex_exit(&es->es_lock);
+
+		ebr_free_list(ebr, obj);
+	}
+
+	atomic_store_64(&ebr->ebr_epoch, epoch + 1);
+	mutex_exit(&ebr->ebr_reclaim_lock);
+}
+
+/*
+ * Free an object once no reader can reference it anymore.  The object must
+ * already be unlinked from the protected structure.
+ */
+void
+ebr_retire(ebr_t *ebr, void *obj)
+{
+	ebr_slot_t *es = &ebr->ebr_slots[CPU_SEQID_UNSTABLE % ebr->ebr_nslots];
+	uint64_t n;
+
+	mutex_enter(&es->es_lock);
+	/*
+	 * The unlinking of the object must be visible before we sample the
+	 * epoch, so that no reader counted in a later epoch can find it.
+	 */
+	membar_sync();
+	uint_t e = atomic_load_64(&ebr->ebr_epoch) & 1;
+	*EBR_LINK(ebr, obj) = es->es_retired[e];
+	es->es_retired[e] = obj;
+	n = ++es->es_nretired[e];
+	mutex_exit(&es->es_lock);
+
+	if (n % EBR_RECLAIM_BATCH == 0)
+		ebr_reclaim(ebr);
+}
@@ -223,6 +223,12 @@ static uint_t metaslab_unload_delay_ms = 10 * 60 * 1000; /* ten minutes */
  */
 uint_t metaslab_preload_limit = 10;
 
+/*
+ * Max number of metaslabs per group to preload when a pool is imported or
+ * a vdev is expanded, see metaslab_preload_vdev(). 0 disables this.
+ */
+static uint_t metaslab_preload_import_limit = 10;
+
 /*
  * Enable/disable preloading of metaslab.
  */
@@ -301,6 +307,14 @@ static uint64_t zfs_metaslab_max_size_cache_sec = 1 * 60 * 60; /* 1 hour */
  */
 static uint_t zfs_metaslab_mem_limit = 25;
 
+/*
+ * Once a metaslab is loaded, rebuild its allocatable trees with full leaves.
+ * Both trees are filled in a mostly random order while loading, which leaves
+ * the B-Tree leaves around 70% full; packing them lets roughly 40% more
+ * metaslabs stay loaded within zfs_metaslab_mem_limit.
+ */
+static int zfs_metaslab_compact_on_load = 1;
+
 /*
  * Force the per-metaslab range trees to use 64-bit integers to store
  * segments. Used for debugging purposes.
@@ -366,6 +380,12 @@ typedef struct metaslab_stats {
 	kstat_named_t metaslabstat_reload_tree;
 	kstat_named_t metaslabstat_too_many_tries;
 	kstat_named_t metaslabstat_try_hard;
+	kstat_named_t metaslabstat_loaded;
+	kstat_named_t metaslabstat_loaded_tree_bytes;
+	kstat_named_t metaslabstat_compact_saved_bytes;
+	kstat_named_t metaslabstat_preload_queued;
+	kstat_named_t metaslabstat_preload_done;
+	kstat_named_t metaslabstat_preload_over_limit;
 } metaslab_stats_t;
 
 static metaslab_stats_t metaslab_stats = {
@@ -373,10 +393,18 @@ static metaslab_stats_t metaslab_stats = {
 	{ "reload_tree",		KSTAT_DATA_UINT64 },
 	{ "too_many_tries",		KSTAT_DATA_UINT64 },
 	{ "try_hard",			KSTAT_DATA_UINT64 },
+	{ "loaded",			KSTAT_DATA_UINT64 },
+	{ "loaded_tree_bytes",		KSTAT_DATA_UINT64 },
+	{ "compact_saved_bytes",	KSTAT_DATA_INT64 },
+	{ "preload_queued",		KSTAT_DATA_UINT64 },
+	{ "preload_done",		KSTAT_DATA_UINT64 },
+	{ "preload_over_limit",		KSTAT_DATA_UINT64 },
 };
 
 #define	METASLABSTAT_BUMP(stat) \
 	atomic_inc_64(&metaslab_stats.stat.value.ui64);
+#define	METASLABSTAT_INCR(stat, val) \
+	atomic_add_64(&metaslab_stats.stat.value.ui64, (val));
 
 char *
 metaslab_rt_name(metaslab_group_t *mg, metaslab_t *ms, const char *name)
@@ -2409,6 +2437,83 @@ metaslab_verify_weight_and_frag(metaslab_t *msp)
 	VERIFY3U(msp->ms_weight, ==, weight);
 }
 
+/*
+ * Memory used by the in-core allocatable trees of a loaded metaslab.
+ */
+static uint64_t
+metaslab_tree_mem(metaslab_t *msp)
+{
+	if (!msp->ms_loaded)
+		return (0);
+
+	return (zfs_btree_memory(&msp->ms_allocatable->rt_root) +
+	    zfs_btree_memory(&msp->ms_allocatable_by_size));
+}
+
+/*
+ * Keep the loaded_tree_bytes kstat in step with this metaslab. The trees
+ * change with every allocation and free, so this is refreshed whenever the
+ * metaslab is loaded, synced or unloaded.
+ */
+static void
+metaslab_tree_mem_update(metaslab_t *msp)
+{
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	uint64_t mem = metaslab_tree_mem(msp);
+	METASLABSTAT_INCR(metaslabstat_loaded_tree_bytes,
+	    mem - msp->ms_tree_mem);
+	msp->ms_tree_mem = mem;
+}
+
+static uint64_t
+metaslab_tree_elems(metaslab_t *msp)
+{
+	return (zfs_btree_numnodes(&msp->ms_allocatable->rt_root) +
+	    zfs_btree_numnodes(&msp->ms_allocatable_by_size));
+}
+
+/*
+ * Pack the leaves of the trees of a freshly loaded metaslab, see
+ * zfs_metaslab_compact_on_load. Their size per segment beforehand is kept
+ * for metaslab_tree_compact_account().
+ */
+static void
+metaslab_tree_compact(metaslab_t *msp)
+{
+	ASSERT(msp->ms_loaded);
+
+	if (!zfs_metaslab_compact_on_load)
+		return;
+
+	msp->ms_compact_mem = metaslab_tree_mem(msp);
+	msp->ms_compact_elems = metaslab_tree_elems(msp);
+	zfs_btree_compact(&msp->ms_allocatable->rt_root);
+	zfs_btree_compact(&msp->ms_allocatable_by_size);
+}
+
+/*
+ * Allocations and frees split packed leaves in two, so how much a compaction
+ * saved is only known once the metaslab is unloaded. Compare the trees then
+ * with what they would take for as many segments at the density they had
+ * before they were compacted. This can come out negative.
+ */
+static void
+metaslab_tree_compact_account(metaslab_t *msp)
+{
+	ASSERT(msp->ms_loaded);
+
+	if (msp->ms_compact_elems == 0)
+		return;
+
+	uint64_t uncompacted = metaslab_tree_elems(msp) *
+	    msp->ms_compact_mem / msp->ms_compact_elems;
+	METASLABSTAT_INCR(metaslabstat_compact_saved_bytes,
+	    (int64_t)(uncompacted - metaslab_tree_mem(msp)));
+	msp->ms_compact_mem = 0;
+	msp->ms_compact_elems = 0;
+}
+
 /*
  * If we're over the zfs_metaslab_mem_limit, select the loaded metaslab from
  * this class that was used longest ago, and attempt to unload it.  We don't
@@ -2664,6 +2769,12 @@ metaslab_load_impl(metaslab_t *msp)
 		    zfs_range_tree_remove, msp->ms_allocatable);
 	}
 
+	/*
+	 * Only pack the trees once all the above is applied, as those
+	 * scattered updates would split most of the packed leaves again.
+	 */
+	metaslab_tree_compact(msp);
+
 	/*
 	 * Call metaslab_recalculate_weight_and_sort() now that the
 	 * metaslab is loaded so we get the metaslab's real weight.
@@ -2708,6 +2819,9 @@ metaslab_load_impl(metaslab_t *msp)
 	    (u_longlong_t)msp->ms_max_size - max_size,
 	    (u_longlong_t)weight, (u_longlong_t)msp->ms_weight);
 
+	METASLABSTAT_BUMP(metaslabstat_loaded);
+	metaslab_tree_mem_update(msp);
+
 	metaslab_verify_space(msp, spa_syncing_txg(spa));
 	mutex_exit(&msp->ms_sync_lock);
 	return (0);
@@ -2783,9 +2897,12 @@ metaslab_unload(metaslab_t *msp)
 	if (!msp->ms_loaded)
 		return;
 
+	metaslab_tree_compact_account(msp);
 	zfs_range_tree_vacate(msp->ms_allocatable, NULL, NULL);
 	msp->ms_loaded = B_FALSE;
 	msp->ms_unload_time = gethrtime();
+	atomic_dec_64(&metaslab_stats.metaslabstat_loaded.value.ui64);
+	metaslab_tree_mem_update(msp);
 
 	msp->ms_activation_weight = 0;
 	msp->ms_weight &= ~METASLAB_ACTIVE_MASK;
@@ -3789,6 +3906,44 @@ metaslab_preload(void *arg)
 	metaslab_set_selected_txg(msp, spa_syncing_txg(spa));
 	mutex_exit(&msp->ms_lock);
 	spl_fstrans_unmark(cookie);
+	METASLABSTAT_BUMP(metaslabstat_preload_done);
+}
+
+/*
+ * Returns B_TRUE if loaded metaslabs already use up zfs_metaslab_mem_limit,
+ * the point at which metaslab_potentially_evict() starts unloading them.
+ */
+static boolean_t
+metaslab_mem_over_limit(void)
+{
+#ifdef _KERNEL
+	uint64_t allmem = arc_all_memory();
+	uint64_t inuse = spl_kmem_cache_inuse(zfs_btree_leaf_cache);
+	uint64_t size =	spl_kmem_cache_entry_size(zfs_btree_leaf_cache);
+
+	return (allmem * zfs_metaslab_mem_limit / 100 < inuse * size);
+#else
+	return (B_FALSE);
+#endif
+}
+
+/*
+ * Preload task for metaslab_preload_vdev(). Loading a metaslab past the
+ * memory limit would only get it or another one evicted again, so those
+ * are skipped.
+ */
+static void
+metaslab_preload_bounded(void *arg)
+{
+	metaslab_t *msp = arg;
+
+	if (spa_shutting_down(msp->ms_group->mg_vd->vdev_spa) ||
+	    metaslab_mem_over_limit()) {
+		METASLABSTAT_BUMP(metaslabstat_preload_over_limit);
+		METASLABSTAT_BUMP(metaslabstat_preload_done);
+		return;
+	}
+	metaslab_preload(msp);
 }
 
 static void
@@ -3820,6 +3975,7 @@ metaslab_group_preload(metaslab_group_t *mg)
 			continue;
 		}
 
+		METASLABSTAT_BUMP(metaslabstat_preload_queued);
 		VERIFY(taskq_dispatch(spa->spa_metaslab_taskq, metaslab_preload,
 		    msp, TQ_SLEEP | (m <= spa->spa_alloc_count ? TQ_FRONT : 0))
 		    != TASKQID_INVALID);
@@ -3827,6 +3983,93 @@ metaslab_group_preload(metaslab_group_t *mg)
 	mutex_exit(&mg->mg_lock);
 }
 
+/*
+ * Collect up to "max" of the best metaslabs of an active group into "msps".
+ */
+static uint_t
+metaslab_group_preload_collect(metaslab_group_t *mg, metaslab_t **msps,
+    uint_t max)
+{
+	uint_t n = 0;
+
+	if (mg == NULL || mg->mg_activation_count <= 0)
+		return (0);
+
+	avl_tree_t *t = &mg->mg_metaslab_tree;
+	mutex_enter(&mg->mg_lock);
+	for (metaslab_t *msp = avl_first(t); msp != NULL && n < max;
+	    msp = AVL_NEXT(t, msp)) {
+		if (!msp->ms_loaded)
+			msps[n++] = msp;
+	}
+	mutex_exit(&mg->mg_lock);
+
+	return (n);
+}
+
+/*
+ * Start loading the best metaslabs of the given top-level vdev, or of all
+ * of them if given the root vdev, without waiting for their load to finish.
+ *
+ * metaslab_sync_reassess() only preloads a group once one of its
+ * metaslabs has been synced, so right after import (or after a vdev grows)
+ * the first allocations on each vdev would otherwise wait for
+ * space_map_load(). The metaslabs are queued round-robin across the
+ * groups, so that every vdev gets its best metaslab loaded first; the
+ * preload_queued and preload_done kstats show the progress.
+ */
+void
+metaslab_preload_vdev(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	uint_t limit = metaslab_preload_import_limit;
+
+	ASSERT(spa_config_held(spa, SCL_ALLOC, RW_READER));
+
+	if (spa_shutting_down(spa) || !metaslab_preload_enabled || limit == 0)
+		return;
+
+	vdev_t **tvds = vd == spa->spa_root_vdev ? vd->vdev_child : &vd;
+	uint64_t ntvds = vd == spa->spa_root_vdev ? vd->vdev_children : 1;
+	uint64_t ngroups = ntvds * 2;
+	metaslab_t **msps = kmem_zalloc(ngroups * limit * sizeof (*msps),
+	    KM_SLEEP);
+	uint_t *counts = kmem_zalloc(ngroups * sizeof (*counts), KM_SLEEP);
+
+	for (uint64_t c = 0; c < ntvds; c++) {
+		vdev_t *tvd = tvds[c];
+		if (!vdev_is_concrete(tvd) || tvd->vdev_ms == NULL)
+			continue;
+
+		counts[c * 2] = metaslab_group_preload_collect(tvd->vdev_mg,
+		    &msps[c * 2 * limit], limit);
+		counts[c * 2 + 1] = metaslab_group_preload_collect(
+		    tvd->vdev_log_mg, &msps[(c * 2 + 1) * limit], limit);
+	}
+
+	uint64_t queued = 0;
+	for (uint_t m = 0; m < limit; m++) {
+		for (uint64_t g = 0; g < ngroups; g++) {
+			if (m >= counts[g])
+				continue;
+			METASLABSTAT_BUMP(metaslabstat_preload_queued);
+			VERIFY(taskq_dispatch(spa->spa_metaslab_taskq,
+			    metaslab_preload_bounded, msps[g * limit + m],
+			    TQ_SLEEP) != TASKQID_INVALID);
+			queued++;
+		}
+	}
+
+	if (queued != 0) {
+		zfs_dbgmsg("spa=%s vdev=%llu queued %llu metaslabs for preload",
+		    spa_name(spa), (u_longlong_t)vd->vdev_id,
+		    (u_longlong_t)queued);
+	}
+
+	kmem_free(counts, ngroups * sizeof (*counts));
+	kmem_free(msps, ngroups * limit * sizeof (*msps));
+}
+
 /*
  * Determine if the space map's on-disk footprint is past our tolerance for
  * inefficiency. We would like to use the following criteria to make our
@@ -4694,6 +4937,7 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	ASSERT0(zfs_range_tree_space(msp->ms_checkpointing));
 	msp->ms_allocating_total -= msp->ms_allocated_this_txg;
 	msp->ms_allocated_this_txg = 0;
+	metaslab_tree_mem_update(msp);
 	mutex_exit(&msp->ms_lock);
 }
 
@@ -6092,6 +6336,124 @@ metaslab_alloc_range(spa_t *spa, metaslab_class_t *mc, uint64_t psize,
 	return (0);
 }
 
+/*
+ * Allocate "asize" bytes from the allocator's active primary metaslab in
+ * the group, if it has a free segment that large. Unlike
+ * metaslab_group_alloc() this never activates or passivates metaslabs, so
+ * a failure leaves the group as it was.
+ */
+static uint64_t
+metaslab_group_alloc_primary(metaslab_group_t *mg, zio_alloc_list_t *zal,
+    uint64_t asize, uint64_t txg, int allocator)
+{
+	uint64_t offset = -1ULL;
+
+	if (allocator >= mg->mg_ms_ready / 3)
+		allocator = 0;
+	metaslab_group_allocator_t *mga = &mg->mg_allocator[allocator];
+
+	mutex_enter(&mg->mg_lock);
+	metaslab_t *msp = mga->mga_primary;
+	mutex_exit(&mg->mg_lock);
+	if (msp == NULL)
+		return (-1ULL);
+
+	mutex_enter(&msp->ms_lock);
+	/*
+	 * The metaslab may have been passivated while we were waiting for
+	 * the ms_lock; see the similar checks in metaslab_group_alloc().
+	 */
+	if ((msp->ms_weight & METASLAB_WEIGHT_PRIMARY) &&
+	    msp->ms_allocator == allocator && !msp->ms_condensing &&
+	    msp->ms_disabled == 0 && metaslab_should_allocate(msp, asize,
+	    B_FALSE)) {
+		uint64_t actual_asize;
+
+		ASSERT(msp->ms_loaded);
+		metaslab_set_selected_txg(msp, txg);
+		offset = metaslab_block_alloc(msp, asize, asize, txg,
+		    &actual_asize);
+		if (offset != -1ULL)
+			ASSERT3U(actual_asize, ==, asize);
+		metaslab_trace_add(zal, mg, msp, asize, 0, offset, allocator);
+	}
+	mutex_exit(&msp->ms_lock);
+
+	return (offset);
+}
+
+/*
+ * Allocate the blocks of several single-copy writes from the same class,
+ * allocator and txg as one contiguous region, which takes the group and
+ * metaslab locks once for the whole batch and lays the blocks out next to
+ * each other. This only uses the metaslab that the allocator is already
+ * allocating from, and either allocates every block or none of them; on
+ * failure the caller allocates them one at a time with metaslab_alloc().
+ */
+int
+metaslab_alloc_batch(spa_t *spa, metaslab_class_t *mc, blkptr_t **bps,
+    const void **tags, int count, uint64_t txg, int flags,
+    zio_alloc_list_t *zal, int allocator)
+{
+	metaslab_class_allocator_t *mca = &mc->mc_allocator[allocator];
+	uint64_t psize = 0, asize = 0;
+
+	ASSERT0(flags & (METASLAB_GANG_HEADER | METASLAB_GANG_CHILD));
+
+	spa_config_enter(spa, SCL_ALLOC, FTAG, RW_READER);
+
+	metaslab_group_t *mg = mca->mca_rotor;
+	if (mg == NULL || !metaslab_group_allocatable(spa, mg,
+	    BP_GET_PSIZE(bps[0]), 0, flags, B_FALSE, zal, allocator)) {
+		spa_config_exit(spa, SCL_ALLOC, FTAG);
+		return (SET_ERROR(ENOSPC));
+	}
+
+	vdev_t *vd = mg->mg_vd;
+	for (int i = 0; i < count; i++) {
+		ASSERT(BP_IS_HOLE(bps[i]));
+		ASSERT0(BP_GET_NDVAS(bps[i]));
+		/* Leave the blocks ztest wants to gang to metaslab_alloc(). */
+		if (BP_GET_PSIZE(bps[i]) >= metaslab_force_ganging &&
+		    metaslab_force_ganging_pct > 0) {
+			spa_config_exit(spa, SCL_ALLOC, FTAG);
+			return (SET_ERROR(ENOSPC));
+		}
+		psize += BP_GET_PSIZE(bps[i]);
+		asize += vdev_psize_to_asize_txg(vd, BP_GET_PSIZE(bps[i]), txg);
+	}
+
+	uint64_t offset = metaslab_group_alloc_primary(mg, zal, asize, txg,
+	    allocator);
+	if (offset == -1ULL) {
+		spa_config_exit(spa, SCL_ALLOC, FTAG);
+		return (SET_ERROR(ENOSPC));
+	}
+	metaslab_class_rotate(mg, allocator, psize, B_TRUE);
+
+	for (int i = 0; i < count; i++) {
+		dva_t *dva = &bps[i]->blk_dva[0];
+		uint64_t bpsize = BP_GET_PSIZE(bps[i]);
+		uint64_t basize = vdev_psize_to_asize_txg(vd, bpsize, txg);
+
+		DVA_SET_VDEV(dva, vd->vdev_id);
+		DVA_SET_OFFSET(dva, offset);
+		DVA_SET_GANG(dva, 0);
+		DVA_SET_ASIZE(dva, basize);
+		offset += basize;
+
+		metaslab_group_alloc_increment(spa, vd->vdev_id, allocator,
+		    flags, bpsize, tags[i]);
+	}
+
+	spa_config_exit(spa, SCL_ALLOC, FTAG);
+
+	for (int i = 0; i < count; i++)
+		BP_SET_BIRTH(bps[i], txg, 0);
+
+	return (0);
+}
+
 void
 metaslab_free(spa_t *spa, const blkptr_t *bp, uint64_t txg, boolean_t now)
 {
@@ -6416,6 +6778,9 @@ ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, preload_enabled, INT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, preload_limit, UINT, ZMOD_RW,
 	"Max number of metaslabs per group to preload");
 
+ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, preload_import_limit, UINT,
+	ZMOD_RW, "Max number of metaslabs per group to preload on import");
+
 ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, unload_delay, UINT, ZMOD_RW,
 	"Delay in txgs after metaslab was last used before unloading");
 
@@ -6479,6 +6844,9 @@ ZFS_MODULE_PARAM(zfs_metaslab, zfs_metaslab_, max_size_cache_sec, U64,
 ZFS_MODULE_PARAM(zfs_metaslab, zfs_metaslab_, mem_limit, UINT, ZMOD_RW,
 	"Percentage of memory that can be used to store metaslab range trees");
 
+ZFS_MODULE_PARAM(zfs_metaslab, zfs_metaslab_, compact_on_load, INT, ZMOD_RW,
+	"Pack the range tree leaves of newly loaded metaslabs");
+
 ZFS_MODULE_PARAM(zfs_metaslab, zfs_metaslab_, try_hard_before_gang, INT,
 	ZMOD_RW, "Try hard to allocate before ganging");
 
@@ -219,6 +219,12 @@ static const boolean_t spa_create_process = B_TRUE; /* no process => no sysdc */
 
 static uint_t	zio_taskq_write_tpq = 16;
 
+/*
+ * Level 0 blocks at least this large are given their own share of the
+ * allocators, see spa_select_allocator(). 0 disables this.
+ */
+static uint_t spa_large_alloc_threshold = 0;
+
 /*
  * Report any spa_load_verify errors found, but do not fail spa_load.
  * This is used by zdb to analyze non-idle pools.
@@ -2194,6 +2200,14 @@ spa_destroy_aux_threads(spa_t *spa)
 		zthr_destroy(spa->spa_raidz_expand_zthr);
 		spa->spa_raidz_expand_zthr = NULL;
 	}
+	if (spa->spa_ddt_flush_zthr != NULL) {
+		zthr_destroy(spa->spa_ddt_flush_zthr);
+		spa->spa_ddt_flush_zthr = NULL;
+	}
+	if (spa->spa_ddt_filter_zthr != NULL) {
+		zthr_destroy(spa->spa_ddt_filter_zthr);
+		spa->spa_ddt_filter_zthr = NULL;
+	}
 }
 
 static void
@@ -3618,6 +3632,8 @@ spa_spawn_aux_threads(spa_t *spa)
 	spa_start_indirect_condensing_thread(spa);
 	spa_start_livelist_destroy_thread(spa);
 	spa_start_livelist_condensing_thread(spa);
+	spa_start_ddt_flush_thread(spa);
+	spa_start_ddt_filter_thread(spa);
 
 	ASSERT0P(spa->spa_checkpoint_discard_zthr);
 	spa->spa_checkpoint_discard_zthr =
@@ -6231,6 +6247,15 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, const char **ereport)
 		 */
 		spa_ld_claim_log_blocks(spa);
 
+		/*
+		 * Start loading the best metaslabs of every vdev in the
+		 * background, so the first txgs don't wait on space maps.
+		 */
+		spa_import_progress_set_notes(spa, "Preloading metaslabs");
+		spa_config_enter(spa, SCL_ALLOC, FTAG, RW_READER);
+		metaslab_preload_vdev(spa->spa_root_vdev);
+		spa_config_exit(spa, SCL_ALLOC, FTAG);
+
 		/*
 		 * Kick-off the syncing thread.
 		 */
@@ -10009,6 +10034,14 @@ spa_async_suspend(spa_t *spa)
 	zthr_t *ll_condense_thread = spa->spa_livelist_condense_zthr;
 	if (ll_condense_thread != NULL)
 		zthr_cancel(ll_condense_thread);
+
+	zthr_t *ddt_flush_thread = spa->spa_ddt_flush_zthr;
+	if (ddt_flush_thread != NULL)
+		zthr_cancel(ddt_flush_thread);
+
+	zthr_t *ddt_filter_thread = spa->spa_ddt_filter_zthr;
+	if (ddt_filter_thread != NULL)
+		zthr_cancel(ddt_filter_thread);
 }
 
 void
@@ -10039,6 +10072,14 @@ spa_async_resume(spa_t *spa)
 	zthr_t *ll_condense_thread = spa->spa_livelist_condense_zthr;
 	if (ll_condense_thread != NULL)
 		zthr_resume(ll_condense_thread);
+
+	zthr_t *ddt_flush_thread = spa->spa_ddt_flush_zthr;
+	if (ddt_flush_thread != NULL)
+		zthr_resume(ddt_flush_thread);
+
+	zthr_t *ddt_filter_thread = spa->spa_ddt_filter_zthr;
+	if (ddt_filter_thread != NULL)
+		zthr_resume(ddt_filter_thread);
 }
 
 static boolean_t
@@ -11232,16 +11273,38 @@ spa_select_allocator(zio_t *zio)
 	ASSERT(spa != NULL);
 	ASSERT(bm != NULL);
 
+	/*
+	 * Blocks this large only come from datasets with a large recordsize,
+	 * which are mostly written as long streams. Those get the first half
+	 * of the allocators and everything else gets the rest, so the two
+	 * kinds are allocated from different metaslabs. When large blocks
+	 * are freed they then leave large free segments behind, rather than
+	 * gaps between small blocks that are still in use.
+	 */
+	uint_t base = 0, count = spa->spa_alloc_count;
+	if (spa_large_alloc_threshold != 0 && count > 1) {
+		uint_t nlarge = count / 2;
+		if (bm->zb_level == 0 &&
+		    zio->io_lsize >= spa_large_alloc_threshold) {
+			count = nlarge;
+		} else {
+			base = nlarge;
+			count -= nlarge;
+		}
+	}
+
 	/*
 	 * First try to use an allocator assigned to the syncthread, and set
-	 * the corresponding write issue taskq for the allocator.
+	 * the corresponding write issue taskq for the allocator.  Without
+	 * the split above, each sync thread has an allocator of its own.
 	 * Note, we must have an open pool to do this.
 	 */
 	if (spa->spa_sync_tq != NULL) {
 		spa_syncthread_info_t *ti = spa->spa_syncthreads;
 		for (int i = 0; i < spa->spa_alloc_count; i++, ti++) {
 			if (ti->sti_thread == curthread) {
-				zio->io_allocator = ti->sti_allocator;
+				zio->io_allocator = base +
+				    ti->sti_allocator % count;
 				return;
 			}
 		}
@@ -11257,7 +11320,7 @@ spa_select_allocator(zio_t *zio)
 	uint64_t hv = cityhash4(bm->zb_objset, bm->zb_object, bm->zb_level,
 	    bm->zb_blkid >> 20);
 
-	zio->io_allocator = (uint_t)hv % spa->spa_alloc_count;
+	zio->io_allocator = base + (uint_t)hv % count;
 }
 
 /*
@@ -12010,6 +12073,9 @@ ZFS_MODULE_PARAM(zfs_spa, spa_, flush_txg_time, UINT, ZMOD_RW,
 	"How frequently the TXG timestamps database should be flushed "
 	"to disk (in seconds)");
 
+ZFS_MODULE_PARAM(zfs, spa_, large_alloc_threshold, UINT, ZMOD_RW,
+	"Minimum size of data blocks given their own allocators");
+
 #ifdef _KERNEL
 ZFS_MODULE_VIRTUAL_PARAM_CALL(zfs_zio, zio_, taskq_read,
 	spa_taskq_read_param_set, spa_taskq_read_param_get, ZMOD_RW,
@@ -67,6 +67,7 @@
 #include <sys/zfeature.h>
 #include <sys/qat.h>
 #include <sys/zstd/zstd.h>
+#include <sys/zfs_zero.h>
 
 /*
  * SPA locking
@@ -2676,6 +2677,7 @@ spa_init(spa_mode_t mode)
 	zil_init();
 	vdev_mirror_stat_init();
 	vdev_raidz_math_init();
+	zfs_zero_init();
 	vdev_file_init();
 	zfs_prop_init();
 	chksum_init();
@@ -2696,6 +2698,7 @@ spa_fini(void)
 	vdev_file_fini();
 	vdev_mirror_stat_fini();
 	vdev_raidz_math_fini();
+	zfs_zero_fini();
 	chksum_fini();
 	zil_fini();
 	dmu_fini();
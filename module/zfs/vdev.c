@@ -801,6 +801,8 @@ vdev_alloc_common(spa_t *spa, uint_t id, uint64_t guid, vdev_ops_t *ops)
 	mutex_init(&vd->vdev_rebuild_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&vd->vdev_rebuild_cv, NULL, CV_DEFAULT, NULL);
 
+	mutex_init(&vd->vdev_zil_flush_lock, NULL, MUTEX_DEFAULT, NULL);
+
 	for (int t = 0; t < DTL_TYPES; t++) {
 		vd->vdev_dtl[t] = zfs_range_tree_create_flags(
 		    NULL, ZFS_RANGE_SEG64, NULL, 0, 0,
@@ -929,6 +931,14 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	vd->vdev_tsd = tsd;
 	vd->vdev_islog = islog;
 
+	/*
+	 * A spare in use is both in the spare list and in the vdev tree, with
+	 * the same guid. Only the one in the tree, which gets the I/O, has a
+	 * queue kstat, as they are named after the guid.
+	 */
+	if (alloctype != VDEV_ALLOC_SPARE)
+		vdev_queue_kstat_init(vd);
+
 	if (top_level && alloc_bias != VDEV_BIAS_NONE)
 		vd->vdev_alloc_bias = alloc_bias;
 
@@ -1295,6 +1305,10 @@ vdev_free(vdev_t *vd)
 	mutex_destroy(&vd->vdev_rebuild_lock);
 	cv_destroy(&vd->vdev_rebuild_cv);
 
+	ASSERT(!vd->vdev_zil_flush_active);
+	ASSERT0P(vd->vdev_zil_flush_next);
+	mutex_destroy(&vd->vdev_zil_flush_lock);
+
 	zfs_ratelimit_fini(&vd->vdev_delay_rl);
 	zfs_ratelimit_fini(&vd->vdev_deadman_rl);
 	zfs_ratelimit_fini(&vd->vdev_dio_verify_rl);
@@ -5839,6 +5853,7 @@ vdev_expand(vdev_t *vd, uint64_t txg)
 		vdev_metaslab_group_create(vd);
 		VERIFY0(vdev_metaslab_init(vd, txg));
 		vdev_config_dirty(vd);
+		metaslab_preload_vdev(vd);
 	}
 }
 
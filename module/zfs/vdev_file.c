@@ -52,6 +52,32 @@ static taskq_t *vdev_file_taskq;
 static uint_t vdev_file_logical_ashift = SPA_MINBLOCKSHIFT;
 static uint_t vdev_file_physical_ashift = SPA_MINBLOCKSHIFT;
 
+#ifndef _KERNEL
+/*
+ * In user space, reads, writes and flushes are submitted through a shared
+ * asynchronous I/O ring (io_uring on Linux) when available, instead of
+ * being dispatched to vdev_file_taskq as blocking calls.  Their completions
+ * are handled on vdev_file_taskq.  Scatter ABDs are bounced through the
+ * ring's registered buffers when one is free.  The ring is only set up
+ * while file vdevs are open, and this is checked when the first one is.
+ */
+static int vdev_file_io_uring = 1;
+
+#define	VDEV_FILE_RING_ENTRIES	256
+#define	VDEV_FILE_RING_NBUFS	64
+#define	VDEV_FILE_RING_BUFSIZE	SPA_OLD_MAXBLOCKSIZE
+
+static kmutex_t vdev_file_ring_lock;
+static uint_t vdev_file_ring_refs;	/* open file vdevs */
+static zfs_file_ring_t *vdev_file_ring;
+
+typedef struct vdev_file_ring_io {
+	zio_t	*vfr_zio;
+	void	*vfr_buf;
+	int	vfr_bufidx;	/* registered buffer, or -1 */
+} vdev_file_ring_io_t;
+#endif
+
 void
 vdev_file_init(void)
 {
@@ -59,14 +85,53 @@ vdev_file_init(void)
 	    minclsyspri, boot_ncpus, INT_MAX, TASKQ_DYNAMIC);
 
 	VERIFY(vdev_file_taskq);
+
+#ifndef _KERNEL
+	mutex_init(&vdev_file_ring_lock, NULL, MUTEX_DEFAULT, NULL);
+#endif
 }
 
 void
 vdev_file_fini(void)
 {
+#ifndef _KERNEL
+	ASSERT0(vdev_file_ring_refs);
+	ASSERT0P(vdev_file_ring);
+	mutex_destroy(&vdev_file_ring_lock);
+#endif
 	taskq_destroy(vdev_file_taskq);
 }
 
+#ifndef _KERNEL
+/*
+ * The ring is created when the first file vdev is opened, and destroyed
+ * when the last one is closed, once none of their I/O can be in flight.
+ */
+static void
+vdev_file_ring_hold(void)
+{
+	mutex_enter(&vdev_file_ring_lock);
+	if (vdev_file_ring_refs++ == 0 && vdev_file_io_uring) {
+		vdev_file_ring = zfs_file_ring_create(VDEV_FILE_RING_ENTRIES,
+		    VDEV_FILE_RING_NBUFS, VDEV_FILE_RING_BUFSIZE,
+		    vdev_file_taskq);
+	}
+	mutex_exit(&vdev_file_ring_lock);
+}
+
+static void
+vdev_file_ring_rele(void)
+{
+	mutex_enter(&vdev_file_ring_lock);
+	ASSERT3U(vdev_file_ring_refs, >, 0);
+	if (--vdev_file_ring_refs == 0 && vdev_file_ring != NULL) {
+		zfs_file_ring_destroy(vdev_file_ring);
+		vdev_file_ring = NULL;
+	}
+	mutex_exit(&vdev_file_ring_lock);
+}
+#endif
+
 static void
 vdev_file_hold(vdev_t *vd)
 {
@@ -162,6 +227,9 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 	}
 
 	vf->vf_file = fp;
+#ifndef _KERNEL
+	vdev_file_ring_hold();
+#endif
 
 #ifdef _KERNEL
 	/*
@@ -201,6 +269,9 @@ vdev_file_close(vdev_t *vd)
 
 	if (vf->vf_file != NULL) {
 		(void) zfs_file_close(vf->vf_file);
+#ifndef _KERNEL
+		vdev_file_ring_rele();
+#endif
 	}
 
 	vd->vdev_delayed_close = B_FALSE;
@@ -265,6 +336,93 @@ vdev_file_io_deallocate(void *arg)
 	zio_interrupt(zio);
 }
 
+#ifndef _KERNEL
+static void
+vdev_file_ring_done(void *arg, int err, ssize_t resid)
+{
+	vdev_file_ring_io_t *vfr = arg;
+	zio_t *zio = vfr->vfr_zio;
+
+	if (zio->io_type == ZIO_TYPE_FLUSH) {
+		kmem_free(vfr, sizeof (*vfr));
+		zio->io_error = err;
+		zio_interrupt(zio);
+		return;
+	}
+
+	if (vfr->vfr_bufidx >= 0) {
+		if (zio->io_type == ZIO_TYPE_READ) {
+			abd_copy_from_buf(zio->io_abd, vfr->vfr_buf,
+			    zio->io_size);
+		}
+		zfs_file_ring_buf_free(vdev_file_ring, vfr->vfr_bufidx);
+	} else if (zio->io_type == ZIO_TYPE_READ) {
+		abd_return_buf_copy(zio->io_abd, vfr->vfr_buf, zio->io_size);
+	} else {
+		abd_return_buf(zio->io_abd, vfr->vfr_buf, zio->io_size);
+	}
+	kmem_free(vfr, sizeof (*vfr));
+
+	zio->io_error = err;
+	if (resid != 0 && zio->io_error == 0)
+		zio->io_error = SET_ERROR(ENOSPC);
+
+	zio_delay_interrupt(zio);
+}
+
+static void
+vdev_file_ring_io_start(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_file_t *vf = vd->vdev_tsd;
+	vdev_file_ring_io_t *vfr = kmem_alloc(sizeof (*vfr), KM_SLEEP);
+
+	vfr->vfr_zio = zio;
+	vfr->vfr_buf = NULL;
+	vfr->vfr_bufidx = -1;
+
+	if (zio->io_type == ZIO_TYPE_FLUSH) {
+		zfs_file_ring_fsync(vdev_file_ring, vf->vf_file,
+		    vdev_file_ring_done, vfr);
+		return;
+	}
+
+	ASSERT(zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE);
+
+	/*
+	 * Linear ABDs are used in place.  Anything else needs a linear copy,
+	 * which goes to a registered buffer when one is free.
+	 */
+	if (!abd_is_linear(zio->io_abd)) {
+		vfr->vfr_buf = zfs_file_ring_buf_alloc(vdev_file_ring,
+		    zio->io_size, &vfr->vfr_bufidx);
+		if (vfr->vfr_buf != NULL && zio->io_type == ZIO_TYPE_WRITE) {
+			abd_copy_to_buf(vfr->vfr_buf, zio->io_abd,
+			    zio->io_size);
+		}
+	}
+	if (vfr->vfr_buf == NULL) {
+		if (zio->io_type == ZIO_TYPE_READ) {
+			vfr->vfr_buf = abd_borrow_buf(zio->io_abd,
+			    zio->io_size);
+		} else {
+			vfr->vfr_buf = abd_borrow_buf_copy(zio->io_abd,
+			    zio->io_size);
+		}
+	}
+
+	if (zio->io_type == ZIO_TYPE_READ) {
+		zfs_file_ring_pread(vdev_file_ring, vf->vf_file, vfr->vfr_buf,
+		    vfr->vfr_bufidx, zio->io_size, zio->io_offset,
+		    vdev_file_ring_done, vfr);
+	} else {
+		zfs_file_ring_pwrite(vdev_file_ring, vf->vf_file, vfr->vfr_buf,
+		    vfr->vfr_bufidx, zio->io_size, zio->io_offset,
+		    vd->vdev_ashift, vdev_file_ring_done, vfr);
+	}
+}
+#endif
+
 static void
 vdev_file_io_start(zio_t *zio)
 {
@@ -283,6 +441,13 @@ vdev_file_io_start(zio_t *zio)
 			return;
 		}
 
+#ifndef _KERNEL
+		if (vdev_file_ring != NULL) {
+			vdev_file_ring_io_start(zio);
+			return;
+		}
+#endif
+
 		VERIFY3U(taskq_dispatch(vdev_file_taskq,
 		    vdev_file_io_fsync, zio, TQ_SLEEP), !=, TASKQID_INVALID);
 
@@ -302,6 +467,13 @@ vdev_file_io_start(zio_t *zio)
 	ASSERT(zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE);
 	zio->io_target_timestamp = zio_handle_io_delay(zio);
 
+#ifndef _KERNEL
+	if (vdev_file_ring != NULL) {
+		vdev_file_ring_io_start(zio);
+		return;
+	}
+#endif
+
 	VERIFY3U(taskq_dispatch(vdev_file_taskq, vdev_file_io_strategy, zio,
 	    TQ_SLEEP), !=, TASKQID_INVALID);
 }
@@ -374,3 +546,7 @@ ZFS_MODULE_PARAM(zfs_vdev_file, vdev_file_, logical_ashift, UINT, ZMOD_RW,
 	"Logical ashift for file-based devices");
 ZFS_MODULE_PARAM(zfs_vdev_file, vdev_file_, physical_ashift, UINT, ZMOD_RW,
 	"Physical ashift for file-based devices");
+#ifndef _KERNEL
+ZFS_MODULE_PARAM(zfs_vdev_file, vdev_file_, io_uring, INT, ZMOD_RD,
+	"Use io_uring for file-based devices in user space");
+#endif
@@ -116,6 +116,28 @@
  * maximum percentage, this indicates that the rate of incoming data is
  * greater than the rate that the backend storage can handle. In this case, we
  * must further throttle incoming writes (see dmu_tx_delay() for details).
+ *
+ * Latency Targeting
+ *
+ * When zfs_vdev_latency_target_us is non-zero, the static *_max_active
+ * limits are replaced by per-vdev limits that adapt to the completion
+ * latency observed on each leaf vdev.  Every completed I/O records its
+ * device service time in a per-class histogram.  After
+ * zfs_vdev_latency_window completions the 99th percentile of each class is
+ * computed and every class limit is adjusted: if the p99 latency of the
+ * synchronous classes (or, with no synchronous I/O in the window, of the
+ * class itself) exceeds the target, the limit is halved; otherwise, if the
+ * class was held back by its limit during the window, the limit grows by
+ * one, up to zfs_vdev_max_active.  Synchronous I/O thus stays close to the
+ * target while asynchronous writes and non-interactive I/O expand to use
+ * whatever capacity the device has left.  Since a device can be slower
+ * than the target at any queue depth, every VDQ_LAT_PROBE_WINDOWS windows
+ * the classes held back below their static *_max_active double their
+ * limit for one window, and keep it unless the latency got worse.  The
+ * *_min_active limits, the non-interactive credit logic and the async
+ * write dirty data thresholds still apply on top of the adaptive limits.
+ * The state of each vdev is exported in the zfs/<pool>/vdev_queue_<guid>
+ * kstat.
  */
 
 /*
@@ -204,6 +226,64 @@ static uint_t zfs_vdev_aggregation_limit_non_rotating = SPA_OLD_MAXBLOCKSIZE;
 static uint_t zfs_vdev_read_gap_limit = 32 << 10;
 static uint_t zfs_vdev_write_gap_limit = 4 << 10;
 
+/*
+ * Target p99 device latency in microseconds for the latency-targeting mode
+ * of the scheduler, or 0 to use the static *_max_active limits.  The limits
+ * are re-evaluated every zfs_vdev_latency_window completed I/Os.
+ */
+static uint_t zfs_vdev_latency_target_us = 0;
+static uint_t zfs_vdev_latency_window = 256;
+
+#define	VDQ_LAT_PROBE_WINDOWS	16
+
+typedef struct vdev_queue_kstats {
+	kstat_named_t	vqks_latency_target_us;
+	kstat_named_t	vqks_windows;
+	kstat_named_t	vqks_active;
+	kstat_named_t	vqks_sync_read_limit;
+	kstat_named_t	vqks_sync_read_p99_us;
+	kstat_named_t	vqks_sync_write_limit;
+	kstat_named_t	vqks_sync_write_p99_us;
+	kstat_named_t	vqks_async_read_limit;
+	kstat_named_t	vqks_async_read_p99_us;
+	kstat_named_t	vqks_async_write_limit;
+	kstat_named_t	vqks_async_write_p99_us;
+	kstat_named_t	vqks_scrub_limit;
+	kstat_named_t	vqks_scrub_p99_us;
+	kstat_named_t	vqks_removal_limit;
+	kstat_named_t	vqks_removal_p99_us;
+	kstat_named_t	vqks_initializing_limit;
+	kstat_named_t	vqks_initializing_p99_us;
+	kstat_named_t	vqks_trim_limit;
+	kstat_named_t	vqks_trim_p99_us;
+	kstat_named_t	vqks_rebuild_limit;
+	kstat_named_t	vqks_rebuild_p99_us;
+} vdev_queue_kstats_t;
+
+static const vdev_queue_kstats_t vdev_queue_kstats_template = {
+	{ "latency_target_us",		KSTAT_DATA_UINT64 },
+	{ "windows",			KSTAT_DATA_UINT64 },
+	{ "active",			KSTAT_DATA_UINT64 },
+	{ "sync_read_limit",		KSTAT_DATA_UINT64 },
+	{ "sync_read_p99_us",		KSTAT_DATA_UINT64 },
+	{ "sync_write_limit",		KSTAT_DATA_UINT64 },
+	{ "sync_write_p99_us",		KSTAT_DATA_UINT64 },
+	{ "async_read_limit",		KSTAT_DATA_UINT64 },
+	{ "async_read_p99_us",		KSTAT_DATA_UINT64 },
+	{ "async_write_limit",		KSTAT_DATA_UINT64 },
+	{ "async_write_p99_us",		KSTAT_DATA_UINT64 },
+	{ "scrub_limit",		KSTAT_DATA_UINT64 },
+	{ "scrub_p99_us",		KSTAT_DATA_UINT64 },
+	{ "removal_limit",		KSTAT_DATA_UINT64 },
+	{ "removal_p99_us",		KSTAT_DATA_UINT64 },
+	{ "initializing_limit",		KSTAT_DATA_UINT64 },
+	{ "initializing_p99_us",	KSTAT_DATA_UINT64 },
+	{ "trim_limit",			KSTAT_DATA_UINT64 },
+	{ "trim_p99_us",		KSTAT_DATA_UINT64 },
+	{ "rebuild_limit",		KSTAT_DATA_UINT64 },
+	{ "rebuild_p99_us",		KSTAT_DATA_UINT64 },
+};
+
 static int
 vdev_queue_offset_compare(const void *x1, const void *x2)
 {
@@ -353,8 +433,11 @@ vdev_queue_max_async_writes(spa_t *spa)
 	return (writes);
 }
 
+/*
+ * Return the static per-class maximum, as configured by the tunables.
+ */
 static uint_t
-vdev_queue_class_max_active(vdev_queue_t *vq, zio_priority_t p)
+vdev_queue_class_static_max_active(zio_priority_t p)
 {
 	switch (p) {
 	case ZIO_PRIORITY_SYNC_READ:
@@ -364,37 +447,86 @@ vdev_queue_class_max_active(vdev_queue_t *vq, zio_priority_t p)
 	case ZIO_PRIORITY_ASYNC_READ:
 		return (zfs_vdev_async_read_max_active);
 	case ZIO_PRIORITY_ASYNC_WRITE:
-		return (vdev_queue_max_async_writes(vq->vq_vdev->vdev_spa));
+		return (zfs_vdev_async_write_max_active);
+	case ZIO_PRIORITY_SCRUB:
+		return (zfs_vdev_scrub_max_active);
+	case ZIO_PRIORITY_REMOVAL:
+		return (zfs_vdev_removal_max_active);
+	case ZIO_PRIORITY_INITIALIZING:
+		return (zfs_vdev_initializing_max_active);
+	case ZIO_PRIORITY_TRIM:
+		return (zfs_vdev_trim_max_active);
+	case ZIO_PRIORITY_REBUILD:
+		return (zfs_vdev_rebuild_max_active);
+	default:
+		panic("invalid priority %u", p);
+		return (0);
+	}
+}
+
+/*
+ * Return the maximum for the class, which is the adaptive limit when the
+ * latency-targeting mode is enabled and the static tunable otherwise.
+ */
+static inline uint_t
+vdev_queue_class_limit(vdev_queue_t *vq, zio_priority_t p)
+{
+	if (zfs_vdev_latency_target_us == 0)
+		return (vdev_queue_class_static_max_active(p));
+	return (vq->vq_lat[p].vql_limit);
+}
+
+static uint_t
+vdev_queue_class_max_active(vdev_queue_t *vq, zio_priority_t p)
+{
+	uint_t writes;
+
+	switch (p) {
+	case ZIO_PRIORITY_SYNC_READ:
+	case ZIO_PRIORITY_SYNC_WRITE:
+	case ZIO_PRIORITY_ASYNC_READ:
+	case ZIO_PRIORITY_TRIM:
+		return (vdev_queue_class_limit(vq, p));
+	case ZIO_PRIORITY_ASYNC_WRITE:
+		writes = vdev_queue_max_async_writes(vq->vq_vdev->vdev_spa);
+		if (zfs_vdev_latency_target_us == 0)
+			return (writes);
+		/*
+		 * Once the dirty data reaches the maximum threshold the
+		 * writes must drain regardless of the latency target, or
+		 * the write throttle would stall the whole pool.
+		 */
+		if (writes >= zfs_vdev_async_write_max_active)
+			return (MAX(writes, vq->vq_lat[p].vql_limit));
+		return (vq->vq_lat[p].vql_limit);
 	case ZIO_PRIORITY_SCRUB:
 		if (vq->vq_ia_active > 0) {
 			return (MIN(vq->vq_nia_credit,
 			    zfs_vdev_scrub_min_active));
 		} else if (vq->vq_nia_credit < zfs_vdev_nia_delay)
 			return (MAX(1, zfs_vdev_scrub_min_active));
-		return (zfs_vdev_scrub_max_active);
+		return (vdev_queue_class_limit(vq, p));
 	case ZIO_PRIORITY_REMOVAL:
 		if (vq->vq_ia_active > 0) {
 			return (MIN(vq->vq_nia_credit,
 			    zfs_vdev_removal_min_active));
 		} else if (vq->vq_nia_credit < zfs_vdev_nia_delay)
 			return (MAX(1, zfs_vdev_removal_min_active));
-		return (zfs_vdev_removal_max_active);
+		return (vdev_queue_class_limit(vq, p));
 	case ZIO_PRIORITY_INITIALIZING:
 		if (vq->vq_ia_active > 0) {
 			return (MIN(vq->vq_nia_credit,
 			    zfs_vdev_initializing_min_active));
 		} else if (vq->vq_nia_credit < zfs_vdev_nia_delay)
 			return (MAX(1, zfs_vdev_initializing_min_active));
-		return (zfs_vdev_initializing_max_active);
-	case ZIO_PRIORITY_TRIM:
-		return (zfs_vdev_trim_max_active);
+		return (vdev_queue_class_limit(vq, p));
 	case ZIO_PRIORITY_REBUILD:
 		if (vq->vq_ia_active > 0) {
 			return (MIN(vq->vq_nia_credit,
 			    zfs_vdev_rebuild_min_active));
 		} else if (vq->vq_nia_credit < zfs_vdev_nia_delay)
 			return (MAX(1, zfs_vdev_rebuild_min_active));
-		return (zfs_vdev_rebuild_max_active);
+		return (vdev_queue_class_limit(vq, p));
 	default:
 		panic("invalid priority %u", p);
 		return (0);
@@ -438,9 +570,12 @@ vdev_queue_class_to_issue(vdev_queue_t *vq)
 	 * maximum # outstanding i/os.
 	 */
 	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
-		if ((cq & (1U << p)) != 0 && vq->vq_cactive[p] <
-		    vdev_queue_class_max_active(vq, p))
+		if ((cq & (1U << p)) == 0)
+			continue;
+		if (vq->vq_cactive[p] < vdev_queue_class_max_active(vq, p))
 			break;
+		if (zfs_vdev_latency_target_us != 0)
+			vq->vq_lat[p].vql_throttled = B_TRUE;
 	}
 
 found:
@@ -448,6 +583,198 @@ found:
 	return (p);
 }
 
+/*
+ * Map a latency in microseconds to a histogram bucket.  Buckets are spaced
+ * at half powers of two, which is fine enough for the controller while
+ * keeping the histogram small.
+ */
+static uint_t
+vdev_queue_lat_bucket(uint64_t us)
+{
+	if (us < 2)
+		return (us);
+	int b = highbit64(us) - 1;
+	uint_t idx = 2 * b + ((us >> (b - 1)) & 1);
+	return (MIN(idx, VDQ_LAT_BUCKETS - 1));
+}
+
+/*
+ * Return the upper bound, in microseconds, of a histogram bucket.
+ */
+static uint64_t
+vdev_queue_lat_bucket_max(uint_t idx)
+{
+	if (idx < 2)
+		return (idx + 1);
+	int b = idx / 2;
+	return ((1ULL << b) + ((idx & 1) + 1) * (1ULL << (b - 1)));
+}
+
+static uint64_t
+vdev_queue_lat_p99(const vdev_queue_lat_t *vql)
+{
+	uint64_t want = vql->vql_count - vql->vql_count / 100;
+	uint64_t sum = 0;
+
+	for (uint_t i = 0; i < VDQ_LAT_BUCKETS; i++) {
+		sum += vql->vql_hist[i];
+		if (sum >= want)
+			return (vdev_queue_lat_bucket_max(i));
+	}
+	return (vdev_queue_lat_bucket_max(VDQ_LAT_BUCKETS - 1));
+}
+
+/*
+ * End of a sampling window: compute the p99 latency of every class and
+ * adjust the class limits towards zfs_vdev_latency_target_us.
+ */
+static void
+vdev_queue_lat_adjust(vdev_queue_t *vq)
+{
+	uint64_t target = zfs_vdev_latency_target_us;
+	uint64_t sync_p99 = 0;
+	boolean_t sync_seen = B_FALSE;
+	boolean_t probe =
+	    (vq->vq_lat_windows + 1) % VDQ_LAT_PROBE_WINDOWS == 0;
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+
+	for (zio_priority_t p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+		vdev_queue_lat_t *vql = &vq->vq_lat[p];
+		if (vql->vql_count == 0)
+			continue;
+		vql->vql_p99 = vdev_queue_lat_p99(vql);
+		if (p == ZIO_PRIORITY_SYNC_READ ||
+		    p == ZIO_PRIORITY_SYNC_WRITE) {
+			sync_p99 = MAX(sync_p99, vql->vql_p99);
+			sync_seen = B_TRUE;
+		}
+	}
+
+	for (zio_priority_t p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+		vdev_queue_lat_t *vql = &vq->vq_lat[p];
+		uint_t static_max = vdev_queue_class_static_max_active(p);
+		uint64_t lat;
+
+		if (p == ZIO_PRIORITY_SYNC_READ ||
+		    p == ZIO_PRIORITY_SYNC_WRITE || !sync_seen)
+			lat = vql->vql_count != 0 ? vql->vql_p99 : 0;
+		else
+			lat = sync_p99;
+
+		if (vql->vql_probing) {
+			/*
+			 * Keep the raised limit unless it made the latency
+			 * worse, i.e. the device is slow at any depth.
+			 */
+			vql->vql_probing = B_FALSE;
+			if (lat > target && lat > vql->vql_probe_lat)
+				vql->vql_limit = MAX(1, vql->vql_limit / 2);
+		} else if (probe && vql->vql_throttled &&
+		    vql->vql_limit < static_max) {
+			vql->vql_probing = B_TRUE;
+			vql->vql_probe_lat = lat;
+			vql->vql_limit = MIN(2 * vql->vql_limit, static_max);
+		} else if (lat > target) {
+			vql->vql_limit = MAX(1, vql->vql_limit / 2);
+		} else if (vql->vql_throttled &&
+		    vql->vql_limit < zfs_vdev_max_active) {
+			vql->vql_limit++;
+		}
+
+		memset(vql->vql_hist, 0, sizeof (vql->vql_hist));
+		vql->vql_count = 0;
+		vql->vql_throttled = B_FALSE;
+	}
+
+	vq->vq_lat_samples = 0;
+	vq->vq_lat_windows++;
+}
+
+static void
+vdev_queue_lat_record(vdev_queue_t *vq, zio_t *zio)
+{
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+
+	if (zio->io_delay == 0 || zio->io_error != 0)
+		return;
+
+	vdev_queue_lat_t *vql = &vq->vq_lat[zio->io_priority];
+	vql->vql_hist[vdev_queue_lat_bucket(NSEC2USEC(zio->io_delay))]++;
+	vql->vql_count++;
+
+	if (++vq->vq_lat_samples >= MAX(zfs_vdev_latency_window, 1))
+		vdev_queue_lat_adjust(vq);
+}
+
+static int
+vdev_queue_kstat_update(kstat_t *ksp, int rw)
+{
+	vdev_queue_t *vq = ksp->ks_private;
+	vdev_queue_kstats_t *vqks = ksp->ks_data;
+	kstat_named_t *knp = &vqks->vqks_sync_read_limit;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	mutex_enter(&vq->vq_lock);
+	vqks->vqks_latency_target_us.value.ui64 = zfs_vdev_latency_target_us;
+	vqks->vqks_windows.value.ui64 = vq->vq_lat_windows;
+	vqks->vqks_active.value.ui64 = vq->vq_active;
+	for (zio_priority_t p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+		(knp++)->value.ui64 = vdev_queue_class_limit(vq, p);
+		(knp++)->value.ui64 = vq->vq_lat[p].vql_p99;
+	}
+	mutex_exit(&vq->vq_lock);
+
+	return (0);
+}
+
+/*
+ * Not done by vdev_queue_init(), as the caller must make sure that no other
+ * vdev of the pool with the same guid has the kstat, see vdev_alloc().
+ */
+void
+vdev_queue_kstat_init(vdev_t *vd)
+{
+	vdev_queue_t *vq = &vd->vdev_queue;
+
+	if (!vd->vdev_ops->vdev_op_leaf)
+		return;
+
+	char *mod = kmem_asprintf("zfs/%s", spa_name(vd->vdev_spa));
+	char *name = kmem_asprintf("vdev_queue_%llu",
+	    (u_longlong_t)vd->vdev_guid);
+
+	vq->vq_ksp = kstat_create(mod, 0, name, "misc", KSTAT_TYPE_NAMED,
+	    sizeof (vdev_queue_kstats_t) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (vq->vq_ksp != NULL) {
+		vdev_queue_kstats_t *vqks =
+		    kmem_alloc(sizeof (vdev_queue_kstats_t), KM_SLEEP);
+		memcpy(vqks, &vdev_queue_kstats_template,
+		    sizeof (vdev_queue_kstats_t));
+		vq->vq_ksp->ks_data = vqks;
+		vq->vq_ksp->ks_update = vdev_queue_kstat_update;
+		vq->vq_ksp->ks_private = vq;
+		kstat_install(vq->vq_ksp);
+	}
+
+	kmem_strfree(name);
+	kmem_strfree(mod);
+}
+
+static void
+vdev_queue_kstat_fini(vdev_queue_t *vq)
+{
+	if (vq->vq_ksp == NULL)
+		return;
+
+	kmem_free(vq->vq_ksp->ks_data, sizeof (vdev_queue_kstats_t));
+	kstat_delete(vq->vq_ksp);
+	vq->vq_ksp = NULL;
+}
+
 void
 vdev_queue_init(vdev_t *vd)
 {
@@ -478,6 +805,11 @@ vdev_queue_init(vdev_t *vd)
 	list_create(&vq->vq_active_list, sizeof (struct zio),
 	    offsetof(struct zio, io_queue_node.l));
 	mutex_init(&vq->vq_lock, NULL, MUTEX_DEFAULT, NULL);
+
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+		vq->vq_lat[p].vql_limit =
+		    MAX(1, vdev_queue_class_static_max_active(p));
+	}
 }
 
 void
@@ -485,6 +817,8 @@ vdev_queue_fini(vdev_t *vd)
 {
 	vdev_queue_t *vq = &vd->vdev_queue;
 
+	vdev_queue_kstat_fini(vq);
+
 	for (zio_priority_t p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
 		if (vdev_queue_class_fifo(p))
 			list_destroy(&vq->vq_class[p].vqc_list);
@@ -996,6 +1330,8 @@ vdev_queue_io_done(zio_t *zio)
 		return;
 
 	mutex_enter(&vq->vq_lock);
+	if (zfs_vdev_latency_target_us != 0)
+		vdev_queue_lat_record(vq, zio);
 	vdev_queue_pending_remove(vq, zio);
 
 	while ((nio = vdev_queue_io_to_issue(vq)) != NULL) {
@@ -1184,3 +1520,9 @@ ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, nia_credit, UINT, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, nia_delay, UINT, ZMOD_RW,
 	"Number of non-interactive I/Os before _max_active");
+
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, latency_target_us, UINT, ZMOD_RW,
+	"Target p99 vdev I/O latency for adaptive max_active (0 = disabled)");
+
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, latency_window, UINT, ZMOD_RW,
+	"Completed I/Os between adaptive max_active adjustments");
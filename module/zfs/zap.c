@@ -1114,6 +1114,19 @@ zap_cursor_init_noprefetch_by_dnode(zap_cursor_t *zc, dnode_t *dn)
 	return (zap_cursor_init_by_dnode_impl(zc, dn, 0, B_FALSE));
 }
 
+int
+zap_cursor_init_hash_by_dnode(zap_cursor_t *zc, dnode_t *dn, uint64_t hash)
+{
+	int err = zap_cursor_init_by_dnode_impl(zc, dn, 0, B_FALSE);
+	if (err == 0) {
+		/* Only the bits the ZAP actually hashes on are meaningful. */
+		int shift = 64 - zap_hashbits(zc->zc_zap);
+		zc->zc_hash = (hash >> shift) << shift;
+		zc->zc_cd = 0;
+	}
+	return (err);
+}
+
 int
 zap_cursor_init_serialized(zap_cursor_t *zc, objset_t *os, uint64_t zapobj,
     uint64_t serialized)
@@ -0,0 +1,537 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or https://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/simd.h>
+#include <sys/spa.h>
+#include <sys/zfs_zero.h>
+
+/*
+ * Scalar implementations.  These are the reference for the SIMD ones, which
+ * must return exactly the same results, and are what is used when the FPU
+ * can't be used.
+ */
+static boolean_t
+zfs_zero_scalar_check(const void *buf, size_t size)
+{
+	const uint64_t *end = (const uint64_t *)((const char *)buf + size);
+
+	for (const uint64_t *word = buf; word < end; word++)
+		if (*word != 0)
+			return (B_FALSE);
+
+	return (B_TRUE);
+}
+
+static size_t
+zfs_zero_scalar_zle(const void *s_start, void *d_start, size_t s_len,
+    size_t d_len, int n)
+{
+	const uchar_t *src = s_start;
+	uchar_t *dst = d_start;
+	const uchar_t *s_end = src + s_len;
+	uchar_t *d_end = dst + d_len;
+
+	while (src < s_end && dst < d_end - 1) {
+		const uchar_t *first = src;
+		uchar_t *len = dst++;
+		if (src[0] == 0) {
+			const uchar_t *last = src + (256 - n);
+			while (src < MIN(last, s_end) && src[0] == 0)
+				src++;
+			*len = src - first - 1 + n;
+		} else {
+			const uchar_t *last = src + n;
+			if (d_end - dst < n)
+				break;
+			while (src < MIN(last, s_end) - 1 && (src[0] | src[1]))
+				*dst++ = *src++;
+			if (src[0])
+				*dst++ = *src++;
+			*len = src - first - 1;
+		}
+	}
+	return (src == s_end ? dst - (uchar_t *)d_start : s_len);
+}
+
+static boolean_t
+zfs_zero_scalar_will_work(void)
+{
+	return (B_TRUE);
+}
+
+static const zfs_zero_ops_t zfs_zero_scalar_ops = {
+	.check = zfs_zero_scalar_check,
+	.zle = zfs_zero_scalar_zle,
+	.is_supported = zfs_zero_scalar_will_work,
+	.uses_fpu = B_FALSE,
+	.name = "scalar"
+};
+
+/* All compiled in implementations */
+static const zfs_zero_ops_t *const zfs_zero_impls[] = {
+	&zfs_zero_scalar_ops,
+#if defined(__x86_64) && HAVE_SIMD(SSE2)
+	&zfs_zero_sse2_ops,
+#endif
+#if defined(__x86_64) && HAVE_SIMD(AVX2)
+	&zfs_zero_avx2_ops,
+#endif
+#if defined(__x86_64) && HAVE_SIMD(AVX512BW)
+	&zfs_zero_avx512bw_ops,
+#endif
+};
+
+/* Hold all supported implementations */
+static uint32_t zfs_zero_supp_impls_cnt = 0;
+static const zfs_zero_ops_t *zfs_zero_supp_impls[ARRAY_SIZE(zfs_zero_impls)];
+
+/* Fastest supported implementation of each function */
+static const zfs_zero_ops_t *zfs_zero_fastest_impl[ZFS_ZERO_FN_NUM];
+
+/* Select implementation */
+#define	IMPL_FASTEST	(UINT32_MAX)
+#define	IMPL_CYCLE	(UINT32_MAX - 1)
+#define	IMPL_SCALAR	(0)
+
+static uint32_t zfs_zero_impl_chosen = IMPL_FASTEST;
+
+#define	IMPL_READ(i)	(*(volatile uint32_t *) &(i))
+
+static struct zfs_zero_impl_selector {
+	const char	*zis_name;
+	uint32_t	zis_sel;
+} zfs_zero_impl_selectors[] = {
+	{ "cycle",	IMPL_CYCLE },
+	{ "fastest",	IMPL_FASTEST },
+	{ "scalar",	IMPL_SCALAR }
+};
+
+#if defined(_KERNEL)
+static kstat_t *zfs_zero_kstat;
+
+/*
+ * Throughput of each function in B/s, the last entry holds the index of the
+ * fastest implementation instead.
+ */
+static struct zfs_zero_kstat {
+	uint64_t zs_fn[ZFS_ZERO_FN_NUM];
+} zfs_zero_stat_data[ARRAY_SIZE(zfs_zero_impls) + 1];
+
+static const char *const zfs_zero_fn_name[ZFS_ZERO_FN_NUM] = {
+	"check", "zle"
+};
+#endif
+
+/* Indicate that benchmark has been completed */
+static boolean_t zfs_zero_initialized = B_FALSE;
+
+int
+zfs_zero_impl_set(const char *val)
+{
+	int err = -EINVAL;
+	uint32_t impl = IMPL_READ(zfs_zero_impl_chosen);
+	size_t i, val_len;
+
+	val_len = strlen(val);
+	while ((val_len > 0) && !!isspace(val[val_len-1])) /* trim '\n' */
+		val_len--;
+
+	/* check mandatory implementations */
+	for (i = 0; i < ARRAY_SIZE(zfs_zero_impl_selectors); i++) {
+		const char *name = zfs_zero_impl_selectors[i].zis_name;
+
+		if (val_len == strlen(name) &&
+		    strncmp(val, name, val_len) == 0) {
+			impl = zfs_zero_impl_selectors[i].zis_sel;
+			err = 0;
+			break;
+		}
+	}
+
+	if (err != 0 && zfs_zero_initialized) {
+		/* check all supported implementations */
+		for (i = 0; i < zfs_zero_supp_impls_cnt; i++) {
+			const char *name = zfs_zero_supp_impls[i]->name;
+
+			if (val_len == strlen(name) &&
+			    strncmp(val, name, val_len) == 0) {
+				impl = i;
+				err = 0;
+				break;
+			}
+		}
+	}
+
+	if (err == 0) {
+		atomic_swap_32(&zfs_zero_impl_chosen, impl);
+		membar_producer();
+	}
+
+	return (err);
+}
+
+/*
+ * Returns the implementation of fn to use.  When a SIMD implementation is not
+ * allowed in the current context, or before the implementations have been
+ * benchmarked, fall back to the scalar one.
+ */
+static inline const zfs_zero_ops_t *
+zfs_zero_impl_get(zfs_zero_fn_t fn)
+{
+	if (!kfpu_allowed() || !zfs_zero_initialized)
+		return (&zfs_zero_scalar_ops);
+
+	const zfs_zero_ops_t *ops = NULL;
+	uint32_t impl = IMPL_READ(zfs_zero_impl_chosen);
+
+	switch (impl) {
+	case IMPL_FASTEST:
+		ops = zfs_zero_fastest_impl[fn];
+		break;
+	case IMPL_CYCLE:
+		/* Cycle through supported implementations */
+		ASSERT3U(zfs_zero_supp_impls_cnt, >, 0);
+		static uint32_t cycle_count = 0;
+		uint32_t idx = (++cycle_count) % zfs_zero_supp_impls_cnt;
+		ops = zfs_zero_supp_impls[idx];
+		break;
+	default:
+		ASSERT3U(zfs_zero_supp_impls_cnt, >, 0);
+		ASSERT3U(impl, <, zfs_zero_supp_impls_cnt);
+		ops = zfs_zero_supp_impls[impl];
+		break;
+	}
+
+	ASSERT3P(ops, !=, NULL);
+
+	return (ops);
+}
+
+const zfs_zero_ops_t *
+zfs_zero_ops_begin(zfs_zero_fn_t fn)
+{
+	const zfs_zero_ops_t *ops = zfs_zero_impl_get(fn);
+
+	if (ops->uses_fpu)
+		kfpu_begin();
+
+	return (ops);
+}
+
+void
+zfs_zero_ops_end(const zfs_zero_ops_t *ops)
+{
+	if (ops->uses_fpu)
+		kfpu_end();
+}
+
+#if defined(_KERNEL)
+/*
+ * Zero detection and ZLE kstats
+ */
+static int
+zfs_zero_kstat_headers(char *buf, size_t size)
+{
+	ssize_t off = 0;
+
+	off += snprintf(buf + off, size, "%-17s", "implementation");
+	for (int fn = 0; fn < ZFS_ZERO_FN_NUM; fn++)
+		off += snprintf(buf + off, size - off, "%-15s",
+		    zfs_zero_fn_name[fn]);
+	(void) snprintf(buf + off, size - off, "\n");
+
+	return (0);
+}
+
+static int
+zfs_zero_kstat_data(char *buf, size_t size, void *data)
+{
+	struct zfs_zero_kstat *fastest_stat =
+	    &zfs_zero_stat_data[zfs_zero_supp_impls_cnt];
+	struct zfs_zero_kstat *curr_stat = (struct zfs_zero_kstat *)data;
+	ssize_t off = 0;
+
+	if (curr_stat == fastest_stat) {
+		off += snprintf(buf + off, size - off, "%-17s", "fastest");
+		for (int fn = 0; fn < ZFS_ZERO_FN_NUM; fn++)
+			off += snprintf(buf + off, size - off, "%-15s",
+			    zfs_zero_supp_impls[fastest_stat->zs_fn[fn]]->name);
+	} else {
+		ptrdiff_t id = curr_stat - zfs_zero_stat_data;
+
+		off += snprintf(buf + off, size - off, "%-17s",
+		    zfs_zero_supp_impls[id]->name);
+		for (int fn = 0; fn < ZFS_ZERO_FN_NUM; fn++)
+			off += snprintf(buf + off, size - off, "%-15llu",
+			    (u_longlong_t)curr_stat->zs_fn[fn]);
+	}
+	(void) snprintf(buf + off, size - off, "\n");
+
+	return (0);
+}
+
+static void *
+zfs_zero_kstat_addr(kstat_t *ksp, loff_t n)
+{
+	if (n <= zfs_zero_supp_impls_cnt)
+		ksp->ks_private = (void *) (zfs_zero_stat_data + n);
+	else
+		ksp->ks_private = NULL;
+
+	return (ksp->ks_private);
+}
+
+#define	ZFS_ZERO_BENCH_NS	(MSEC2NSEC(1))		/* 1ms */
+#define	ZFS_ZERO_BENCH_SIZE	(1ULL << SPA_OLD_MAXBLOCKSHIFT)	/* 128kiB */
+#define	ZFS_ZERO_BENCH_ZLE_N	(64)	/* as in zio_compress_table */
+
+static void
+zfs_zero_benchmark_impl(zfs_zero_fn_t fn, const void *src, void *dst)
+{
+	struct zfs_zero_kstat *fastest_stat =
+	    &zfs_zero_stat_data[zfs_zero_supp_impls_cnt];
+	uint64_t run_bw, run_time_ns, best_run = 0;
+	hrtime_t start;
+
+	for (uint32_t i = 0; i < zfs_zero_supp_impls_cnt; i++) {
+		const zfs_zero_ops_t *ops = zfs_zero_supp_impls[i];
+		uint64_t run_count = 0;
+
+		kpreempt_disable();
+		start = gethrtime();
+		do {
+			for (int l = 0; l < 32; l++, run_count++) {
+				if (ops->uses_fpu)
+					kfpu_begin();
+				if (fn == ZFS_ZERO_CHECK) {
+					(void) ops->check(src,
+					    ZFS_ZERO_BENCH_SIZE);
+				} else {
+					(void) ops->zle(src, dst,
+					    ZFS_ZERO_BENCH_SIZE,
+					    ZFS_ZERO_BENCH_SIZE,
+					    ZFS_ZERO_BENCH_ZLE_N);
+				}
+				if (ops->uses_fpu)
+					kfpu_end();
+			}
+
+			run_time_ns = gethrtime() - start;
+		} while (run_time_ns < ZFS_ZERO_BENCH_NS);
+		kpreempt_enable();
+
+		run_bw = ZFS_ZERO_BENCH_SIZE * run_count * NANOSEC;
+		run_bw /= run_time_ns;	/* B/s */
+		zfs_zero_stat_data[i].zs_fn[fn] = run_bw;
+
+		if (run_bw > best_run) {
+			best_run = run_bw;
+			fastest_stat->zs_fn[fn] = i;
+			zfs_zero_fastest_impl[fn] = ops;
+		}
+	}
+}
+#endif /* _KERNEL */
+
+/*
+ * Initialize and benchmark all supported implementations.
+ */
+static void
+zfs_zero_benchmark(void)
+{
+	const zfs_zero_ops_t *curr_impl;
+	int i, c;
+
+	/* Move supported implementations into zfs_zero_supp_impls */
+	for (i = 0, c = 0; i < ARRAY_SIZE(zfs_zero_impls); i++) {
+		curr_impl = zfs_zero_impls[i];
+
+		if (curr_impl->is_supported())
+			zfs_zero_supp_impls[c++] = curr_impl;
+	}
+	membar_producer();	/* complete zfs_zero_supp_impls[] init */
+	zfs_zero_supp_impls_cnt = c;	/* number of supported impl */
+
+#if defined(_KERNEL)
+	/*
+	 * A zero block has to be scanned all the way through, so it is what
+	 * the check is timed on.  ZLE is timed on a sparse block, alternating
+	 * zero and non-zero runs of different lengths.
+	 */
+	uint8_t *zerobuf = vmem_zalloc(ZFS_ZERO_BENCH_SIZE, KM_SLEEP);
+	uint8_t *databuf = vmem_alloc(ZFS_ZERO_BENCH_SIZE, KM_SLEEP);
+	uint8_t *dstbuf = vmem_alloc(ZFS_ZERO_BENCH_SIZE, KM_SLEEP);
+
+	for (i = 0; i < ZFS_ZERO_BENCH_SIZE; i++) {
+		if ((i / 512) % 3 == 0 || (i % 97) < 13)
+			databuf[i] = 0;
+		else
+			databuf[i] = (uint8_t)(i * 131 + 7) | 1;
+	}
+
+	zfs_zero_benchmark_impl(ZFS_ZERO_CHECK, zerobuf, NULL);
+	zfs_zero_benchmark_impl(ZFS_ZERO_ZLE, databuf, dstbuf);
+
+	vmem_free(zerobuf, ZFS_ZERO_BENCH_SIZE);
+	vmem_free(databuf, ZFS_ZERO_BENCH_SIZE);
+	vmem_free(dstbuf, ZFS_ZERO_BENCH_SIZE);
+#else
+	/*
+	 * Skip the benchmark in user space to avoid impacting libzpool
+	 * consumers (zdb, zhack, zinject, ztest).  The last implementation
+	 * is assumed to be the fastest and used by default.
+	 */
+	for (int fn = 0; fn < ZFS_ZERO_FN_NUM; fn++)
+		zfs_zero_fastest_impl[fn] =
+		    zfs_zero_supp_impls[zfs_zero_supp_impls_cnt - 1];
+#endif /* _KERNEL */
+	membar_producer();
+}
+
+void
+zfs_zero_init(void)
+{
+	/* Determine the fastest available implementation. */
+	zfs_zero_benchmark();
+
+#if defined(_KERNEL)
+	/* Install kstats for all implementations */
+	zfs_zero_kstat = kstat_create("zfs", 0, "zero_bench", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (zfs_zero_kstat != NULL) {
+		zfs_zero_kstat->ks_data = NULL;
+		zfs_zero_kstat->ks_ndata = UINT32_MAX;
+		kstat_set_raw_ops(zfs_zero_kstat,
+		    zfs_zero_kstat_headers,
+		    zfs_zero_kstat_data,
+		    zfs_zero_kstat_addr);
+		kstat_install(zfs_zero_kstat);
+	}
+#endif
+
+	/* Finish initialization */
+	zfs_zero_initialized = B_TRUE;
+}
+
+void
+zfs_zero_fini(void)
+{
+	zfs_zero_initialized = B_FALSE;
+
+#if defined(_KERNEL)
+	if (zfs_zero_kstat != NULL) {
+		kstat_delete(zfs_zero_kstat);
+		zfs_zero_kstat = NULL;
+	}
+#endif
+}
+
+#if defined(_KERNEL)
+
+#define	IMPL_FMT(impl, i)	(((impl) == (i)) ? "[%s] " : "%s ")
+
+#if defined(__linux__)
+
+static int
+zfs_zero_param_get(char *buffer, zfs_kernel_param_t *unused)
+{
+	const uint32_t impl = IMPL_READ(zfs_zero_impl_chosen);
+	char *fmt;
+	int cnt = 0;
+
+	/* list fastest */
+	fmt = IMPL_FMT(impl, IMPL_FASTEST);
+	cnt += kmem_scnprintf(buffer + cnt, PAGE_SIZE - cnt, fmt, "fastest");
+
+	/* list all supported implementations */
+	for (uint32_t i = 0; i < zfs_zero_supp_impls_cnt; ++i) {
+		fmt = IMPL_FMT(impl, i);
+		cnt += kmem_scnprintf(buffer + cnt, PAGE_SIZE - cnt, fmt,
+		    zfs_zero_supp_impls[i]->name);
+	}
+
+	return (cnt);
+}
+
+static int
+zfs_zero_param_set(const char *val, zfs_kernel_param_t *unused)
+{
+	return (zfs_zero_impl_set(val));
+}
+
+#else
+
+#include <sys/sbuf.h>
+
+static int
+zfs_zero_param(ZFS_MODULE_PARAM_ARGS)
+{
+	int err;
+
+	if (req->newptr == NULL) {
+		const uint32_t impl = IMPL_READ(zfs_zero_impl_chosen);
+		const int init_buflen = 64;
+		const char *fmt;
+		struct sbuf *s;
+
+		s = sbuf_new_for_sysctl(NULL, NULL, init_buflen, req);
+
+		/* list fastest */
+		fmt = IMPL_FMT(impl, IMPL_FASTEST);
+		(void) sbuf_printf(s, fmt, "fastest");
+
+		/* list all supported implementations */
+		for (uint32_t i = 0; i < zfs_zero_supp_impls_cnt; ++i) {
+			fmt = IMPL_FMT(impl, i);
+			(void) sbuf_printf(s, fmt,
+			    zfs_zero_supp_impls[i]->name);
+		}
+
+		err = sbuf_finish(s);
+		sbuf_delete(s);
+
+		return (err);
+	}
+
+	char buf[16];
+
+	err = sysctl_handle_string(oidp, buf, sizeof (buf), req);
+	if (err)
+		return (err);
+	return (-zfs_zero_impl_set(buf));
+}
+
+#endif
+
+#undef IMPL_FMT
+
+/*
+ * Choose the zero detection and ZLE implementation.
+ * Users can choose "cycle" to exercise all implementations, but this is
+ * for testing purpose therefore it can only be set in user space.
+ */
+ZFS_MODULE_VIRTUAL_PARAM_CALL(zfs, zfs_, zero_impl,
+    zfs_zero_param_set, zfs_zero_param_get, ZMOD_RW,
+	"Select zero detection and ZLE implementation.");
+
+#endif /* _KERNEL */
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or https://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/isa_defs.h>
+
+#if defined(__x86_64) && HAVE_SIMD(AVX512BW)
+
+#include <sys/types.h>
+#include <sys/simd.h>
+#include "zfs_zero_impl.h"
+
+static inline uint64_t
+zfs_zero_avx512bw_mask(const uint8_t *p)
+{
+	uint64_t mask;
+
+	__asm(
+	    "vmovdqu64	(%1), %%zmm0\n"
+	    "vptestnmb	%%zmm0, %%zmm0, %%k1\n"
+	    "kmovq	%%k1, %0\n"
+	    "vzeroupper\n"
+	    : "=r" (mask)
+	    : "r" (p), "m" (*(const uint8_t (*)[64])p)
+	    ZERO_CLOBBER("xmm0"));
+
+	return (mask);
+}
+
+static boolean_t
+zfs_zero_avx512bw_check(const void *buf, size_t size)
+{
+	const uint8_t *p = buf;
+	const uint8_t *end = p + size;
+
+	for (; p + 256 <= end; p += 256) {
+		uint8_t zero;
+
+		__asm(
+		    "vmovdqu64	0(%1), %%zmm0\n"
+		    "vmovdqu64	64(%1), %%zmm1\n"
+		    "vporq	128(%1), %%zmm0, %%zmm0\n"
+		    "vporq	192(%1), %%zmm1, %%zmm1\n"
+		    "vporq	%%zmm1, %%zmm0, %%zmm0\n"
+		    "vptestmq	%%zmm0, %%zmm0, %%k1\n"
+		    "kortestw	%%k1, %%k1\n"
+		    "setz	%0\n"
+		    : "=r" (zero)
+		    : "r" (p), "m" (*(const uint8_t (*)[256])p)
+		    ZERO_CLOBBER("xmm0", "xmm1"));
+
+		if (!zero)
+			break;
+	}
+	__asm("vzeroupper");
+
+	/* p is only short of the end if a non-zero chunk was found */
+	return (p + 256 <= end ? B_FALSE : zfs_zero_check_tail(p, end));
+}
+
+static size_t
+zfs_zero_avx512bw_zle(const void *s_start, void *d_start, size_t s_len,
+    size_t d_len, int n)
+{
+	return (zfs_zero_zle_impl(s_start, d_start, s_len, d_len, n,
+	    zfs_zero_avx512bw_mask));
+}
+
+static boolean_t
+zfs_zero_avx512bw_will_work(void)
+{
+	return (kfpu_allowed() && zfs_avx512f_available() &&
+	    zfs_avx512bw_available());
+}
+
+const zfs_zero_ops_t zfs_zero_avx512bw_ops = {
+	.check = zfs_zero_avx512bw_check,
+	.zle = zfs_zero_avx512bw_zle,
+	.is_supported = zfs_zero_avx512bw_will_work,
+	.uses_fpu = B_TRUE,
+	.name = "avx512bw"
+};
+
+#endif /* defined(__x86_64) && HAVE_SIMD(AVX512BW) */
@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or https://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _ZFS_ZERO_IMPL_H
+#define	_ZFS_ZERO_IMPL_H
+
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/string.h>
+#include <sys/zfs_zero.h>
+
+#ifdef __linux__
+#define	__asm __asm__ __volatile__
+#endif
+
+/*
+ * The kernel is built without SSE/AVX, so vector registers can't be named as
+ * clobbers there; it relies on kfpu_begin() instead, as the RAID-Z and
+ * fletcher code do.  User space code is free to keep values in them, so tell
+ * the compiler about the registers we use.
+ */
+#if defined(_KERNEL)
+#define	ZERO_CLOBBER(...)
+#else
+#define	ZERO_CLOBBER(...)	: __VA_ARGS__
+#endif
+
+/* Bitmap of which of the 64 bytes at p are zero, bit i for p[i] */
+typedef uint64_t (*zfs_zero_mask_f)(const uint8_t *p);
+
+/*
+ * Zero-length encoder built on a mask function.  It produces the same output
+ * as zfs_zero_scalar_zle() for any input; only the scanning for runs is
+ * vectorized.  Spans shorter than 64 bytes at the end of the buffer and
+ * literal runs for n > 64 fall back to scanning bytes.
+ *
+ * This is always inlined into the SIMD implementations together with their
+ * mask function, so there is no indirect call per 64 bytes.
+ */
+static inline size_t
+zfs_zero_zle_impl(const void *s_start, void *d_start, size_t s_len,
+    size_t d_len, int n, zfs_zero_mask_f zero_mask)
+{
+	const uint8_t *src = s_start;
+	uint8_t *dst = d_start;
+	const uint8_t *s_end = src + s_len;
+	uint8_t *d_end = dst + d_len;
+
+	while (src < s_end && dst < d_end - 1) {
+		uint8_t *len = dst++;
+		size_t avail = s_end - src;
+
+		if (src[0] == 0) {
+			size_t max = MIN((size_t)(256 - n), avail);
+			size_t run = 0;
+
+			while (run < max) {
+				if (avail - run < 64) {
+					while (run < max && src[run] == 0)
+						run++;
+					break;
+				}
+				uint64_t nonzero = ~zero_mask(src + run);
+				if (nonzero != 0) {
+					run += __builtin_ctzll(nonzero);
+					break;
+				}
+				run += 64;
+			}
+			run = MIN(run, max);
+			src += run;
+			*len = run - 1 + n;
+		} else {
+			size_t max = MIN((size_t)n, avail);
+			size_t lit = 0;
+
+			if (d_end - dst < n)
+				break;
+
+			if (n <= 64 && avail >= 64) {
+				/*
+				 * A literal run ends before the first pair of
+				 * zero bytes, or after max bytes.  Bit i of
+				 * pairs is set if src[i] and src[i + 1] are
+				 * both zero; bit 63 is meaningless but max - 1
+				 * is at most 63, so it is masked off.
+				 */
+				uint64_t zeroes = zero_mask(src);
+				uint64_t pairs = zeroes & (zeroes >> 1);
+
+				pairs &= (1ULL << (max - 1)) - 1;
+				if (pairs != 0) {
+					lit = __builtin_ctzll(pairs);
+				} else {
+					lit = max - 1;
+					if (src[lit] != 0)
+						lit++;
+				}
+			} else {
+				while (lit < max - 1 &&
+				    (src[lit] | src[lit + 1]) != 0)
+					lit++;
+				if (src[lit] != 0)
+					lit++;
+			}
+			memcpy(dst, src, lit);
+			dst += lit;
+			src += lit;
+			*len = lit - 1;
+		}
+	}
+	return (src == s_end ? dst - (uint8_t *)d_start : s_len);
+}
+
+/*
+ * Scalar tail of the zero check, for what is left after the vector loop.
+ */
+static inline boolean_t
+zfs_zero_check_tail(const uint8_t *p, const uint8_t *end)
+{
+	for (; p < end; p += sizeof (uint64_t))
+		if (*(const uint64_t *)p != 0)
+			return (B_FALSE);
+	return (B_TRUE);
+}
+
+#endif /* _ZFS_ZERO_IMPL_H */
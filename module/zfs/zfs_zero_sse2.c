@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or https://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/isa_defs.h>
+
+#if defined(__x86_64) && HAVE_SIMD(SSE2)
+
+#include <sys/types.h>
+#include <sys/simd.h>
+#include "zfs_zero_impl.h"
+
+static inline uint64_t
+zfs_zero_sse2_mask(const uint8_t *p)
+{
+	uint32_t m0, m1, m2, m3;
+
+	__asm(
+	    "pxor	%%xmm0, %%xmm0\n"
+	    "movdqu	0(%4), %%xmm1\n"
+	    "pcmpeqb	%%xmm0, %%xmm1\n"
+	    "pmovmskb	%%xmm1, %0\n"
+	    "movdqu	16(%4), %%xmm1\n"
+	    "pcmpeqb	%%xmm0, %%xmm1\n"
+	    "pmovmskb	%%xmm1, %1\n"
+	    "movdqu	32(%4), %%xmm1\n"
+	    "pcmpeqb	%%xmm0, %%xmm1\n"
+	    "pmovmskb	%%xmm1, %2\n"
+	    "movdqu	48(%4), %%xmm1\n"
+	    "pcmpeqb	%%xmm0, %%xmm1\n"
+	    "pmovmskb	%%xmm1, %3\n"
+	    : "=&r" (m0), "=&r" (m1), "=&r" (m2), "=&r" (m3)
+	    : "r" (p), "m" (*(const uint8_t (*)[64])p)
+	    ZERO_CLOBBER("xmm0", "xmm1"));
+
+	return ((uint64_t)m3 << 48 | (uint64_t)m2 << 32 |
+	    (uint64_t)m1 << 16 | m0);
+}
+
+static boolean_t
+zfs_zero_sse2_check(const void *buf, size_t size)
+{
+	const uint8_t *p = buf;
+	const uint8_t *end = p + size;
+
+	for (; p + 64 <= end; p += 64) {
+		uint32_t mask;
+
+		__asm(
+		    "movdqu	0(%1), %%xmm0\n"
+		    "movdqu	16(%1), %%xmm1\n"
+		    "por	%%xmm1, %%xmm0\n"
+		    "movdqu	32(%1), %%xmm1\n"
+		    "por	%%xmm1, %%xmm0\n"
+		    "movdqu	48(%1), %%xmm1\n"
+		    "por	%%xmm1, %%xmm0\n"
+		    "pxor	%%xmm1, %%xmm1\n"
+		    "pcmpeqb	%%xmm1, %%xmm0\n"
+		    "pmovmskb	%%xmm0, %0\n"
+		    : "=r" (mask)
+		    : "r" (p), "m" (*(const uint8_t (*)[64])p)
+		    ZERO_CLOBBER("xmm0", "xmm1"));
+
+		if (mask != 0xffff)
+			return (B_FALSE);
+	}
+
+	return (zfs_zero_check_tail(p, end));
+}
+
+static size_t
+zfs_zero_sse2_zle(const void *s_start, void *d_start, size_t s_len,
+    size_t d_len, int n)
+{
+	return (zfs_zero_zle_impl(s_start, d_start, s_len, d_len, n,
+	    zfs_zero_sse2_mask));
+}
+
+static boolean_t
+zfs_zero_sse2_will_work(void)
+{
+	return (kfpu_allowed() && zfs_sse2_available());
+}
+
+const zfs_zero_ops_t zfs_zero_sse2_ops = {
+	.check = zfs_zero_sse2_check,
+	.zle = zfs_zero_sse2_zle,
+	.is_supported = zfs_zero_sse2_will_work,
+	.uses_fpu = B_TRUE,
+	.name = "sse2"
+};
+
+#endif /* defined(__x86_64) && HAVE_SIMD(SSE2) */
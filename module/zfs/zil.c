@@ -120,6 +120,8 @@ static zil_kstat_values_t zil_stats = {
 	{ "zil_itx_metaslab_slog_bytes",	KSTAT_DATA_UINT64 },
 	{ "zil_itx_metaslab_slog_write",	KSTAT_DATA_UINT64 },
 	{ "zil_itx_metaslab_slog_alloc",	KSTAT_DATA_UINT64 },
+	{ "zil_lwb_flush_count",		KSTAT_DATA_UINT64 },
+	{ "zil_lwb_flush_grouped_count",	KSTAT_DATA_UINT64 },
 };
 
 static zil_sums_t zil_sums_global;
@@ -137,6 +139,13 @@ int zil_replay_disable = 0;
  */
 static int zil_nocacheflush = 0;
 
+/*
+ * Group the cache flushes of LWBs written to the same top-level vdev, of
+ * all datasets in the pool, so that at most one flush per vdev is in flight
+ * and LWBs completing while it runs share the next one.
+ */
+static int zil_flush_group = 1;
+
 /*
  * Limit SLOG write size per commit executed with synchronous priority.
  * Any writes above that will be executed with lower (asynchronous) priority
@@ -385,6 +394,8 @@ zil_sums_init(zil_sums_t *zs)
 	wmsum_init(&zs->zil_itx_metaslab_slog_bytes, 0);
 	wmsum_init(&zs->zil_itx_metaslab_slog_write, 0);
 	wmsum_init(&zs->zil_itx_metaslab_slog_alloc, 0);
+	wmsum_init(&zs->zil_lwb_flush_count, 0);
+	wmsum_init(&zs->zil_lwb_flush_grouped_count, 0);
 }
 
 void
@@ -411,6 +422,8 @@ zil_sums_fini(zil_sums_t *zs)
 	wmsum_fini(&zs->zil_itx_metaslab_slog_bytes);
 	wmsum_fini(&zs->zil_itx_metaslab_slog_write);
 	wmsum_fini(&zs->zil_itx_metaslab_slog_alloc);
+	wmsum_fini(&zs->zil_lwb_flush_count);
+	wmsum_fini(&zs->zil_lwb_flush_grouped_count);
 }
 
 void
@@ -458,6 +471,10 @@ zil_kstat_values_update(zil_kstat_values_t *zs, zil_sums_t *zil_sums)
 	    wmsum_value(&zil_sums->zil_itx_metaslab_slog_write);
 	zs->zil_itx_metaslab_slog_alloc.value.ui64 =
 	    wmsum_value(&zil_sums->zil_itx_metaslab_slog_alloc);
+	zs->zil_lwb_flush_count.value.ui64 =
+	    wmsum_value(&zil_sums->zil_lwb_flush_count);
+	zs->zil_lwb_flush_grouped_count.value.ui64 =
+	    wmsum_value(&zil_sums->zil_lwb_flush_grouped_count);
 }
 
 /*
@@ -1571,6 +1588,103 @@ zil_lwb_flush_wait_all(zilog_t *zilog, uint64_t txg)
 #endif
 }
 
+/*
+ * Issue a group flush to its vdev.  The group zio was created by
+ * zil_lwb_flush_group() and the root zios of all LWBs sharing it are
+ * already its parents.
+ */
+static void
+zil_flush_group_issue(zio_t *group, vdev_t *vd)
+{
+	/*
+	 * The "ZIO_FLAG_DONT_PROPAGATE" is currently always used within
+	 * "zio_flush" and on the group zio itself, so the flush errors are
+	 * not propagated up to "zil_lwb_flush_vdevs_done", same as if the
+	 * flush was issued directly under the lwb's root zio.
+	 */
+	zio_flush(group, vd);
+	zio_nowait(group);
+}
+
+/*
+ * Completion callback of a group flush.  If more LWBs were waiting for a
+ * flush of this vdev while the group was in flight, issue the next group
+ * for all of them.  Otherwise the vdev becomes idle.
+ */
+static void
+zil_flush_group_done(zio_t *zio)
+{
+	vdev_t *vd = zio->io_private;
+	zio_t *next;
+
+	mutex_enter(&vd->vdev_zil_flush_lock);
+	ASSERT(vd->vdev_zil_flush_active);
+	next = vd->vdev_zil_flush_next;
+	vd->vdev_zil_flush_next = NULL;
+	if (next == NULL)
+		vd->vdev_zil_flush_active = B_FALSE;
+	mutex_exit(&vd->vdev_zil_flush_lock);
+
+	if (next != NULL)
+		zil_flush_group_issue(next, vd);
+}
+
+/*
+ * Make the lwb's root zio wait for a cache flush of the given top-level
+ * vdev issued after the lwb's write completed.
+ *
+ * With many datasets committing concurrently to the same SLOG each LWB
+ * would otherwise send its own flush, and on most devices a flush costs
+ * about as much as a small write.  Since a flush covers all the writes
+ * completed before it was issued, no matter what dataset they belong to,
+ * we only keep one flush per vdev in flight.  LWBs completing while it
+ * runs join a single pending group, issued as soon as the running flush
+ * completes.  The log chains remain per dataset, only the flushes are
+ * shared.
+ *
+ * The top-level vdev can not go away while a group is in flight or
+ * pending, since the LWBs attached to it hold SCL_STATE until their
+ * root zios complete, which can not happen before the group completes.
+ */
+static void
+zil_lwb_flush_group(lwb_t *lwb, vdev_t *vd)
+{
+	zilog_t *zilog = lwb->lwb_zilog;
+	spa_t *spa = zilog->zl_spa;
+	zio_t *group;
+
+	ZIL_STAT_BUMP(zilog, zil_lwb_flush_count);
+
+	if (!zil_flush_group || vd->vdev_nowritecache) {
+		zio_flush(lwb->lwb_root_zio, vd);
+		return;
+	}
+
+	mutex_enter(&vd->vdev_zil_flush_lock);
+	if (!vd->vdev_zil_flush_active) {
+		ASSERT0P(vd->vdev_zil_flush_next);
+		vd->vdev_zil_flush_active = B_TRUE;
+		mutex_exit(&vd->vdev_zil_flush_lock);
+
+		group = zio_root(spa, zil_flush_group_done, vd,
+		    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE);
+		zio_add_child(lwb->lwb_root_zio, group);
+		zil_flush_group_issue(group, vd);
+		return;
+	}
+
+	group = vd->vdev_zil_flush_next;
+	if (group == NULL) {
+		group = zio_root(spa, zil_flush_group_done, vd,
+		    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE);
+		vd->vdev_zil_flush_next = group;
+	} else {
+		ZIL_STAT_BUMP(zilog, zil_lwb_flush_grouped_count);
+	}
+	zio_add_child(lwb->lwb_root_zio, group);
+	mutex_exit(&vd->vdev_zil_flush_lock);
+}
+
 /*
  * This is called when an lwb's write zio completes. The callback's purpose is
  * to issue the flush commands for the vdevs in the lwb's lwb_vdev_tree. The
@@ -1677,7 +1791,7 @@ zil_lwb_write_done(zio_t *zio)
 			 * since these "zio_flush" errors will not be
 			 * propagated up to "zil_lwb_flush_vdevs_done".
 			 */
-			zio_flush(lwb->lwb_root_zio, vd);
+			zil_lwb_flush_group(lwb, vd);
 		}
 		kmem_free(zv, sizeof (*zv));
 	}
@@ -4891,6 +5005,9 @@ ZFS_MODULE_PARAM(zfs_zil, zil_, replay_disable, INT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_zil, zil_, nocacheflush, INT, ZMOD_RW,
 	"Disable ZIL cache flushes");
 
+ZFS_MODULE_PARAM(zfs_zil, zil_, flush_group, INT, ZMOD_RW,
+	"Share ZIL cache flushes between concurrent LWBs");
+
 ZFS_MODULE_PARAM(zfs_zil, zil_, slog_bulk, U64, ZMOD_RW,
 	"Limit in bytes slog sync writes per commit");
 
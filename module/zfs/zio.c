@@ -71,6 +71,13 @@ const char *const zio_type_name[ZIO_TYPES] = {
 int zio_dva_throttle_enabled = B_TRUE;
 static int zio_deadman_log_all = B_FALSE;
 
+/*
+ * Largest total size of the writes that are released together by the
+ * allocation throttle and allocated as one region, see
+ * zio_dva_allocate_batch(). 0 disables batching.
+ */
+static uint_t zio_dva_batch_bytes = 1024 * 1024;
+
 /*
  * ==========================================================================
  * I/O kmem caches
@@ -151,6 +158,7 @@ typedef struct zio_stats {
 	kstat_named_t ziostat_alloc_class_fallbacks;
 	kstat_named_t ziostat_gang_writes;
 	kstat_named_t ziostat_gang_multilevel;
+	kstat_named_t ziostat_batched_allocations;
 } zio_stats_t;
 
 static zio_stats_t zio_stats = {
@@ -158,6 +166,7 @@ static zio_stats_t zio_stats = {
 	{ "alloc_class_fallbacks",	KSTAT_DATA_UINT64 },
 	{ "gang_writes",	KSTAT_DATA_UINT64 },
 	{ "gang_multilevel",	KSTAT_DATA_UINT64 },
+	{ "batched_allocations",	KSTAT_DATA_UINT64 },
 };
 
 struct {
@@ -165,6 +174,7 @@ struct {
 	wmsum_t ziostat_alloc_class_fallbacks;
 	wmsum_t ziostat_gang_writes;
 	wmsum_t ziostat_gang_multilevel;
+	wmsum_t ziostat_batched_allocations;
 } ziostat_sums;
 
 #define	ZIOSTAT_BUMP(stat)	wmsum_add(&ziostat_sums.stat, 1);
@@ -190,6 +200,8 @@ zio_kstats_update(kstat_t *ksp, int rw)
 	    wmsum_value(&ziostat_sums.ziostat_gang_writes);
 	zs->ziostat_gang_multilevel.value.ui64 =
 	    wmsum_value(&ziostat_sums.ziostat_gang_multilevel);
+	zs->ziostat_batched_allocations.value.ui64 =
+	    wmsum_value(&ziostat_sums.ziostat_batched_allocations);
 	return (0);
 }
 
@@ -207,6 +219,7 @@ zio_init(void)
 	wmsum_init(&ziostat_sums.ziostat_alloc_class_fallbacks, 0);
 	wmsum_init(&ziostat_sums.ziostat_gang_writes, 0);
 	wmsum_init(&ziostat_sums.ziostat_gang_multilevel, 0);
+	wmsum_init(&ziostat_sums.ziostat_batched_allocations, 0);
 	zio_ksp = kstat_create("zfs", 0, "zio_stats",
 	    "misc", KSTAT_TYPE_NAMED, sizeof (zio_stats) /
 	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
@@ -352,6 +365,7 @@ zio_fini(void)
 	wmsum_fini(&ziostat_sums.ziostat_alloc_class_fallbacks);
 	wmsum_fini(&ziostat_sums.ziostat_gang_writes);
 	wmsum_fini(&ziostat_sums.ziostat_gang_multilevel);
+	wmsum_fini(&ziostat_sums.ziostat_batched_allocations);
 
 	kmem_cache_destroy(zio_link_cache);
 	kmem_cache_destroy(zio_cache);
@@ -4313,11 +4327,31 @@ zio_dva_throttle(zio_t *zio)
 	return (nio);
 }
 
+/*
+ * Can this write's block be allocated together with the leader's, as part
+ * of the leader's allocation batch?
+ */
+static boolean_t
+zio_dva_batchable(zio_t *leader, zio_t *zio)
+{
+	return (zio->io_prop.zp_copies == 1 && !zio->io_prop.zp_rewrite &&
+	    !(zio->io_flags & (ZIO_FLAG_GANG_CHILD | ZIO_FLAG_PREALLOCATED)) &&
+	    zio->io_gang_leader == NULL && zio->io_txg == leader->io_txg &&
+	    zio->io_priority == leader->io_priority);
+}
+
+/*
+ * Issue the writes that the throttle lets through. Rather than have each
+ * of them allocate its block separately, the ones that can be allocated
+ * together are chained to the first one, which allocates all of their
+ * blocks in zio_dva_allocate() and then issues the rest.
+ */
 static void
 zio_allocate_dispatch(metaslab_class_t *mc, int allocator)
 {
 	metaslab_class_allocator_t *mca = &mc->mc_allocator[allocator];
-	zio_t *zio;
+	zio_t *zio, *leader = NULL, **tailp = NULL;
+	uint64_t batch_size = 0;
 	boolean_t more;
 
 	do {
@@ -4325,12 +4359,89 @@ zio_allocate_dispatch(metaslab_class_t *mc, int allocator)
 		zio = zio_io_to_allocate(mca, &more);
 		mutex_exit(&mca->mca_lock);
 		if (zio == NULL)
-			return;
+			break;
 
 		ASSERT3U(zio->io_stage, ==, ZIO_STAGE_DVA_THROTTLE);
 		ASSERT0(zio->io_error);
+		ASSERT0P(zio->io_alloc_next);
+
+		if (leader != NULL && zio_dva_batchable(leader, zio) &&
+		    batch_size + zio->io_size <= zio_dva_batch_bytes) {
+			*tailp = zio;
+			tailp = &zio->io_alloc_next;
+			batch_size += zio->io_size;
+			continue;
+		}
+		if (leader != NULL) {
+			zio_taskq_dispatch(leader, ZIO_TASKQ_ISSUE, B_TRUE);
+			leader = NULL;
+		}
+		if (zio_dva_batchable(zio, zio) &&
+		    zio->io_size < zio_dva_batch_bytes) {
+			leader = zio;
+			tailp = &zio->io_alloc_next;
+			batch_size = zio->io_size;
+			continue;
+		}
 		zio_taskq_dispatch(zio, ZIO_TASKQ_ISSUE, B_TRUE);
 	} while (more);
+
+	if (leader != NULL)
+		zio_taskq_dispatch(leader, ZIO_TASKQ_ISSUE, B_TRUE);
+}
+
+/*
+ * Allocate the blocks of a batch of writes put together by
+ * zio_allocate_dispatch() with a single metaslab_alloc_batch() call, then
+ * issue the other writes of the batch. Those that got their block skip the
+ * DVA_ALLOCATE stage, the others will allocate it there as usual. Returns
+ * B_TRUE if the leader's block was allocated.
+ */
+static boolean_t
+zio_dva_allocate_batch(zio_t *leader, metaslab_class_t *mc, int flags)
+{
+	spa_t *spa = leader->io_spa;
+	int count = 1;
+
+	for (zio_t *zio = leader->io_alloc_next; zio != NULL;
+	    zio = zio->io_alloc_next)
+		count++;
+
+	blkptr_t **bps = kmem_alloc(count * sizeof (*bps), KM_SLEEP);
+	const void **tags = kmem_alloc(count * sizeof (*tags), KM_SLEEP);
+	zio_t *zio = leader;
+	for (int i = 0; i < count; i++, zio = zio->io_alloc_next) {
+		ASSERT3P(zio->io_metaslab_class, ==, mc);
+		ASSERT3U(zio->io_allocator, ==, leader->io_allocator);
+		ASSERT3U(zio->io_size, ==, BP_GET_PSIZE(zio->io_bp));
+		bps[i] = zio->io_bp;
+		tags[i] = zio;
+	}
+
+	boolean_t allocated = metaslab_alloc_batch(spa, mc, bps, tags, count,
+	    leader->io_txg, flags, ZIO_ALLOC_LIST(leader),
+	    leader->io_allocator) == 0;
+
+	kmem_free(tags, count * sizeof (*tags));
+	kmem_free(bps, count * sizeof (*bps));
+
+	zio_t *next = leader->io_alloc_next;
+	leader->io_alloc_next = NULL;
+	while ((zio = next) != NULL) {
+		next = zio->io_alloc_next;
+		zio->io_alloc_next = NULL;
+		if (allocated) {
+			zio->io_gang_leader = zio;
+			zio->io_pipeline &= ~ZIO_STAGE_DVA_ALLOCATE;
+			ZIOSTAT_BUMP(ziostat_total_allocations);
+			ZIOSTAT_BUMP(ziostat_batched_allocations);
+		}
+		zio_taskq_dispatch(zio, ZIO_TASKQ_ISSUE, B_TRUE);
+	}
+	if (allocated)
+		ZIOSTAT_BUMP(ziostat_batched_allocations);
+
+	return (allocated);
 }
 
 static zio_t *
@@ -4379,6 +4490,10 @@ zio_dva_allocate(zio_t *zio)
 	}
 	ZIOSTAT_BUMP(ziostat_total_allocations);
 
+	if (zio->io_alloc_next != NULL && zio_dva_allocate_batch(zio, mc,
+	    flags))
+		return (zio);
+
 again:
 	/*
 	 * Try allocating the block in the usual metaslab class.
@@ -6242,5 +6357,8 @@ ZFS_MODULE_PARAM(zfs, zfs_, sync_pass_rewrite, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_zio, zio_, dva_throttle_enabled, INT, ZMOD_RW,
 	"Throttle block allocations in the ZIO pipeline");
 
+ZFS_MODULE_PARAM(zfs_zio, zio_, dva_batch_bytes, UINT, ZMOD_RW,
+	"Max total size of writes to allocate as one region");
+
 ZFS_MODULE_PARAM(zfs_zio, zio_, deadman_log_all, INT, ZMOD_RW,
 	"Log all slow ZIOs, not just those with vdevs");
@@ -33,37 +33,23 @@
  */
 #include <sys/types.h>
 #include <sys/sysmacros.h>
+#include <sys/string.h>
 #include <sys/zio_compress.h>
+#include <sys/zfs_zero.h>
 
+/*
+ * The encoder is implemented in zfs_zero.c and its SIMD variants, which
+ * search for runs of zeroes a vector at a time.
+ */
 static size_t
 zfs_zle_compress_buf(void *s_start, void *d_start, size_t s_len,
     size_t d_len, int n)
 {
-	uchar_t *src = s_start;
-	uchar_t *dst = d_start;
-	uchar_t *s_end = src + s_len;
-	uchar_t *d_end = dst + d_len;
+	const zfs_zero_ops_t *ops = zfs_zero_ops_begin(ZFS_ZERO_ZLE);
+	size_t c_len = ops->zle(s_start, d_start, s_len, d_len, n);
+	zfs_zero_ops_end(ops);
 
-	while (src < s_end && dst < d_end - 1) {
-		uchar_t *first = src;
-		uchar_t *len = dst++;
-		if (src[0] == 0) {
-			uchar_t *last = src + (256 - n);
-			while (src < MIN(last, s_end) && src[0] == 0)
-				src++;
-			*len = src - first - 1 + n;
-		} else {
-			uchar_t *last = src + n;
-			if (d_end - dst < n)
-				break;
-			while (src < MIN(last, s_end) - 1 && (src[0] | src[1]))
-				*dst++ = *src++;
-			if (src[0])
-				*dst++ = *src++;
-			*len = src - first - 1;
-		}
-	}
-	return (src == s_end ? dst - (uchar_t *)d_start : s_len);
+	return (c_len);
 }
 
 static int
@@ -80,14 +66,15 @@ zfs_zle_decompress_buf(void *s_start, void *d_start, size_t s_len,
 		if (len <= n) {
 			if (src + len > s_end || dst + len > d_end)
 				return (-1);
-			while (len-- != 0)
-				*dst++ = *src++;
+			memcpy(dst, src, len);
+			src += len;
+			dst += len;
 		} else {
 			len -= n;
 			if (dst + len > d_end)
 				return (-1);
-			while (len-- != 0)
-				*dst++ = 0;
+			memset(dst, 0, len);
+			dst += len;
 		}
 	}
 	return (dst == d_end ? 0 : -1);
@@ -0,0 +1,316 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Measure how ARC hash table lookups scale with the number of threads.  A
+ * pool backed by a file is created and filled with small blocks.  The even
+ * numbered blocks are read and kept referenced, while one thread keeps
+ * reading and flushing the odd numbered ones, so that the hash chains are
+ * updated all the time.  For each power of two number of threads up to the
+ * limit, the threads look up random blocks with arc_cached() and the lookup
+ * rate is printed.  Half of the lookups are for blocks which were never
+ * written.  Referenced blocks which are not found, or blocks which were
+ * never written but are found, are wrong results and make the command fail.
+ *
+ * Lockless lookups are enabled with -o zfs_arc_lockless_lookup=1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/arc.h>
+#include <sys/dmu.h>
+#include <sys/dmu_objset.h>
+#include <sys/dmu_tx.h>
+#include <sys/txg.h>
+#include <sys/fs/zfs.h>
+#include <libzpool.h>
+
+#define	BENCH_POOL	"arc_hash_bench"
+
+typedef struct bench {
+	spa_t		*b_spa;
+	uint64_t	b_nblks;
+	blkptr_t	*b_bps;
+	zbookmark_phys_t *b_zbs;
+	arc_buf_t	**b_bufs;
+	volatile boolean_t b_stop;
+	uint64_t	b_seed;
+	uint64_t	b_lookups;
+	uint64_t	b_errors;
+} bench_t;
+
+static void
+usage(void)
+{
+	(void) fprintf(stderr, "Usage: arc_hash_bench [-n blocks] "
+	    "[-t max_threads] [-s milliseconds] [-f vdev_file] "
+	    "[-o var=value]...\n");
+	(void) fprintf(stderr, "\t-n number of blocks in the pool "
+	    "[default: 65536]\n");
+	(void) fprintf(stderr, "\t-t largest number of lookup threads "
+	    "[default: number of CPUs]\n");
+	(void) fprintf(stderr, "\t-s milliseconds to run each pass "
+	    "[default: 1000]\n");
+	(void) fprintf(stderr, "\t-f file backing the pool, removed on exit "
+	    "[default: /tmp/arc_hash_bench.<pid>]\n");
+	(void) fprintf(stderr, "\t-o set a tunable, e.g. "
+	    "zfs_arc_lockless_lookup=1\n");
+	exit(1);
+}
+
+static arc_buf_t *
+bench_read(bench_t *b, uint64_t i, arc_buf_t **bufp)
+{
+	arc_flags_t aflags = ARC_FLAG_WAIT;
+
+	*bufp = NULL;
+	(void) arc_read(NULL, b->b_spa, &b->b_bps[i], arc_getbuf_func, bufp,
+	    ZIO_PRIORITY_SYNC_READ, ZIO_FLAG_CANFAIL, &aflags, &b->b_zbs[i]);
+	return (*bufp);
+}
+
+static void
+bench_lookup(void *arg)
+{
+	bench_t *b = arg;
+	uint64_t x = atomic_inc_64_nv(&b->b_seed) * 0x9e3779b97f4a7c15ULL;
+	uint64_t lookups = 0, errors = 0;
+	blkptr_t bp;
+
+	while (!b->b_stop) {
+		for (int i = 0; i < 1024; i++) {
+			uint64_t r, blk;
+			int flags;
+
+			/* xorshift64 */
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			r = x % (2 * b->b_nblks);
+			blk = r / 2;
+
+			if (r & 1) {
+				/* The same block, born in a later txg. */
+				bp = b->b_bps[blk];
+				BP_SET_BIRTH(&bp, BP_GET_LOGICAL_BIRTH(&bp),
+				    BP_GET_PHYSICAL_BIRTH(&bp) + (1ULL << 40));
+				if (arc_cached(b->b_spa, &bp) != 0)
+					errors++;
+			} else {
+				flags = arc_cached(b->b_spa, &b->b_bps[blk]);
+				if (!(blk & 1) && !(flags & ARC_CACHED_IN_L1))
+					errors++;
+			}
+		}
+		lookups += 1024;
+	}
+
+	atomic_add_64(&b->b_lookups, lookups);
+	atomic_add_64(&b->b_errors, errors);
+}
+
+static void
+bench_churn(void *arg)
+{
+	bench_t *b = arg;
+
+	while (!b->b_stop) {
+		for (uint64_t i = 1; i < b->b_nblks && !b->b_stop; i += 2) {
+			arc_buf_t *buf;
+
+			if (bench_read(b, i, &buf) != NULL)
+				arc_buf_destroy(buf, &buf);
+		}
+		arc_flush(b->b_spa, B_FALSE);
+	}
+}
+
+/*
+ * Create the pool and write nblks blocks of random data to an object,
+ * saving their block pointers.
+ */
+static void
+bench_setup(bench_t *b, const char *path)
+{
+	const uint64_t chunk = 1 << 20;
+	uint64_t size = b->b_nblks << SPA_MINBLOCKSHIFT;
+	nvlist_t *file, *root;
+	objset_t *os;
+	uint64_t obj = 0;
+	char *data;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1 || ftruncate(fd, MAX(4 * size, 256ULL << 20)) != 0) {
+		(void) fprintf(stderr, "can't create %s: %s\n", path,
+		    strerror(errno));
+		exit(1);
+	}
+	(void) close(fd);
+
+	file = fnvlist_alloc();
+	fnvlist_add_string(file, ZPOOL_CONFIG_TYPE, VDEV_TYPE_FILE);
+	fnvlist_add_string(file, ZPOOL_CONFIG_PATH, path);
+	fnvlist_add_uint64(file, ZPOOL_CONFIG_ASHIFT, SPA_MINBLOCKSHIFT);
+	root = fnvlist_alloc();
+	fnvlist_add_string(root, ZPOOL_CONFIG_TYPE, VDEV_TYPE_ROOT);
+	fnvlist_add_nvlist_array(root, ZPOOL_CONFIG_CHILDREN,
+	    (const nvlist_t **)&file, 1);
+	VERIFY0(spa_create(BENCH_POOL, root, NULL, NULL, NULL, NULL));
+	fnvlist_free(root);
+	fnvlist_free(file);
+
+	VERIFY0(spa_open(BENCH_POOL, &b->b_spa, FTAG));
+	VERIFY0(dmu_objset_own(BENCH_POOL, DMU_OST_ANY, B_FALSE, B_TRUE,
+	    FTAG, &os));
+
+	data = umem_alloc(chunk, UMEM_NOFAIL);
+	for (uint64_t off = 0; off < size; off += chunk) {
+		uint64_t len = MIN(chunk, size - off);
+		dmu_tx_t *tx = dmu_tx_create(os);
+
+		/* Random data, so that no block is compressed or embedded. */
+		random_get_pseudo_bytes((uint8_t *)data, len);
+		if (off == 0)
+			dmu_tx_hold_bonus(tx, DMU_NEW_OBJECT);
+		dmu_tx_hold_write(tx, off == 0 ? DMU_NEW_OBJECT : obj, off,
+		    len);
+		VERIFY0(dmu_tx_assign(tx, DMU_TX_WAIT));
+		if (off == 0) {
+			obj = dmu_object_alloc(os, DMU_OT_UINT64_OTHER,
+			    SPA_MINBLOCKSIZE, DMU_OT_NONE, 0, tx);
+		}
+		dmu_write(os, obj, off, len, data, tx, 0);
+		dmu_tx_commit(tx);
+	}
+	umem_free(data, chunk);
+	txg_wait_synced(spa_get_dsl(b->b_spa), 0);
+
+	b->b_bps = umem_alloc(b->b_nblks * sizeof (blkptr_t), UMEM_NOFAIL);
+	b->b_zbs = umem_alloc(b->b_nblks * sizeof (zbookmark_phys_t),
+	    UMEM_NOFAIL);
+	for (uint64_t i = 0; i < b->b_nblks; i++) {
+		dmu_buf_t *db;
+
+		VERIFY0(dmu_buf_hold(os, obj, i << SPA_MINBLOCKSHIFT, FTAG,
+		    &db, DMU_READ_NO_PREFETCH));
+		b->b_bps[i] = *dmu_buf_get_blkptr(db);
+		VERIFY(!BP_IS_HOLE(&b->b_bps[i]));
+		VERIFY(!BP_IS_EMBEDDED(&b->b_bps[i]));
+		SET_BOOKMARK(&b->b_zbs[i], dmu_objset_id(os), obj, 0, i);
+		dmu_buf_rele(db, FTAG);
+	}
+
+	/* Start without any cached block. */
+	dmu_objset_evict_dbufs(os);
+	dmu_objset_disown(os, B_TRUE, FTAG);
+	arc_flush(b->b_spa, B_FALSE);
+
+	b->b_bufs = umem_zalloc(b->b_nblks * sizeof (arc_buf_t *),
+	    UMEM_NOFAIL);
+	for (uint64_t i = 0; i < b->b_nblks; i += 2)
+		VERIFY3P(bench_read(b, i, &b->b_bufs[i]), !=, NULL);
+}
+
+static void
+bench_teardown(bench_t *b, const char *path)
+{
+	for (uint64_t i = 0; i < b->b_nblks; i += 2)
+		arc_buf_destroy(b->b_bufs[i], &b->b_bufs[i]);
+	umem_free(b->b_bufs, b->b_nblks * sizeof (arc_buf_t *));
+	umem_free(b->b_zbs, b->b_nblks * sizeof (zbookmark_phys_t));
+	umem_free(b->b_bps, b->b_nblks * sizeof (blkptr_t));
+
+	spa_close(b->b_spa, FTAG);
+	VERIFY0(spa_destroy(BENCH_POOL));
+	(void) unlink(path);
+}
+
+int
+main(int argc, char *argv[])
+{
+	bench_t b = { 0 };
+	uint64_t ms = 1000;
+	long maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	char pathbuf[MAXPATHLEN];
+	char *path = NULL;
+	int c;
+
+	b.b_nblks = 65536;
+	while ((c = getopt(argc, argv, "n:t:s:f:o:")) != -1) {
+		switch (c) {
+		case 'n':
+			b.b_nblks = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			maxthreads = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			ms = strtoull(optarg, NULL, 0);
+			break;
+		case 'f':
+			path = optarg;
+			break;
+		case 'o':
+			if (handle_tunable_option(optarg, B_TRUE) != 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (b.b_nblks < 2 || maxthreads < 1 || ms == 0)
+		usage();
+	if (path == NULL) {
+		(void) snprintf(pathbuf, sizeof (pathbuf),
+		    "/tmp/arc_hash_bench.%d", (int)getpid());
+		path = pathbuf;
+	}
+
+	kernel_init(SPA_MODE_READ | SPA_MODE_WRITE);
+	bench_setup(&b, path);
+
+	(void) printf("%8s %16s\n", "threads", "lookups/s");
+	for (long t = 1; t <= maxthreads; t *= 2) {
+		taskq_t *tq;
+
+		b.b_stop = B_FALSE;
+		b.b_lookups = 0;
+		tq = taskq_create("arc_hash_bench", t + 1, defclsyspri,
+		    t + 1, INT_MAX, TASKQ_PREPOPULATE);
+		for (long i = 0; i < t; i++)
+			VERIFY(taskq_dispatch(tq, bench_lookup, &b, TQ_SLEEP));
+		VERIFY(taskq_dispatch(tq, bench_churn, &b, TQ_SLEEP));
+
+		delay(MSEC_TO_TICK(ms));
+		b.b_stop = B_TRUE;
+		taskq_wait(tq);
+		taskq_destroy(tq);
+
+		(void) printf("%8ld %16llu\n", t,
+		    (u_longlong_t)(b.b_lookups * 1000 / ms));
+	}
+
+	bench_teardown(&b, path);
+	kernel_fini();
+
+	if (b.b_errors != 0) {
+		(void) fprintf(stderr, "%llu wrong lookup results\n",
+		    (u_longlong_t)b.b_errors);
+		return (1);
+	}
+	return (0);
+}
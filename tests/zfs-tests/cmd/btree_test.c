@@ -19,6 +19,7 @@
 #include <string.h>
 #include <sys/avl.h>
 #include <sys/btree.h>
+#include <sys/range_tree.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 
@@ -29,6 +30,7 @@ static int stress_timeout = 180;
 static int contents_frequency = 100;
 static int tree_limit = 64 * 1024;
 static boolean_t stress_only = B_FALSE;
+static uint64_t bench_elems = 0;
 
 static void
 usage(int exit_value)
@@ -38,6 +40,7 @@ usage(int exit_value)
 	    "[-t timeout>] [-c check_contents]\n");
 	(void) fprintf(stderr, "\tbtree_test [-r <seed>] [-l <limit>] "
 	    "[-t timeout>] [-c check_contents]\n");
+	(void) fprintf(stderr, "\tbtree_test -b <elements> [-r <seed>]\n");
 	(void) fprintf(stderr, "\n    With the -n option, run the named "
 	    "negative test. With the -s option,\n");
 	(void) fprintf(stderr, "    run the stress test according to the "
@@ -45,6 +48,10 @@ usage(int exit_value)
 	(void) fprintf(stderr, "    neither, run all the positive tests, "
 	    "including the stress test with\n");
 	(void) fprintf(stderr, "    the default options.\n");
+	(void) fprintf(stderr, "\n    With the -b option, time inserting "
+	    "and looking up the given number\n");
+	(void) fprintf(stderr, "    of random keys in a plain B-Tree and "
+	    "in 32- and 64-bit range trees.\n");
 	(void) fprintf(stderr, "\n    Options that control the stress test\n");
 	(void) fprintf(stderr, "\t-c stress iterations after which to compare "
 	    "tree contents [default: 100]\n");
@@ -77,6 +84,7 @@ avl_compare(const void *v1, const void *v2)
 	return (TREE_CMP(a, b));
 }
 
+__attribute__((always_inline)) inline
 static int
 zfs_btree_compare(const void *v1, const void *v2)
 {
@@ -86,6 +94,9 @@ zfs_btree_compare(const void *v1, const void *v2)
 	return (TREE_CMP(*a, *b));
 }
 
+ZFS_BTREE_FIND_IN_BUF_FUNC(zfs_btree_find_in_buf_u64, uint64_t,
+    zfs_btree_compare)
+
 static void
 verify_contents(avl_tree_t *avl, zfs_btree_t *bt)
 {
@@ -189,6 +200,72 @@ insert_find_remove(zfs_btree_t *bt, char *why)
 	return (0);
 }
 
+/*
+ * Fill the tree in random order, compact it, and check that it kept all of
+ * its values, shrank, and can still be modified afterwards.
+ */
+static int
+compact_tree(zfs_btree_t *bt, char *why)
+{
+	const int count = 100000;
+	uint64_t *vals = malloc(count * sizeof (uint64_t));
+	zfs_btree_index_t bt_idx = {0};
+	int n = 0;
+
+	if (vals == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < count; i++) {
+		uint64_t randval = random();
+		if (zfs_btree_find(bt, &randval, &bt_idx) != NULL)
+			continue;
+		zfs_btree_add_idx(bt, &randval, &bt_idx);
+		vals[n++] = randval;
+	}
+
+	size_t before = zfs_btree_memory(bt);
+	zfs_btree_compact(bt);
+	zfs_btree_verify(bt);
+
+	if (zfs_btree_memory(bt) >= before) {
+		(void) snprintf(why, BUFSIZE, "Compacting didn't shrink the "
+		    "tree (%zu >= %zu bytes)\n", zfs_btree_memory(bt), before);
+		free(vals);
+		return (1);
+	}
+	if (zfs_btree_numnodes(bt) != n) {
+		(void) snprintf(why, BUFSIZE, "Tree has %lu values, "
+		    "expected %d\n", (ulong_t)zfs_btree_numnodes(bt), n);
+		free(vals);
+		return (1);
+	}
+	for (int i = 0; i < n; i++) {
+		if (zfs_btree_find(bt, &vals[i], &bt_idx) == NULL) {
+			(void) snprintf(why, BUFSIZE, "Didn't find value "
+			    "(%llu) after compacting\n",
+			    (u_longlong_t)vals[i]);
+			free(vals);
+			return (1);
+		}
+	}
+
+	/* Every other value goes away; the packed leaves must merge. */
+	for (int i = 0; i < n; i += 2)
+		zfs_btree_remove(bt, &vals[i]);
+	zfs_btree_verify(bt);
+	for (int i = 0; i < count; i++) {
+		uint64_t randval = random();
+		if (zfs_btree_find(bt, &randval, &bt_idx) == NULL)
+			zfs_btree_add_idx(bt, &randval, &bt_idx);
+	}
+	zfs_btree_verify(bt);
+
+	free(vals);
+	return (0);
+}
+
 /*
  * This test uses an avl and btree, and continually processes new random
  * values. Each value is either removed or inserted, depending on whether
@@ -346,6 +423,119 @@ do_negative_test(zfs_btree_t *bt, char *test_name)
 	return (0);
 }
 
+/*
+ * Benchmarks
+ */
+
+static void
+bench_report(const char *name, const char *op, uint64_t n, hrtime_t ns)
+{
+	(void) printf("%-20s %-8s %10llu ops %12llu ns %8.2f Mops/s\n",
+	    name, op, (u_longlong_t)n, (u_longlong_t)ns,
+	    ns == 0 ? 0.0 : (double)n * 1000 / ns);
+}
+
+/*
+ * Distinct even keys in random order, so that neighbouring range tree
+ * segments never merge and every lookup hits.
+ */
+static uint64_t *
+bench_keys(uint64_t n)
+{
+	uint64_t *keys = malloc(n * sizeof (uint64_t));
+	if (keys == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (uint64_t i = 0; i < n; i++)
+		keys[i] = i * 2;
+	for (uint64_t i = n - 1; i > 0; i--) {
+		uint64_t j = ((uint64_t)random() << 31 | random()) % (i + 1);
+		uint64_t t = keys[i];
+		keys[i] = keys[j];
+		keys[j] = t;
+	}
+
+	return (keys);
+}
+
+static void
+bench_btree(const char *name, bt_find_in_buf_f find, const uint64_t *keys,
+    uint64_t n)
+{
+	zfs_btree_t bt;
+	zfs_btree_index_t *idx = NULL;
+	zfs_btree_index_t where;
+	hrtime_t start;
+
+	zfs_btree_create(&bt, zfs_btree_compare, find, sizeof (uint64_t));
+
+	start = gethrtime();
+	for (uint64_t i = 0; i < n; i++)
+		zfs_btree_add(&bt, &keys[i]);
+	bench_report(name, "insert", n, gethrtime() - start);
+
+	start = gethrtime();
+	for (uint64_t i = 0; i < n; i++)
+		VERIFY3P(zfs_btree_find(&bt, &keys[i], &where), !=, NULL);
+	bench_report(name, "find", n, gethrtime() - start);
+
+	start = gethrtime();
+	for (uint64_t i = 0; i < n; i++)
+		zfs_btree_remove(&bt, &keys[i]);
+	bench_report(name, "remove", n, gethrtime() - start);
+
+	while (zfs_btree_destroy_nodes(&bt, &idx) != NULL)
+		;
+	zfs_btree_destroy(&bt);
+}
+
+static void
+bench_range_tree(const char *name, zfs_range_seg_type_t type,
+    const uint64_t *keys, uint64_t n)
+{
+	zfs_range_tree_t *rt = zfs_range_tree_create(NULL, type, NULL, 0, 0);
+	hrtime_t start;
+
+	start = gethrtime();
+	for (uint64_t i = 0; i < n; i++)
+		zfs_range_tree_add(rt, keys[i], 1);
+	bench_report(name, "insert", n, gethrtime() - start);
+
+	start = gethrtime();
+	for (uint64_t i = 0; i < n; i++)
+		VERIFY(zfs_range_tree_contains(rt, keys[i], 1));
+	bench_report(name, "find", n, gethrtime() - start);
+
+	start = gethrtime();
+	for (uint64_t i = 0; i < n; i++)
+		zfs_range_tree_remove(rt, keys[i], 1);
+	bench_report(name, "remove", n, gethrtime() - start);
+
+	zfs_range_tree_destroy(rt);
+}
+
+/*
+ * Time the in-leaf search functions on the layouts that matter most: plain
+ * 64-bit keys with the generic and the inlined search, and the 32- and
+ * 64-bit segments used by range trees.
+ */
+static int
+bench_tree(uint64_t n)
+{
+	uint64_t *keys = bench_keys(n);
+
+	bench_btree("btree_u64_generic", NULL, keys, n);
+	bench_btree("btree_u64_inline", zfs_btree_find_in_buf_u64, keys, n);
+	if (n * 2 <= UINT32_MAX)
+		bench_range_tree("range_tree_seg32", ZFS_RANGE_SEG32, keys, n);
+	bench_range_tree("range_tree_seg64", ZFS_RANGE_SEG64, keys, n);
+
+	free(keys);
+	return (0);
+}
+
 typedef struct btree_test {
 	const char	*name;
 	int		(*func)(zfs_btree_t *, char *);
@@ -353,6 +543,7 @@ typedef struct btree_test {
 
 static btree_test_t test_table[] = {
 	{ "insert_find_remove",		insert_find_remove	},
+	{ "compact_tree",		compact_tree		},
 	{ "stress_tree",		stress_tree		},
 	{ NULL,				NULL			}
 };
@@ -366,8 +557,11 @@ main(int argc, char *argv[])
 	zfs_btree_t bt;
 	int c;
 
-	while ((c = getopt(argc, argv, "c:l:n:r:st:")) != -1) {
+	while ((c = getopt(argc, argv, "b:c:l:n:r:st:")) != -1) {
 		switch (c) {
+		case 'b':
+			bench_elems = strtoull(optarg, NULL, 0);
+			break;
 		case 'c':
 			contents_frequency = atoi(optarg);
 			break;
@@ -412,6 +606,13 @@ main(int argc, char *argv[])
 
 	fprintf(stderr, "Seed: %u\n", seed);
 
+	if (bench_elems != 0) {
+		zfs_btree_destroy(&bt);
+		(void) bench_tree(bench_elems);
+		zfs_btree_fini();
+		return (0);
+	}
+
 	/*
 	 * This is a stress test that does operations on a btree over the
 	 * requested timeout period, verifying them against identical